@@ -29,6 +29,11 @@ option(NNG_TOOLS "Build extra tools." ${NNG_NATIVE_BUILD})
 option(NNG_ENABLE_NNGCAT "Enable building nngcat utility." ${NNG_TOOLS})
 option(NNG_ENABLE_COVERAGE "Enable coverage reporting." OFF)
 
+# Throughput benchmarks in the unit tests only print rates and take
+# a while, so they are left out of the default test run.
+option(NNG_TEST_BENCH "Run benchmarks with the tests." OFF)
+mark_as_advanced(NNG_TEST_BENCH)
+
 message(NNG_TESTS = "${NNG_TESTS}")
 message(NNG_TOOLS = "${NNG_TOOLS}")
 
@@ -75,6 +75,22 @@ extern "C" {
 
 #define NNG_OPT_MQTT_ENABLE_SCRAM "mqtt-scram-option"
 
+// NNG_OPT_MQTT_CONN_DIALER registers a dialer id of a client socket that
+// opens several connections to the same broker, its connection takes the
+// next slot. The first slot is the primary connection, which SUBSCRIBE and
+// UNSUBSCRIBE go to. See nng_mqtt_client_dialers_create.
+#define NNG_OPT_MQTT_CONN_DIALER "mqtt-conn-dialer"
+
+// NNG_OPT_MQTT_CONN_DISPATCH is an int that picks the connection of an
+// outgoing PUBLISH. NNG_MQTT_DISPATCH_TOPIC keeps each topic on one
+// connection, in order. NNG_MQTT_DISPATCH_ROUND_ROBIN does not.
+#define NNG_OPT_MQTT_CONN_DISPATCH "mqtt-conn-dispatch"
+
+#define NNG_MQTT_DISPATCH_TOPIC 0
+#define NNG_MQTT_DISPATCH_ROUND_ROBIN 1
+
+#define NNG_MQTT_CLIENT_MAX_CONNS 16
+
 // NNG_OPT_MQTT_QOS is a byte (only lower two bits significant) representing
 // the quality of service.  At this time, only level zero is supported.
 // TODO: level 1 and level 2 QoS
@@ -126,13 +142,12 @@ extern "C" {
 
 #define NNG_OPT_MQTT_WILL_DELAY "will-delay"
 
-// NNG_OPT_MQTT_RECEIVE_MAX is used with QoS 1 or 2 (not implemented),
-// and indicates the level of concurrent receives it is willing to
-// process. (TODO: Implementation note: we will need to preallocate a complete
-// state machine (aio, plus any state) for each value of this > 0.
-// It's not clear whether this should be tunable.)  This is read-only
-// property on the socket, and records the value given from the server.
-// It will be 64K if the server did not indicate a specific value.
+// NNG_OPT_MQTT_RECEIVE_MAX is used with QoS 1 or 2, and indicates the
+// level of concurrent receives the server is willing to process.  This is
+// read-only property on the pipe, and records the value given from the
+// server.  It will be 64K if the server did not indicate a specific value.
+// The client keeps at most this many QoS 1/2 PUBLISH unacknowledged (and
+// never more than 1024), further sends wait until acks arrive.
 #define NNG_OPT_MQTT_RECEIVE_MAX "mqtt-receive-max"
 
 // NNG_OPT_MQTT_SESSION_EXPIRES is an nng_duration.
@@ -143,8 +158,15 @@ extern "C" {
 // expiry interval.
 #define NNG_OPT_MQTT_SESSION_EXPIRES "session-expires"
 
+// NNG_OPT_MQTT_TOPIC_ALIAS_MAX on a v5 dialer caps the topic aliases the
+// client assigns to its PUBLISH packets, 0 turns them off.  The broker's
+// Topic Alias Maximum from CONNACK is the upper bound.  On a pipe it reads
+// the number of aliases that connection uses.
 #define NNG_OPT_MQTT_TOPIC_ALIAS_MAX "alias-max"
 #define NNG_OPT_MQTT_TOPIC_ALIAS "topic-alias"
+// NNG_OPT_MQTT_TOPIC_ALIAS_SAVED is a read-only uint64 of a dialer, the
+// bytes topic aliases saved on all its connections so far.
+#define NNG_OPT_MQTT_TOPIC_ALIAS_SAVED "alias-saved"
 #define NNG_OPT_MQTT_MAX_QOS "max-qos"
 
 // NNG_MAX_RECV_LMQ and NNG_MAX_SEND_LMQ define the length of waiting queue
@@ -577,6 +599,11 @@ NNG_DECL int nng_mqtt_unsubscribe_async(nng_mqtt_client *, nng_mqtt_topic *, siz
 // as with other ctx based methods, we use the aio form exclusively
 NNG_DECL int nng_mqtt_ctx_subscribe(nng_ctx *, const char *, nng_aio *, ...);
 NNG_DECL int nng_mqtt_disconnect(nng_socket *, uint8_t, property *);
+// Create count dialers of url on a client socket, registered as its
+// connection slots. The first one owns connmsg, the others a copy with
+// client id "<client id>-<index>". The dialers are not started.
+NNG_DECL int nng_mqtt_client_dialers_create(
+    nng_dialer *, nng_socket, const char *, nng_msg *, int);
 
 typedef struct nng_mqtt_sqlite_option nng_mqtt_sqlite_option;
 
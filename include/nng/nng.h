@@ -45,6 +45,18 @@ extern "C" {
 #endif // _WIN32 && !NNG_STATIC_LIB
 #endif // NNG_DECL
 
+// NNG_DECL_DATA is used on declarations of global data.  It carries one
+// storage class, as NNG_DECL is already "extern" where it is not an
+// attribute.
+#ifndef NNG_DECL_DATA
+#if (defined(_WIN32) && !defined(NNG_STATIC_LIB)) || \
+    (defined(NNG_SHARED_LIB) && defined(NNG_HIDDEN_VISIBILITY))
+#define NNG_DECL_DATA extern NNG_DECL
+#else
+#define NNG_DECL_DATA NNG_DECL
+#endif
+#endif // NNG_DECL_DATA
+
 #ifndef NNG_DEPRECATED
 #if defined(__GNUC__) || defined(__clang__)
 #define NNG_DEPRECATED __attribute__((deprecated))
@@ -1011,6 +1023,15 @@ NNG_DECL void nng_stats_free(nng_stat *);
 // statistics to stdout.
 NNG_DECL void nng_stats_dump(nng_stat *);
 
+// nng_stats_openmetrics writes the statistics in the OpenMetrics text
+// format, as scraped by Prometheus.  Each statistic under a scope becomes
+// a metric family named after both, e.g. nng_socket_rx_msgs, with the
+// scope ID and any ID statistics beside it as labels.  Strings are left
+// out.  Nothing is allocated: the text is cut short to fit the buffer,
+// which is always NUL terminated, and the length of the whole text is
+// returned, as snprintf does.
+NNG_DECL size_t nng_stats_openmetrics(nng_stat *, char *, size_t);
+
 // nng_stat_next finds the next sibling for the current stat.  If there
 // are no more siblings, it returns NULL.
 NNG_DECL nng_stat *nng_stat_next(nng_stat *);
@@ -1046,12 +1067,13 @@ NNG_DECL nng_stat *nng_stat_find_dialer(nng_stat *, nng_dialer);
 NNG_DECL nng_stat *nng_stat_find_listener(nng_stat *, nng_listener);
 
 enum nng_stat_type_enum {
-	NNG_STAT_SCOPE   = 0, // Stat is for scoping, and carries no value
-	NNG_STAT_LEVEL   = 1, // Numeric "absolute" value, diffs meaningless
-	NNG_STAT_COUNTER = 2, // Incrementing value (diffs are meaningful)
-	NNG_STAT_STRING  = 3, // Value is a string
-	NNG_STAT_BOOLEAN = 4, // Value is a boolean
-	NNG_STAT_ID      = 5, // Value is a numeric ID
+	NNG_STAT_SCOPE     = 0, // Stat is for scoping, and carries no value
+	NNG_STAT_LEVEL     = 1, // Numeric "absolute" value, diffs meaningless
+	NNG_STAT_COUNTER   = 2, // Incrementing value (diffs are meaningful)
+	NNG_STAT_STRING    = 3, // Value is a string
+	NNG_STAT_BOOLEAN   = 4, // Value is a boolean
+	NNG_STAT_ID        = 5, // Value is a numeric ID
+	NNG_STAT_HISTOGRAM = 6, // Sum of samples, buckets are the children
 };
 
 // nng_stat_unit provides information about the unit for the statistic,
@@ -1064,7 +1086,8 @@ enum nng_unit_enum {
 	NNG_UNIT_BYTES    = 1, // Bytes, e.g. bytes sent, etc.
 	NNG_UNIT_MESSAGES = 2, // Messages, one per message
 	NNG_UNIT_MILLIS   = 3, // Milliseconds
-	NNG_UNIT_EVENTS   = 4  // Some other type of event
+	NNG_UNIT_EVENTS   = 4, // Some other type of event
+	NNG_UNIT_MICROS   = 5  // Microseconds
 };
 
 // nng_stat_value returns the actual value of the statistic.
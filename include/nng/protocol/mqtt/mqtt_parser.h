@@ -93,6 +93,8 @@ NNG_DECL uint32_t fnv1a_hashn(char *str, size_t n);
 NNG_DECL uint8_t  crc_hashn(char *str, size_t n);
 NNG_DECL uint32_t crc32_hashn(char *str, size_t n);
 NNG_DECL uint32_t crc32c_hashn(char *str, size_t n);
+NNG_DECL uint32_t crc32c_hashn_sw(char *str, size_t n);
+NNG_DECL uint64_t wy_hashn(char *str, size_t n);
 NNG_DECL uint8_t  verify_connect(conn_param *cparam, conf *conf);
 
 // repack
@@ -138,6 +140,19 @@ NNG_DECL property *property_set_value_strpair(uint8_t prop_id, const char *key,
     uint32_t key_len, const char *value, uint32_t value_len, bool copy_value);
 NNG_DECL void      property_append(property *prop_list, property *last);
 
+// A topic filter of SUBSCRIBE/UNSUBSCRIBE, points into the msg body and is
+// not NUL terminated, keep the msg alive while slices are in use.
+typedef struct {
+	char    *topic;
+	uint16_t len;
+	uint8_t  option; // subscription options, 0 for UNSUBSCRIBE
+	uint8_t  flag;   // free for the consumer
+	uint32_t hash;   // fnv1a_hashn of topic
+} topic_slice;
+
+NNG_DECL int  nmq_topic_slices_decode(
+     nng_msg *msg, uint8_t ver, topic_slice **slices, uint32_t *subid);
+NNG_DECL void nmq_topic_slices_free(topic_slice *slices);
 NNG_DECL int  nmq_subtopic_decode(nng_msg *msg, uint8_t ver, topic_queue **ptq);
 NNG_DECL int  nmq_subinfo_decode(nng_msg *msg, void *l, uint8_t ver);
 NNG_DECL int  nmq_unsubinfo_decode(nng_msg *msg, void *l, uint8_t ver);
@@ -335,6 +335,11 @@ NNG_DECL int nng_http_handler_alloc_static(
 NNG_DECL int nng_http_handler_alloc_redirect(
     nng_http_handler **, const char *, uint16_t, const char *);
 
+// nng_http_handler_alloc_stats creates a handler that serves the
+// statistics, as nng_stats_openmetrics writes them, on each request.
+// Pointed at by a Prometheus scrape job, it exports them for monitoring.
+NNG_DECL int nng_http_handler_alloc_stats(nng_http_handler **, const char *);
+
 // nng_http_handler_alloc_file creates a "directory" based handler, that
 // serves up static content from the given directory tree.  Directories
 // that contain an index.html or index.htm file use that file for the
@@ -44,6 +44,48 @@ struct blf_object {
 	blf_write_type   type;
 };
 
+// CAN frames of a message. Besides the JSON form
+// {"frames":[{"id":..,"t":..,"bus":..,"d":..,"l":..,"data":"<hex>"}]},
+// the writer takes a binary form: BLF_CAN_MAGIC, then one
+// BLF_CAN_FRAME_SIZE record per frame, little endian:
+// t u64 | id u32 | bus u16 | flags u8 | dlc u8 | data[8]
+#define BLF_CAN_MAGIC "CANB"
+#define BLF_CAN_MAGIC_LEN 4
+#define BLF_CAN_FRAME_SIZE 24
+
+typedef struct {
+	uint64_t timestamp;
+	uint32_t id;
+	uint16_t bus;
+	uint8_t  flags;
+	uint8_t  dlc;
+	uint8_t  data[8];
+} blf_can_frame;
+
+typedef void (*blf_can_frame_cb)(const blf_can_frame *frame, void *arg);
+
+/**
+ * @brief blf_can_frames_encode - Encode frames in the binary form.
+ * @param frames - frames
+ * @param count - number of frames
+ * @param buf - output
+ * @param len - size of buf
+ * @return bytes written, 0 if buf is too short
+ */
+size_t blf_can_frames_encode(
+    const blf_can_frame *frames, uint32_t count, uint8_t *buf, size_t len);
+
+/**
+ * @brief blf_can_frames_decode - Decode a binary or JSON message.
+ * @param payload - message payload, not NUL terminated
+ * @param len - payload length
+ * @param cb - called for each frame
+ * @param arg - passed to cb
+ * @return number of frames or -1 if payload is malformed
+ */
+int blf_can_frames_decode(
+    const uint8_t *payload, uint32_t len, blf_can_frame_cb cb, void *arg);
+
 blf_object *blf_object_alloc(uint64_t *keys, uint8_t **darray, uint32_t *dsize,
     uint32_t size, nng_aio *aio, void *arg);
 void        blf_object_free(blf_object *elem);
@@ -13,6 +13,7 @@
 #include "acl_conf.h"
 #include "log.h"
 #include "ringbuffer.h"
+#include "mqtt_db.h"
 #include "nng/supplemental/util/platform.h"
 
 #define PID_PATH_NAME "/tmp/nanomq/nanomq.pid"
@@ -288,6 +289,8 @@ struct conf_bridge_node {
 	size_t       max_send_queue_len;
 	topics     **forwards_list;
 	uint64_t     parallel;
+	uint32_t     connections; // connections to the broker, at most 16
+	uint8_t      dispatch;    // NNG_MQTT_DISPATCH_* of PUBLISH over them
 	topics     **sub_list;
 	conf_tls     tls;
 	conf_tcp     tcp;
@@ -395,6 +398,17 @@ struct conf_parquet {
 	uint32_t                limit_frequency;
 	uint8_t                 file_index;
 	int32_t                 file_size;
+	uint32_t                row_group_size; // rows, 0: one row group
+	bool                    page_index;
+	bool                    bloom_filter; // on key column
+	uint32_t                write_threads;
+	uint32_t                write_queue_limit; // per thread, 0: unbounded
+	char                   *columns; // select list of rule sql
+	bool                    compact;
+	uint64_t                compact_interval; // seconds
+	uint64_t                compact_rate;     // bytes/s, 0: unthrottled
+	uint64_t                retention_size;   // bytes, 0: unlimited
+	uint64_t                retention_age;    // seconds, 0: unlimited
 	compression_type        comp_type;
 	conf_parquet_encryption encryption;
 };
@@ -564,6 +578,20 @@ typedef enum {
 	sqlite,
 } persistence_type;
 
+typedef struct {
+	char                  *name;
+	dbtree_shared_strategy strategy;
+} conf_shared_sub_group;
+
+// dispatch strategy of $share groups, selected per group
+struct conf_shared_sub {
+	dbtree_shared_strategy  strategy; // default of all groups
+	size_t                  count;
+	conf_shared_sub_group **groups;
+};
+
+typedef struct conf_shared_sub conf_shared_sub;
+
 struct conf {
 	char      *vin;
 	char      *cmd_ipc_url;
@@ -579,6 +607,7 @@ struct conf {
 	uint64_t   total_ctx;		       // Total ctx of work (bridge + AWS + broker + HTTP)
 	uint64_t   max_packet_size;        // byte
 	uint32_t   client_max_packet_size; // byte
+	uint64_t   recv_buffer_size;       // byte, per connection read buffer
 	uint32_t   max_inflight_window;
 	uint32_t   max_awaiting_rel;
 	uint32_t   await_rel_timeout;
@@ -590,6 +619,7 @@ struct conf {
 	bool       ipc_internal;
 	bool       bridge_mode;
 
+	conf_shared_sub      shared_sub;
 	conf_tcp_list        tcp_list;
 	conf_tls_list        tls_list;
 	conf_sqlite          sqlite;
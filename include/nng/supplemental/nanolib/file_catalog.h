@@ -0,0 +1,131 @@
+#ifndef FILE_CATALOG_H
+#define FILE_CATALOG_H
+
+#include "nng/nng.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Key ranges of persisted files (parquet, blf). Lookups run on an immutable
+// sorted snapshot and never take a lock, updates publish a new snapshot.
+
+typedef struct file_catalog file_catalog;
+
+typedef struct {
+	uint64_t    start_key;
+	uint64_t    end_key;
+	const char *topic; // NULL or "" if the file is not bound to a topic
+	const char *path;
+	const char *md5;
+	uint64_t    size;
+} file_catalog_entry;
+
+// Return false to stop the walk. The entry is valid only in the callback.
+typedef bool (*file_catalog_cb)(const file_catalog_entry *entry, void *arg);
+
+/**
+ * @brief file_catalog_create - Create an empty catalog.
+ * @param catp - file_catalog
+ * @return 0 or NNG_ENOMEM
+ */
+NNG_DECL int file_catalog_create(file_catalog **catp);
+
+/**
+ * @brief file_catalog_destroy - Destroy catalog, no lookup may be running.
+ * @param cat - file_catalog
+ * @return void
+ */
+NNG_DECL void file_catalog_destroy(file_catalog *cat);
+
+/**
+ * @brief file_catalog_add - Add a file, the strings are copied.
+ * @param cat - file_catalog
+ * @param entry - key range, topic, path, md5 and size of the file
+ * @return 0, NNG_EINVAL or NNG_ENOMEM
+ */
+NNG_DECL int file_catalog_add(
+    file_catalog *cat, const file_catalog_entry *entry);
+
+/**
+ * @brief file_catalog_remove - Remove the file of path.
+ * @param cat - file_catalog
+ * @param path - path of file
+ * @return 0, NNG_ENOENT or NNG_ENOMEM
+ */
+NNG_DECL int file_catalog_remove(file_catalog *cat, const char *path);
+
+/**
+ * @brief file_catalog_replace - Remove files of paths and add entry in one
+ * update, lookups see either all the old files or the new one.
+ * @param cat - file_catalog
+ * @param paths - paths of files to remove
+ * @param count - number of paths
+ * @param entry - file to add, or NULL
+ * @return 0, NNG_EINVAL, NNG_ENOENT if a path is not found or NNG_ENOMEM
+ */
+NNG_DECL int file_catalog_replace(file_catalog *cat, const char **paths,
+    size_t count, const file_catalog_entry *entry);
+
+/**
+ * @brief file_catalog_count - Number of files in catalog.
+ * @param cat - file_catalog
+ * @return count
+ */
+NNG_DECL size_t file_catalog_count(file_catalog *cat);
+
+/**
+ * @brief file_catalog_contains - Check if path is in catalog.
+ * @param cat - file_catalog
+ * @param path - path of file
+ * @return true if found
+ */
+NNG_DECL bool file_catalog_contains(file_catalog *cat, const char *path);
+
+/**
+ * @brief file_catalog_foreach_span - Walk files whose key range overlaps
+ * [start_key, end_key] in start key order, O(log files) plus the files
+ * overlapping.
+ * @param cat - file_catalog
+ * @param start_key - low key
+ * @param end_key - high key
+ * @param topic - only files of this topic, NULL for all
+ * @param cb - called for each file
+ * @param arg - passed to cb
+ * @return number of files cb was called for
+ */
+NNG_DECL size_t file_catalog_foreach_span(file_catalog *cat,
+    uint64_t start_key, uint64_t end_key, const char *topic,
+    file_catalog_cb cb, void *arg);
+
+/**
+ * @brief file_catalog_find - Path of the first file containing key.
+ * @param cat - file_catalog
+ * @param key - key
+ * @param topic - only files of this topic, NULL for all
+ * @return path or NULL, caller frees it with nng_strfree
+ */
+NNG_DECL char *file_catalog_find(
+    file_catalog *cat, uint64_t key, const char *topic);
+
+/**
+ * @brief file_catalog_find_span - Paths of files overlapping
+ * [start_key, end_key] in start key order.
+ * @param cat - file_catalog
+ * @param start_key - low key
+ * @param end_key - high key
+ * @param topic - only files of this topic, NULL for all
+ * @param size - number of paths
+ * @return array of paths or NULL, caller frees each path with nng_strfree
+ * and the array with nng_free
+ */
+NNG_DECL char **file_catalog_find_span(file_catalog *cat, uint64_t start_key,
+    uint64_t end_key, const char *topic, uint32_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
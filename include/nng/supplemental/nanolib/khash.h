@@ -421,6 +421,19 @@ static kh_inline khint_t __ac_Wang_hash(khint_t key)
 }
 #define kh_int_hash_func2(key) __ac_Wang_hash((khint_t)key)
 
+/*! @function
+  @abstract     wyhash32 style integer mixer, spreads ids and hash values
+                that share their low bits
+  @param  key   The integer [khint32_t]
+  @return       The hash value [khint_t]
+ */
+static kh_inline khint_t __ac_wymix_hash(khint32_t key)
+{
+	khint64_t r = (khint64_t)(key ^ 0x53c5ca59U) * (khint64_t)(key ^ 0x74743c1bU);
+	return (khint_t)(r ^ (r >> 32));
+}
+#define kh_int_hash_func_wy(key) __ac_wymix_hash((khint32_t)key)
+
 /* --- END OF HASH FUNCTIONS --- */
 
 /* Other convenient macros... */
@@ -593,6 +606,15 @@ static kh_inline khint_t __ac_Wang_hash(khint_t key)
 #define KHASH_MAP_INIT_INT(name, khval_t)								\
 	KHASH_INIT(name, khint32_t, khval_t, 1, kh_int_hash_func, kh_int_hash_equal)
 
+/*! @function
+  @abstract     Instantiate a hash map containing integer keys, hashed with
+                kh_int_hash_func_wy
+  @param  name  Name of the hash table [symbol]
+  @param  khval_t  Type of values [type]
+ */
+#define KHASH_MAP_INIT_INT_WY(name, khval_t)							\
+	KHASH_INIT(name, khint32_t, khval_t, 1, kh_int_hash_func_wy, kh_int_hash_equal)
+
 /*! @function
   @abstract     Instantiate a hash set containing 64-bit integer keys
   @param  name  Name of the hash table [symbol]
@@ -37,6 +37,7 @@ struct conf_log {
 	char    *rotation_sz_str; // 1000KB, 100MB, 10GB
 	uint64_t rotation_sz;     // unit: byte
 	size_t   rotation_count;  // rotation count
+	bool     async;           // write console and file logs in background
 };
 
 typedef struct {
@@ -75,34 +76,100 @@ NNG_DECL void uds_closelog(void);
 NNG_DECL void log_log(int level, const char *file, int line, const char *func,
     const char *fmt, ...);
 NNG_DECL void log_clear_callback();
-#ifdef ENABLE_LOG
 
-#define log_trace(...) \
-    log_log(NNG_LOG_TRACE, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
-#define log_debug(...) \
-    log_log(NNG_LOG_DEBUG, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
-#define log_info(...) \
-    log_log(NNG_LOG_INFO, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
-#define log_warn(...) \
-    log_log(NNG_LOG_WARN, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
-#define log_error(...) \
-    log_log(NNG_LOG_ERROR, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
-#define log_fatal(...) \
-    log_log(NNG_LOG_FATAL, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+// Most verbose level any callback or module override takes, -1 when
+// nothing is logged. The log_xxx macros check it before evaluating their
+// arguments, with a relaxed atomic load as it changes under them.
+NNG_DECL_DATA int log_level_max;
+
+#if defined(_MSC_VER)
+#define log_level_max_load() (*(volatile int *) &log_level_max)
+#else
+#define log_level_max_load() __atomic_load_n(&log_level_max, __ATOMIC_RELAXED)
+#endif
+
+/**
+ * @brief log_set_module_level - Override the level of callbacks for
+ * records of one module, the file name of the call site without its
+ * extension, e.g. "broker_tcp".
+ * @param module - module name
+ * @param level - level, -1 removes the override
+ * @return 0, NNG_ENOMEM if LOG_MAX_MODULES are set or NNG_EINVAL
+ */
+NNG_DECL int log_set_module_level(const char *module, int level);
+
+#define LOG_MAX_MODULES 16
+
+// Records of the console and file callbacks go through a ring per thread
+// and are written by one background thread, file rotation is checked on
+// the bytes written. Records longer than about 440 bytes are truncated.
+#define LOG_ASYNC_SLOTS 256   // records queued per thread
+#define LOG_ASYNC_INTERVAL 10 // ms, writer drains at least this often
+
+/**
+ * @brief log_async_start - Start the async writer.
+ * @param slots - records queued per thread, 0 for LOG_ASYNC_SLOTS
+ * @return 0, NNG_EBUSY if started, NNG_ENOTSUP or a system error
+ */
+NNG_DECL int log_async_start(size_t slots);
+
+/**
+ * @brief log_async_stop - Write what is queued and stop the async writer,
+ * callbacks are synchronous again. log_clear_callback stops it as well.
+ * @return void
+ */
+NNG_DECL void log_async_stop(void);
 
+/**
+ * @brief log_async_dropped - Records dropped on full rings or pushed after
+ * the writer stopped.
+ * @return count
+ */
+NNG_DECL uint64_t log_async_dropped(void);
+
+// Calls less severe than LOG_COMPILE_LEVEL are removed by the compiler.
+// It follows NNG_LOG_COMPILE_LEVEL set by CMake, define it before
+// including this header to change it for one file.
+#ifndef LOG_COMPILE_LEVEL
+#ifdef NNG_LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL NNG_LOG_COMPILE_LEVEL
 #else
+#define LOG_COMPILE_LEVEL NNG_LOG_TRACE
+#endif
+#endif
+
+#define log_enabled(level) \
+    ((level) <= LOG_COMPILE_LEVEL && (level) <= log_level_max_load())
 
 static inline void dummy_log_function(const char *fmt, ...) { (void)fmt;  }
 
-#define log_trace(...) dummy_log_function(__VA_ARGS__)
-#define log_debug(...) dummy_log_function(__VA_ARGS__)
-#define log_info(...) dummy_log_function(__VA_ARGS__)
-#define log_warn(...) dummy_log_function(__VA_ARGS__)
-#define log_error(...) dummy_log_function(__VA_ARGS__)
-#define log_fatal(...) dummy_log_function(__VA_ARGS__)
+#ifdef ENABLE_LOG
+
+#define log_at(level, ...)                                               \
+	do {                                                             \
+		if (log_enabled(level))                                  \
+			log_log(level, __FILE__, __LINE__, __FUNCTION__, \
+			    __VA_ARGS__);                                \
+	} while (0)
+
+#else
+
+// arguments are still type checked but never evaluated
+#define log_at(level, ...)                        \
+	do {                                      \
+		if (0)                            \
+			dummy_log_function(__VA_ARGS__); \
+	} while (0)
 
 #endif
 
+#define log_trace(...) log_at(NNG_LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) log_at(NNG_LOG_DEBUG, __VA_ARGS__)
+#define log_info(...) log_at(NNG_LOG_INFO, __VA_ARGS__)
+#define log_warn(...) log_at(NNG_LOG_WARN, __VA_ARGS__)
+#define log_error(...) log_at(NNG_LOG_ERROR, __VA_ARGS__)
+#define log_fatal(...) log_at(NNG_LOG_FATAL, __VA_ARGS__)
+
 
 #ifdef __cplusplus
 }
@@ -15,6 +15,20 @@ typedef enum {
 
 typedef struct dbtree            dbtree;
 
+/**
+ * Dispatch strategies of shared subscription. Each $share group keeps
+ * its own dispatch state for every topic filter it subscribed.
+ * STICKY keeps each publisher on one subscriber until that one leaves,
+ * a member joining takes over about 1/n of the publishers.
+ */
+typedef enum {
+	DBTREE_SHARED_ROUND_ROBIN = 0,
+	DBTREE_SHARED_STICKY,
+	DBTREE_SHARED_HASH_TOPIC,
+	DBTREE_SHARED_LEAST_INFLIGHT,
+	DBTREE_SHARED_RANDOM,
+} dbtree_shared_strategy;
+
 typedef struct {
 	char * topic;
 	char **clients;
@@ -111,6 +125,8 @@ NNG_DECL nng_msg *dbtree_delete_retain(dbtree *db, char *topic);
 
 /**
  * @brief dbtree_find_retain - Get all retain message to this topic.
+ * Wildcard filters are answered from the retain_db kept in the tree, so
+ * they never match topics starting with '$'.
  * @param db - dbtree
  * @param topic - topic
  * @return dbtree_retain_msg pointer vector
@@ -126,6 +142,41 @@ NNG_DECL nng_msg **dbtree_find_retain(dbtree *db, char *topic);
  */
 NNG_DECL uint32_t *dbtree_find_shared_clients(dbtree *db, char *topic);
 
+/**
+ * @brief dbtree_find_shared_clients_from - Find shared subscribe client
+ * for a publish of one client, STICKY groups dispatch by it.
+ * dbtree_find_shared_clients is the same with pub_id 0.
+ * @param dbtree - dbtree
+ * @param topic - topic
+ * @param pub_id - pipe id of the publisher
+ * @return pipe id array
+ */
+NNG_DECL uint32_t *dbtree_find_shared_clients_from(
+    dbtree *db, char *topic, uint32_t pub_id);
+
+/**
+ * @brief dbtree_set_shared_strategy - Select the dispatch strategy of
+ * a shared subscription group.
+ * @param dbtree - dbtree
+ * @param group - group name, NULL to set default of all groups
+ * @param strategy - dispatch strategy
+ * @return void
+ */
+NNG_DECL void dbtree_set_shared_strategy(
+    dbtree *db, const char *group, dbtree_shared_strategy strategy);
+
+/**
+ * @brief dbtree_set_shared_inflight_cb - Set the callback which reports
+ * the queue depth of a pipe, used by DBTREE_SHARED_LEAST_INFLIGHT.
+ * It is called with the tree read lock held.
+ * @param dbtree - dbtree
+ * @param cb - a callback function
+ * @param arg - argument of callback
+ * @return void
+ */
+NNG_DECL void dbtree_set_shared_inflight_cb(
+    dbtree *db, uint32_t (*cb)(uint32_t pipe_id, void *arg), void *arg);
+
 /**
  * @brief dbtree_get_tree - This function will
  * get all info about this tree.
@@ -135,4 +186,76 @@ NNG_DECL uint32_t *dbtree_find_shared_clients(dbtree *db, char *topic);
  */
 NNG_DECL void ***dbtree_get_tree(dbtree *db, void *(*cb)(uint32_t pipe_id));
 
+typedef struct retain_db     retain_db;
+typedef struct retain_cursor retain_cursor;
+
+/**
+ * @brief retain_db_create - Create a retained message store ordered by
+ * topic, wildcard queries on it are answered incrementally.
+ * @param rdb - retain_db
+ * @return 0 or NNG_ENOMEM
+ */
+NNG_DECL int retain_db_create(retain_db **rdb);
+
+/**
+ * @brief retain_db_destroy - Destroy store and free all messages.
+ * @param rdb - retain_db
+ * @return void
+ */
+NNG_DECL void retain_db_destroy(retain_db *rdb);
+
+/**
+ * @brief retain_db_insert - Insert or replace retain message of topic.
+ * @param rdb - retain_db
+ * @param topic - topic
+ * @param msg - retain message, NULL to delete
+ * @return the replaced message or NULL, caller frees it
+ */
+NNG_DECL nng_msg *retain_db_insert(
+    retain_db *rdb, const char *topic, nng_msg *msg);
+
+/**
+ * @brief retain_db_delete - Delete retain message of topic.
+ * @param rdb - retain_db
+ * @param topic - topic
+ * @return the deleted message or NULL, caller frees it
+ */
+NNG_DECL nng_msg *retain_db_delete(retain_db *rdb, const char *topic);
+
+/**
+ * @brief retain_db_count - Number of retained topics.
+ * @param rdb - retain_db
+ * @return count
+ */
+NNG_DECL size_t retain_db_count(retain_db *rdb);
+
+/**
+ * @brief retain_cursor_open - Start a query of all retain messages
+ * matching a topic filter.
+ * @param rdb - retain_db
+ * @param filter - topic filter, wildcards allowed
+ * @param cur - retain_cursor
+ * @return 0 or error
+ */
+NNG_DECL int retain_cursor_open(
+    retain_db *rdb, const char *filter, retain_cursor **cur);
+
+/**
+ * @brief retain_cursor_next - Get the next batch of matched messages.
+ * Lock of the store is only held while a batch is collected.
+ * @param cur - retain_cursor
+ * @param msgs - array to be filled with cloned messages
+ * @param batch - size of msgs
+ * @return number of messages, 0 if the query is finished
+ */
+NNG_DECL size_t retain_cursor_next(
+    retain_cursor *cur, nng_msg **msgs, size_t batch);
+
+/**
+ * @brief retain_cursor_close - Free a cursor.
+ * @param cur - retain_cursor
+ * @return void
+ */
+NNG_DECL void retain_cursor_close(retain_cursor *cur);
+
 #endif
@@ -43,6 +43,7 @@ struct parquet_object {
 	parquet_file_ranges *ranges;
 	parquet_write_type   type;
 	char                *topic;
+	nng_msg            **msgs; // messages of rows for conf columns, or NULL
 };
 
 parquet_object *parquet_object_alloc(uint64_t *keys, uint8_t **darray,
@@ -53,11 +54,20 @@ parquet_file_range *parquet_file_range_alloc(uint32_t start_idx, uint32_t end_id
 void parquet_file_range_free(parquet_file_range *range);
 
 void parquet_object_set_cb(parquet_object *obj, parquet_cb cb);
+// Queue a batch to the write thread of elem->topic, blocks while that
+// thread has write_queue_limit batches pending.
 int  parquet_write_batch_async(parquet_object *elem);
 // Write a batch to a temporary Parquet file, utilize it in scenarios where a single 
 // file is sufficient for writing, sending, and subsequent deletion.
 int  parquet_write_batch_tmp_async(parquet_object *elem);
+// Starts the write threads once, launching again does nothing.
 int  parquet_write_launcher(conf_parquet *conf);
+// Writes the batches queued, then ends the threads and frees the writers.
+// Producers must be stopped first, parquet can be launched again after.
+void parquet_write_stop(void);
+// Run retention and, if enabled, compaction once, as the background thread
+// does every compact_interval. Returns the number of merged files.
+int  parquet_compact_run(void);
 
 const char  *parquet_find(uint64_t key);
 const char **parquet_find_span(
@@ -14,10 +14,15 @@
 #include "nng/nng.h"
 #include "nng/supplemental/util/platform.h"
 #include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/segment.h"
 
 #define RBNAME_LEN          100
 #define RINGBUFFER_MAX_SIZE	0xffffffff
 #define RBRULELIST_MAX_SIZE	0xff
+/* Segments of RB_FULL_SEGMENT go to RB_SEGMENT_DIR/<pid>-<time>-<seq> of
+ * each ringbuffer by default and are removed by ringBuffer_release, use
+ * ringBuffer_set_segment to keep them across runs */
+#define RB_SEGMENT_DIR      "/tmp/nanomq-segment"
 
 #define ENQUEUE_IN_HOOK     0x0001
 #define ENQUEUE_OUT_HOOK    0x0010
@@ -45,6 +50,7 @@ enum fullOption {
 	RB_FULL_DROP,
 	RB_FULL_RETURN,
 	RB_FULL_FILE,
+	RB_FULL_SEGMENT,
 
 	RB_FULL_MAX
 };
@@ -82,6 +88,13 @@ struct ringBuffer_s {
 
 	/* FOR RB_FULL_FILE */
 	ringBufferFile_t        **files;
+	/* Topic of files flushed to, NULL if not bound to a topic */
+	char                    *topic;
+
+	/* FOR RB_FULL_SEGMENT, opened when first full if not set */
+	segment_store           *segs;
+	/* segs is the default store, removed on release */
+	bool                    segsTmp;
 
 	nng_mtx                 *ring_lock;
 
@@ -129,10 +142,13 @@ int ringBuffer_get_and_clean_msgs(ringBuffer_t *rb,
 								  unsigned int *count, nng_msg ***list);
 
 int ringBuffer_set_fullOp(ringBuffer_t *rb, enum fullOption fullOp);
-#ifdef SUPP_PARQUET
+int ringBuffer_set_segment(ringBuffer_t *rb, const char *dir,
+						   uint32_t seg_size, uint32_t seg_count);
+/* Messages flushed to parquet or segment files, return count or -1 */
 int ringBuffer_get_msgs_from_file(ringBuffer_t *rb, void ***msgs, int **msgLen);
 int ringBuffer_get_msgs_from_file_by_keys(ringBuffer_t *rb, uint64_t *keys, uint32_t count,
 										  void ***msgs, int **msgLen);
-#endif
+int ringBuffer_get_msgs_from_file_by_range(ringBuffer_t *rb, uint64_t start, uint64_t end,
+										   void ***msgs, int **msgLen);
 
 #endif
@@ -4,6 +4,10 @@
 #include "nng/nng.h"
 #include "nng/supplemental/util/platform.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef enum {
 	RULE_QOS,
 	RULE_ID,
@@ -165,4 +169,8 @@ bool        rule_timescaledb_check(rule_timescaledb *timescaledb);
 void        rule_timescaledb_free(rule_timescaledb *timescaledb);
 rule_timescaledb *rule_timescaledb_init(void);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
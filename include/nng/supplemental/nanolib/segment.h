@@ -0,0 +1,107 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include "nng/nng.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Append only store of keyed records in fixed size memory mapped segment
+// files, {dir}/{seq}.seg. Records are length prefixed and checked with
+// crc32c, a sparse index of keys per segment serves key and range lookups.
+// The oldest segment is removed once seg_count segments are full.
+
+#define SEGMENT_SIZE_DEFAULT (4 * 1024 * 1024)
+#define SEGMENT_COUNT_DEFAULT 16
+
+typedef struct segment_store segment_store;
+
+// Return false to stop the walk. data is valid only in the callback.
+typedef bool (*segment_store_cb)(
+    uint64_t key, const uint8_t *data, uint32_t len, void *arg);
+
+/**
+ * @brief segment_store_open - Open or create the store in dir, records of
+ * segments left by the last run are checked and kept up to the first torn
+ * one.
+ * @param sp - segment_store
+ * @param dir - directory of segment files, created if missing
+ * @param seg_size - bytes of a segment file, 0 for SEGMENT_SIZE_DEFAULT
+ * @param seg_count - segments kept, 0 for SEGMENT_COUNT_DEFAULT
+ * @return 0, NNG_EINVAL, NNG_ENOMEM, NNG_ENOTSUP or a system error
+ */
+NNG_DECL int segment_store_open(segment_store **sp, const char *dir,
+    uint32_t seg_size, uint32_t seg_count);
+
+/**
+ * @brief segment_store_close - Flush and unmap all segments.
+ * @param s - segment_store
+ * @return void
+ */
+NNG_DECL void segment_store_close(segment_store *s);
+
+/**
+ * @brief segment_store_destroy - Close the store and remove its segment
+ * files, and its directory once empty.
+ * @param s - segment_store
+ * @return void
+ */
+NNG_DECL void segment_store_destroy(segment_store *s);
+
+/**
+ * @brief segment_store_append - Append one record.
+ * @param s - segment_store
+ * @param key - key of record
+ * @param data - data of record
+ * @param len - length of data
+ * @return 0, NNG_EMSGSIZE if it never fits a segment or a system error
+ */
+NNG_DECL int segment_store_append(
+    segment_store *s, uint64_t key, const void *data, uint32_t len);
+
+/**
+ * @brief segment_store_sync - Write dirty pages of the active segment.
+ * @param s - segment_store
+ * @return 0 or a system error
+ */
+NNG_DECL int segment_store_sync(segment_store *s);
+
+/**
+ * @brief segment_store_foreach_span - Walk records with key in
+ * [start_key, end_key], oldest segment first, in append order.
+ * @param s - segment_store
+ * @param start_key - low key
+ * @param end_key - high key
+ * @param cb - called for each record
+ * @param arg - passed to cb
+ * @return number of records cb was called for
+ */
+NNG_DECL size_t segment_store_foreach_span(segment_store *s,
+    uint64_t start_key, uint64_t end_key, segment_store_cb cb, void *arg);
+
+/**
+ * @brief segment_store_get - Copy of the newest record of key.
+ * @param s - segment_store
+ * @param key - key
+ * @param data - data, caller frees it with nng_free(data, len)
+ * @param len - length of data
+ * @return 0, NNG_ENOENT or NNG_ENOMEM
+ */
+NNG_DECL int segment_store_get(
+    segment_store *s, uint64_t key, uint8_t **data, uint32_t *len);
+
+/**
+ * @brief segment_store_count - Number of records in store.
+ * @param s - segment_store
+ * @return count
+ */
+NNG_DECL size_t segment_store_count(segment_store *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef NNG_NANOLIB_TRACE_H
+#define NNG_NANOLIB_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Latency of the stages a PUBLISH goes through in the broker.  Tracing is
+// off until trace_enable is called; then each stage adds its spans to a
+// histogram in the "trace" scope of the stats tree, e.g. trace.queue_us,
+// and trace_open samples them to a file.
+//
+// Spans are in microseconds of a monotonic clock.  A stage started before
+// tracing was turned on is not counted.
+typedef enum {
+	TRACE_DECODE, // first byte of a PUBLISH read to its handoff upwards
+	TRACE_MATCH,  // topic tree lookup of the subscribers
+	TRACE_QUEUE,  // wait in the send queue of a subscriber
+	TRACE_QOS,    // QoS message sent until acknowledged
+	TRACE_WRITE,  // socket write to a subscriber
+	TRACE_STAGES,
+} trace_stage;
+
+// Whether spans are recorded, checked at the call site by trace_now with a
+// relaxed atomic load.
+NNG_DECL_DATA bool trace_active;
+
+#if defined(_MSC_VER)
+#define trace_active_load() (*(volatile bool *) &trace_active)
+#else
+#define trace_active_load() __atomic_load_n(&trace_active, __ATOMIC_RELAXED)
+#endif
+
+NNG_DECL uint64_t trace_clock(void);
+
+// Start of a span, 0 while tracing is off.
+#define trace_now() (trace_active_load() ? trace_clock() : 0)
+
+/**
+ * @brief trace_span - Record a span of a stage that began at start
+ * @param stage - stage of the span
+ * @param start - trace_now() when it began, nothing is done for 0
+ * @param id - pipe the span belongs to, 0 if none, for the trace file
+ */
+NNG_DECL void trace_span(trace_stage stage, uint64_t start, uint32_t id);
+
+NNG_DECL const char *trace_stage_name(trace_stage stage);
+
+/**
+ * @brief trace_enable - Turn recording of spans on or off
+ * @param on - true to record spans
+ */
+NNG_DECL void trace_enable(bool on);
+
+/**
+ * @brief trace_open - Write one span in every spans to a file, as lines
+ * of "<end us> <stage> <pipe id> <span us>". Turns tracing on.
+ * @param path - file, truncated when opened
+ * @param every - sampling interval, 1 writes every span
+ * @return 0, NNG_EINVAL or an error of opening the file
+ */
+NNG_DECL int trace_open(const char *path, uint32_t every);
+
+/**
+ * @brief trace_close - Flush and close the trace file. Spans are still
+ * recorded until trace_enable(false).
+ */
+NNG_DECL void trace_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -214,10 +214,12 @@ id_map_register(nni_id_map *m)
 			nni_mtx_unlock(&id_reg_mtx);
 			return (NNG_ENOMEM);
 		}
-		id_reg_len = len;
-		if (id_reg_map != NULL)
+		if (id_reg_map != NULL) {
 			memcpy(
 			    mr, id_reg_map, id_reg_num * sizeof(nni_id_map *));
+			nni_free(id_reg_map, sizeof(nni_id_map *) * id_reg_len);
+		}
+		id_reg_len = len;
 		id_reg_map = mr;
 	}
 	id_reg_map[id_reg_num++] = m;
@@ -37,6 +37,7 @@ struct nng_msg {
 	uint8_t          CMD_TYPE;
 	uint8_t *        payload_ptr; // payload
 	nni_time         times;		  // the time msg arrives
+	nni_atomic_u64   trace;       // the time msg entered its stage (us)
 	conn_param      *cparam;      // indicates where it originated
 };
 
@@ -431,6 +432,7 @@ nni_msg_alloc(nni_msg **mp, size_t sz)
 	// We always start with a single valid reference count.
 	nni_atomic_init(&m->m_refcnt);
 	nni_atomic_set(&m->m_refcnt, 1);
+	nni_atomic_init64(&m->trace);
 	*mp = m;
 	return (0);
 }
@@ -456,6 +458,7 @@ nni_msg_dup(nni_msg **dup, const nni_msg *src)
 	m->m_pipe = src->m_pipe;
 	nni_atomic_init(&m->m_refcnt);
 	nni_atomic_set(&m->m_refcnt, 1);
+	nni_atomic_init64(&m->trace);
 
 	// clone protocol data if a method was supplied.
 	if (src->m_proto_ops != NULL && src->m_proto_ops->msg_free != NULL) {
@@ -831,3 +834,15 @@ nni_msg_get_timestamp(nni_msg *m)
 {
 	return m->times;
 }
+
+void
+nni_msg_set_trace(nni_msg *m, uint64_t us)
+{
+	nni_atomic_set64(&m->trace, us);
+}
+
+uint64_t
+nni_msg_get_trace(nni_msg *m)
+{
+	return nni_atomic_get64(&m->trace);
+}
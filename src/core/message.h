@@ -68,6 +68,11 @@ extern nni_msg *nni_msg_pull_up(nni_msg *);
 // NANOMQ MQTT
 extern nni_time      nni_msg_get_timestamp(nni_msg *m);
 extern void          nni_msg_set_timestamp(nni_msg *m, nni_time time);
+// Microseconds the message entered its current stage, 0 when untraced.
+// Clones share it, atomically, so the last stage entered by any of them
+// wins and spans of the others are approximate.
+extern uint64_t      nni_msg_get_trace(nni_msg *m);
+extern void          nni_msg_set_trace(nni_msg *m, uint64_t us);
 extern uint8_t       nni_msg_cmd_type(nni_msg *m);
 extern uint8_t       nni_msg_get_type(nni_msg *m);
 extern uint8_t *     nni_msg_header_ptr(const nni_msg *m);
@@ -146,6 +151,11 @@ struct conn_param {
 	property *properties;
 	uint32_t  will_prop_len;
 	property *will_properties;
+
+	// CONNECT packet the strings above are slices of, freed with us
+	uint8_t *pkt;
+	size_t   pkt_len;
+	char     idbuf[20]; // assigned client id
 };
 // Message protocol private data.  This is specific for protocol use,
 // and not exposed to library users.
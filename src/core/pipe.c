@@ -18,9 +18,41 @@
 // Operations on pipes (to the transport) are generally blocking operations,
 // performed in the context of the protocol.
 
-static nni_id_map pipes =
-    NNI_ID_MAP_INITIALIZER(1, 0x7fffffff, NNI_ID_FLAG_RANDOM);
-static nni_mtx pipes_lk = NNI_MTX_INITIALIZER;
+// The pipes are spread over shards by the low bits of their id, each shard
+// with its own lock, so that connections coming and going at a high rate do
+// not all wait on one lock. An id allocated in a shard is shifted up and
+// tagged with the shard. Ids set by NanoMQ land in the shard they select.
+#define PIPE_SHARD_BITS 4
+#define PIPE_SHARDS (1u << PIPE_SHARD_BITS)
+#define PIPE_KEY(id) ((id) >> PIPE_SHARD_BITS)
+
+typedef struct {
+	nni_mtx    lk;
+	nni_id_map pipes;
+} pipe_shard;
+
+#define PIPE_SHARD_INITIALIZER                                              \
+	{                                                                   \
+		.lk    = NNI_MTX_INITIALIZER,                               \
+		.pipes = NNI_ID_MAP_INITIALIZER(                            \
+		    1, 0x7fffffff >> PIPE_SHARD_BITS, NNI_ID_FLAG_RANDOM), \
+	}
+#define PIPE_SHARD_INITIALIZER4                                 \
+	PIPE_SHARD_INITIALIZER, PIPE_SHARD_INITIALIZER,         \
+	    PIPE_SHARD_INITIALIZER, PIPE_SHARD_INITIALIZER
+
+static pipe_shard pipe_shards[PIPE_SHARDS] = {
+	PIPE_SHARD_INITIALIZER4,
+	PIPE_SHARD_INITIALIZER4,
+	PIPE_SHARD_INITIALIZER4,
+	PIPE_SHARD_INITIALIZER4,
+};
+
+static pipe_shard *
+pipe_shard_get(uint32_t id)
+{
+	return (&pipe_shards[id & (PIPE_SHARDS - 1)]);
+}
 
 static void pipe_destroy(void *);
 
@@ -32,7 +64,9 @@ static nni_reap_list pipe_reap_list = {
 static void
 pipe_destroy(void *arg)
 {
-	nni_pipe *p = arg;
+	nni_pipe   *p = arg;
+	pipe_shard *shard;
+
 	if (p == NULL || p->cache) {
 		return;
 	}
@@ -41,17 +75,21 @@ pipe_destroy(void *arg)
 
 	// Make sure any unlocked holders are done with this.
 	// This happens during initialization for example.
-	nni_mtx_lock(&pipes_lk);
+	shard = pipe_shard_get(p->p_id);
+	nni_mtx_lock(&shard->lk);
 	// This is a change for NanoMQ only
 	// NNG always remove the pipe with a matching p_id
-	if (p->p_id != 0 && nni_id_get(&pipes, p->p_id) == p) {
-		nni_id_remove(&pipes, p->p_id);
+	if (p->p_id != 0 && nni_id_get(&shard->pipes, PIPE_KEY(p->p_id)) == p) {
+		nni_id_remove(&shard->pipes, PIPE_KEY(p->p_id));
 	}
+	nni_mtx_unlock(&shard->lk);
+
 	// This wait guarantees that all callers are done with us.
-	while (p->p_ref != 0) {
+	nni_mtx_lock(&p->p_ref_mtx);
+	while (nni_atomic_get(&p->p_ref) != 0) {
 		nni_cv_wait(&p->p_cv);
 	}
-	nni_mtx_unlock(&pipes_lk);
+	nni_mtx_unlock(&p->p_ref_mtx);
 
 	if (p->p_proto_data != NULL) {
 		p->p_proto_ops.pipe_stop(p->p_proto_data);
@@ -87,36 +125,39 @@ pipe_destroy(void *arg)
 		p->p_tran_ops.p_fini(p->p_tran_data);
 	}
 	nni_cv_fini(&p->p_cv);
+	nni_mtx_fini(&p->p_ref_mtx);
 	nni_free(p, p->p_size);
 }
 
 int
 nni_pipe_find(nni_pipe **pp, uint32_t id)
 {
-	nni_pipe *p;
+	nni_pipe   *p;
+	pipe_shard *shard = pipe_shard_get(id);
 
 	// We don't care if the pipe is "closed".  End users only have
 	// access to the pipe in order to obtain properties (which may
 	// be retried during the post-close notification callback) or to
 	// close the pipe.
-	nni_mtx_lock(&pipes_lk);
-	if ((p = nni_id_get(&pipes, id)) != NULL) {
-		p->p_ref++;
+	nni_mtx_lock(&shard->lk);
+	if ((p = nni_id_get(&shard->pipes, PIPE_KEY(id))) != NULL) {
+		nni_atomic_inc(&p->p_ref);
 		*pp = p;
 	}
-	nni_mtx_unlock(&pipes_lk);
+	nni_mtx_unlock(&shard->lk);
 	return (p == NULL ? NNG_ENOENT : 0);
 }
 
 void
 nni_pipe_rele(nni_pipe *p)
 {
-	nni_mtx_lock(&pipes_lk);
-	p->p_ref--;
-	if (p->p_ref == 0) {
+	// Taken even when other holds remain, pipe_destroy must not see the
+	// last one go before we are done with p.
+	nni_mtx_lock(&p->p_ref_mtx);
+	if (nni_atomic_dec_nv(&p->p_ref) == 0) {
 		nni_cv_wake(&p->p_cv);
 	}
-	nni_mtx_unlock(&pipes_lk);
+	nni_mtx_unlock(&p->p_ref_mtx);
 }
 
 // nni_pipe_id returns the 32-bit pipe id, which can be used in backtraces.
@@ -253,6 +294,8 @@ pipe_create(nni_pipe **pp, nni_sock *sock, nni_sp_tran *tran, void *tran_data)
 {
 	nni_pipe           *p;
 	int                 rv;
+	uint32_t            key;
+	pipe_shard         *shard;
 	void               *sock_data = nni_sock_proto_data(sock);
 	nni_proto_pipe_ops *pops      = nni_sock_proto_pipe_ops(sock);
 	size_t              sz;
@@ -272,7 +315,8 @@ pipe_create(nni_pipe **pp, nni_sock *sock, nni_sp_tran *tran, void *tran_data)
 	p->p_proto_ops  = *pops;
 	p->p_sock       = sock;
 	p->p_cbs        = false;
-	p->p_ref        = 1;
+	nni_atomic_init(&p->p_ref);
+	nni_atomic_set(&p->p_ref, 1);
 	// NanoMQ
 	p->packet_id = 0;
 	p->cache     = false;
@@ -284,11 +328,16 @@ pipe_create(nni_pipe **pp, nni_sock *sock, nni_sp_tran *tran, void *tran_data)
 	NNI_LIST_NODE_INIT(&p->p_sock_node);
 	NNI_LIST_NODE_INIT(&p->p_ep_node);
 
-	nni_cv_init(&p->p_cv, &pipes_lk);
+	nni_mtx_init(&p->p_ref_mtx);
+	nni_cv_init(&p->p_cv, &p->p_ref_mtx);
 
-	nni_mtx_lock(&pipes_lk);
-	rv = nni_id_alloc32(&pipes, &p->p_id, p);
-	nni_mtx_unlock(&pipes_lk);
+	// spread the new pipes, like the aio expire queues
+	shard = &pipe_shards[nni_random() % PIPE_SHARDS];
+	nni_mtx_lock(&shard->lk);
+	if ((rv = nni_id_alloc32(&shard->pipes, &key, p)) == 0) {
+		p->p_id = key << PIPE_SHARD_BITS | (uint32_t) (shard - pipe_shards);
+	}
+	nni_mtx_unlock(&shard->lk);
 
 #ifdef NNG_ENABLE_STATS
 	pipe_stats_init(p);
@@ -479,17 +528,29 @@ void
 nni_pipe_id_swap(uint32_t old_id, uint32_t new_id)
 {
 	// q is the new pipe, p is the old one
-	nni_pipe *p, *q;
-	if ((p = nni_id_get(&pipes, old_id)) != NULL &&
-	    (q = nni_id_get(&pipes, new_id)) != NULL) {
+	nni_pipe   *p, *q;
+	pipe_shard *os = pipe_shard_get(old_id);
+	pipe_shard *ns = pipe_shard_get(new_id);
+
+	// both shards, in a fixed order
+	nni_mtx_lock(os < ns ? &os->lk : &ns->lk);
+	if (os != ns) {
+		nni_mtx_lock(os < ns ? &ns->lk : &os->lk);
+	}
+	if ((p = nni_id_get(&os->pipes, PIPE_KEY(old_id))) != NULL &&
+	    (q = nni_id_get(&ns->pipes, PIPE_KEY(new_id))) != NULL) {
 		nni_list *l = q->subinfol;
 		q->subinfol = p->subinfol;
 		p->subinfol = l;
-		nni_id_set(&pipes, new_id, p);
-		nni_id_set(&pipes, old_id, q);
+		nni_id_set(&ns->pipes, PIPE_KEY(new_id), p);
+		nni_id_set(&os->pipes, PIPE_KEY(old_id), q);
 		p->p_id = new_id;
 		q->p_id = old_id;
 	}
+	if (os != ns) {
+		nni_mtx_unlock(&ns->lk);
+	}
+	nni_mtx_unlock(&os->lk);
 }
 
 /**
@@ -501,17 +562,25 @@ nni_pipe_id_swap(uint32_t old_id, uint32_t new_id)
 int
 nni_pipe_set_pid(nni_pipe *new_pipe, uint32_t id)
 {
-	int rv;
-	nni_pipe *p;
+	int         rv;
+	nni_pipe   *p;
+	pipe_shard *shard = pipe_shard_get(new_pipe->p_id);
+
 	// remove the id set by NNG
-	nni_mtx_lock(&pipes_lk);
-	nni_id_remove(&pipes, new_pipe->p_id);
+	nni_mtx_lock(&shard->lk);
+	if (nni_id_get(&shard->pipes, PIPE_KEY(new_pipe->p_id)) == new_pipe) {
+		nni_id_remove(&shard->pipes, PIPE_KEY(new_pipe->p_id));
+	}
+	nni_mtx_unlock(&shard->lk);
+
+	shard = pipe_shard_get(id);
+	nni_mtx_lock(&shard->lk);
 	new_pipe->p_id = id;
 	nni_stat_set_id(&new_pipe->st_root, (int) new_pipe->p_id);
 	nni_stat_set_id(&new_pipe->st_id, (int) new_pipe->p_id);
-	if ((p = nni_id_get(&pipes, id)) != NULL) {
-		rv = nni_id_set(&pipes, id, new_pipe);
-		nni_mtx_unlock(&pipes_lk);
+	if ((p = nni_id_get(&shard->pipes, PIPE_KEY(id))) != NULL) {
+		rv = nni_id_set(&shard->pipes, PIPE_KEY(id), new_pipe);
+		nni_mtx_unlock(&shard->lk);
 		if (!p->cache || rv != 0) {
 			nni_pipe_close(p);
 			nni_pipe_rele(p);
@@ -519,7 +588,7 @@ nni_pipe_set_pid(nni_pipe *new_pipe, uint32_t id)
 		return rv;
 	}
 
-	rv = nni_id_set(&pipes, id, new_pipe);
-	nni_mtx_unlock(&pipes_lk);
+	rv = nni_id_set(&shard->pipes, PIPE_KEY(id), new_pipe);
+	nni_mtx_unlock(&shard->lk);
 	return rv;
 }
\ No newline at end of file
@@ -0,0 +1,169 @@
+//
+// Copyright 2024 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "core/nng_impl.h"
+
+#include <nuts.h>
+
+#define STORM_THREADS 4
+#define STORM_DIALS 2000
+
+void
+test_pipe_find(void)
+{
+	nng_socket s1, s2;
+	nng_pipe   p1, p2;
+	nni_pipe  *p;
+
+	NUTS_OPEN(s1);
+	NUTS_OPEN(s2);
+	NUTS_MARRY_EX(s1, s2, NULL, &p1, &p2);
+	NUTS_PASS(nni_pipe_find(&p, nng_pipe_id(p1)));
+	NUTS_TRUE(nni_pipe_id(p) == (uint32_t) nng_pipe_id(p1));
+	nni_pipe_rele(p);
+	NUTS_PASS(nni_pipe_find(&p, nng_pipe_id(p2)));
+	NUTS_TRUE(nni_pipe_id(p) == (uint32_t) nng_pipe_id(p2));
+	nni_pipe_rele(p);
+	NUTS_CLOSE(s1);
+	NUTS_CLOSE(s2);
+	nng_msleep(100);
+	NUTS_FAIL(nni_pipe_find(&p, nng_pipe_id(p1)), NNG_ENOENT);
+	NUTS_FAIL(nni_pipe_find(&p, nng_pipe_id(p2)), NNG_ENOENT);
+}
+
+// Ids set by NanoMQ and swapped for session takeover may move a pipe to
+// another shard.
+void
+test_pipe_set_pid(void)
+{
+	nng_socket s1, s2;
+	nng_pipe   p1, p2;
+	nni_pipe  *p, *q, *r;
+	uint32_t   id1, id2;
+
+	NUTS_OPEN(s1);
+	NUTS_OPEN(s2);
+	NUTS_MARRY_EX(s1, s2, NULL, &p1, &p2);
+	NUTS_PASS(nni_pipe_find(&p, nng_pipe_id(p1)));
+	NUTS_PASS(nni_pipe_find(&q, nng_pipe_id(p2)));
+
+	id1 = (nni_pipe_id(p) | 0x40000000u) ^ 1u;
+	id2 = (nni_pipe_id(q) | 0x40000000u) ^ 2u;
+	NUTS_PASS(nni_pipe_set_pid(p, id1));
+	NUTS_PASS(nni_pipe_set_pid(q, id2));
+	NUTS_FAIL(nni_pipe_find(&r, nng_pipe_id(p1)), NNG_ENOENT);
+	NUTS_PASS(nni_pipe_find(&r, id1));
+	NUTS_TRUE(r == p);
+	nni_pipe_rele(r);
+
+	nni_pipe_id_swap(id1, id2);
+	NUTS_TRUE(nni_pipe_id(p) == id2);
+	NUTS_TRUE(nni_pipe_id(q) == id1);
+	NUTS_PASS(nni_pipe_find(&r, id1));
+	NUTS_TRUE(r == q);
+	nni_pipe_rele(r);
+	NUTS_PASS(nni_pipe_find(&r, id2));
+	NUTS_TRUE(r == p);
+	nni_pipe_rele(r);
+
+	nni_pipe_rele(p);
+	nni_pipe_rele(q);
+	NUTS_CLOSE(s1);
+	NUTS_CLOSE(s2);
+	nng_msleep(100);
+	NUTS_FAIL(nni_pipe_find(&r, id1), NNG_ENOENT);
+	NUTS_FAIL(nni_pipe_find(&r, id2), NNG_ENOENT);
+}
+
+typedef struct {
+	nng_socket     sock;
+	const char    *url;
+	nni_atomic_int found;
+} storm_arg;
+
+static void
+storm_added(nng_pipe p, nng_pipe_ev ev, void *arg)
+{
+	storm_arg *sa = arg;
+
+	NNI_ARG_UNUSED(ev);
+	// a lookup per connection, as the api calls on a pipe do
+	if (nng_socket_id(nng_pipe_socket(p)) > 0) {
+		nni_atomic_inc(&sa->found);
+	}
+}
+
+static void
+storm_dial(void *arg)
+{
+	storm_arg *sa = arg;
+
+	for (int i = 0; i < STORM_DIALS; i++) {
+		nng_dialer d;
+
+		NUTS_PASS(nng_dial(sa->sock, sa->url, &d, 0));
+		NUTS_PASS(nng_dialer_close(d));
+	}
+}
+
+// Connect storm: threads dial and hang up as fast as they can, while each
+// new pipe is looked up by id.
+void
+test_pipe_connect_storm(void)
+{
+	nng_socket  l;
+	nng_thread *thrs[STORM_THREADS];
+	storm_arg   args[STORM_THREADS];
+	char       *url;
+	nng_time    start, end;
+	int         found = 0;
+
+	NUTS_PASS(nng_bus0_open(&l));
+	NUTS_ADDR(url, "inproc");
+	NUTS_PASS(nng_listen(l, url, NULL, 0));
+	for (int i = 0; i < STORM_THREADS; i++) {
+		NUTS_PASS(nng_bus0_open(&args[i].sock));
+		args[i].url = url;
+		nni_atomic_init(&args[i].found);
+		NUTS_PASS(nng_pipe_notify(
+		    args[i].sock, NNG_PIPE_EV_ADD_POST, storm_added, &args[i]));
+	}
+
+	start = nng_clock();
+	for (int i = 0; i < STORM_THREADS; i++) {
+		NUTS_PASS(nng_thread_create(&thrs[i], storm_dial, &args[i]));
+	}
+	for (int i = 0; i < STORM_THREADS; i++) {
+		nng_thread_destroy(thrs[i]);
+	}
+	end = nng_clock();
+	for (int i = 0; i < STORM_THREADS; i++) {
+		found += nni_atomic_get(&args[i].found);
+		NUTS_CLOSE(args[i].sock);
+	}
+	NUTS_TRUE(found == STORM_THREADS * STORM_DIALS);
+#ifdef NNG_TEST_BENCH
+	printf("connect storm: %d connections by %d threads in %lums "
+	       "(%.0f/s)\n",
+	    STORM_THREADS * STORM_DIALS, STORM_THREADS,
+	    (unsigned long) (end - start),
+	    STORM_THREADS * STORM_DIALS * 1000.0 /
+	        (double) (end > start ? end - start : 1));
+#else
+	(void) (end - start);
+#endif
+	NUTS_CLOSE(l);
+}
+
+NUTS_TESTS = {
+	{ "pipe find", test_pipe_find },
+	{ "pipe set pid", test_pipe_set_pid },
+	{ "pipe connect storm", test_pipe_connect_storm },
+	{ NULL, NULL },
+};
@@ -226,6 +226,7 @@ extern int  nni_atomic_swap(nni_atomic_int *, int);
 extern int  nni_atomic_dec_nv(nni_atomic_int *);
 extern void nni_atomic_dec(nni_atomic_int *);
 extern void nni_atomic_inc(nni_atomic_int *);
+extern int  nni_atomic_inc_nv(nni_atomic_int *);
 
 // nni_atomic_cas is a compare and swap.  The second argument is the
 // value to compare against, and the third is the new value. Returns
@@ -248,6 +249,8 @@ extern void                  *nni_atomic_get_ptr(nni_atomic_ptr *);
 // relax this last constraint, but there is no reason to, and leaves us the
 // option of using negative values for other purposes in the future.)
 extern nni_time nni_clock(void);
+// nni_clock_us is nni_clock in microseconds, for measuring short intervals.
+extern uint64_t nni_clock_us(void);
 // nn_clock returns a standard UNIX timestamp
 extern nni_time nni_timestamp(void);
 
@@ -287,6 +290,11 @@ extern void nni_plat_fini(void);
 // used to scale the number of independent threads started.
 extern int nni_plat_ncpu(void);
 
+// nni_plat_cpu_index returns the CPU the calling thread runs on, or 0 if
+// the platform cannot tell.  It is only a hint for spreading contended
+// state; the thread may be migrated at any time.
+extern int nni_plat_cpu_index(void);
+
 //
 // TCP Support.
 //
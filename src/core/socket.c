@@ -472,6 +472,7 @@ sock_stats_init(nni_sock *s)
 		.si_type   = NNG_STAT_COUNTER,
 		.si_unit   = NNG_UNIT_MESSAGES,
 		.si_atomic = true,
+		.si_percpu = true,
 	};
 	static const nni_stat_info rx_msgs_info = {
 		.si_name   = "rx_msgs",
@@ -479,6 +480,7 @@ sock_stats_init(nni_sock *s)
 		.si_type   = NNG_STAT_COUNTER,
 		.si_unit   = NNG_UNIT_MESSAGES,
 		.si_atomic = true,
+		.si_percpu = true,
 	};
 	static const nni_stat_info tx_bytes_info = {
 		.si_name   = "tx_bytes",
@@ -486,6 +488,7 @@ sock_stats_init(nni_sock *s)
 		.si_type   = NNG_STAT_COUNTER,
 		.si_unit   = NNG_UNIT_BYTES,
 		.si_atomic = true,
+		.si_percpu = true,
 	};
 	static const nni_stat_info rx_bytes_info = {
 		.si_name   = "rx_bytes",
@@ -493,6 +496,7 @@ sock_stats_init(nni_sock *s)
 		.si_type   = NNG_STAT_COUNTER,
 		.si_unit   = NNG_UNIT_BYTES,
 		.si_atomic = true,
+		.si_percpu = true,
 	};
 
 	// To make collection cheap and atomic for the socket,
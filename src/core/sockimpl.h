@@ -119,7 +119,8 @@ struct nni_pipe {
 	nni_atomic_bool    p_closed;
 	nni_atomic_flag    p_stop;
 	bool               p_cbs;
-	int                p_ref;
+	nni_atomic_int     p_ref;
+	nni_mtx            p_ref_mtx; // p_cv waits for the last p_ref
 	nni_cv             p_cv;
 	nni_reap_node      p_reap;
 
@@ -44,6 +44,48 @@ static nni_stat_item stats_root = {
 };
 static nni_mtx stats_lock     = NNI_MTX_INITIALIZER;
 static nni_mtx stats_val_lock = NNI_MTX_INITIALIZER;
+
+// Each CPU has a line of its own, so they do not bounce it between them.
+struct nni_stat_cpu {
+	nni_atomic_u64 sc_value;
+	char           sc_pad[64 - sizeof(nni_atomic_u64)];
+};
+
+#define STAT_BUCKET(name)                                          \
+	{                                                          \
+		.si_name = name, .si_desc = "samples up to " name, \
+		.si_type = NNG_STAT_COUNTER,                       \
+	}
+
+static const nni_stat_info stat_bucket_info[NNI_STAT_BUCKETS] = {
+	STAT_BUCKET("1"),
+	STAT_BUCKET("2"),
+	STAT_BUCKET("4"),
+	STAT_BUCKET("8"),
+	STAT_BUCKET("16"),
+	STAT_BUCKET("32"),
+	STAT_BUCKET("64"),
+	STAT_BUCKET("128"),
+	STAT_BUCKET("256"),
+	STAT_BUCKET("512"),
+	STAT_BUCKET("1024"),
+	STAT_BUCKET("2048"),
+	STAT_BUCKET("4096"),
+	STAT_BUCKET("8192"),
+	STAT_BUCKET("16384"),
+	STAT_BUCKET("+Inf"),
+};
+
+static const struct {
+	const char *name;
+	const char *desc;
+	uint64_t    per10k;
+} stat_quantiles[NNI_STAT_QUANTILES] = {
+	{ "p50", "median sample", 5000 },
+	{ "p90", "90th percentile sample", 9000 },
+	{ "p99", "99th percentile sample", 9900 },
+	{ "p999", "99.9th percentile sample", 9990 },
+};
 #endif
 
 void
@@ -92,6 +134,10 @@ stat_unregister(nni_stat_item *item)
 		nni_strfree(item->si_u.sv_string);
 		item->si_u.sv_string = NULL;
 	}
+	if (item->si_cpu != NULL) {
+		nni_free(item->si_cpu, sizeof(nni_stat_cpu) * NNI_STAT_CPUS);
+		item->si_cpu = NULL;
+	}
 	nni_list_node_remove(&item->si_node);
 }
 #endif
@@ -115,6 +161,13 @@ nni_stat_init(nni_stat_item *item, const nni_stat_info *info)
 	memset(item, 0, sizeof(*item));
 	NNI_LIST_INIT(&item->si_children, nni_stat_item, si_node);
 	item->si_info = info;
+	if (info->si_percpu) {
+		// Without the slots, the stat is a plain atomic one.
+		item->si_cpu = nni_zalloc(sizeof(nni_stat_cpu) * NNI_STAT_CPUS);
+		for (int i = 0; item->si_cpu != NULL && i < NNI_STAT_CPUS; i++) {
+			nni_atomic_init64(&item->si_cpu[i].sc_value);
+		}
+	}
 #else
 	NNI_ARG_UNUSED(item);
 	NNI_ARG_UNUSED(info);
@@ -125,7 +178,11 @@ void
 nni_stat_inc(nni_stat_item *item, uint64_t inc)
 {
 #ifdef NNG_ENABLE_STATS
-	if (item->si_info->si_atomic) {
+	if (item->si_cpu != NULL) {
+		nni_atomic_add64(
+		    &item->si_cpu[nni_plat_cpu_index() % NNI_STAT_CPUS].sc_value,
+		    inc);
+	} else if (item->si_info->si_atomic) {
 		nni_atomic_add64(&item->si_u.sv_atomic, inc);
 	} else {
 		item->si_u.sv_number += inc;
@@ -141,7 +198,11 @@ nni_stat_dec(nni_stat_item *item, uint64_t inc)
 {
 #ifdef NNG_ENABLE_STATS
 
-	if (item->si_info->si_atomic) {
+	if (item->si_cpu != NULL) {
+		nni_atomic_sub64(
+		    &item->si_cpu[nni_plat_cpu_index() % NNI_STAT_CPUS].sc_value,
+		    inc);
+	} else if (item->si_info->si_atomic) {
 		nni_atomic_sub64(&item->si_u.sv_atomic, inc);
 	} else {
 		item->si_u.sv_number -= inc;
@@ -211,7 +272,13 @@ void
 nni_stat_set_value(nni_stat_item *item, uint64_t v)
 {
 #ifdef NNG_ENABLE_STATS
-	if (item->si_info->si_atomic) {
+	if (item->si_cpu != NULL) {
+		// Not atomic as a whole, which setting a counter never is.
+		nni_atomic_set64(&item->si_cpu[0].sc_value, v);
+		for (int i = 1; i < NNI_STAT_CPUS; i++) {
+			nni_atomic_set64(&item->si_cpu[i].sc_value, 0);
+		}
+	} else if (item->si_info->si_atomic) {
 		nni_atomic_set64(&item->si_u.sv_atomic, v);
 	} else {
 		item->si_u.sv_number = v;
@@ -222,6 +289,118 @@ nni_stat_set_value(nni_stat_item *item, uint64_t v)
 #endif
 }
 
+void
+nni_stat_hist_init(nni_stat_hist *hist, const nni_stat_info *info)
+{
+#ifdef NNG_ENABLE_STATS
+	nni_stat_init(&hist->sh_item, info);
+	for (int i = 0; i < NNI_STAT_BUCKETS; i++) {
+		nni_stat_init(&hist->sh_buckets[i], &stat_bucket_info[i]);
+		nni_stat_add(&hist->sh_item, &hist->sh_buckets[i]);
+	}
+	for (int i = 0; i < NNI_STAT_QUANTILES; i++) {
+		nni_stat_info *qi = &hist->sh_quantile_info[i];
+
+		memset(qi, 0, sizeof(*qi));
+		qi->si_name = stat_quantiles[i].name;
+		qi->si_desc = stat_quantiles[i].desc;
+		qi->si_type = NNG_STAT_LEVEL;
+		qi->si_unit = info->si_unit;
+		nni_stat_init(&hist->sh_quantiles[i], qi);
+		nni_stat_add(&hist->sh_item, &hist->sh_quantiles[i]);
+	}
+	for (int i = 0; i < NNI_STAT_HDR_SLOTS; i++) {
+		nni_atomic_init64(&hist->sh_slots[i]);
+	}
+#else
+	NNI_ARG_UNUSED(hist);
+	NNI_ARG_UNUSED(info);
+#endif
+}
+
+#ifdef NNG_ENABLE_STATS
+// Slots hold v - 1, so that powers of two end a slot rather than begin
+// one.  Below 2 * NNI_STAT_HDR_SUB a slot is one value, above it the value
+// is shifted down into [NNI_STAT_HDR_SUB, 2 * NNI_STAT_HDR_SUB).
+static int
+stat_hist_slot(uint64_t v)
+{
+	uint64_t u = v > 0 ? v - 1 : 0;
+	int      shift = 0;
+
+	while ((u >> shift) >= 2 * NNI_STAT_HDR_SUB) {
+		if (++shift > NNI_STAT_HDR_SHIFT) {
+			return (NNI_STAT_HDR_SLOTS - 1);
+		}
+	}
+	return (shift * NNI_STAT_HDR_SUB + (int) (u >> shift));
+}
+
+// The largest value counted in a slot.
+static uint64_t
+stat_hist_upper(int slot)
+{
+	int shift = slot / NNI_STAT_HDR_SUB - 1;
+
+	if (shift < 0) {
+		shift = 0;
+	}
+	return ((uint64_t) (slot - shift * NNI_STAT_HDR_SUB + 1) << shift);
+}
+
+// Works out the buckets and quantiles from the slots, under the stats
+// lock, before the snapshot reads them.
+static void
+stat_hist_update(nni_stat_hist *hist)
+{
+	uint64_t counts[NNI_STAT_HDR_SLOTS];
+	uint64_t total = 0;
+	uint64_t seen  = 0;
+	int      b     = 0;
+	int      q     = 0;
+
+	for (int i = 0; i < NNI_STAT_BUCKETS; i++) {
+		hist->sh_buckets[i].si_u.sv_number = 0;
+	}
+	for (int i = 0; i < NNI_STAT_HDR_SLOTS; i++) {
+		uint64_t upper = stat_hist_upper(i);
+
+		counts[i] = nni_atomic_get64(&hist->sh_slots[i]);
+		total += counts[i];
+		while ((b < NNI_STAT_BUCKETS - 1) &&
+		    (upper > ((uint64_t) 1 << b))) {
+			b++;
+		}
+		hist->sh_buckets[b].si_u.sv_number += counts[i];
+	}
+	for (int i = 0; i < NNI_STAT_HDR_SLOTS && q < NNI_STAT_QUANTILES;
+	     i++) {
+		seen += counts[i];
+		// rank of the sample at the quantile, counted from 1
+		while ((q < NNI_STAT_QUANTILES) && (seen > 0) &&
+		    (seen * 10000 >= total * stat_quantiles[q].per10k)) {
+			hist->sh_quantiles[q++].si_u.sv_number =
+			    stat_hist_upper(i);
+		}
+	}
+	while (q < NNI_STAT_QUANTILES) {
+		hist->sh_quantiles[q++].si_u.sv_number = 0;
+	}
+}
+#endif
+
+void
+nni_stat_hist_add(nni_stat_hist *hist, uint64_t v)
+{
+#ifdef NNG_ENABLE_STATS
+	nni_atomic_inc64(&hist->sh_slots[stat_hist_slot(v)]);
+	nni_stat_inc(&hist->sh_item, v);
+#else
+	NNI_ARG_UNUSED(hist);
+	NNI_ARG_UNUSED(v);
+#endif
+}
+
 void
 nng_stats_free(nni_stat *st)
 {
@@ -289,7 +468,21 @@ stat_update(nni_stat *stat)
 		break;
 	case NNG_STAT_COUNTER:
 	case NNG_STAT_LEVEL:
-		if (info->si_atomic) {
+	case NNG_STAT_HISTOGRAM:
+		if (info->si_type == NNG_STAT_HISTOGRAM) {
+			// children are updated after it
+			stat_hist_update((nni_stat_hist *) item);
+		}
+		if (info->si_update != NULL) {
+			info->si_update((nni_stat_item *) item);
+		}
+		if (item->si_cpu != NULL) {
+			stat->s_val.sv_value = 0;
+			for (int i = 0; i < NNI_STAT_CPUS; i++) {
+				stat->s_val.sv_value += nni_atomic_get64(
+				    &item->si_cpu[i].sc_value);
+			}
+		} else if (info->si_atomic) {
 			stat->s_val.sv_value = nni_atomic_get64(
 			    (nni_atomic_u64 *) &item->si_u.sv_atomic);
 		} else {
@@ -552,6 +745,7 @@ nng_stats_dump(nng_stat *stat)
 		break;
 	case NNG_STAT_LEVEL:
 	case NNG_STAT_COUNTER:
+	case NNG_STAT_HISTOGRAM:
 		val = nng_stat_value(stat);
 		nni_plat_printf(
 		    "%s%-32s%llu", indent, nng_stat_name(stat), val);
@@ -565,6 +759,9 @@ nng_stats_dump(nng_stat *stat)
 		case NNG_UNIT_MILLIS:
 			nni_plat_printf(" ms\n");
 			break;
+		case NNG_UNIT_MICROS:
+			nni_plat_printf(" us\n");
+			break;
 		case NNG_UNIT_NONE:
 		case NNG_UNIT_EVENTS:
 		default:
@@ -589,3 +786,336 @@ nng_stats_dump(nng_stat *stat)
 	NNI_ARG_UNUSED(stat);
 #endif
 }
+
+#ifdef NNG_ENABLE_STATS
+#define STAT_KINDS 16
+
+typedef struct {
+	char  *buf;
+	size_t size;
+	size_t len; // of the whole text, written or not
+} stat_writer;
+
+static void
+stat_putc(stat_writer *w, char c)
+{
+	if (w->len + 1 < w->size) {
+		w->buf[w->len] = c;
+	}
+	w->len++;
+}
+
+static void
+stat_puts(stat_writer *w, const char *s)
+{
+	while (*s != '\0') {
+		stat_putc(w, *s++);
+	}
+}
+
+static void
+stat_putu(stat_writer *w, uint64_t v)
+{
+	char buf[24];
+
+	(void) snprintf(buf, sizeof(buf), "%llu", (unsigned long long) v);
+	stat_puts(w, buf);
+}
+
+// Names are stat names with anything else than [a-zA-Z0-9_] replaced.
+static void
+stat_put_name(stat_writer *w, const char *s)
+{
+	for (; *s != '\0'; s++) {
+		if ((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') ||
+		    (*s >= '0' && *s <= '9') || (*s == '_')) {
+			stat_putc(w, *s);
+		} else {
+			stat_putc(w, '_');
+		}
+	}
+}
+
+static void
+stat_put_help(stat_writer *w, const char *s)
+{
+	for (; *s != '\0'; s++) {
+		if (*s == '\\') {
+			stat_puts(w, "\\\\");
+		} else if (*s == '\n') {
+			stat_puts(w, "\\n");
+		} else {
+			stat_putc(w, *s);
+		}
+	}
+}
+
+static void
+stat_put_family(stat_writer *w, nni_stat *scope, nni_stat *stat)
+{
+	stat_puts(w, "nng_");
+	stat_put_name(w, scope->s_info->si_name);
+	stat_putc(w, '_');
+	stat_put_name(w, stat->s_info->si_name);
+}
+
+static bool
+stat_is_metric(nni_stat *stat)
+{
+	switch (stat->s_info->si_type) {
+	case NNG_STAT_LEVEL:
+	case NNG_STAT_COUNTER:
+	case NNG_STAT_BOOLEAN:
+	case NNG_STAT_HISTOGRAM:
+		return (true);
+	default:
+		return (false);
+	}
+}
+
+static bool
+stat_same_name(nni_stat *a, nni_stat *b)
+{
+	return ((a->s_info == b->s_info) ||
+	    (strcmp(a->s_info->si_name, b->s_info->si_name) == 0));
+}
+
+// The next scope after sc of the same kind, NULL if it is the last one.
+static nni_stat *
+stat_next_scope(nni_stat *sc, bool single)
+{
+	nni_stat *next = sc;
+
+	while (!single && (next = nng_stat_next(next)) != NULL) {
+		if (next->s_info->si_type == NNG_STAT_SCOPE &&
+		    stat_same_name(next, sc)) {
+			return (next);
+		}
+	}
+	return (NULL);
+}
+
+static nni_stat *
+stat_find_metric(nni_stat *sc, nni_stat *stat)
+{
+	nni_stat *child;
+
+	NNI_LIST_FOREACH (&sc->s_children, child) {
+		if (stat_same_name(child, stat) &&
+		    child->s_info->si_type == stat->s_info->si_type) {
+			return (child);
+		}
+	}
+	return (NULL);
+}
+
+static void
+stat_put_labels(stat_writer *w, nni_stat *sc, const char *le)
+{
+	nni_stat *child;
+
+	stat_putc(w, '{');
+	stat_put_name(w, sc->s_info->si_name);
+	stat_puts(w, "=\"");
+	stat_putu(w, (uint32_t) sc->s_val.sv_id);
+	stat_putc(w, '"');
+	NNI_LIST_FOREACH (&sc->s_children, child) {
+		if (child->s_info->si_type != NNG_STAT_ID ||
+		    strcmp(child->s_info->si_name, "id") == 0) {
+			continue;
+		}
+		stat_putc(w, ',');
+		stat_put_name(w, child->s_info->si_name);
+		stat_puts(w, "=\"");
+		stat_putu(w, (uint32_t) child->s_val.sv_id);
+		stat_putc(w, '"');
+	}
+	if (le != NULL) {
+		stat_puts(w, ",le=\"");
+		stat_puts(w, le);
+		stat_putc(w, '"');
+	}
+	stat_putc(w, '}');
+}
+
+static void
+stat_put_sample(stat_writer *w, nni_stat *sc, nni_stat *stat)
+{
+	nni_stat *bucket;
+	uint64_t  count = 0;
+
+	switch (stat->s_info->si_type) {
+	case NNG_STAT_COUNTER:
+		stat_put_family(w, sc, stat);
+		stat_puts(w, "_total");
+		stat_put_labels(w, sc, NULL);
+		stat_putc(w, ' ');
+		stat_putu(w, stat->s_val.sv_value);
+		break;
+	case NNG_STAT_LEVEL:
+		stat_put_family(w, sc, stat);
+		stat_put_labels(w, sc, NULL);
+		stat_putc(w, ' ');
+		stat_putu(w, stat->s_val.sv_value);
+		break;
+	case NNG_STAT_BOOLEAN:
+		stat_put_family(w, sc, stat);
+		stat_put_labels(w, sc, NULL);
+		stat_puts(w, stat->s_val.sv_bool ? " 1" : " 0");
+		break;
+	case NNG_STAT_HISTOGRAM:
+		// buckets are kept apart, but exported cumulative; the
+		// quantiles are left to the scraper, from the buckets
+		NNI_LIST_FOREACH (&stat->s_children, bucket) {
+			if (bucket->s_info->si_type != NNG_STAT_COUNTER) {
+				continue;
+			}
+			count += bucket->s_val.sv_value;
+			stat_put_family(w, sc, stat);
+			stat_puts(w, "_bucket");
+			stat_put_labels(w, sc, bucket->s_info->si_name);
+			stat_putc(w, ' ');
+			stat_putu(w, count);
+			stat_putc(w, '\n');
+		}
+		stat_put_family(w, sc, stat);
+		stat_puts(w, "_count");
+		stat_put_labels(w, sc, NULL);
+		stat_putc(w, ' ');
+		stat_putu(w, count);
+		stat_putc(w, '\n');
+		stat_put_family(w, sc, stat);
+		stat_puts(w, "_sum");
+		stat_put_labels(w, sc, NULL);
+		stat_putc(w, ' ');
+		stat_putu(w, stat->s_val.sv_value);
+		break;
+	default:
+		return;
+	}
+	stat_putc(w, '\n');
+}
+
+// Samples of a family must be together, so a family is written out
+// whole, from all the scopes of its kind, where it is first met.
+static void
+stat_put_metric(stat_writer *w, nni_stat *sc, nni_stat *stat, bool single)
+{
+	const char *type;
+
+	switch (stat->s_info->si_type) {
+	case NNG_STAT_COUNTER:
+		type = "counter";
+		break;
+	case NNG_STAT_HISTOGRAM:
+		type = "histogram";
+		break;
+	default:
+		type = "gauge";
+		break;
+	}
+	stat_puts(w, "# TYPE ");
+	stat_put_family(w, sc, stat);
+	stat_putc(w, ' ');
+	stat_puts(w, type);
+	stat_putc(w, '\n');
+	if (stat->s_info->si_desc != NULL) {
+		stat_puts(w, "# HELP ");
+		stat_put_family(w, sc, stat);
+		stat_putc(w, ' ');
+		stat_put_help(w, stat->s_info->si_desc);
+		stat_putc(w, '\n');
+	}
+	for (; sc != NULL; sc = stat_next_scope(sc, single)) {
+		nni_stat *found;
+		if ((found = stat_find_metric(sc, stat)) != NULL) {
+			stat_put_sample(w, sc, found);
+		}
+	}
+}
+
+// Whether a scope before sc, from first on, has the stat already.
+static bool
+stat_metric_seen(nni_stat *first, nni_stat *sc, nni_stat *stat)
+{
+	for (nni_stat *s = first; s != sc; s = stat_next_scope(s, false)) {
+		if (stat_find_metric(s, stat) != NULL) {
+			return (true);
+		}
+	}
+	return (false);
+}
+
+static void
+stat_put_scopes(stat_writer *w, nni_stat *first, bool single)
+{
+	// Scope kinds are few; more than this and we look back instead.
+	const nni_stat_info *kinds[STAT_KINDS];
+	int                  nkinds = 0;
+
+	for (nni_stat *sc = first; sc != NULL;
+	     sc           = single ? NULL : nng_stat_next(sc)) {
+		nni_stat *s;
+		nni_stat *stat;
+		bool      seen = false;
+
+		if (sc->s_info->si_type != NNG_STAT_SCOPE) {
+			continue;
+		}
+		for (int i = 0; i < nkinds && !seen; i++) {
+			seen = strcmp(kinds[i]->si_name, sc->s_info->si_name) == 0;
+		}
+		if (nkinds == STAT_KINDS) {
+			for (s = first; s != sc && !seen; s = nng_stat_next(s)) {
+				seen = s->s_info->si_type == NNG_STAT_SCOPE &&
+				    stat_same_name(s, sc);
+			}
+		}
+		if (seen) {
+			continue;
+		}
+		if (nkinds < STAT_KINDS) {
+			kinds[nkinds++] = sc->s_info;
+		}
+
+		// Scopes of a kind mostly carry the same stats, so the
+		// look back at those before ends at the first one.
+		for (s = sc; s != NULL; s = stat_next_scope(s, single)) {
+			NNI_LIST_FOREACH (&s->s_children, stat) {
+				if (stat_is_metric(stat) &&
+				    ((s == sc) ||
+				        !stat_metric_seen(sc, s, stat))) {
+					stat_put_metric(w, s, stat, single);
+				}
+			}
+		}
+	}
+}
+#endif
+
+size_t
+nng_stats_openmetrics(nng_stat *stat, char *buf, size_t size)
+{
+#ifdef NNG_ENABLE_STATS
+	stat_writer w = { .buf = buf, .size = size, .len = 0 };
+
+	if (stat->s_info->si_type == NNG_STAT_SCOPE) {
+		if (strlen(stat->s_info->si_name) > 0) {
+			stat_put_scopes(&w, stat, true);
+		} else if ((stat = nng_stat_child(stat)) != NULL) {
+			stat_put_scopes(&w, stat, false);
+		}
+	}
+	stat_puts(&w, "# EOF\n");
+	if (size > 0) {
+		buf[w.len < size ? w.len : size - 1] = '\0';
+	}
+	return (w.len);
+#else
+	NNI_ARG_UNUSED(stat);
+	if (size > 0) {
+		buf[0] = '\0';
+	}
+	return (0);
+#endif
+}
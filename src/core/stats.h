@@ -25,7 +25,11 @@
 
 typedef struct nni_stat_item nni_stat_item;
 typedef struct nni_stat_info nni_stat_info;
+typedef struct nni_stat_cpu  nni_stat_cpu;
+typedef struct nni_stat_hist nni_stat_hist;
 
+// An update function refreshes a numeric stat just before a snapshot reads
+// it.  It runs with the stats lock held, so it must not add or remove stats.
 typedef void (*nni_stat_update)(nni_stat_item *);
 typedef enum nng_stat_type_enum nni_stat_type;
 typedef enum nng_unit_enum      nni_stat_unit;
@@ -39,6 +43,7 @@ struct nni_stat_item {
 	nni_list_node        si_node;     // list node, framework use only
 	nni_list             si_children; // children, framework use only
 	const nni_stat_info *si_info;     // statistic description
+	nni_stat_cpu        *si_cpu;      // per-CPU values, if si_percpu
 	union {
 		uint64_t       sv_number;
 		nni_atomic_u64 sv_atomic;
@@ -56,6 +61,40 @@ struct nni_stat_info {
 	nni_stat_update si_update;     // update function (can be NULL)
 	bool            si_atomic : 1; // stat is atomic
 	bool            si_alloc : 1;  // stat string is allocated
+	bool            si_percpu : 1; // stat is summed over CPUs (and atomic)
+};
+
+// Counters bumped from every thread at once are best kept per-CPU: each
+// CPU adds to its own cache line, and a snapshot sums them.  They cost
+// NNI_STAT_CPUS cache lines, so this is for socket wide counters rather
+// than per pipe ones.  A per-CPU stat falls back to a single atomic if
+// its slots cannot be allocated, and frees them when unregistered.
+#define NNI_STAT_CPUS 16
+
+// A histogram counts samples HDR style: exactly up to 2 * NNI_STAT_HDR_SUB,
+// then in NNI_STAT_HDR_SUB linear steps within each power of two, so any
+// sample is known to within 1/NNI_STAT_HDR_SUB of its value.  Samples past
+// the last slot, about 2^31, are counted in it.  Recording is two atomic
+// adds, everything else is worked out when a snapshot is taken.
+//
+// The histogram's value is the sum of the samples.  Its children are the
+// counts in power of two buckets, from 1 up to 2^(NNI_STAT_BUCKETS - 2)
+// and a last one for anything larger, named by their upper bound ("+Inf"
+// for the last), then the quantiles p50, p90, p99 and p999 as levels in
+// the unit of the histogram.  A quantile is the upper bound of the slot
+// holding it.
+#define NNI_STAT_BUCKETS 16
+#define NNI_STAT_QUANTILES 4
+#define NNI_STAT_HDR_SUB 16
+#define NNI_STAT_HDR_SHIFT 26
+#define NNI_STAT_HDR_SLOTS (NNI_STAT_HDR_SUB * (NNI_STAT_HDR_SHIFT + 2))
+
+struct nni_stat_hist {
+	nni_stat_item  sh_item;
+	nni_stat_item  sh_buckets[NNI_STAT_BUCKETS];
+	nni_stat_item  sh_quantiles[NNI_STAT_QUANTILES];
+	nni_stat_info  sh_quantile_info[NNI_STAT_QUANTILES];
+	nni_atomic_u64 sh_slots[NNI_STAT_HDR_SLOTS];
 };
 
 // nni_stat_add adds a statistic, but the operation is unlocked, and the
@@ -77,4 +116,11 @@ void nni_stat_init(nni_stat_item *, const nni_stat_info *);
 void nni_stat_inc(nni_stat_item *, uint64_t);
 void nni_stat_dec(nni_stat_item *, uint64_t);
 
+// nni_stat_hist_init initializes a histogram, described by an atomic info
+// of type NNG_STAT_HISTOGRAM, and its children.  Add it to a tree with
+// nni_stat_add, using &hist->sh_item.  Items of that type must be the
+// sh_item of a histogram.
+void nni_stat_hist_init(nni_stat_hist *, const nni_stat_info *);
+void nni_stat_hist_add(nni_stat_hist *, uint64_t);
+
 #endif // CORE_STATS_H
@@ -8,6 +8,8 @@
 // found online at https://opensource.org/licenses/MIT.
 //
 
+#include "core/nng_impl.h"
+
 #include <nuts.h>
 
 #define SECONDS(x) ((x) *1000)
@@ -89,8 +91,174 @@ test_stats_dump(void)
 #endif
 }
 
+void
+test_stats_openmetrics(void)
+{
+#ifdef NNG_ENABLE_STATS
+	nng_socket s1;
+	nng_socket s2;
+	nng_stat  *stats;
+	char      *buf;
+	char       small[16];
+	char       sample[64];
+	size_t     len;
+	size_t     size = 65536;
+
+	NUTS_OPEN(s1);
+	NUTS_OPEN(s2);
+	NUTS_MARRY(s1, s2);
+	NUTS_SEND(s1, "ping");
+	NUTS_RECV(s2, "ping");
+	NUTS_PASS(nng_stats_get(&stats));
+	buf = nng_alloc(size);
+	NUTS_ASSERT(buf != NULL);
+	len = nng_stats_openmetrics(stats, buf, size);
+	NUTS_ASSERT(len < size);
+	NUTS_ASSERT(strlen(buf) == len);
+
+	// one family for the counter of both sockets
+	char *type = "# TYPE nng_socket_tx_msgs counter\n";
+	NUTS_ASSERT(strstr(buf, type) != NULL);
+	NUTS_ASSERT(strstr(strstr(buf, type) + 1, type) == NULL);
+	(void) snprintf(sample, sizeof(sample),
+	    "nng_socket_tx_msgs_total{socket=\"%d\"} 1\n", nng_socket_id(s1));
+	NUTS_ASSERT(strstr(buf, sample) != NULL);
+	NUTS_MATCH(buf + len - 6, "# EOF\n");
+
+	// truncated output is still terminated, and reports its full length
+	NUTS_ASSERT(nng_stats_openmetrics(stats, small, sizeof(small)) == len);
+	NUTS_ASSERT(strlen(small) == sizeof(small) - 1);
+
+	nng_free(buf, size);
+	nng_stats_free(stats);
+	NUTS_CLOSE(s1);
+	NUTS_CLOSE(s2);
+#endif
+}
+
+#define PERCPU_THREADS 4
+#define PERCPU_INCS 100000
+
+static void
+stats_percpu_inc(void *arg)
+{
+	for (int i = 0; i < PERCPU_INCS; i++) {
+		nni_stat_inc(arg, 1);
+	}
+}
+
+void
+test_stats_percpu(void)
+{
+#ifdef NNG_ENABLE_STATS
+	static const nni_stat_info root_info = {
+		.si_name = "test_percpu",
+		.si_type = NNG_STAT_SCOPE,
+	};
+	static const nni_stat_info count_info = {
+		.si_name   = "count",
+		.si_type   = NNG_STAT_COUNTER,
+		.si_atomic = true,
+		.si_percpu = true,
+	};
+	nni_stat_item root;
+	nni_stat_item count;
+	nng_thread   *thrs[PERCPU_THREADS];
+	nng_stat     *stats;
+	nng_stat     *item;
+
+	nni_stat_init(&root, &root_info);
+	nni_stat_init(&count, &count_info);
+	nni_stat_add(&root, &count);
+	nni_stat_register(&root);
+
+	for (int i = 0; i < PERCPU_THREADS; i++) {
+		NUTS_PASS(nng_thread_create(&thrs[i], stats_percpu_inc, &count));
+	}
+	for (int i = 0; i < PERCPU_THREADS; i++) {
+		nng_thread_destroy(thrs[i]);
+	}
+	NUTS_PASS(nng_stats_get(&stats));
+	item = nng_stat_find(stats, "count");
+	NUTS_ASSERT(item != NULL);
+	NUTS_ASSERT(nng_stat_value(item) == PERCPU_THREADS * PERCPU_INCS);
+	nng_stats_free(stats);
+
+	nni_stat_set_value(&count, 5);
+	nni_stat_inc(&count, 1);
+	NUTS_PASS(nng_stats_get(&stats));
+	item = nng_stat_find(stats, "count");
+	NUTS_ASSERT(item != NULL);
+	NUTS_ASSERT(nng_stat_value(item) == 6);
+	nng_stats_free(stats);
+
+	nni_stat_unregister(&root);
+#endif
+}
+
+void
+test_stats_histogram(void)
+{
+#ifdef NNG_ENABLE_STATS
+	static const nni_stat_info root_info = {
+		.si_name = "test_hist",
+		.si_type = NNG_STAT_SCOPE,
+	};
+	static const nni_stat_info hist_info = {
+		.si_name   = "wait",
+		.si_type   = NNG_STAT_HISTOGRAM,
+		.si_unit   = NNG_UNIT_MICROS,
+		.si_atomic = true,
+	};
+	nni_stat_item root;
+	nni_stat_hist hist;
+	nng_stat     *stats;
+	nng_stat     *scope;
+	char          buf[4096];
+	const char   *lines[] = {
+		"# TYPE nng_test_hist_wait histogram\n",
+		"nng_test_hist_wait_bucket{test_hist=\"1\",le=\"1\"} 2\n",
+		"nng_test_hist_wait_bucket{test_hist=\"1\",le=\"2\"} 2\n",
+		"nng_test_hist_wait_bucket{test_hist=\"1\",le=\"4\"} 3\n",
+		"nng_test_hist_wait_bucket{test_hist=\"1\",le=\"+Inf\"} 4\n",
+		"nng_test_hist_wait_count{test_hist=\"1\"} 4\n",
+		"nng_test_hist_wait_sum{test_hist=\"1\"} 100004\n",
+		NULL,
+	};
+
+	nni_stat_init(&root, &root_info);
+	nni_stat_hist_init(&hist, &hist_info);
+	nni_stat_add(&root, &hist.sh_item);
+	nni_stat_set_id(&root, 1);
+	nni_stat_register(&root);
+	nni_stat_hist_add(&hist, 0);
+	nni_stat_hist_add(&hist, 1);
+	nni_stat_hist_add(&hist, 3);
+	nni_stat_hist_add(&hist, 100000);
+
+	NUTS_PASS(nng_stats_get(&stats));
+	scope = nng_stat_find(stats, "test_hist");
+	NUTS_ASSERT(scope != NULL);
+	NUTS_ASSERT(nng_stat_value(nng_stat_find(scope, "wait")) == 100004);
+	// quantiles are the upper bound of their slot, 1/16th wide up there
+	NUTS_ASSERT(nng_stat_value(nng_stat_find(scope, "p50")) == 1);
+	NUTS_ASSERT(nng_stat_value(nng_stat_find(scope, "p90")) == 102400);
+	NUTS_ASSERT(nng_stat_value(nng_stat_find(scope, "p999")) == 102400);
+	NUTS_ASSERT(nng_stat_unit(nng_stat_find(scope, "p99")) == NNG_UNIT_MICROS);
+	(void) nng_stats_openmetrics(scope, buf, sizeof(buf));
+	for (int i = 0; lines[i] != NULL; i++) {
+		NUTS_ASSERT(strstr(buf, lines[i]) != NULL);
+	}
+	nng_stats_free(stats);
+	nni_stat_unregister(&root);
+#endif
+}
+
 NUTS_TESTS = {
 	{ "socket stats", test_stats_socket },
 	{ "dump stats", test_stats_dump },
+	{ "openmetrics", test_stats_openmetrics },
+	{ "per-CPU counters", test_stats_percpu },
+	{ "histogram", test_stats_histogram },
 	{ NULL, NULL },
 };
@@ -67,6 +67,7 @@ exchange_init(exchange_t **ex, char *name, char *topic,
 			return -1;
 		}
 		(void)strcpy(rb->name, rbsName[i]);
+		rb->topic = newEx->topic;
 		newEx->rbs[i] = rb;
 		newEx->rb_count++;
 	}
@@ -88,6 +89,7 @@ exchange_add_rb(exchange_t *ex, ringBuffer_t *rb)
 		return -1;
 	}
 
+	rb->topic = ex->topic;
 	ex->rbs[ex->rb_count++] = rb;
 
 	return 0;
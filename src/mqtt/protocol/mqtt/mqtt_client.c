@@ -18,16 +18,30 @@
 
 // MQTT client implementation.
 //
-// 1. MQTT client sockets have a single implicit dialer, and cannot
-//    support creation of additional dialers or listeners.
-// 2. Send sends PUBLISH messages.
+// 1. MQTT client sockets have a single implicit dialer by default. Up to
+//    NNG_MQTT_CLIENT_MAX_CONNS dialers to the same broker may be registered
+//    with NNG_OPT_MQTT_CONN_DIALER, each connection gets a slot and its own
+//    lock. Slot 0 is the primary connection.
+// 2. Send sends PUBLISH messages, spread over the open connections by topic
+//    hash or round robin. Other packets go to the primary connection.
 // 3. Receive is used to receive published data from the server.
+//
+// Lock order is s->mtx then p->mtx. p->mtx guards the session state of a
+// connection, s->mtx guards the slots, the ctx queues, the recv_messages
+// of all pipes and sqlite.
 
 #define NNG_MQTT_SELF 0
 #define NNG_MQTT_SELF_NAME "mqtt-client"
 #define NNG_MQTT_PEER 0
 #define NNG_MQTT_PEER_NAME "mqtt-server"
 
+// send aios a connection keeps in flight to the transport
+#define MQTT_SEND_AIOS 4
+// msgs waiting for a send aio before user aios wait
+#define MQTT_SEND_QUEUE_LEN 1024
+// cap of the inflight window, whatever the server allows
+#define MQTT_INFLIGHT_MAX 1024
+
 typedef struct mqtt_sock_s mqtt_sock_t;
 typedef struct mqtt_pipe_s mqtt_pipe_t;
 typedef struct mqtt_ctx_s  mqtt_ctx_t;
@@ -55,6 +69,19 @@ static void mqtt_ctx_cancel_send(nni_aio *aio, void *arg, int rv);
 
 typedef nni_mqtt_packet_type packet_type_t;
 
+typedef struct {
+	nni_aio      aio;
+	mqtt_pipe_t *pipe;
+	bool         busy;
+} mqtt_send_t;
+
+// A slot of the packet id ring, the aio waits for the ack of pid.
+typedef struct {
+	nni_aio *aio;
+	uint16_t pid;
+	bool     publish; // counted in the inflight window
+} mqtt_unack_t;
+
 #if defined(NNG_SUPP_SQLITE)
 static void *mqtt_sock_get_sqlite_option(mqtt_sock_t *s);
 #endif
@@ -70,19 +97,26 @@ struct mqtt_ctx_s {
 
 // A mqtt_pipe_s is our per-pipe protocol private structure.
 struct mqtt_pipe_s {
+	nni_mtx         mtx;
 	nni_atomic_bool closed;			// indicates mqtt connection status
 	nni_pipe *      pipe;
 	mqtt_sock_t *   mqtt_sock;
-
-	nni_id_map      sent_unack;    // send messages unacknowledged
+	uint32_t        slot;          // index in mqtt_sock pipes
+	nni_duration    keepalive;     // mqtt keepalive
+	nni_duration    timeleft;      // left time to send next ping
+
+	mqtt_unack_t   *unack;         // send messages unacknowledged
+	uint32_t        unack_mask;    // ring size - 1, indexed by packet id
+	uint32_t        window;        // QoS 1/2 PUBLISH the server accepts
+	uint32_t        inflight;      // QoS 1/2 PUBLISH unacknowledged
+	nni_list        wait_aios;     // user aios waiting for room to send
 	nni_id_map      recv_unack;    // recv messages unacknowledged
-	nni_aio         send_aio;      // send aio to the underlying transport
+	mqtt_send_t     send_aios[MQTT_SEND_AIOS]; // to the underlying transport
 	nni_aio         recv_aio;      // recv aio to the underlying transport
 	nni_aio         time_aio;      // timer aio to resend unack msg
 	nni_lmq         recv_messages; // recv messages queue
 	nni_lmq         send_messages; // send messages queue
-	uint16_t        rid;           // index of resending packet id
-	bool            busy;
+	uint32_t        rid;           // ring index to resend from
 	uint8_t         pingcnt;
 	nni_msg        *pingmsg;
 #ifdef NNG_HAVE_MQTT_BROKER
@@ -98,9 +132,15 @@ struct mqtt_sock_s {
 	nni_atomic_int  next_packet_id; // next packet id to use
 	nni_duration    retry;
 	nni_duration    keepalive; // mqtt keepalive
-	nni_duration    timeleft;  // left time to send next ping
 	mqtt_ctx_t      master; // to which we delegate send/recv calls
-	mqtt_pipe_t    *mqtt_pipe;
+	mqtt_pipe_t    *pipes[NNG_MQTT_CLIENT_MAX_CONNS]; // open pipes by slot
+	uint32_t        dialers[NNG_MQTT_CLIENT_MAX_CONNS]; // dialer of slot
+	uint32_t        ndialers; // registered dialers
+	uint32_t        nslots;   // slots PUBLISH is spread over
+	uint32_t        npipes;   // open pipes
+	uint32_t        dispatch; // NNG_MQTT_DISPATCH_*
+	uint32_t        next_send; // next slot of round robin
+	uint32_t        next_recv; // first slot to receive from
 	nni_list        recv_queue; // ctx pending to receive
 	nni_list        send_queue; // ctx pending to send (only offline msg)
 	reason_code     disconnect_code; // disconnect reason code
@@ -138,7 +178,6 @@ mqtt_sock_init(void *arg, nni_sock *sock)
 	s->retry      = NNI_SECOND * 5;
 	s->retry_wait = NNI_SECOND * 3;
 	s->keepalive  = NNI_SECOND * 10; // default mqtt keepalive
-	s->timeleft   = NNI_SECOND * 10;
 
 	s->timeout_backoff = 1;
 
@@ -146,7 +185,15 @@ mqtt_sock_init(void *arg, nni_sock *sock)
 	mqtt_ctx_init(&s->master, s);
 
 	s->mqtt_ver  = MQTT_PROTOCOL_VERSION_v311;
-	s->mqtt_pipe = NULL;
+	s->ndialers  = 0;
+	s->nslots    = 1;
+	s->npipes    = 0;
+	s->dispatch  = NNG_MQTT_DISPATCH_TOPIC;
+	s->next_send = 0;
+	s->next_recv = 0;
+	for (int i = 0; i < NNG_MQTT_CLIENT_MAX_CONNS; i++) {
+		s->pipes[i] = NULL;
+	}
 	NNI_LIST_INIT(&s->recv_queue, mqtt_ctx_t, rqnode);
 	NNI_LIST_INIT(&s->send_queue, mqtt_ctx_t, sqnode);
 }
@@ -178,7 +225,7 @@ mqtt_sock_get_disconnect_prop(void *arg, void *v, size_t *szp, nni_opt_type t)
 
 	nni_mtx_lock(&s->mtx);
 	rv = nni_copyout_ptr(s->dis_prop, v, szp, t);
-	nni_mtx_lock(&s->mtx);
+	nni_mtx_unlock(&s->mtx);
 	return (rv);
 }
 
@@ -251,6 +298,123 @@ mqtt_sock_set_sqlite_option(
 	return NNG_EUNREACHABLE;
 }
 
+static int
+mqtt_sock_set_conn_dialer(void *arg, const void *v, size_t sz, nni_opt_type t)
+{
+	mqtt_sock_t *s = arg;
+	int          id;
+	int          rv;
+
+	if ((rv = nni_copyin_int(&id, v, sz, 1, NNI_MAXINT, t)) != 0) {
+		return (rv);
+	}
+	nni_mtx_lock(&s->mtx);
+	if (s->ndialers == NNG_MQTT_CLIENT_MAX_CONNS) {
+		rv = NNG_ENOSPC;
+	} else {
+		s->dialers[s->ndialers++] = (uint32_t) id;
+		if (s->ndialers > s->nslots) {
+			s->nslots = s->ndialers;
+		}
+	}
+	nni_mtx_unlock(&s->mtx);
+	return (rv);
+}
+
+static int
+mqtt_sock_set_conn_dispatch(
+    void *arg, const void *v, size_t sz, nni_opt_type t)
+{
+	mqtt_sock_t *s = arg;
+	int          dispatch;
+	int          rv;
+
+	if ((rv = nni_copyin_int(&dispatch, v, sz, NNG_MQTT_DISPATCH_TOPIC,
+	         NNG_MQTT_DISPATCH_ROUND_ROBIN, t)) == 0) {
+		nni_mtx_lock(&s->mtx);
+		s->dispatch = (uint32_t) dispatch;
+		nni_mtx_unlock(&s->mtx);
+	}
+	return (rv);
+}
+
+static int
+mqtt_sock_get_conn_dispatch(void *arg, void *v, size_t *szp, nni_opt_type t)
+{
+	mqtt_sock_t *s = arg;
+	int          rv;
+
+	nni_mtx_lock(&s->mtx);
+	rv = nni_copyout_int((int) s->dispatch, v, szp, t);
+	nni_mtx_unlock(&s->mtx);
+	return (rv);
+}
+
+// Pick the pipe of msg, with s->mtx held. PUBLISH is spread over the slots,
+// the rest goes to the primary. A slot that is reconnecting is covered by
+// the next open one.
+static mqtt_pipe_t *
+mqtt_sock_get_pipe(mqtt_sock_t *s, nni_msg *msg)
+{
+	uint32_t    slot = 0;
+	uint32_t    len;
+	const char *topic;
+
+	if (s->npipes == 0) {
+		return (NULL);
+	}
+	if (s->npipes > 1 &&
+	    nni_mqtt_msg_get_packet_type(msg) == NNG_MQTT_PUBLISH) {
+		if (s->dispatch == NNG_MQTT_DISPATCH_ROUND_ROBIN) {
+			slot = s->next_send++ % s->nslots;
+		} else if ((topic = nni_mqtt_msg_get_publish_topic(
+		                msg, &len)) != NULL) {
+			// same topic same connection, keeps it in order
+			slot = (uint32_t) (wy_hashn((char *) topic, len) %
+			    s->nslots);
+		}
+	}
+	for (uint32_t i = 0; i < s->nslots; i++) {
+		mqtt_pipe_t *p = s->pipes[(slot + i) % s->nslots];
+		if (p != NULL) {
+			return (p);
+		}
+	}
+	return (NULL);
+}
+
+// Give the started pipe a slot, the one of its dialer if registered.
+static int
+mqtt_sock_add_pipe(mqtt_sock_t *s, mqtt_pipe_t *p)
+{
+	uint32_t id   = nni_pipe_dialer_id(p->pipe);
+	uint32_t slot = NNG_MQTT_CLIENT_MAX_CONNS;
+
+	for (uint32_t i = 0; i < s->ndialers; i++) {
+		if (s->dialers[i] == id && s->pipes[i] == NULL) {
+			slot = i;
+			break;
+		}
+	}
+	for (uint32_t i = s->ndialers;
+	     slot == NNG_MQTT_CLIENT_MAX_CONNS && i < NNG_MQTT_CLIENT_MAX_CONNS;
+	     i++) {
+		if (s->pipes[i] == NULL) {
+			slot = i;
+		}
+	}
+	if (slot == NNG_MQTT_CLIENT_MAX_CONNS) {
+		return (NNG_ENOSPC);
+	}
+	s->pipes[slot] = p;
+	s->npipes++;
+	p->slot = slot;
+	if (slot >= s->nslots) {
+		s->nslots = slot + 1;
+	}
+	return (0);
+}
+
 static void
 mqtt_sock_close(void *arg)
 {
@@ -306,11 +470,18 @@ mqtt_pipe_init(void *arg, nni_pipe *pipe, void *s)
 {
 	mqtt_pipe_t *p = arg;
 
+	nni_mtx_init(&p->mtx);
 	nni_atomic_init_bool(&p->closed);
 	nni_atomic_set_bool(&p->closed, true);
 	p->pipe      = pipe;
 	p->mqtt_sock = s;
-	p->rid       = 1;
+	p->slot      = NNG_MQTT_CLIENT_MAX_CONNS;
+	p->keepalive = p->mqtt_sock->keepalive;
+	p->timeleft  = p->keepalive;
+	p->rid       = 0;
+	p->unack     = NULL;
+	p->window    = 0;
+	p->inflight  = 0;
 	p->pingcnt   = 0;
 	p->pingmsg   = NULL;
 	nni_msg_alloc(&p->pingmsg, 0);
@@ -324,18 +495,22 @@ mqtt_pipe_init(void *arg, nni_pipe *pipe, void *s)
 		nni_msg_header_append(p->pingmsg, buf, 2);
 	}
 
-	nni_aio_init(&p->send_aio, mqtt_send_cb, p);
+	for (int i = 0; i < MQTT_SEND_AIOS; i++) {
+		p->send_aios[i].pipe = p;
+		p->send_aios[i].busy = false;
+		nni_aio_init(
+		    &p->send_aios[i].aio, mqtt_send_cb, &p->send_aios[i]);
+	}
 	nni_aio_init(&p->recv_aio, mqtt_recv_cb, p);
 	nni_aio_init(&p->time_aio, mqtt_timer_cb, p);
+	nni_aio_list_init(&p->wait_aios);
 	// Packet IDs are 16 bits
 	// We start at a random point, to minimize likelihood of
 	// accidental collision across restarts.
-	nni_id_map_init(&p->sent_unack, 0x0000u, 0xffffu, true);
 	nni_id_map_init(&p->recv_unack, 0x0000u, 0xffffu, true);
 	// nni_lmq_init(&p->recv_messages, NNG_MAX_RECV_LMQ);
-	// nni_lmq_init(&p->send_messages, NNG_MAX_SEND_LMQ);
 	nni_lmq_init(&p->recv_messages, 102400);
-	nni_lmq_init(&p->send_messages, 102400);
+	nni_lmq_init(&p->send_messages, MQTT_SEND_QUEUE_LEN);
 
 #ifdef NNG_HAVE_MQTT_BROKER
 	p->cparam = NULL;
@@ -358,22 +533,27 @@ mqtt_pipe_fini(void *arg)
 		nni_aio_set_prov_data(&p->recv_aio, NULL);
 		nni_msg_free(msg);
 	}
-	if ((msg = nni_aio_get_msg(&p->send_aio)) != NULL) {
-		nni_aio_set_msg(&p->send_aio, NULL);
-		nni_msg_free(msg);
+	for (int i = 0; i < MQTT_SEND_AIOS; i++) {
+		if ((msg = nni_aio_get_msg(&p->send_aios[i].aio)) != NULL) {
+			nni_aio_set_msg(&p->send_aios[i].aio, NULL);
+			nni_msg_free(msg);
+		}
+		nni_aio_fini(&p->send_aios[i].aio);
 	}
 
 	if (p->pingmsg)
 		nni_msg_free(p->pingmsg);
 
-	nni_aio_fini(&p->send_aio);
 	nni_aio_fini(&p->recv_aio);
 	nni_aio_fini(&p->time_aio);
 
-	nni_id_map_fini(&p->sent_unack);
+	if (p->unack != NULL) {
+		nni_free(p->unack, (p->unack_mask + 1) * sizeof(mqtt_unack_t));
+	}
 	nni_id_map_fini(&p->recv_unack);
 	nni_lmq_fini(&p->recv_messages);
 	nni_lmq_fini(&p->send_messages);
+	nni_mtx_fini(&p->mtx);
 }
 
 static inline int
@@ -396,26 +576,234 @@ mqtt_pipe_recv_msgq_putq(mqtt_pipe_t *p, nni_msg *msg)
 	return rv;
 }
 
-// Should be called with mutex lock hold. and it will unlock mtx.
-// flag indicates if need to skip msg in sqlite 1: check sqlite 0: only aio
+// Hand msg received on p to a waiting ctx or queue it, takes s->mtx.
+static void
+mqtt_pipe_deliver(mqtt_pipe_t *p, nni_msg *msg)
+{
+	mqtt_sock_t *s = p->mqtt_sock;
+	mqtt_ctx_t  *ctx;
+	nni_aio     *user_aio;
+
+	nni_mtx_lock(&s->mtx);
+	if (nni_atomic_get_bool(&p->closed)) {
+		nni_mtx_unlock(&s->mtx);
+#ifdef NNG_HAVE_MQTT_BROKER
+		conn_param_free(p->cparam);
+#endif
+		nni_msg_free(msg);
+		return;
+	}
+	if ((ctx = nni_list_first(&s->recv_queue)) == NULL) {
+		// No one waiting to receive yet, putting msg
+		// into lmq
+		if (mqtt_pipe_recv_msgq_putq(p, msg) != 0) {
+#ifdef NNG_HAVE_MQTT_BROKER
+			conn_param_free(p->cparam);
+#endif
+			log_warn("Warning: no ctx found! msg queue full, msg lost!");
+		}
+		nni_mtx_unlock(&s->mtx);
+		return;
+	}
+	nni_list_remove(&s->recv_queue, ctx);
+	user_aio  = ctx->raio;
+	ctx->raio = NULL;
+	nni_aio_set_msg(user_aio, msg);
+	nni_mtx_unlock(&s->mtx);
+	nni_aio_finish(user_aio, 0, 0);
+}
+
+// A send aio of p not in flight, with p->mtx held.
+static mqtt_send_t *
+mqtt_pipe_get_sender(mqtt_pipe_t *p)
+{
+	for (int i = 0; i < MQTT_SEND_AIOS; i++) {
+		if (!p->send_aios[i].busy) {
+			return (&p->send_aios[i]);
+		}
+	}
+	return (NULL);
+}
+
+// Hand msg to a free send aio, or queue it behind the ones in flight.
+// Should be called with p->mtx hold, fails when the queue is full.
+static int
+mqtt_pipe_send_msg(mqtt_pipe_t *p, nni_msg *msg)
+{
+	mqtt_send_t *snd;
+
+	if (nni_lmq_empty(&p->send_messages) &&
+	    (snd = mqtt_pipe_get_sender(p)) != NULL) {
+		snd->busy = true;
+		nni_aio_set_msg(&snd->aio, msg);
+		nni_pipe_send(p->pipe, &snd->aio);
+		return (0);
+	}
+	return (nni_lmq_put(&p->send_messages, msg));
+}
+
+// Acks, pings and resends are never held back, the queue grows for them.
+static void
+mqtt_pipe_send_ctrl(mqtt_pipe_t *p, nni_msg *msg)
+{
+	if (mqtt_pipe_send_msg(p, msg) != 0 &&
+	    (nni_lmq_resize(&p->send_messages,
+	         nni_lmq_cap(&p->send_messages) * 2) != 0 ||
+	        nni_lmq_put(&p->send_messages, msg) != 0)) {
+		log_warn("Warning! msg lost due to busy socket");
+		nni_msg_free(msg);
+	}
+}
+
+// Whether msg waits for an ack, and the packet id it waits with.
+static bool
+mqtt_msg_get_ack_id(nni_msg *msg, uint16_t *pid, bool *publish)
+{
+	*publish = false;
+	switch (nni_mqtt_msg_get_packet_type(msg)) {
+	case NNG_MQTT_PUBLISH:
+		if (nni_mqtt_msg_get_publish_qos(msg) == 0) {
+			return (false);
+		}
+		*publish = true;
+		// FALLTHROUGH
+	case NNG_MQTT_SUBSCRIBE:
+	case NNG_MQTT_UNSUBSCRIBE:
+		*pid = nni_mqtt_msg_get_packet_id(msg);
+		return (true);
+	default:
+		return (false);
+	}
+}
+
+static nni_aio *
+mqtt_pipe_unack_get(mqtt_pipe_t *p, uint16_t pid)
+{
+	mqtt_unack_t *u = &p->unack[pid & p->unack_mask];
+
+	return (u->aio != NULL && u->pid == pid ? u->aio : NULL);
+}
+
+static void
+mqtt_pipe_unack_remove(mqtt_pipe_t *p, uint16_t pid)
+{
+	mqtt_unack_t *u = &p->unack[pid & p->unack_mask];
+
+	if (u->publish) {
+		p->inflight--;
+	}
+	u->aio     = NULL;
+	u->publish = false;
+}
+
+// Whether msg can go out now: there is room in the send queue, a QoS msg
+// needs its slot of the ring free and a QoS 1/2 PUBLISH room in the window.
+static bool
+mqtt_pipe_has_room(mqtt_pipe_t *p, nni_msg *msg)
+{
+	uint16_t pid;
+	bool     publish;
+
+	if (nni_lmq_full(&p->send_messages) &&
+	    mqtt_pipe_get_sender(p) == NULL) {
+		return (false);
+	}
+	if (!mqtt_msg_get_ack_id(msg, &pid, &publish)) {
+		return (true);
+	}
+	if (publish && p->inflight >= p->window) {
+		return (false);
+	}
+	return (p->unack[pid & p->unack_mask].aio == NULL);
+}
+
+// Sends the msg of aio, which has room. A QoS msg stays in the ring until
+// acked and the ack finishes aio, returns false for those.
+static bool
+mqtt_pipe_send_aio(mqtt_pipe_t *p, nni_aio *aio)
+{
+	nni_msg      *msg = nni_aio_get_msg(aio);
+	mqtt_unack_t *u;
+	uint16_t      pid;
+	bool          publish;
+	bool          acked;
+
+	if ((acked = mqtt_msg_get_ack_id(msg, &pid, &publish))) {
+		u          = &p->unack[pid & p->unack_mask];
+		u->aio     = aio;
+		u->pid     = pid;
+		u->publish = publish;
+		if (publish) {
+			p->inflight++;
+		}
+		// pass proto_data to cached aio, either it is freed in ack or
+		// in cancel
+		nni_aio_set_prov_data(aio, nni_msg_get_proto_data(msg));
+		nni_msg_clone(msg);
+	}
+	nni_aio_bump_count(aio, nni_msg_header_len(msg) + nni_msg_len(msg));
+	(void) mqtt_pipe_send_msg(p, msg);
+	return (!acked);
+}
+
+// Sends the waiting aios that fit now, in order. Those done are moved to
+// done, to be finished once p->mtx is released.
+static void
+mqtt_pipe_admit(mqtt_pipe_t *p, nni_list *done)
+{
+	nni_aio *aio;
+
+	while ((aio = nni_list_first(&p->wait_aios)) != NULL &&
+	    mqtt_pipe_has_room(p, nni_aio_get_msg(aio))) {
+		nni_aio_list_remove(aio);
+		if (mqtt_pipe_send_aio(p, aio)) {
+			nni_aio_set_msg(aio, NULL);
+			nni_aio_list_append(done, aio);
+		}
+	}
+}
+
+static void
+mqtt_finish_admitted(nni_list *done)
+{
+	nni_aio *aio;
+
+	while ((aio = nni_list_first(done)) != NULL) {
+		nni_aio_list_remove(aio);
+		nni_aio_finish(aio, 0, 0);
+	}
+}
+
+// Should be called with p->mtx hold. and it will unlock p->mtx.
+// Only queued ctx reach here without a msg, s->mtx is held by the caller
+// then. An aio that does not fit in the inflight window or the send queue
+// waits in wait_aios, behind any aio already waiting, and is never dropped.
 static inline void
-mqtt_send_msg(nni_aio *aio, mqtt_ctx_t *arg)
+mqtt_send_msg(nni_aio *aio, mqtt_ctx_t *arg, mqtt_pipe_t *p)
 {
 	mqtt_ctx_t *     ctx   = arg;
 	mqtt_sock_t *    s     = ctx->mqtt_sock;
-	mqtt_pipe_t *    p     = s->mqtt_pipe;
-	uint16_t         ptype = 0, packet_id = 0;
-	uint8_t          qos   = 0;
 	nni_msg *        msg   = NULL;
-	nni_msg *        tmsg  = NULL;
-	nni_aio *        taio  = NULL;
-
-	if (p == NULL || nni_atomic_get_bool(&p->closed) || aio == NULL) {
+	uint16_t         pid;
+	bool             publish;
+	bool             wait;
+	int              rv;
+
+	NNI_ARG_UNUSED(s);
+	if (aio == NULL) {
+		nni_mtx_unlock(&p->mtx);
+		return;
+	}
+	msg = nni_aio_get_msg(aio);
+	if (nni_atomic_get_bool(&p->closed)) {
 		//pipe closed, should never gets here
 		// sending msg on a closed pipe
-		goto out;
+		nni_mtx_unlock(&p->mtx);
+		nni_aio_set_msg(aio, NULL);
+		nni_msg_free(msg);
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+		return;
 	}
-	msg = nni_aio_get_msg(aio);
 	if (msg == NULL) {
 		// start sending cached msg
 #if defined(NNG_SUPP_SQLITE)
@@ -429,92 +817,53 @@ mqtt_send_msg(nni_aio *aio, mqtt_ctx_t *arg)
 		}
 #endif
 		if (msg == NULL) {
-			goto out;
+			nni_mtx_unlock(&p->mtx);
+			nni_aio_finish(aio, 0, 0);
+			return;
 		}
+		nni_aio_set_msg(aio, msg);
 	}
 
-	ptype = nni_mqtt_msg_get_packet_type(msg);
-	switch (ptype) {
+	switch (nni_mqtt_msg_get_packet_type(msg)) {
 	case NNG_MQTT_CONNECT:
 	case NNG_MQTT_PINGREQ:
 	case NNG_MQTT_DISCONNECT:
-		break;
-
 	case NNG_MQTT_PUBLISH:
-		qos = nni_mqtt_msg_get_publish_qos(msg);
-		if (0 == qos) {
-			break; // QoS 0 need no packet id
-		}
-		// FALLTHROUGH
 	case NNG_MQTT_SUBSCRIBE:
 	case NNG_MQTT_UNSUBSCRIBE:
-		packet_id = nni_mqtt_msg_get_packet_id(msg);
-		taio = nni_id_get(&p->sent_unack, packet_id);
-		// pass proto_data to cached aio, either it is freed in ack or in cancel
-		nni_aio_set_prov_data(aio, nni_msg_get_proto_data(msg));
-		if (taio != NULL) {
-			log_warn("Warning : msg %d lost due to "
-			                "packetID duplicated!", packet_id);
-			nni_aio_finish_error(taio, NNG_ECANCELED);
-			nni_id_remove(&p->sent_unack, packet_id);
-			nni_msg_free(nni_aio_get_msg(taio));
-			nni_aio_set_msg(taio, NULL);
-		}
-		if (0 != nni_id_set(&p->sent_unack, packet_id, aio)) {
-			nni_plat_printf("Warning : aio caching failed");
-			nni_aio_finish_error(aio, NNG_ECANCELED);
-		} else {
-			int rv;
-			if ((rv = nni_aio_schedule(aio, mqtt_ctx_cancel_send, ctx)) != 0) {
-				log_warn("Cancel_Func scheduling failed, send abort!");
-				nni_id_remove(&p->sent_unack, packet_id);
-				nni_aio_set_msg(aio, NULL);
-				nni_mtx_unlock(&s->mtx);
-				nni_msg_free(msg);	// User need to realloc this msg again
-				nni_aio_finish_error(aio, rv);
-				return;
-			}
-			// pass proto_data to cached aio, either it is freed in ack or in cancel
-			nni_aio_set_prov_data(aio, nni_msg_get_proto_data(msg));
-			nni_msg_clone(msg);
-		}
 		break;
 
 	default:
-		nni_mtx_unlock(&s->mtx);
+		nni_mtx_unlock(&p->mtx);
+		nni_aio_set_msg(aio, NULL);
 		nni_msg_free(msg);
 		nni_aio_finish_error(aio, NNG_EPROTO);
 		return;
 	}
-	if (!p->busy) {
-		p->busy = true;
-		nni_aio_set_msg(&p->send_aio, msg);
-		nni_aio_bump_count(
-		    aio, nni_msg_header_len(msg) + nni_msg_len(msg));
-		nni_pipe_send(p->pipe, &p->send_aio);
-		nni_mtx_unlock(&s->mtx);
-		if (0 == qos && ptype != NNG_MQTT_SUBSCRIBE &&
-		    ptype != NNG_MQTT_UNSUBSCRIBE) {
+	wait = !nni_list_empty(&p->wait_aios) || !mqtt_pipe_has_room(p, msg);
+	if (wait || mqtt_msg_get_ack_id(msg, &pid, &publish)) {
+		if ((rv = nni_aio_schedule(aio, mqtt_ctx_cancel_send, ctx)) !=
+		    0) {
+			log_warn("Cancel_Func scheduling failed, send abort!");
+			nni_mtx_unlock(&p->mtx);
 			nni_aio_set_msg(aio, NULL);
-			nni_aio_finish(aio, 0, 0);
+			nni_msg_free(msg); // User need to realloc this msg again
+			nni_aio_finish_error(aio, rv);
+			return;
 		}
-		return;
 	}
-	if (nni_lmq_full(&p->send_messages)) {
-		log_error("rhack: pipe is busy and lmq is full\n");
-		(void) nni_lmq_get(&p->send_messages, &tmsg);
-		nni_msg_free(tmsg);
-	}
-	if (0 != nni_lmq_put(&p->send_messages, msg)) {
-		log_error("Warning! msg lost due to busy socket");
+	if (wait) {
+		nni_aio_list_append(&p->wait_aios, aio);
+		nni_mtx_unlock(&p->mtx);
+		return;
 	}
-out:
-	nni_mtx_unlock(&s->mtx);
-	if (0 == qos && ptype != NNG_MQTT_SUBSCRIBE &&
-	    ptype != NNG_MQTT_UNSUBSCRIBE) {
-		nni_aio_finish(aio, 0, 0);
+	if (!mqtt_pipe_send_aio(p, aio)) {
+		nni_mtx_unlock(&p->mtx);
+		return;
 	}
-	return;
+	nni_mtx_unlock(&p->mtx);
+	nni_aio_set_msg(aio, NULL);
+	nni_aio_finish(aio, 0, 0);
 }
 
 static int
@@ -523,22 +872,48 @@ mqtt_pipe_start(void *arg)
 	mqtt_pipe_t *p = arg;
 	mqtt_sock_t *s = p->mqtt_sock;
 	mqtt_ctx_t  *c = NULL;
+	int          rv;
+	int          recv_max;
+	size_t       sz   = sizeof(recv_max);
+	uint32_t     size = 2;
+
+	// The window is the Receive Maximum of the server. The ring has room
+	// for twice as many packet ids, the ids of the socket are shared by
+	// all of its connections.
+	if (nni_pipe_getopt(p->pipe, NNG_OPT_MQTT_RECEIVE_MAX, &recv_max, &sz,
+	        NNI_TYPE_INT32) != 0 ||
+	    recv_max <= 0 || recv_max > MQTT_INFLIGHT_MAX) {
+		recv_max = MQTT_INFLIGHT_MAX;
+	}
+	while (size < (uint32_t) recv_max * 2) {
+		size <<= 1;
+	}
+	if ((p->unack = nni_zalloc(size * sizeof(mqtt_unack_t))) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	p->unack_mask = size - 1;
+	p->window     = (uint32_t) recv_max;
 
 	nni_mtx_lock(&s->mtx);
+	if ((rv = mqtt_sock_add_pipe(s, p)) != 0) {
+		nni_mtx_unlock(&s->mtx);
+		log_warn("MQTT client has no free connection slot!");
+		return (rv);
+	}
+	nni_mtx_lock(&p->mtx);
 	nni_atomic_set_bool(&p->closed, false);
-	s->mqtt_pipe       = p;
 	s->disconnect_code = SUCCESS;
 	s->dis_prop        = NULL;
 
-	if ((c = nni_list_first(&s->send_queue)) != NULL) {
+	// ctxs cached while no connection was open go out here, in order
+	while ((c = nni_list_first(&s->send_queue)) != NULL) {
 		nni_list_remove(&s->send_queue, c);
-		nni_pipe_recv(p->pipe, &p->recv_aio);
-		mqtt_send_msg(c->saio, c);
+		mqtt_send_msg(c->saio, c, p);
 		c->saio = NULL;
-		nni_sleep_aio(s->retry, &p->time_aio);
-		return (0);
+		nni_mtx_lock(&p->mtx);
 	}
 	nni_pipe_recv(p->pipe, &p->recv_aio);
+	nni_mtx_unlock(&p->mtx);
 	nni_mtx_unlock(&s->mtx);
 	// initiate the global resend timer
 	nni_sleep_aio(s->retry, &p->time_aio);
@@ -550,7 +925,9 @@ static void
 mqtt_pipe_stop(void *arg)
 {
 	mqtt_pipe_t *p = arg;
-	nni_aio_stop(&p->send_aio);
+	for (int i = 0; i < MQTT_SEND_AIOS; i++) {
+		nni_aio_stop(&p->send_aios[i].aio);
+	}
 	nni_aio_stop(&p->recv_aio);
 	nni_aio_stop(&p->time_aio);
 }
@@ -560,11 +937,19 @@ mqtt_pipe_close(void *arg)
 {
 	mqtt_pipe_t *p = arg;
 	mqtt_sock_t *s = p->mqtt_sock;
+	nni_aio     *aio;
+	nni_msg     *msg;
 
 	nni_mtx_lock(&s->mtx);
+	nni_mtx_lock(&p->mtx);
 	nni_atomic_set_bool(&p->closed, true);
-	s->mqtt_pipe = NULL;
-	nni_aio_close(&p->send_aio);
+	if (p->slot < NNG_MQTT_CLIENT_MAX_CONNS && s->pipes[p->slot] == p) {
+		s->pipes[p->slot] = NULL;
+		s->npipes--;
+	}
+	for (int i = 0; i < MQTT_SEND_AIOS; i++) {
+		nni_aio_close(&p->send_aios[i].aio);
+	}
 	nni_aio_close(&p->recv_aio);
 	nni_aio_close(&p->time_aio);
 
@@ -579,11 +964,25 @@ mqtt_pipe_close(void *arg)
 
 	nni_lmq_flush(&p->send_messages);
 
-	nni_id_map_foreach(&p->sent_unack, mqtt_close_unack_aio_cb);
+	for (uint32_t i = 0; p->unack != NULL && i <= p->unack_mask; i++) {
+		if ((aio = p->unack[i].aio) != NULL) {
+			p->unack[i].aio = NULL;
+			mqtt_close_unack_aio_cb(NULL, aio);
+		}
+	}
+	p->inflight = 0;
+	while ((aio = nni_list_first(&p->wait_aios)) != NULL) {
+		nni_aio_list_remove(aio);
+		msg = nni_aio_get_msg(aio);
+		nni_aio_set_msg(aio, NULL);
+		nni_msg_free(msg);
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+	}
 	nni_id_map_foreach(&p->recv_unack, mqtt_close_unack_msg_cb);
+	nni_mtx_unlock(&p->mtx);
 
 #ifdef NNG_HAVE_MQTT_BROKER
-	nni_aio     *user_aio;
+	nni_aio *user_aio;
 
 	if (p->cparam == NULL) {
 		nni_mtx_unlock(&s->mtx);
@@ -625,6 +1024,44 @@ mqtt_pipe_close(void *arg)
 	return 0;
 }
 
+#if defined(NNG_SUPP_SQLITE)
+// Send a msg cached in sqlite on an idle p. Only the first open pipe
+// drains the cache, to keep the order of it.
+static bool
+mqtt_pipe_send_sqlite(mqtt_pipe_t *p)
+{
+	mqtt_sock_t            *s      = p->mqtt_sock;
+	nni_mqtt_sqlite_option *sqlite = mqtt_sock_get_sqlite_option(s);
+	nni_msg                *msg    = NULL;
+	mqtt_pipe_t            *first  = NULL;
+
+	if (!sqlite_is_enabled(sqlite)) {
+		return (false);
+	}
+	nni_mtx_lock(&s->mtx);
+	for (uint32_t i = 0; i < s->nslots && first == NULL; i++) {
+		first = s->pipes[i];
+	}
+	nni_mtx_lock(&p->mtx);
+	if (first != p || !nni_lmq_empty(&p->send_messages) ||
+	    mqtt_pipe_get_sender(p) == NULL ||
+	    nni_atomic_get_bool(&p->closed)) {
+		nni_mtx_unlock(&p->mtx);
+		nni_mtx_unlock(&s->mtx);
+		return (false);
+	}
+	if (!nni_lmq_empty(&sqlite->offline_cache)) {
+		sqlite_flush_offline_cache(sqlite);
+	}
+	if (NULL != (msg = sqlite_get_cache_msg(sqlite))) {
+		(void) mqtt_pipe_send_msg(p, msg);
+	}
+	nni_mtx_unlock(&p->mtx);
+	nni_mtx_unlock(&s->mtx);
+	return (msg != NULL);
+}
+#endif
+
 // Timer callback, we use it for retransmitting.
 static void
 mqtt_timer_cb(void *arg)
@@ -636,86 +1073,60 @@ mqtt_timer_cb(void *arg)
 		log_info("Timer aio error!");
 		return;
 	}
-	nni_mtx_lock(&s->mtx);
-	if (NULL == p || nni_atomic_get_bool(&p->closed)) {
-		nni_mtx_unlock(&s->mtx);
+	nni_mtx_lock(&p->mtx);
+	if (nni_atomic_get_bool(&p->closed)) {
+		nni_mtx_unlock(&p->mtx);
 		return;
 	}
 
 	if (p->pingcnt > s->timeout_backoff) {	// expose it
 		log_warn("MQTT Timeout and disconnect");
-		nni_mtx_unlock(&s->mtx);
+		nni_mtx_unlock(&p->mtx);
 		nni_pipe_close(p->pipe);
 		return;
 	}
 
 	// Update left time to send pingreq
-	s->timeleft -= s->retry;
+	p->timeleft -= s->retry;
 
-	if (!p->busy && p->pingmsg && s->timeleft <= 0) {
-		p->busy = true;
-		s->timeleft = s->keepalive;
+	if (p->pingmsg && p->timeleft <= 0) {
+		p->timeleft = p->keepalive;
 		// send pingreq
 		nni_msg_clone(p->pingmsg);
-		nni_aio_set_msg(&p->send_aio, p->pingmsg);
-		nni_pipe_send(p->pipe, &p->send_aio);
+		mqtt_pipe_send_ctrl(p, p->pingmsg);
 		p->pingcnt ++;
-		nni_mtx_unlock(&s->mtx);
-		log_info("Send pingreq (sock%p)(%dms)", s, s->keepalive);
+		nni_mtx_unlock(&p->mtx);
+		log_info("Send pingreq (sock%p)(%dms)", s, p->keepalive);
 		nni_sleep_aio(s->retry, &p->time_aio);
 		return;
 	}
 
-	// start message resending
-	nni_aio *taio = NULL;
-	uint16_t pid;
-	taio = nni_id_get_min(&p->sent_unack, &pid);
-	if (taio != NULL) {
-		uint16_t ptype;
-		nni_msg *msg = nni_aio_get_msg(taio);
-		nni_time time = nni_clock() - nni_msg_get_timestamp(msg);
-		if (time > s->retry_wait && msg != NULL) {
-			ptype = nni_mqtt_msg_get_packet_type(msg);
-			if (ptype == NNG_MQTT_PUBLISH) {
+	// start message resending, the oldest unacked msg after the one
+	// resent last
+	for (uint32_t i = 0; i <= p->unack_mask; i++) {
+		uint32_t idx  = (p->rid + i) & p->unack_mask;
+		nni_aio *taio = p->unack[idx].aio;
+		nni_msg *msg;
+
+		if (taio == NULL || (msg = nni_aio_get_msg(taio)) == NULL) {
+			continue;
+		}
+		if (nni_clock() - nni_msg_get_timestamp(msg) > s->retry_wait) {
+			if (nni_mqtt_msg_get_packet_type(msg) ==
+			    NNG_MQTT_PUBLISH) {
 				nni_mqtt_msg_set_publish_dup(msg, true);
 			}
-			log_error("resending QoS msg %d", pid);
+			log_error("resending QoS msg %d", p->unack[idx].pid);
 			nni_msg_clone(msg);
-			if (!p->busy) {
-				p->busy = true;
-				nni_aio_set_msg(&p->send_aio, msg);
-				log_error("actually resending QoS msg %d", pid);
-				nni_pipe_send(p->pipe, &p->send_aio);
-				nni_mtx_unlock(&s->mtx);
-				nni_sleep_aio(s->retry, &p->time_aio);
-				return;
-			} else {
-				if (nni_lmq_put(&p->send_messages, msg) != 0)
-					nni_msg_free(msg);
-			}
+			mqtt_pipe_send_ctrl(p, msg);
+			p->rid = idx + 1;
 		}
+		break;
 	}
+	nni_mtx_unlock(&p->mtx);
 #if defined(NNG_SUPP_SQLITE)
-	if (!p->busy) {
-		nni_msg     *msg = NULL;
-		nni_mqtt_sqlite_option *sqlite =
-		    mqtt_sock_get_sqlite_option(s);
-		if (sqlite_is_enabled(sqlite)) {
-			if (!nni_lmq_empty(&sqlite->offline_cache)) {
-				sqlite_flush_offline_cache(sqlite);
-			}
-			if (NULL != (msg = sqlite_get_cache_msg(sqlite))) {
-				p->busy = true;
-				nni_aio_set_msg(&p->send_aio, msg);
-				nni_pipe_send(p->pipe, &p->send_aio);
-				nni_mtx_unlock(&s->mtx);
-				nni_sleep_aio(s->retry, &p->time_aio);
-				return;
-			}
-		}
-	}
+	(void) mqtt_pipe_send_sqlite(p);
 #endif
-	nni_mtx_unlock(&s->mtx);
 	nni_sleep_aio(s->retry, &p->time_aio);
 	return;
 }
@@ -723,51 +1134,45 @@ mqtt_timer_cb(void *arg)
 static void
 mqtt_send_cb(void *arg)
 {
-	mqtt_pipe_t *p   = arg;
+	mqtt_send_t *snd = arg;
+	mqtt_pipe_t *p   = snd->pipe;
 	mqtt_sock_t *s   = p->mqtt_sock;
-	mqtt_ctx_t * c   = NULL;
 	nni_msg *    msg = NULL;
+	nni_list     done;
 	int          rv;
 
-	if ((rv = nni_aio_result(&p->send_aio)) != 0) {
+	if ((rv = nni_aio_result(&snd->aio)) != 0) {
 		// We failed to send... clean up and deal with it.
-		nni_msg_free(nni_aio_get_msg(&p->send_aio));
-		nni_aio_set_msg(&p->send_aio, NULL);
+		nni_msg_free(nni_aio_get_msg(&snd->aio));
+		nni_aio_set_msg(&snd->aio, NULL);
 		log_warn("MQTT client send error %d!", rv);
 		s->disconnect_code = 0x8B; // TODO hardcode
 		nni_pipe_close(p->pipe);
 		return;
 	}
-	nni_mtx_lock(&s->mtx);
+	nni_mtx_lock(&p->mtx);
 
-	p->busy     = false;
-	s->timeleft = s->keepalive;
+	snd->busy   = false;
+	p->timeleft = p->keepalive;
 	if (nni_atomic_get_bool(&s->closed) ||
 	    nni_atomic_get_bool(&p->closed)) {
 		// This occurs if the mqtt_pipe_close has been called.
 		// In that case we don't want any more processing.
-		nni_mtx_unlock(&s->mtx);
-		return;
-	}
-	// Check cached ctx in nni_list first
-	// these ctxs are triggered before the pipe is established
-	if ((c = nni_list_first(&s->send_queue)) != NULL) {
-		nni_list_remove(&s->send_queue, c);
-		mqtt_send_msg(c->saio, c);
-		c->saio = NULL;
+		nni_mtx_unlock(&p->mtx);
 		return;
 	}
+	// ctxs cached before the pipe was established are already sent by
+	// mqtt_pipe_start, the send_queue stays empty while a pipe is open
 	if (nni_lmq_get(&p->send_messages, &msg) == 0) {
-		p->busy = true;
-		nni_aio_set_msg(&p->send_aio, msg);
-		nni_pipe_send(p->pipe, &p->send_aio);
-		nni_mtx_unlock(&s->mtx);
-		return;
+		snd->busy = true;
+		nni_aio_set_msg(&snd->aio, msg);
+		nni_pipe_send(p->pipe, &snd->aio);
 	}
-
-	p->busy = false;
-	nni_mtx_unlock(&s->mtx);
-	return;
+	// room in the send queue lets waiting aios go
+	nni_aio_list_init(&done);
+	mqtt_pipe_admit(p, &done);
+	nni_mtx_unlock(&p->mtx);
+	mqtt_finish_admitted(&done);
 }
 
 static void
@@ -778,7 +1183,8 @@ mqtt_recv_cb(void *arg)
 	mqtt_sock_t *s          = p->mqtt_sock;
 	nni_aio     *user_aio   = NULL;
 	nni_msg     *cached_msg = NULL;
-	mqtt_ctx_t  *ctx;
+	nni_msg     *deliver    = NULL;
+	nni_list     done;
 
 	if ((rv = nni_aio_result(&p->recv_aio)) != 0) {
 		log_warn("MQTT client recv error %d!", rv);
@@ -787,7 +1193,7 @@ mqtt_recv_cb(void *arg)
 		return;
 	}
 
-	nni_mtx_lock(&s->mtx);
+	nni_mtx_lock(&p->mtx);
 	nni_msg *msg = nni_aio_get_msg(&p->recv_aio);
 	nni_aio_set_msg(&p->recv_aio, NULL);
 	if (nni_atomic_get_bool(&s->closed) ||
@@ -796,23 +1202,13 @@ mqtt_recv_cb(void *arg)
 		if (msg) {
 			nni_msg_free(msg);
 		}
-		nni_mtx_unlock(&s->mtx);
+		nni_mtx_unlock(&p->mtx);
 		return;
 	}
 	nni_msg *ack_msg = NULL;
 	if ((ack_msg = nni_aio_get_prov_data(&p->recv_aio)) != NULL) {
 		nni_aio_set_prov_data(&p->recv_aio, NULL);
-		if (!p->busy) {
-			p->busy = true;
-			nni_aio_set_msg(&p->send_aio, ack_msg);
-			nni_pipe_send(p->pipe, &p->send_aio);
-		} else {
-			if (0 != nni_lmq_put(&p->send_messages, ack_msg)) {
-				nni_println(
-				    "Warning! ack msg lost due to busy socket");
-				nni_msg_free(ack_msg);
-			}
-		}
+		mqtt_pipe_send_ctrl(p, ack_msg);
 	}
 	nni_msg_set_pipe(msg, nni_pipe_id(p->pipe));
 	nni_mqtt_msg_proto_data_alloc(msg);
@@ -820,7 +1216,7 @@ mqtt_recv_cb(void *arg)
 		rv = nni_mqtt_msg_decode(msg);
 		if (rv != MQTT_SUCCESS) {
 			log_warn("MQTT client decode error %d!", rv);
-			nni_mtx_unlock(&s->mtx);
+			nni_mtx_unlock(&p->mtx);
 			nni_msg_free(msg);
 			// close pipe directly, no DISCONNECT for MQTTv3.1.1
 			nni_pipe_close(p->pipe);
@@ -838,28 +1234,14 @@ mqtt_recv_cb(void *arg)
 			if ((rv = nni_mqttv5_msg_encode(msg)) != MQTT_SUCCESS) {
 				nni_plat_printf("Error in encoding disconnect.\n");
 			}
-			if (!p->busy) {
-				p->busy = true;
-				nni_aio_set_msg(&p->send_aio, msg);
-				nni_pipe_send(p->pipe, &p->send_aio);
-				nni_mtx_unlock(&s->mtx);
-				return;
-			}
-			if (nni_lmq_full(&p->send_messages)) {
-				nni_msg *tmsg;
-				(void) nni_lmq_get(&p->send_messages, &tmsg);
-				nni_msg_free(tmsg);
-			}
-			if (0 != nni_lmq_put(&p->send_messages, msg)) {
-				nni_println("Warning! DISCONNECT msg lost due to busy socket");
-			}
-			nni_mtx_unlock(&s->mtx);
+			mqtt_pipe_send_ctrl(p, msg);
+			nni_mtx_unlock(&p->mtx);
 			return;
 		}
 	} else {
 		rv = PROTOCOL_ERROR;
 		log_error("Invalid mqtt version");
-		nni_mtx_unlock(&s->mtx);
+		nni_mtx_unlock(&p->mtx);
 		nni_msg_free(msg);
 		// close pipe directly
 		nni_pipe_close(p->pipe);
@@ -870,11 +1252,9 @@ mqtt_recv_cb(void *arg)
 	int32_t       packet_id;
 	uint8_t       qos;
 
-	// schedule another receive
-	nni_pipe_recv(p->pipe, &p->recv_aio);
-
 	// reset ping state
 	p->pingcnt = 0;
+	nni_aio_list_init(&done);
 
 	// state transitions
 	switch (packet_type) {
@@ -893,8 +1273,8 @@ mqtt_recv_cb(void *arg)
 			nng_pipe.id = nni_pipe_id(p->pipe);
 
 			// Set keepalive
-			s->keepalive = conn_param_get_keepalive(p->cparam) * 1000;
-			s->timeleft  = s->keepalive;
+			p->keepalive = conn_param_get_keepalive(p->cparam) * 1000;
+			p->timeleft  = p->keepalive;
 
 			rv = nng_pipe_get_addr(
 			    nng_pipe, NNG_OPT_REMADDR, &addr);
@@ -924,27 +1304,12 @@ mqtt_recv_cb(void *arg)
 				nni_plat_printf("Error in encoding CONNACK.\n");
 			}
 			conn_param_clone(p->cparam);
-			if ((ctx = nni_list_first(&s->recv_queue)) == NULL) {
-				// No one waiting to receive yet, putting msg
-				// into lmq
-				if (mqtt_pipe_recv_msgq_putq(p, msg) != 0)
-					conn_param_free(p->cparam);
-				nni_mtx_unlock(&s->mtx);
-				log_warn("Warning: no ctx found!! create more "
-				         "ctxs!");
-				return;
-			}
-			nni_list_remove(&s->recv_queue, ctx);
-			user_aio  = ctx->raio;
-			ctx->raio = NULL;
-			nni_aio_set_msg(user_aio, msg);
-			nni_mtx_unlock(&s->mtx);
-			nni_aio_finish(user_aio, 0, 0);
-			return;
+			deliver = msg;
+			break;
 		}
 #endif
-		nni_mtx_unlock(&s->mtx);
-		return;
+		nni_msg_free(msg);
+		break;
 	case NNG_MQTT_PUBACK:
 		// we have received a PUBACK, successful delivery of a QoS 1
 		// FALLTHROUGH
@@ -956,11 +1321,11 @@ mqtt_recv_cb(void *arg)
 		// FALLTHROUGH
 	case NNG_MQTT_UNSUBACK:
 		// we have received a UNSUBACK, successful unsubscription
-		packet_id  = nni_mqtt_msg_get_packet_id(msg);
-		p->rid ++;
-		user_aio = nni_id_get(&p->sent_unack, packet_id);
+		packet_id = nni_mqtt_msg_get_packet_id(msg);
+		user_aio  = mqtt_pipe_unack_get(p, packet_id);
 		if (user_aio != NULL) {
-			nni_id_remove(&p->sent_unack, packet_id);
+			mqtt_pipe_unack_remove(p, packet_id);
+			mqtt_pipe_admit(p, &done);
 			// in case data race in cancel
 			nni_aio_set_prov_data(user_aio, NULL);
 			nni_msg_free(nni_aio_get_msg(user_aio));
@@ -978,8 +1343,7 @@ mqtt_recv_cb(void *arg)
 	case NNG_MQTT_PINGRESP:
 		// free msg
 		nni_msg_free(msg);
-		nni_mtx_unlock(&s->mtx);
-		return;
+		break;
 
 	case NNG_MQTT_PUBREC:
 		nni_msg_free(msg);
@@ -994,27 +1358,8 @@ mqtt_recv_cb(void *arg)
 			break;
 		}
 		nni_id_remove(&p->recv_unack, packet_id);
-
-		if ((ctx = nni_list_first(&s->recv_queue)) == NULL) {
-			// No one waiting to receive yet, putting msg
-			// into lmq
-			if (mqtt_pipe_recv_msgq_putq(p, cached_msg) != 0) {
-#ifdef NNG_HAVE_MQTT_BROKER
-				conn_param_free(p->cparam);
-#endif
-				log_warn("ERROR: no ctx found! msg queue full! QoS2 msg lost!");
-			}
-			nni_mtx_unlock(&s->mtx);
-			return;
-		}
-
-		nni_list_remove(&s->recv_queue, ctx);
-		user_aio  = ctx->raio;
-		ctx->raio = NULL;
-		nni_aio_set_msg(user_aio, cached_msg);
-		nni_mtx_unlock(&s->mtx);
-		nni_aio_finish(user_aio, 0, 0);
-		return;
+		deliver = cached_msg;
+		break;
 
 	case NNG_MQTT_PUBLISH:
 		// we have received a PUBLISH
@@ -1027,25 +1372,7 @@ mqtt_recv_cb(void *arg)
 		if (2 > qos) {
 			// QoS 0, successful receipt
 			// QoS 1, the transport handled sending a PUBACK
-			if ((ctx = nni_list_first(&s->recv_queue)) == NULL) {
-				// No one waiting to receive yet, putting msg
-				// into lmq
-				if (mqtt_pipe_recv_msgq_putq(p, msg) != 0) {
-#ifdef NNG_HAVE_MQTT_BROKER
-					conn_param_free(p->cparam);
-					log_warn("Warning: no ctx found!! PUB msg lost!");
-#endif
-				}
-				nni_mtx_unlock(&s->mtx);
-				return;
-			}
-			nni_list_remove(&s->recv_queue, ctx);
-			user_aio  = ctx->raio;
-			ctx->raio = NULL;
-			nni_aio_set_msg(user_aio, msg);
-			nni_mtx_unlock(&s->mtx);
-			nni_aio_finish(user_aio, 0, 0);
-			return;
+			deliver = msg;
 		} else {
 			packet_id = nni_mqtt_msg_get_publish_packet_id(msg);
 			if ((cached_msg = nni_id_get(
@@ -1074,12 +1401,12 @@ mqtt_recv_cb(void *arg)
 			log_error("Invalid mqtt version");
 		}
 		nni_msg_free(msg);
-		nni_mtx_unlock(&s->mtx);
+		nni_mtx_unlock(&p->mtx);
 		nni_pipe_close(p->pipe);
 		return;
 	default:
 		// unexpected packet type, server misbehaviour
-		nni_mtx_unlock(&s->mtx);
+		nni_mtx_unlock(&p->mtx);
 		if (s->mqtt_ver == MQTT_PROTOCOL_VERSION_v311) {
 			s->disconnect_code = PROTOCOL_ERROR;
 		} else if (s->mqtt_ver == MQTT_PROTOCOL_VERSION_v5) {
@@ -1091,10 +1418,17 @@ mqtt_recv_cb(void *arg)
 		return;
 	}
 
-	nni_mtx_unlock(&s->mtx);
+	nni_mtx_unlock(&p->mtx);
+	if (deliver != NULL) {
+		mqtt_pipe_deliver(p, deliver);
+	}
+	// schedule another receive only now, so messages of a connection
+	// reach the ctxs in order
+	nni_pipe_recv(p->pipe, &p->recv_aio);
 	if (user_aio) {
 		nni_aio_finish(user_aio, 0, 0);
 	}
+	mqtt_finish_admitted(&done);
 
 	return;
 }
@@ -1147,9 +1481,13 @@ mqtt_ctx_cancel_send(nni_aio *aio, void *arg, int rv)
 	mqtt_sock_t         *s   = ctx->mqtt_sock;
 	mqtt_pipe_t         *p;
 	nni_mqtt_proto_data *proto_data;
+	nni_aio             *taio = NULL;
+	nni_msg             *msg;
+	nni_list             done;
 
 	// if (rv != NNG_ETIMEDOUT)
 	// 	return;
+	nni_aio_list_init(&done);
 	nni_mtx_lock(&s->mtx);
 	if (nni_list_active(&s->send_queue, ctx)) {
 		nni_list_remove(&s->send_queue, ctx);
@@ -1157,6 +1495,32 @@ mqtt_ctx_cancel_send(nni_aio *aio, void *arg, int rv)
 	}
 
 	ctx->saio = NULL;
+	// an aio still waiting for room has nothing in flight
+	for (uint32_t i = 0; i < s->nslots && taio != aio; i++) {
+		if ((p = s->pipes[i]) == NULL) {
+			continue;
+		}
+		nni_mtx_lock(&p->mtx);
+		taio = nni_list_first(&p->wait_aios);
+		while (taio != NULL && taio != aio) {
+			taio = nni_list_next(&p->wait_aios, taio);
+		}
+		if (taio == aio) {
+			nni_aio_list_remove(aio);
+			mqtt_pipe_admit(p, &done);
+		}
+		nni_mtx_unlock(&p->mtx);
+	}
+	if (taio == aio) {
+		nni_mtx_unlock(&s->mtx);
+		msg = nni_aio_get_msg(aio);
+		nni_aio_set_msg(aio, NULL);
+		nni_msg_free(msg);
+		nni_aio_finish_error(aio, rv);
+		mqtt_finish_admitted(&done);
+		return;
+	}
+
 	// deal with canceld QoS msg
 	proto_data = nni_aio_get_prov_data(aio);
 	if (proto_data) {
@@ -1167,29 +1531,30 @@ mqtt_ctx_cancel_send(nni_aio *aio, void *arg, int rv)
 			packet_id = proto_data->var_header.subscribe.packet_id;
 		else if (type == NNG_MQTT_UNSUBSCRIBE)
 			packet_id = proto_data->var_header.unsubscribe.packet_id;
-		p = s->mqtt_pipe;
-		if (p != NULL) {
-			nni_aio *taio;
-			taio = nni_id_get(&p->sent_unack, packet_id);
-			if (taio != NULL) {
+		// packet ids are unique in the socket, only one pipe has it
+		for (uint32_t i = 0; i < s->nslots && taio != aio; i++) {
+			if ((p = s->pipes[i]) == NULL) {
+				continue;
+			}
+			nni_mtx_lock(&p->mtx);
+			if ((taio = mqtt_pipe_unack_get(p, packet_id)) == aio) {
 				log_warn("Warning : QoS action of msg %d is canceled due to "
 								"timeout!", packet_id);
-				nni_id_remove(&p->sent_unack, packet_id);
+				mqtt_pipe_unack_remove(p, packet_id);
 				nni_msg_free(nni_aio_get_msg(taio));
 				nni_aio_set_msg(taio, NULL);
 				nni_aio_set_prov_data(taio, NULL);
+				mqtt_pipe_admit(p, &done);
 			}
-			if (taio == aio)
-				nni_aio_finish_error(aio, NNG_ECANCELED);
-			else
-				log_error("canceling wrong aio!");
+			nni_mtx_unlock(&p->mtx);
 		}
-	}
-
-	if (nni_aio_list_active(aio)) {
-		nni_aio_list_remove(aio);
+		if (taio == aio)
+			nni_aio_finish_error(aio, NNG_ECANCELED);
+		else if (s->npipes > 0)
+			log_error("canceling wrong aio!");
 	}
 	nni_mtx_unlock(&s->mtx);
+	mqtt_finish_admitted(&done);
 }
 
 static void
@@ -1207,16 +1572,13 @@ mqtt_ctx_send(void *arg, nni_aio *aio)
 		return;
 	}
 
-	nni_mtx_lock(&s->mtx);
 	if (nni_atomic_get_bool(&s->closed)) {
-		nni_mtx_unlock(&s->mtx);
 		nni_aio_finish_error(aio, NNG_ECLOSED);
 		return;
 	}
 
 	msg   = nni_aio_get_msg(aio);
 	if (msg == NULL) {
-		nni_mtx_unlock(&s->mtx);
 		nni_aio_set_msg(aio, NULL);
 		nni_aio_finish_error(aio, NNG_EPROTO);
 		return;
@@ -1239,25 +1601,24 @@ mqtt_ctx_send(void *arg, nni_aio *aio)
 	default:
 		break;
 	}
-	// check return
+	// encode out of the lock, the msg belongs to no pipe yet
 	if (s->mqtt_ver == MQTT_PROTOCOL_VERSION_v311) {
 		rv = nni_mqtt_msg_encode(msg);
 	} else if (s->mqtt_ver == MQTT_PROTOCOL_VERSION_v5) {
 		rv = nni_mqttv5_msg_encode(msg);
 	} else {
-		nni_mtx_unlock(&s->mtx);
 		log_error("Invalid mqtt version");
 		rv = PROTOCOL_ERROR;
 	}
 	if (rv != MQTT_SUCCESS) {
-		nni_mtx_unlock(&s->mtx);
 		log_error("MQTT client encoding msg failed%d!", rv);
 		nni_msg_free(msg);
 		nni_aio_set_msg(aio, NULL);
 		nni_aio_finish_error(aio, NNG_EPROTO);
 		return;
 	}
-	p = s->mqtt_pipe;
+	nni_mtx_lock(&s->mtx);
+	p = mqtt_sock_get_pipe(s, msg);
 	if (p == NULL) {
 		// connection is lost or not established yet
 #if defined(NNG_SUPP_SQLITE)
@@ -1291,7 +1652,9 @@ mqtt_ctx_send(void *arg, nni_aio *aio)
 		}
 		return;
 	}
-	mqtt_send_msg(aio, ctx);
+	nni_mtx_lock(&p->mtx);
+	nni_mtx_unlock(&s->mtx);
+	mqtt_send_msg(aio, ctx, p);
 	log_trace("client sending msg now");
 	return;
 }
@@ -1309,18 +1672,23 @@ mqtt_ctx_recv(void *arg, nni_aio *aio)
 	}
 
 	nni_mtx_lock(&s->mtx);
-	p = s->mqtt_pipe;
-	if (p == NULL) {
+	if (s->npipes == 0) {
 		goto wait;
 	}
-	if (nni_atomic_get_bool(&s->closed) ||
-	    nni_atomic_get_bool(&p->closed)) {
+	if (nni_atomic_get_bool(&s->closed)) {
 		nni_mtx_unlock(&s->mtx);
 		nni_aio_finish_error(aio, NNG_ECLOSED);
 		return;
 	}
 
-	if (nni_lmq_get(&p->recv_messages, &msg) == 0) {
+	// take turns, a busy connection does not starve the others
+	for (uint32_t i = 0; i < s->nslots; i++) {
+		uint32_t slot = (s->next_recv + i) % s->nslots;
+		if ((p = s->pipes[slot]) == NULL ||
+		    nni_lmq_get(&p->recv_messages, &msg) != 0) {
+			continue;
+		}
+		s->next_recv = slot + 1;
 		nni_aio_set_msg(aio, msg);
 		nni_mtx_unlock(&s->mtx);
 		// let user gets a quick reply
@@ -1387,6 +1755,15 @@ static nni_option mqtt_sock_options[] = {
 	    .o_name = NNG_OPT_MQTT_SQLITE,
 	    .o_set  = mqtt_sock_set_sqlite_option,
 	},
+	{
+	    .o_name = NNG_OPT_MQTT_CONN_DIALER,
+	    .o_set  = mqtt_sock_set_conn_dialer,
+	},
+	{
+	    .o_name = NNG_OPT_MQTT_CONN_DISPATCH,
+	    .o_get  = mqtt_sock_get_conn_dispatch,
+	    .o_set  = mqtt_sock_set_conn_dispatch,
+	},
 	// terminate list
 	{
 	    .o_name = NULL,
@@ -0,0 +1,499 @@
+//
+// Copyright 2024 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "nng/mqtt/mqtt_client.h"
+#include "nng/supplemental/util/platform.h"
+#include <nuts.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CONNS 3
+#define TOPICS 8
+#define PUBS 48
+
+// A fake broker on raw streams, it accepts CONNS connections and reads the
+// PUBLISH packets each of them gets.
+typedef struct {
+	nng_stream_listener *l;
+	nng_stream          *conns[CONNS];
+	char                 ids[CONNS][32];
+	char                 url[64];
+} fake_broker;
+
+static int
+stream_read(nng_stream *s, void *buf, size_t len, nng_duration timeout)
+{
+	nng_aio *aio;
+	nng_iov  iov;
+	int      rv = 0;
+
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_set_timeout(aio, timeout);
+	while (len > 0 && rv == 0) {
+		iov.iov_buf = buf;
+		iov.iov_len = len;
+		NUTS_PASS(nng_aio_set_iov(aio, 1, &iov));
+		nng_stream_recv(s, aio);
+		nng_aio_wait(aio);
+		if ((rv = nng_aio_result(aio)) == 0) {
+			buf = (uint8_t *) buf + nng_aio_count(aio);
+			len -= nng_aio_count(aio);
+		}
+	}
+	nng_aio_free(aio);
+	return (rv);
+}
+
+static void
+stream_write(nng_stream *s, void *buf, size_t len)
+{
+	nng_aio *aio;
+	nng_iov  iov;
+
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	iov.iov_buf = buf;
+	iov.iov_len = len;
+	NUTS_PASS(nng_aio_set_iov(aio, 1, &iov));
+	nng_stream_send(s, aio);
+	nng_aio_wait(aio);
+	NUTS_PASS(nng_aio_result(aio));
+	NUTS_TRUE(nng_aio_count(aio) == len);
+	nng_aio_free(aio);
+}
+
+// Read one packet, returns its type or -1 on timeout.
+static int
+packet_read(nng_stream *s, uint8_t *body, size_t *len, nng_duration timeout)
+{
+	uint8_t  hdr;
+	uint8_t  b;
+	uint32_t n     = 0;
+	int      shift = 0;
+
+	if (stream_read(s, &hdr, 1, timeout) != 0) {
+		return (-1);
+	}
+	do {
+		NUTS_PASS(stream_read(s, &b, 1, 1000));
+		n += (uint32_t) (b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	NUTS_ASSERT(n <= *len);
+	NUTS_PASS(stream_read(s, body, n, 1000));
+	*len = n;
+	return (hdr >> 4);
+}
+
+static void
+broker_start(fake_broker *b)
+{
+	int port;
+
+	memset(b, 0, sizeof(*b));
+	NUTS_PASS(nng_stream_listener_alloc(&b->l, "tcp://127.0.0.1:0"));
+	NUTS_PASS(nng_stream_listener_listen(b->l));
+	NUTS_PASS(nng_stream_listener_get_int(b->l, NNG_OPT_TCP_BOUND_PORT, &port));
+	snprintf(b->url, sizeof(b->url), "mqtt-tcp://127.0.0.1:%d", port);
+}
+
+// Accept the connections, note the client id of each and CONNACK it.
+static void
+broker_accept(fake_broker *b, int n, uint8_t *connack, size_t connack_len)
+{
+	nng_aio *aio;
+	uint8_t  body[256];
+
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_set_timeout(aio, 5000);
+	for (int i = 0; i < n; i++) {
+		size_t   len = sizeof(body);
+		size_t   pos = 10;
+		uint16_t idlen;
+
+		nng_stream_listener_accept(b->l, aio);
+		nng_aio_wait(aio);
+		NUTS_PASS(nng_aio_result(aio));
+		b->conns[i] = nng_aio_get_output(aio, 0);
+		NUTS_TRUE(packet_read(b->conns[i], body, &len, 5000) == 1);
+		// "MQTT", level, flags, keepalive, v5 properties, client id
+		if (body[6] == MQTT_PROTOCOL_VERSION_v5) {
+			NUTS_ASSERT(body[pos] < 0x80);
+			pos += 1 + body[pos];
+		}
+		idlen = (uint16_t) (body[pos] << 8 | body[pos + 1]);
+		NUTS_ASSERT(idlen < sizeof(b->ids[i]));
+		memcpy(b->ids[i], body + pos + 2, idlen);
+		stream_write(b->conns[i], connack, connack_len);
+	}
+	nng_aio_free(aio);
+}
+
+// Read the QoS 0 PUBLISH of a connection until it goes quiet, payload is
+// the topic index and the sequence number. seq holds the last number and
+// the connection of each topic.
+static int
+broker_read_pubs(fake_broker *b, int conn, int *seq, bool sticky)
+{
+	uint8_t body[256];
+	size_t  len;
+	int     n = 0;
+	int     type;
+
+	while (len = sizeof(body),
+	    (type = packet_read(b->conns[conn], body, &len, 500)) != -1) {
+		uint16_t tlen;
+		int      topic, num;
+		char     payload[32];
+
+		if (type != 3) {
+			continue;
+		}
+		tlen = (uint16_t) (body[0] << 8 | body[1]);
+		memcpy(payload, body + 2 + tlen, len - 2 - tlen);
+		payload[len - 2 - tlen] = '\0';
+		NUTS_TRUE(sscanf(payload, "%d %d", &topic, &num) == 2);
+		// in order per topic, and a topic sticks to its connection
+		NUTS_TRUE(seq[topic] < num);
+		NUTS_TRUE(!sticky || seq[TOPICS + topic] == -1 ||
+		    seq[TOPICS + topic] == conn);
+		seq[topic]          = num;
+		seq[TOPICS + topic] = conn;
+		n++;
+	}
+	return (n);
+}
+
+static void
+broker_stop(fake_broker *b)
+{
+	for (int i = 0; i < CONNS; i++) {
+		if (b->conns[i] != NULL) {
+			nng_stream_free(b->conns[i]);
+		}
+	}
+	nng_stream_listener_free(b->l);
+}
+
+static void
+client_publish_topic(nng_socket sock, const char *topic, int topic_idx, int num)
+{
+	nng_msg *msg;
+	char     buf[32];
+
+	NUTS_PASS(nng_mqtt_msg_alloc(&msg, 0));
+	nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_PUBLISH);
+	nng_mqtt_msg_set_publish_topic(msg, topic);
+	snprintf(buf, sizeof(buf), "%d %d", topic_idx, num);
+	nng_mqtt_msg_set_publish_payload(msg, (uint8_t *) buf, strlen(buf));
+	NUTS_PASS(nng_sendmsg(sock, msg, 0));
+}
+
+static void
+client_publish(nng_socket sock, int topic, int num)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "topic/%d", topic);
+	client_publish_topic(sock, buf, topic, num);
+}
+
+static nng_msg *
+client_connmsg(const char *id, uint8_t version)
+{
+	nng_msg *msg;
+
+	NUTS_PASS(nng_mqtt_msg_alloc(&msg, 0));
+	nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_CONNECT);
+	nng_mqtt_msg_set_connect_proto_version(msg, version);
+	nng_mqtt_msg_set_connect_keep_alive(msg, 60);
+	nng_mqtt_msg_set_connect_clean_session(msg, true);
+	nng_mqtt_msg_set_connect_client_id(msg, id);
+	return (msg);
+}
+
+static void
+test_client_conns(void)
+{
+	fake_broker b;
+	nng_socket  sock;
+	nng_dialer  dialers[CONNS];
+	int         seq[TOPICS * 2];
+	int         n    = 0;
+	int         used = 0;
+	int         dispatch;
+	uint8_t     connack[] = { 0x20, 0x02, 0x00, 0x00 };
+
+	broker_start(&b);
+	NUTS_PASS(nng_mqtt_client_open(&sock));
+	NUTS_FAIL(nng_mqtt_client_dialers_create(
+	              dialers, sock, b.url, NULL, CONNS),
+	    NNG_EINVAL);
+	NUTS_PASS(nng_mqtt_client_dialers_create(
+	    dialers, sock, b.url, client_connmsg("conns", MQTT_PROTOCOL_VERSION_v311), CONNS));
+	for (int i = 0; i < CONNS; i++) {
+		NUTS_PASS(nng_dialer_start(dialers[i], NNG_FLAG_NONBLOCK));
+	}
+	broker_accept(&b, CONNS, connack, sizeof(connack));
+	nng_msleep(200);
+
+	// each connection has its own client id
+	for (int i = 0; i < CONNS; i++) {
+		NUTS_TRUE(strcmp(b.ids[i], "conns") == 0 ||
+		    strcmp(b.ids[i], "conns-1") == 0 ||
+		    strcmp(b.ids[i], "conns-2") == 0);
+		for (int j = 0; j < i; j++) {
+			NUTS_TRUE(strcmp(b.ids[i], b.ids[j]) != 0);
+		}
+	}
+
+	// by topic hash
+	NUTS_PASS(nng_socket_get_int(sock, NNG_OPT_MQTT_CONN_DISPATCH, &dispatch));
+	NUTS_TRUE(dispatch == NNG_MQTT_DISPATCH_TOPIC);
+	for (int i = 0; i < PUBS; i++) {
+		client_publish(sock, i % TOPICS, i);
+	}
+	for (int i = 0; i < TOPICS; i++) {
+		seq[i]          = -1;
+		seq[TOPICS + i] = -1;
+	}
+	for (int i = 0; i < CONNS; i++) {
+		int got = broker_read_pubs(&b, i, seq, true);
+		n += got;
+		used += got > 0;
+	}
+	NUTS_TRUE(n == PUBS);
+	NUTS_TRUE(used > 1);
+
+	// round robin
+	NUTS_FAIL(nng_socket_set_int(sock, NNG_OPT_MQTT_CONN_DISPATCH, 2),
+	    NNG_EINVAL);
+	NUTS_PASS(nng_socket_set_int(
+	    sock, NNG_OPT_MQTT_CONN_DISPATCH, NNG_MQTT_DISPATCH_ROUND_ROBIN));
+	for (int i = 0; i < PUBS; i++) {
+		client_publish(sock, 0, PUBS + i);
+	}
+	// one topic, spread evenly and in order on each connection
+	for (int i = 0; i < CONNS; i++) {
+		seq[0] = -1;
+		NUTS_TRUE(broker_read_pubs(&b, i, seq, false) == PUBS / CONNS);
+	}
+
+	NUTS_CLOSE(sock);
+	broker_stop(&b);
+}
+
+// Reads a v5 QoS 0 PUBLISH, returns its Topic Alias or 0.
+static uint16_t
+broker_read_alias(fake_broker *b, char *topic, int *num)
+{
+	uint8_t  body[256];
+	size_t   len = sizeof(body);
+	size_t   pos;
+	uint16_t tlen;
+	uint16_t alias = 0;
+	int      idx;
+	char     payload[32];
+
+	NUTS_TRUE(packet_read(b->conns[0], body, &len, 1000) == 3);
+	tlen = (uint16_t) (body[0] << 8 | body[1]);
+	memcpy(topic, body + 2, tlen);
+	topic[tlen] = '\0';
+	pos         = 2 + tlen;
+	NUTS_ASSERT(body[pos] < 0x80);
+	for (size_t i = pos + 1; i < pos + 1 + body[pos]; i++) {
+		if (body[i] == TOPIC_ALIAS) {
+			alias = (uint16_t) (body[i + 1] << 8 | body[i + 2]);
+			break;
+		}
+	}
+	pos += 1 + body[pos];
+	memcpy(payload, body + pos, len - pos);
+	payload[len - pos] = '\0';
+	NUTS_TRUE(sscanf(payload, "%d %d", &idx, num) == 2);
+	return (alias);
+}
+
+static void
+pipe_added(nng_pipe p, nng_pipe_ev ev, void *arg)
+{
+	(void) ev;
+	*(nng_pipe *) arg = p;
+}
+
+static void
+test_client_topic_alias(void)
+{
+	fake_broker b;
+	nng_socket  sock;
+	nng_dialer  dialer;
+	nng_pipe    pipe = NNG_PIPE_INITIALIZER;
+	uint64_t    saved;
+	int         max;
+	char        topic[128];
+	int         num;
+	// Topic Alias Maximum 2
+	uint8_t connack[] = { 0x20, 0x06, 0x00, 0x00, 0x03, 0x22, 0x00, 0x02 };
+	// topic, bound to an alias first, sent with it or its alias
+	struct {
+		const char *topic;
+		uint16_t    alias;
+		bool        bind;
+	} pubs[] = {
+		{ "factory/line-17/cell-3/robot-22/joint/4/torque", 1, true },
+		{ "factory/line-17/cell-3/robot-22/joint/4/torque", 1, false },
+		{ "factory/line-17/cell-3/robot-22/joint/5/torque", 2, true },
+		{ "factory/line-17/cell-3/robot-22/joint/5/torque", 2, false },
+		// evicts joint/4, the least recently used
+		{ "factory/line-17/cell-3/robot-22/joint/6/torque", 1, true },
+		{ "factory/line-17/cell-3/robot-22/joint/5/torque", 2, false },
+		{ "factory/line-17/cell-3/robot-22/joint/4/torque", 1, true },
+		{ "factory/line-17/cell-3/robot-22/joint/4/torque", 1, false },
+	};
+	size_t npubs = sizeof(pubs) / sizeof(pubs[0]);
+
+	broker_start(&b);
+	NUTS_PASS(nng_mqttv5_client_open(&sock));
+	NUTS_PASS(nng_pipe_notify(sock, NNG_PIPE_EV_ADD_POST, pipe_added, &pipe));
+	NUTS_PASS(nng_dialer_create(&dialer, sock, b.url));
+	NUTS_PASS(nng_dialer_set_ptr(dialer, NNG_OPT_MQTT_CONNMSG,
+	    client_connmsg("alias", MQTT_PROTOCOL_VERSION_v5)));
+	NUTS_FAIL(nng_dialer_set_int(dialer, NNG_OPT_MQTT_TOPIC_ALIAS_MAX, 65536),
+	    NNG_EINVAL);
+	NUTS_PASS(nng_dialer_get_int(dialer, NNG_OPT_MQTT_TOPIC_ALIAS_MAX, &max));
+	NUTS_TRUE(max > 2);
+	NUTS_PASS(nng_dialer_start(dialer, NNG_FLAG_NONBLOCK));
+	broker_accept(&b, 1, connack, sizeof(connack));
+	nng_msleep(200);
+
+	for (size_t i = 0; i < npubs; i++) {
+		client_publish_topic(sock, pubs[i].topic, 0, (int) i);
+	}
+	for (size_t i = 0; i < npubs; i++) {
+		NUTS_TRUE(broker_read_alias(&b, topic, &num) == pubs[i].alias);
+		NUTS_TRUE(num == (int) i);
+		NUTS_MATCH(topic, pubs[i].bind ? pubs[i].topic : "");
+	}
+
+	// 3 bytes per binding, the topic less 3 bytes per alias
+	NUTS_PASS(
+	    nng_dialer_get_uint64(dialer, NNG_OPT_MQTT_TOPIC_ALIAS_SAVED, &saved));
+	NUTS_TRUE(saved == 4 * (strlen(pubs[0].topic) - 3) - 4 * 3);
+
+	// the pipe uses what the broker allows
+	NUTS_PASS(nng_pipe_get_int(pipe, NNG_OPT_MQTT_TOPIC_ALIAS_MAX, &max));
+	NUTS_TRUE(max == 2);
+
+	NUTS_CLOSE(sock);
+	broker_stop(&b);
+}
+
+// Reads a v5 QoS 1 PUBLISH, returns its packet id.
+static uint16_t
+broker_read_qos1(fake_broker *b, int *num, nng_duration timeout)
+{
+	uint8_t  body[256];
+	size_t   len = sizeof(body);
+	size_t   pos;
+	uint16_t pid;
+	int      idx;
+	char     payload[32];
+
+	if (packet_read(b->conns[0], body, &len, timeout) != 3) {
+		return (0);
+	}
+	pos = 2 + (body[0] << 8 | body[1]);
+	pid = (uint16_t) (body[pos] << 8 | body[pos + 1]);
+	pos += 2;
+	NUTS_ASSERT(body[pos] < 0x80);
+	pos += 1 + body[pos];
+	memcpy(payload, body + pos, len - pos);
+	payload[len - pos] = '\0';
+	NUTS_TRUE(sscanf(payload, "%d %d", &idx, num) == 2);
+	return (pid);
+}
+
+static void
+test_client_inflight_window(void)
+{
+	fake_broker b;
+	nng_socket  sock;
+	nng_dialer  dialer;
+	nng_pipe    pipe = NNG_PIPE_INITIALIZER;
+	nng_aio    *aios[6];
+	uint16_t    pids[6];
+	int         max;
+	int         num;
+	char        buf[32];
+	// Receive Maximum 2
+	uint8_t connack[] = { 0x20, 0x06, 0x00, 0x00, 0x03, 0x21, 0x00, 0x02 };
+	uint8_t puback[]  = { 0x40, 0x02, 0x00, 0x00 };
+
+	broker_start(&b);
+	NUTS_PASS(nng_mqttv5_client_open(&sock));
+	NUTS_PASS(nng_pipe_notify(sock, NNG_PIPE_EV_ADD_POST, pipe_added, &pipe));
+	NUTS_PASS(nng_dialer_create(&dialer, sock, b.url));
+	NUTS_PASS(nng_dialer_set_ptr(dialer, NNG_OPT_MQTT_CONNMSG,
+	    client_connmsg("window", MQTT_PROTOCOL_VERSION_v5)));
+	NUTS_PASS(nng_dialer_start(dialer, NNG_FLAG_NONBLOCK));
+	broker_accept(&b, 1, connack, sizeof(connack));
+	nng_msleep(200);
+	NUTS_PASS(nng_pipe_get_int(pipe, NNG_OPT_MQTT_RECEIVE_MAX, &max));
+	NUTS_TRUE(max == 2);
+
+	for (int i = 0; i < 6; i++) {
+		nng_msg *msg;
+
+		NUTS_PASS(nng_aio_alloc(&aios[i], NULL, NULL));
+		NUTS_PASS(nng_mqtt_msg_alloc(&msg, 0));
+		nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_PUBLISH);
+		nng_mqtt_msg_set_publish_topic(msg, "window");
+		nng_mqtt_msg_set_publish_qos(msg, 1);
+		snprintf(buf, sizeof(buf), "0 %d", i);
+		nng_mqtt_msg_set_publish_payload(
+		    msg, (uint8_t *) buf, strlen(buf));
+		nng_aio_set_msg(aios[i], msg);
+		nng_send_aio(sock, aios[i]);
+	}
+
+	// two in flight, the rest wait for acks and none is dropped
+	for (int i = 0; i < 6; i++) {
+		if (i >= 2) {
+			NUTS_TRUE(nng_aio_busy(aios[i]));
+			puback[2] = (uint8_t) (pids[i - 2] >> 8);
+			puback[3] = (uint8_t) pids[i - 2];
+			stream_write(b.conns[0], puback, sizeof(puback));
+		}
+		NUTS_TRUE((pids[i] = broker_read_qos1(&b, &num, 1000)) != 0);
+		NUTS_TRUE(num == i);
+		if (i >= 1) {
+			NUTS_TRUE(broker_read_qos1(&b, &num, 300) == 0);
+		}
+	}
+	for (int i = 4; i < 6; i++) {
+		puback[2] = (uint8_t) (pids[i] >> 8);
+		puback[3] = (uint8_t) pids[i];
+		stream_write(b.conns[0], puback, sizeof(puback));
+	}
+	for (int i = 0; i < 6; i++) {
+		nng_aio_wait(aios[i]);
+		NUTS_PASS(nng_aio_result(aios[i]));
+		nng_aio_free(aios[i]);
+	}
+
+	NUTS_CLOSE(sock);
+	broker_stop(&b);
+}
+
+TEST_LIST = {
+	{ "mqtt client conns", test_client_conns },
+	{ "mqtt client topic alias", test_client_topic_alias },
+	{ "mqtt client inflight window", test_client_inflight_window },
+	{ NULL, NULL },
+};
@@ -15,6 +15,7 @@
 #include "nng/mqtt/mqtt_client.h"
 #include "nng/supplemental/nanolib/log.h"
 #include "nng/supplemental/tls/tls.h"
+#include "supplemental/mqtt/mqtt_alias.h"
 #include "supplemental/mqtt/mqtt_msg.h"
 #include "nng/protocol/mqtt/mqtt_parser.h"
 
@@ -31,6 +32,10 @@
 typedef struct mqtts_tcptran_pipe mqtts_tcptran_pipe;
 typedef struct mqtts_tcptran_ep   mqtts_tcptran_ep;
 
+// messages written together, 2 iovs each or 4 for a topic alias binding,
+// within the 8 an aio carries
+#define MQTTS_TCPTRAN_BATCH 4
+
 // tcp_pipe is one end of a TCP connection.
 struct mqtts_tcptran_pipe {
 	nng_stream *      conn;
@@ -59,6 +64,9 @@ struct mqtts_tcptran_pipe {
 	nni_aio *         negoaio;
 	nni_aio *         rpaio;
 	nni_msg *         rxmsg;
+	nni_mqtt_alias *  alias; // outbound topic aliases
+	uint8_t           txalias[MQTTS_TCPTRAN_BATCH][NNI_MQTT_ALIAS_HEADER_MAX];
+	uint32_t          txbatch; // sendq aios in the write
 	nni_lmq           rslmq;
 	nni_mtx           mtx;
 	bool              closed;
@@ -98,6 +106,8 @@ struct mqtts_tcptran_ep {
 	void *               property;  // property
 	void *               connmsg;
 	bool                 enable_scram;
+	uint16_t             alias_max; // outbound topic aliases, 0 disables
+	nni_atomic_u64       alias_saved;
 #ifdef SUPP_SCRAM
 	void *               scram_ctx;
 	nni_msg *            authmsg;
@@ -204,6 +214,9 @@ mqtts_tcptran_pipe_fini(void *arg)
 	nni_aio_free(p->rpaio);
 
 	nni_msg_free(p->rxmsg);
+	if (p->alias != NULL) {
+		nni_mqtt_alias_fini(p->alias);
+	}
 	// nni_lmq_fini(&p->rslmq);
 	nni_mtx_fini(&p->mtx);
 #ifdef NNG_HAVE_MQTT_BROKER
@@ -496,6 +509,14 @@ mqtts_tcptran_pipe_nego_cb(void *arg)
 				if (data) {
 					p->keepalive = data->p_value.u16;
 				}
+				data = property_get_value(ep->property, TOPIC_ALIAS_MAXIMUM);
+				if (data && data->p_value.u16 > 0 && ep->alias_max > 0 &&
+				    nni_mqtt_alias_init(&p->alias,
+				        data->p_value.u16 < ep->alias_max
+				            ? data->p_value.u16
+				            : ep->alias_max) != 0) {
+					log_warn("Topic alias disabled: no memory");
+				}
 #ifdef SUPP_SCRAM
 				data = property_get_value(ep->property, AUTHENTICATION_DATA);
 				if (data && data->p_value.str.buf && ep->scram_ctx) {
@@ -603,14 +624,13 @@ mqtts_tcptran_pipe_send_cb(void *arg)
 {
 	mqtts_tcptran_pipe *p = arg;
 	int                 rv;
-	nni_aio *           aio;
-	size_t              n;
-	nni_msg *           msg;
-	nni_aio *           txaio = p->txaio;
+	nni_aio            *aio;
+	nni_aio            *batch[MQTTS_TCPTRAN_BATCH];
+	size_t              sz[MQTTS_TCPTRAN_BATCH];
+	uint32_t            n = 0;
+	nni_aio            *txaio = p->txaio;
 
 	nni_mtx_lock(&p->mtx);
-	aio = nni_list_first(&p->sendq);
-
 	if ((rv = nni_aio_result(txaio)) != 0) {
 		// nni_pipe_bump_error(p->npipe, rv);
 		log_info("aio result %s", nng_strerror(rv));
@@ -619,31 +639,41 @@ mqtts_tcptran_pipe_send_cb(void *arg)
 		// usable, with a partial transfer.
 		// The protocol should see this error, and close the
 		// pipe itself, we hope.
-		nni_aio_list_remove(aio);
+		while (n < p->txbatch && (aio = nni_list_first(&p->sendq)) != NULL) {
+			nni_aio_list_remove(aio);
+			batch[n++] = aio;
+		}
+		p->txbatch = 0;
 		nni_mtx_unlock(&p->mtx);
-		nni_aio_finish_error(aio, rv);
+		for (uint32_t i = 0; i < n; i++) {
+			nni_aio_finish_error(batch[i], rv);
+		}
 		return;
 	}
 
-	n = nni_aio_count(txaio);
-	nni_aio_iov_advance(txaio, n);
+	sz[0] = nni_aio_count(txaio);
+	nni_aio_iov_advance(txaio, sz[0]);
 	if (nni_aio_iov_count(txaio) > 0) {
 		nng_stream_send(p->conn, txaio);
 		nni_mtx_unlock(&p->mtx);
 		return;
 	}
 
-	nni_aio_list_remove(aio);
+	// the whole batch is written
+	while (n < p->txbatch && (aio = nni_list_first(&p->sendq)) != NULL) {
+		nni_aio_list_remove(aio);
+		sz[n] = nni_msg_len(nni_aio_get_msg(aio));
+		nni_pipe_bump_tx(p->npipe, sz[n]);
+		batch[n++] = aio;
+	}
 	mqtts_tcptran_pipe_send_start(p);
-
-	msg = nni_aio_get_msg(aio);
-	n   = nni_msg_len(msg);
-	nni_pipe_bump_tx(p->npipe, n);
 	nni_mtx_unlock(&p->mtx);
 
-	nni_aio_set_msg(aio, NULL);
-	nni_msg_free(msg);
-	nni_aio_finish_sync(aio, rv, n);
+	for (uint32_t i = 0; i < n; i++) {
+		nni_msg_free(nni_aio_get_msg(batch[i]));
+		nni_aio_set_msg(batch[i], NULL);
+		nni_aio_finish_sync(batch[i], 0, sz[i]);
+	}
 }
 
 static void
@@ -796,9 +826,6 @@ mqtts_tcptran_pipe_recv_cb(void *arg)
 			rv = PROTOCOL_ERROR;
 			goto recv_error;
 		}
-		if (p->proto == MQTT_PROTOCOL_VERSION_v5) {
-			p->sndmax++;
-		}
 		break;
 	case CMD_PINGRESP:
 		//free here?
@@ -858,6 +885,8 @@ static void
 mqtts_tcptran_pipe_send_cancel(nni_aio *aio, void *arg, int rv)
 {
 	mqtts_tcptran_pipe *p = arg;
+	nni_aio            *taio;
+	uint32_t            n = 0;
 
 	nni_mtx_lock(&p->mtx);
 	if (!nni_aio_list_active(aio)) {
@@ -866,11 +895,14 @@ mqtts_tcptran_pipe_send_cancel(nni_aio *aio, void *arg, int rv)
 	}
 	// If this is being sent, then cancel the pending transfer.
 	// The callback on the txaio will cause the user aio to
-	// be canceled too.
-	if (nni_list_first(&p->sendq) == aio) {
-		nni_aio_abort(p->txaio, rv);
-		nni_mtx_unlock(&p->mtx);
-		return;
+	// be canceled too, with the rest of the batch.
+	for (taio = nni_list_first(&p->sendq); taio != NULL && n < p->txbatch;
+	     taio = nni_list_next(&p->sendq, taio), n++) {
+		if (taio == aio) {
+			nni_aio_abort(p->txaio, rv);
+			nni_mtx_unlock(&p->mtx);
+			return;
+		}
 	}
 	nni_aio_list_remove(aio);
 	nni_mtx_unlock(&p->mtx);
@@ -882,10 +914,15 @@ static void
 mqtts_tcptran_pipe_send_start(mqtts_tcptran_pipe *p)
 {
 	nni_aio *aio;
-	nni_aio *txaio;
+	nni_aio *txaio = p->txaio;
 	nni_msg *msg;
-	int      niov;
-	nni_iov  iov[3];
+	uint8_t *header;
+	uint64_t size;
+	int64_t  saved;
+	int      niov = 0;
+	int      n;
+	int      rv;
+	nni_iov  iov[8];
 
 	if (p->closed) {
 		while ((aio = nni_list_first(&p->sendq)) != NULL) {
@@ -895,47 +932,74 @@ mqtts_tcptran_pipe_send_start(mqtts_tcptran_pipe *p)
 		return;
 	}
 
-	if ((aio = nni_list_first(&p->sendq)) == NULL) {
-		return;
-	}
-
-	// This runs to send the message.
-	msg = nni_aio_get_msg(aio);
-
-	if (msg != NULL && p->proto == MQTT_PROTOCOL_VERSION_v5) {
-		uint8_t *header = nni_msg_header(msg);
-		if ((*header & 0XF0) == CMD_PUBLISH) {
+	// Queued messages go out together in one vectored write, each one
+	// takes 2 iovs or 4 when it binds a topic alias.
+	p->txbatch = 0;
+	for (aio = nni_list_first(&p->sendq);
+	     aio != NULL && p->txbatch < MQTTS_TCPTRAN_BATCH &&
+	     niov + 2 <= (int) NNI_NUM_ELEMENTS(iov);
+	     aio = nni_list_next(&p->sendq, aio)) {
+		msg    = nni_aio_get_msg(aio);
+		header = nni_msg_header(msg);
+		if (p->proto == MQTT_PROTOCOL_VERSION_v5 &&
+		    (*header & 0XF0) == CMD_PUBLISH) {
 			// check max qos
 			uint8_t qos = nni_mqtt_msg_get_publish_qos(msg);
-			if (qos > 0)
-				p->sndmax --;
 			if (qos > p->qosmax) {
 				p->qosmax == 1 ? ((*header &= 0XF9), (*header |= 0X02)) : NNI_ARG_UNUSED(*header);
 				p->qosmax == 0 ? *header &= 0XF9 : NNI_ARG_UNUSED(*header);
 			}
 		}
-	}
-
-	// check max packet size
-	if (nni_msg_header_len(msg) + nni_msg_len(msg) > p->packmax) {
-		txaio = p->txaio;
-		nni_aio_finish_error(txaio, UNSPECIFIED_ERROR);
-		return;
-	}
 
-	txaio = p->txaio;
-	niov  = 0;
+		// check max packet size, the error fails only the first
+		size = nni_msg_header_len(msg) + nni_msg_len(msg);
+		if (size > p->packmax) {
+			if (p->txbatch == 0) {
+				p->txbatch = 1;
+				nni_aio_finish_error(txaio, UNSPECIFIED_ERROR);
+				return;
+			}
+			break;
+		}
 
-	if (nni_msg_header_len(msg) > 0) {
-		iov[niov].iov_buf = nni_msg_header(msg);
-		iov[niov].iov_len = nni_msg_header_len(msg);
-		niov++;
+		// A binding adds 3 bytes, so it must still fit.  The message
+		// itself keeps the full topic for resends and other pipes.
+		// A binding without the iovs left waits for the next write.
+		n  = (int) NNI_NUM_ELEMENTS(iov) - niov;
+		rv = NNG_ENOTSUP;
+		if (p->alias != NULL && size + 3 <= p->packmax) {
+			rv = nni_mqtt_alias_publish(p->alias, msg,
+			    p->txalias[p->txbatch], iov + niov, &n, &saved);
+		}
+		if (rv == 0) {
+			if (saved >= 0) {
+				nni_atomic_add64(&p->ep->alias_saved, (uint64_t) saved);
+			} else {
+				nni_atomic_sub64(&p->ep->alias_saved, (uint64_t) -saved);
+			}
+			niov += n;
+			p->txbatch++;
+			continue;
+		}
+		if (rv == NNG_ENOSPC) {
+			break;
+		}
+		if (nni_msg_header_len(msg) > 0) {
+			iov[niov].iov_buf = nni_msg_header(msg);
+			iov[niov].iov_len = nni_msg_header_len(msg);
+			niov++;
+		}
+		if (nni_msg_len(msg) > 0) {
+			iov[niov].iov_buf = nni_msg_body(msg);
+			iov[niov].iov_len = nni_msg_len(msg);
+			niov++;
+		}
+		p->txbatch++;
 	}
-	if (nni_msg_len(msg) > 0) {
-		iov[niov].iov_buf = nni_msg_body(msg);
-		iov[niov].iov_len = nni_msg_len(msg);
-		niov++;
+	if (p->txbatch == 0) {
+		return;
 	}
+
 	nni_aio_set_iov(txaio, niov, iov);
 	nng_stream_send(p->conn, txaio);
 }
@@ -1055,12 +1119,57 @@ mqtts_tcptran_pipe_peer(void *arg)
 	return (p->peer);
 }
 
+static int
+mqtts_tcptran_pipe_get_recv_max(void *arg, void *v, size_t *szp, nni_opt_type t)
+{
+	mqtts_tcptran_pipe *p = arg;
+	int                 max;
+
+	nni_mtx_lock(&p->mtx);
+	max = p->sndmax;
+	nni_mtx_unlock(&p->mtx);
+	return (nni_copyout_int(max, v, szp, t));
+}
+
+static int
+mqtts_tcptran_pipe_get_alias_max(void *arg, void *v, size_t *szp, nni_opt_type t)
+{
+	mqtts_tcptran_pipe *p = arg;
+	int                 max;
+
+	nni_mtx_lock(&p->mtx);
+	max = p->alias != NULL ? nni_mqtt_alias_max(p->alias) : 0;
+	nni_mtx_unlock(&p->mtx);
+	return (nni_copyout_int(max, v, szp, t));
+}
+
+static const nni_option mqtts_tcptran_pipe_opts[] = {
+	{
+	    .o_name = NNG_OPT_MQTT_RECEIVE_MAX,
+	    .o_get  = mqtts_tcptran_pipe_get_recv_max,
+	},
+	{
+	    .o_name = NNG_OPT_MQTT_TOPIC_ALIAS_MAX,
+	    .o_get  = mqtts_tcptran_pipe_get_alias_max,
+	},
+	// terminate list
+	{
+	    .o_name = NULL,
+	},
+};
+
 static int
 mqtts_tcptran_pipe_getopt(
     void *arg, const char *name, void *buf, size_t *szp, nni_type t)
 {
 	mqtts_tcptran_pipe *p = arg;
-	return (nni_stream_get(p->conn, name, buf, szp, t));
+	int                 rv;
+
+	rv = nni_stream_get(p->conn, name, buf, szp, t);
+	if (rv == NNG_ENOTSUP) {
+		rv = nni_getopt(mqtts_tcptran_pipe_opts, name, p, buf, szp, t);
+	}
+	return (rv);
 }
 
 static void
@@ -1434,6 +1543,8 @@ mqtts_tcptran_ep_init(mqtts_tcptran_ep **epp, nng_url *url, nni_sock *sock)
 	ep->reason_code = 0;
 	ep->property    = NULL;
 	ep->backoff     = 0;
+	ep->alias_max   = NNI_MQTT_ALIAS_MAX;
+	nni_atomic_init64(&ep->alias_saved);
 
 #ifdef NNG_ENABLE_STATS
 	static const nni_stat_info rcv_max_info = {
@@ -1717,6 +1828,44 @@ mqtts_tcptran_ep_set_reconnect_backoff(void *arg, const void *v, size_t sz, nni_
 	return (rv);
 }
 
+static int
+mqtts_tcptran_ep_get_alias_max(void *arg, void *v, size_t *szp, nni_opt_type t)
+{
+	mqtts_tcptran_ep *ep = arg;
+	int               rv;
+
+	nni_mtx_lock(&ep->mtx);
+	rv = nni_copyout_int(ep->alias_max, v, szp, t);
+	nni_mtx_unlock(&ep->mtx);
+	return (rv);
+}
+
+static int
+mqtts_tcptran_ep_set_alias_max(void *arg, const void *v, size_t sz, nni_opt_type t)
+{
+	mqtts_tcptran_ep *ep = arg;
+	int               tmp;
+	int               rv;
+
+	if ((rv = nni_copyin_int(&tmp, v, sz, 0, 65535, t)) == 0) {
+		nni_mtx_lock(&ep->mtx);
+		ep->alias_max = (uint16_t) tmp;
+		nni_mtx_unlock(&ep->mtx);
+	}
+	return (rv);
+}
+
+// Net bytes kept off the wire by topic aliases, over all connections.
+static int
+mqtts_tcptran_ep_get_alias_saved(void *arg, void *v, size_t *szp, nni_opt_type t)
+{
+	mqtts_tcptran_ep *ep = arg;
+	int64_t           saved;
+
+	saved = (int64_t) nni_atomic_get64(&ep->alias_saved);
+	return (nni_copyout_u64(saved > 0 ? (uint64_t) saved : 0, v, szp, t));
+}
+
 static int
 mqtts_tcptran_ep_set_enable_scram(void *arg, const void *v, size_t sz, nni_opt_type t)
 {
@@ -1822,6 +1971,15 @@ static const nni_option mqtts_tcptran_ep_opts[] = {
 	    .o_name = NNG_OPT_MQTT_ENABLE_SCRAM,
 	    .o_set  = mqtts_tcptran_ep_set_enable_scram,
 	},
+	{
+	    .o_name = NNG_OPT_MQTT_TOPIC_ALIAS_MAX,
+	    .o_get  = mqtts_tcptran_ep_get_alias_max,
+	    .o_set  = mqtts_tcptran_ep_set_alias_max,
+	},
+	{
+	    .o_name = NNG_OPT_MQTT_TOPIC_ALIAS_SAVED,
+	    .o_get  = mqtts_tcptran_ep_get_alias_saved,
+	},
 	// terminate list
 	{
 	    .o_name = NULL,
@@ -120,6 +120,12 @@ nni_atomic_dec_nv(nni_atomic_int *v)
 	return (atomic_fetch_sub(&v->v, 1) - 1);
 }
 
+int
+nni_atomic_inc_nv(nni_atomic_int *v)
+{
+	return (atomic_fetch_add(&v->v, 1) + 1);
+}
+
 bool
 nni_atomic_cas(nni_atomic_int *v, int comp, int new)
 {
@@ -337,6 +343,12 @@ nni_atomic_dec_nv(nni_atomic_int *v)
 	return (__atomic_sub_fetch(&v->v, 1, __ATOMIC_SEQ_CST));
 }
 
+int
+nni_atomic_inc_nv(nni_atomic_int *v)
+{
+	return (__atomic_add_fetch(&v->v, 1, __ATOMIC_SEQ_CST));
+}
+
 bool
 nni_atomic_cas(nni_atomic_int *v, int comp, int new)
 {
@@ -597,6 +609,17 @@ nni_atomic_dec_nv(nni_atomic_int *v)
 	return (nv);
 }
 
+int
+nni_atomic_inc_nv(nni_atomic_int *v)
+{
+	int nv;
+	pthread_mutex_lock(&plat_atomic_lock);
+	v->v++;
+	nv = v->v;
+	pthread_mutex_unlock(&plat_atomic_lock);
+	return (nv);
+}
+
 bool
 nni_atomic_cas(nni_atomic_int *v, int comp, int new)
 {
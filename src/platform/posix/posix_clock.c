@@ -85,6 +85,23 @@ nni_clock(void)
 	return (msec);
 }
 
+uint64_t
+nni_clock_us(void)
+{
+	struct timespec ts;
+	uint64_t        usec;
+
+	if (clock_gettime(NNG_USE_CLOCKID, &ts) != 0) {
+		// This should never ever occur.
+		nni_panic("clock_gettime failed: %s", strerror(errno));
+	}
+
+	usec = ts.tv_sec;
+	usec *= 1000000;
+	usec += (ts.tv_nsec / 1000);
+	return (usec);
+}
+
 void
 nni_msleep(nni_duration ms)
 {
@@ -141,6 +158,23 @@ nni_clock(void)
 	return (ms);
 }
 
+uint64_t
+nni_clock_us(void)
+{
+	uint64_t us;
+
+	struct timeval tv;
+
+	if (gettimeofday(&tv, NULL) != 0) {
+		nni_panic("gettimeofday failed: %s", strerror(errno));
+	}
+
+	us = tv.tv_sec;
+	us *= 1000000;
+	us += tv.tv_usec;
+	return (us);
+}
+
 void
 nni_msleep(nni_duration ms)
 {
@@ -28,6 +28,10 @@
 #include <pthread_np.h>
 #endif
 
+#ifdef NNG_HAVE_SCHED_GETCPU
+#include <sched.h>
+#endif
+
 #ifdef NNG_SETSTACKSIZE
 #include <limits.h>
 #include <sys/resource.h>
@@ -454,6 +458,18 @@ nni_plat_ncpu(void)
 #endif
 }
 
+int
+nni_plat_cpu_index(void)
+{
+#ifdef NNG_HAVE_SCHED_GETCPU
+	int cpu = sched_getcpu();
+
+	return (cpu < 0 ? 0 : cpu);
+#else
+	return (0);
+#endif
+}
+
 int
 nni_plat_getpid(void)
 {
@@ -30,6 +30,19 @@ nni_clock(void)
 	return (GetTickCount64());
 }
 
+uint64_t
+nni_clock_us(void)
+{
+	LARGE_INTEGER count;
+	LARGE_INTEGER freq;
+
+	// Both calls always succeed on XP and later.
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return ((uint64_t) (count.QuadPart / freq.QuadPart * 1000000 +
+	    count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart));
+}
+
 int
 nni_time_get(uint64_t *seconds, uint32_t *nanoseconds)
 {
@@ -335,6 +335,12 @@ nni_atomic_dec_nv(nni_atomic_int *v)
 	return (InterlockedDecrementRelease(&v->v));
 }
 
+int
+nni_atomic_inc_nv(nni_atomic_int *v)
+{
+	return (InterlockedIncrement(&v->v));
+}
+
 void
 nni_atomic_dec(nni_atomic_int *v)
 {
@@ -427,6 +433,12 @@ nni_plat_ncpu(void)
 	return ((int) (info.dwNumberOfProcessors));
 }
 
+int
+nni_plat_cpu_index(void)
+{
+	return ((int) GetCurrentProcessorNumber());
+}
+
 int
 nni_plat_getpid(void)
 {
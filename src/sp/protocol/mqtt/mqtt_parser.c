@@ -15,6 +15,7 @@
 #include "supplemental/mqtt/mqtt_msg.h"
 
 #include "nng/mqtt/packet.h"
+#include "nng/supplemental/nanolib/cvector.h"
 // #include <iconv.h>
 #include <stdio.h>
 #include <string.h>
@@ -539,10 +540,46 @@ conn_param_set_will_property(conn_param *cparam, property *prop)
 	}
 }
 
+/**
+ * @brief take a string of a CONNECT packet as a slice of it, with the
+ * checks of copyn_utf8_str. The string is moved over its 2 bytes of length
+ * so that it ends in a NUL without touching what follows it.
+ * @param utf8 false for binary data
+ * @return uint8_t* NULL if empty, overflow or not utf-8
+ */
+static uint8_t *
+conn_str_slice(uint8_t *src, uint32_t *pos, int *str_len, int limit, bool utf8)
+{
+	uint8_t *dest;
+
+	*str_len = 0;
+	if (limit < 2)
+		return NULL;
+	NNI_GET16(src + (*pos), *str_len);
+	*pos = (*pos) + 2;
+	if (*str_len > (limit - 2)) {
+		*str_len = -1;
+		return NULL;
+	}
+	if (*str_len == 0)
+		return NULL;
+	if (utf8 &&
+	    utf8_check((const char *) (src + *pos), *str_len) != ERR_SUCCESS) {
+		*str_len = -1;
+		return NULL;
+	}
+	dest = src + (*pos) - 2;
+	memmove(dest, src + (*pos), *str_len);
+	dest[*str_len] = '\0';
+	*pos           = (*pos) + (*str_len);
+	return dest;
+}
+
 /**
  * @brief handle and decode CONNECT packet
  * only use in nego_cb !!!
- *
+ * Strings are decoded in place as slices of packet, which cparam takes
+ * over even on error: it must come from nng_alloc(max).
  */
 int32_t
 conn_handler(uint8_t *packet, conn_param *cparam, size_t max)
@@ -552,6 +589,12 @@ conn_handler(uint8_t *packet, conn_param *cparam, size_t max)
 	int      len_of_str = 0;
 	int32_t  rv         = 0;
 
+	if (cparam->pkt != NULL && cparam->pkt != packet) {
+		nng_free(cparam->pkt, cparam->pkt_len);
+	}
+	cparam->pkt     = packet;
+	cparam->pkt_len = max;
+
 	if (packet[pos] != CMD_CONNECT) {
 		return PROTOCOL_ERROR;
 	} else {
@@ -563,8 +606,8 @@ conn_handler(uint8_t *packet, conn_param *cparam, size_t max)
 	pos += rm_len;
 	log_trace("remaining length: %d", len);
 	// protocol name
-	cparam->pro_name.body =
-	    (char *) copyn_utf8_str(packet, &pos, &len_of_str, max - pos);
+	cparam->pro_name.body = (char *) conn_str_slice(
+	    packet, &pos, &len_of_str, max - pos, true);
 	cparam->pro_name.len = len_of_str;
 	// At least 4 bytes left in valid CONNECT & proname must be valid
 	rv = (cparam->pro_name.body == NULL || len_of_str < 0 || pos + 4 > max)
@@ -624,17 +667,16 @@ conn_handler(uint8_t *packet, conn_param *cparam, size_t max)
 	log_trace("pos after property: [%d]", pos);
 
 	// here starts payload: client_id
-	cparam->clientid.body =
-	    (char *) copyn_utf8_str(packet, &pos, &len_of_str, max - pos);
+	cparam->clientid.body = (char *) conn_str_slice(
+	    packet, &pos, &len_of_str, max - pos, true);
 	cparam->clientid.len = len_of_str;
 	log_trace("id is %s", cparam->clientid.body);
 
 	if (len_of_str == 0) {
-		char clientid_r[20] = {0};
-		snprintf(clientid_r, 20, "nanomq-%08x", nni_random());
-		clientid_r[19]        = '\0';
-		cparam->clientid.body = nng_strdup(clientid_r);
-		cparam->clientid.len  = strlen(clientid_r);
+		snprintf(cparam->idbuf, sizeof(cparam->idbuf), "nanomq-%08x",
+		    nni_random());
+		cparam->clientid.body = cparam->idbuf;
+		cparam->clientid.len  = strlen(cparam->idbuf);
 		cparam->assignedid    = true;
 	} else if (len_of_str < 0) {
 		log_trace("PROTOCOL_ERROR: No clientid is found!");
@@ -672,8 +714,8 @@ conn_handler(uint8_t *packet, conn_param *cparam, size_t max)
 			}
 			log_trace("pos after will property: [%d]", pos);
 		}
-		cparam->will_topic.body =
-		    (char *) copyn_utf8_str(packet, &pos, &len_of_str, max-pos);
+		cparam->will_topic.body = (char *) conn_str_slice(
+		    packet, &pos, &len_of_str, max - pos, true);
 		cparam->will_topic.len = len_of_str;
 		rv                     = len_of_str <= 0 ? 1 : 0;
 
@@ -685,12 +727,12 @@ conn_handler(uint8_t *packet, conn_param *cparam, size_t max)
 		log_trace("pos after will topic body: [%d]", pos);
 		// will msg
 		if (rv == 0 && cparam->payload_format_indicator == 0) {
-			cparam->will_msg.body = (char *) copyn_str(
-			    packet, &pos, &len_of_str, max - pos);
+			cparam->will_msg.body = (char *) conn_str_slice(
+			    packet, &pos, &len_of_str, max - pos, false);
 		} else if (rv == 0 &&
 		    cparam->payload_format_indicator == 0x01) {
-			cparam->will_msg.body = (char *) copyn_utf8_str(
-			    packet, &pos, &len_of_str, max - pos);
+			cparam->will_msg.body = (char *) conn_str_slice(
+			    packet, &pos, &len_of_str, max - pos, true);
 		}
 		rv = len_of_str <= 0 ? PAYLOAD_FORMAT_INVALID : 0;
 		if (cparam->will_msg.body == NULL || rv != 0) {
@@ -706,8 +748,8 @@ conn_handler(uint8_t *packet, conn_param *cparam, size_t max)
 
 	// username
 	if (rv == 0 && (cparam->con_flag & 0x80) > 0) {
-		cparam->username.body =
-		    (char *) copyn_utf8_str(packet, &pos, &len_of_str, max-pos);
+		cparam->username.body = (char *) conn_str_slice(
+		    packet, &pos, &len_of_str, max - pos, true);
 		cparam->username.len = len_of_str;
 		rv                   = len_of_str <= 0 ? PAYLOAD_FORMAT_INVALID : 0;
 		if (rv != 0) {
@@ -723,8 +765,8 @@ conn_handler(uint8_t *packet, conn_param *cparam, size_t max)
 			// log_warn("Got password but no username!");
 			// return PROTOCOL_ERROR;
 		}
-		cparam->password.body =
-		    copyn_utf8_str(packet, &pos, &len_of_str, max-pos);
+		cparam->password.body = conn_str_slice(
+		    packet, &pos, &len_of_str, max - pos, true);
 		cparam->password.len = len_of_str;
 		rv                   = len_of_str <= 0 ? PAYLOAD_FORMAT_INVALID : 0;
 		if (rv != 0) {
@@ -849,6 +891,9 @@ conn_param_init(conn_param *cparam)
 	cparam->properties      = NULL;
 	cparam->will_prop_len   = 0;
 	cparam->will_properties = NULL;
+
+	cparam->pkt     = NULL;
+	cparam->pkt_len = 0;
 }
 
 int
@@ -865,6 +910,20 @@ conn_param_alloc(conn_param **cparamp)
 	return 0;
 }
 
+// Strings set apart from conn_handler are allocated on their own.
+static void
+conn_param_free_str(conn_param *cparam, void *body, size_t len)
+{
+	uint8_t *p = body;
+
+	if (p == NULL || body == cparam->idbuf ||
+	    (cparam->pkt != NULL && p >= cparam->pkt &&
+	        p < cparam->pkt + cparam->pkt_len)) {
+		return;
+	}
+	nng_free(body, len);
+}
+
 void
 conn_param_free(conn_param *cparam)
 {
@@ -875,15 +934,17 @@ conn_param_free(conn_param *cparam)
 		return;
 	}
 	log_trace("destroy conn param");
-	nng_free(cparam->pro_name.body, cparam->pro_name.len);
-	nng_free(cparam->clientid.body, cparam->clientid.len);
-	nng_free(cparam->will_topic.body, cparam->will_topic.len);
-	nng_free(cparam->will_msg.body, cparam->will_msg.len);
-	nng_free(cparam->username.body, cparam->username.len);
-	nng_free(cparam->password.body, cparam->password.len);
+	conn_param_free_str(cparam, cparam->pro_name.body, cparam->pro_name.len);
+	conn_param_free_str(cparam, cparam->clientid.body, cparam->clientid.len);
+	conn_param_free_str(
+	    cparam, cparam->will_topic.body, cparam->will_topic.len);
+	conn_param_free_str(cparam, cparam->will_msg.body, cparam->will_msg.len);
+	conn_param_free_str(cparam, cparam->username.body, cparam->username.len);
+	conn_param_free_str(cparam, cparam->password.body, cparam->password.len);
 
 	property_free(cparam->properties);
 	property_free(cparam->will_properties);
+	nng_free(cparam->pkt, cparam->pkt_len);
 
 
 	nng_free(cparam, sizeof(struct conn_param));
@@ -1123,8 +1184,123 @@ static uint32_t crc32c_sw(uint32_t crci, const void *buf, size_t len)
     return (uint32_t)crc ^ 0xffffffff;
 }
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define NANO_CRC32C_HW 1
+
+/* SSE4.2 crc32 instruction, 8 bytes per step. */
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t crci, const void *buf, size_t len)
+{
+	const unsigned char *next = buf;
+	uint64_t             crc  = crci ^ 0xffffffff;
+
+	while (len && ((uintptr_t) next & 7) != 0) {
+		crc = _mm_crc32_u8((uint32_t) crc, *next++);
+		len--;
+	}
+	while (len >= 8) {
+		uint64_t ncopy;
+		memcpy(&ncopy, next, sizeof(ncopy));
+		crc = _mm_crc32_u64(crc, ncopy);
+		next += 8;
+		len -= 8;
+	}
+	while (len) {
+		crc = _mm_crc32_u8((uint32_t) crc, *next++);
+		len--;
+	}
+	return (uint32_t) crc ^ 0xffffffff;
+}
+
+static bool
+crc32c_hw_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(__aarch64__) && \
+    (defined(__ARM_FEATURE_CRC32) || \
+        (defined(__linux__) && defined(__GNUC__) && !defined(__clang__)))
+#include <arm_acle.h>
+#if !defined(__ARM_FEATURE_CRC32)
+#include <sys/auxv.h>
+#define CRC32C_HW_TARGET __attribute__((target("+crc")))
+#else
+#define CRC32C_HW_TARGET
+#endif
+#define NANO_CRC32C_HW 1
+
+/* ARMv8 crc32c instructions, 8 bytes per step. */
+CRC32C_HW_TARGET static uint32_t
+crc32c_hw(uint32_t crci, const void *buf, size_t len)
+{
+	const unsigned char *next = buf;
+	uint32_t             crc  = crci ^ 0xffffffff;
+
+	while (len && ((uintptr_t) next & 7) != 0) {
+		crc = __crc32cb(crc, *next++);
+		len--;
+	}
+	while (len >= 8) {
+		uint64_t ncopy;
+		memcpy(&ncopy, next, sizeof(ncopy));
+		crc = __crc32cd(crc, le64toh(ncopy));
+		next += 8;
+		len -= 8;
+	}
+	while (len) {
+		crc = __crc32cb(crc, *next++);
+		len--;
+	}
+	return crc ^ 0xffffffff;
+}
+
+static bool
+crc32c_hw_supported(void)
+{
+#if defined(__ARM_FEATURE_CRC32)
+	return true;
+#else
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+#endif
+
+typedef uint32_t (*crc32c_func)(uint32_t, const void *, size_t);
+
+static nni_atomic_ptr crc32c_impl;
+
+/* Picks the crc32c implementation once, the first caller builds the
+   table of the software one if the cpu has no crc32c instruction. */
+static crc32c_func
+crc32c_select(void)
+{
+	crc32c_func fn = (crc32c_func) nni_atomic_get_ptr(&crc32c_impl);
+
+	if (fn != NULL) {
+		return fn;
+	}
+#if defined(NANO_CRC32C_HW)
+	if (crc32c_hw_supported()) {
+		fn = crc32c_hw;
+	}
+#endif
+	if (fn == NULL) {
+		if (crc32c_init == 0) {
+			crc32c_init_sw();
+			crc32c_init = 1;
+		}
+		fn = crc32c_sw;
+	}
+	nni_atomic_set_ptr(&crc32c_impl, (void *) fn);
+	return fn;
+}
+
+/* Software crc32c, the reference of the hardware ones in tests. */
 uint32_t
-crc32c_hashn(char *str, size_t n)
+crc32c_hashn_sw(char *str, size_t n)
 {
 	if (crc32c_init == 0) {
 		crc32c_init_sw();
@@ -1134,6 +1310,114 @@ crc32c_hashn(char *str, size_t n)
 	return crc32c_sw(0, (void *)str, n);
 }
 
+uint32_t
+crc32c_hashn(char *str, size_t n)
+{
+	return crc32c_select()(0, (void *)str, n);
+}
+
+/* wyhash (final version 4.2) from https://github.com/wangyi-fudan/wyhash,
+   fast non-cryptographic hash for tables. */
+static const uint64_t wyp[4] = { 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+	0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+
+static inline void
+wymum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = *a;
+	r *= *b;
+	*a = (uint64_t) r;
+	*b = (uint64_t) (r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32;
+	uint64_t la = (uint32_t) *a, lb = (uint32_t) *b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), lo, hi;
+	uint64_t c = t < rl;
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	*a = lo;
+	*b = hi;
+#endif
+}
+
+static inline uint64_t
+wymix(uint64_t a, uint64_t b)
+{
+	wymum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t
+wyr8(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return le64toh(v);
+}
+
+static inline uint64_t
+wyr4(const uint8_t *p)
+{
+	return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 |
+	    (uint64_t) p[3] << 24;
+}
+
+static inline uint64_t
+wyr3(const uint8_t *p, size_t k)
+{
+	return ((uint64_t) p[0] << 16) | ((uint64_t) p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t
+wy_hashn(char *str, size_t n)
+{
+	const uint8_t *p    = (const uint8_t *) str;
+	uint64_t       seed = wymix(wyp[0], wyp[1]);
+	uint64_t       a, b;
+
+	if (n <= 16) {
+		if (n >= 4) {
+			a = (wyr4(p) << 32) | wyr4(p + ((n >> 3) << 2));
+			b = (wyr4(p + n - 4) << 32) |
+			    wyr4(p + n - 4 - ((n >> 3) << 2));
+		} else if (n > 0) {
+			a = wyr3(p, n);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = n;
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+				see1 = wymix(
+				    wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ see1);
+				see2 = wymix(
+				    wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = wyr8(p + i - 16);
+		b = wyr8(p + i - 8);
+	}
+	a ^= wyp[1];
+	b ^= seed;
+	wymum(&a, &b);
+	return wymix(a ^ wyp[0] ^ n, b ^ wyp[1]);
+}
+
 inline void
 nano_msg_set_dup(nng_msg *msg)
 {
@@ -1326,6 +1610,268 @@ nano_msg_notify_connect(conn_param *cparam, uint8_t code)
 	return msg;
 }
 
+// slots of index kept on stack, enough for most SUBSCRIBE packets
+#define TOPIC_SLICE_STACK_SLOTS 64
+
+// Topic filters of one SUB/UNSUB packet, deduplicated with an open
+// addressing index over the slices, so no string is copied.
+typedef struct {
+	uint8_t     *payload; // first topic filter in msg body
+	topic_slice *slices;  // cvector
+	uint32_t    *index;   // slice position + 1, 0 for empty slot
+	uint32_t     mask;
+	uint32_t     stack[TOPIC_SLICE_STACK_SLOTS];
+} topic_slice_set;
+
+/**
+ * @brief parse packet id and properties of SUB/UNSUB
+ *
+ * @param msg SUB/UNSUB packet
+ * @param ver protocol version
+ * @param sub true for SUBSCRIBE
+ * @param payload ptr to the first topic filter
+ * @param remain length of topic filters
+ * @param subid subscription identifier, 0 if absent
+ * @return int 0: ok; -1: protocol error; -2: unknown error; -3: malformed
+ */
+static int
+nmq_subunsub_header_decode(nng_msg *msg, uint8_t ver, bool sub,
+    uint8_t **payload, size_t *remain, uint32_t *subid)
+{
+	uint8_t *var_ptr = nni_msg_body(msg);
+	size_t   msg_len = nni_msg_len(msg);
+	uint8_t  len_of_varint = 0, len_of_id = 0;
+	uint32_t len = 0, len_of_str = 0, pid = 0;
+	size_t   pos, target_pos;
+
+	if (msg_len < 2)
+		return (-3);
+	NNI_GET16(var_ptr, pid);
+	if (pid == 0) {
+		log_warn(" 0 Packetid in %s request",
+		    sub ? "subscribe" : "unsubscribe");
+		return (-2);
+	}
+	if (ver == MQTT_PROTOCOL_VERSION_v5) {
+		if (msg_len < 3)
+			return (-3);
+		len = get_var_integer(var_ptr + 2, &len_of_varint);
+		if (len > msg_len)
+			return (-1);
+	}
+	pos        = 2 + len_of_varint;
+	target_pos = 2 + len_of_varint + len;
+	if (target_pos > msg_len)
+		return (-2);
+	*subid = 0;
+	while (pos < target_pos) {
+		switch (*(var_ptr + pos)) {
+		case USER_PROPERTY:
+			// ID Length
+			pos++;
+			for (int j = 0; j < 2; j++) {
+				// Check the index of key/value length
+				if (pos + 2 > target_pos)
+					return (-3);
+				NNI_GET16(var_ptr + pos, len_of_str);
+				pos += (2 + len_of_str);
+				// Check the index of properties
+				if (pos > target_pos)
+					return (-3);
+			}
+			break;
+		case SUBSCRIPTION_IDENTIFIER:
+			if (!sub) {
+				log_error("Invalid property id");
+				return (-2);
+			}
+			pos++;
+			// the varint must end inside the properties
+			for (len_of_id = 0; len_of_id < 4; len_of_id++) {
+				if (pos + len_of_id >= target_pos)
+					return (-3);
+				if ((var_ptr[pos + len_of_id] & 0x80) == 0)
+					break;
+			}
+			if (len_of_id == 4)
+				return (-3);
+			len_of_id = 0;
+			*subid    = get_var_integer(var_ptr + pos, &len_of_id);
+			if (*subid == 0)
+				return (-1);
+			pos += len_of_id;
+			break;
+		default:
+			log_error("Invalid property id");
+			return (-2);
+		}
+	}
+	if (pos > target_pos)
+		return (-2);
+
+	*payload = var_ptr + target_pos;
+	*remain  = msg_len - target_pos;
+	return (0);
+}
+
+static int
+topic_slice_set_find(topic_slice_set *set, const char *topic, size_t len,
+    uint32_t hash)
+{
+	uint32_t slot = hash & set->mask;
+
+	while (set->index[slot] != 0) {
+		topic_slice *ts = &set->slices[set->index[slot] - 1];
+		if (ts->hash == hash && ts->len == len &&
+		    memcmp(ts->topic, topic, len) == 0) {
+			return (int) (set->index[slot] - 1);
+		}
+		slot = (slot + 1) & set->mask;
+	}
+	return (-1);
+}
+
+static void
+topic_slice_set_fini(topic_slice_set *set)
+{
+	if (set->index != set->stack && set->index != NULL) {
+		nni_free(set->index, (set->mask + 1) * sizeof(uint32_t));
+	}
+	cvector_free(set->slices);
+	set->slices = NULL;
+	set->index  = NULL;
+}
+
+/**
+ * @brief decode topic filters of SUB/UNSUB as slices of msg body. A filter
+ * repeated in the same packet keeps its first position and the options
+ * of its last occurrence.
+ *
+ * @return int -1: protocol error; -2: unknown error; -3: malformed;
+ *         num: numbers of unique topics
+ */
+static int
+topic_slice_set_decode(topic_slice_set *set, nng_msg *msg, uint8_t ver,
+    bool sub, uint32_t *subid)
+{
+	uint8_t *payload;
+	size_t   remain, bpos, cnt = 0;
+	uint32_t slots;
+	uint16_t len_of_topic;
+	int      rv;
+
+	set->slices = NULL;
+	set->index  = NULL;
+	if ((rv = nmq_subunsub_header_decode(
+	         msg, ver, sub, &payload, &remain, subid)) != 0) {
+		return rv;
+	}
+	set->payload = payload;
+	// Validate and count first, then everything is sized once
+	for (bpos = 0; bpos < remain;) {
+		// Check the index of topic len
+		if (bpos + 2 > remain)
+			return (-3);
+		NNI_GET16(payload + bpos, len_of_topic);
+		bpos += 2 + len_of_topic + (sub ? 1 : 0);
+		// Check the index of topic body and option
+		if (bpos > remain)
+			return (-3);
+		if (len_of_topic != 0)
+			cnt++;
+	}
+	if (cnt == 0)
+		return (0);
+
+	if (cnt <= TOPIC_SLICE_STACK_SLOTS / 2) {
+		slots      = TOPIC_SLICE_STACK_SLOTS;
+		set->index = set->stack;
+		memset(set->stack, 0, sizeof(set->stack));
+	} else {
+		for (slots = TOPIC_SLICE_STACK_SLOTS; slots < cnt * 2;) {
+			slots <<= 1;
+		}
+		if ((set->index = nni_zalloc(slots * sizeof(uint32_t))) ==
+		    NULL) {
+			return (-2);
+		}
+	}
+	set->mask = slots - 1;
+	cvector_grow(set->slices, cnt);
+
+	for (bpos = 0; bpos < remain;) {
+		topic_slice ts;
+		int         i;
+
+		NNI_GET16(payload + bpos, len_of_topic);
+		bpos += 2;
+		if (len_of_topic == 0) {
+			bpos += sub ? 1 : 0;
+			continue;
+		}
+		ts.topic  = (char *) payload + bpos;
+		ts.len    = len_of_topic;
+		ts.hash   = fnv1a_hashn(ts.topic, ts.len);
+		ts.flag   = 0;
+		bpos += len_of_topic;
+		ts.option = sub ? *(payload + bpos++) : 0;
+		log_trace("The current process topic is %.*s", ts.len,
+		    ts.topic);
+
+		i = topic_slice_set_find(set, ts.topic, ts.len, ts.hash);
+		if (i >= 0) {
+			set->slices[i].option = ts.option;
+			continue;
+		}
+		uint32_t slot = ts.hash & set->mask;
+		while (set->index[slot] != 0) {
+			slot = (slot + 1) & set->mask;
+		}
+		cvector_push_back(set->slices, ts);
+		set->index[slot] = (uint32_t) cvector_size(set->slices);
+	}
+
+	return (int) cvector_size(set->slices);
+}
+
+int
+nmq_topic_slices_decode(
+    nng_msg *msg, uint8_t ver, topic_slice **slices, uint32_t *subid)
+{
+	topic_slice_set set;
+	uint32_t        id = 0;
+	int             rv;
+	bool            sub;
+
+	if (msg == NULL || slices == NULL)
+		return (-1);
+	switch (nni_msg_get_type(msg)) {
+	case CMD_SUBSCRIBE:
+		sub = true;
+		break;
+	case CMD_UNSUBSCRIBE:
+		sub = false;
+		break;
+	default:
+		return (-1);
+	}
+	rv = topic_slice_set_decode(&set, msg, ver, sub, &id);
+	if (rv >= 0) {
+		*slices     = set.slices;
+		set.slices  = NULL;
+		if (subid != NULL)
+			*subid = id;
+	}
+	topic_slice_set_fini(&set);
+	return (rv);
+}
+
+void
+nmq_topic_slices_free(topic_slice *slices)
+{
+	cvector_free(slices);
+}
+
 /**
  * @brief
  *
@@ -1337,98 +1883,61 @@ nano_msg_notify_connect(conn_param *cparam, uint8_t code)
 nano_pipe_db *
 nano_msg_get_subtopic(nni_msg *msg, nano_pipe_db *root, conn_param *cparam)
 {
-	char *        topic;
-	nano_pipe_db *db = NULL, *tmp = NULL, *iter = NULL;
-	uint8_t       len_of_topic = 0, len_of_varint = 0, *payload_ptr;
-	uint32_t      len;
-	size_t        bpos = 0, remain = 0;
-	bool          repeat = false;
+	topic_slice_set set;
+	nano_pipe_db   *db = NULL, *tmp = NULL, *iter = NULL;
+	uint32_t        subid;
+	int             rv, i;
 
 	if (nni_msg_get_type(msg) != CMD_SUBSCRIBE)
 		return NULL;
 
-	if (root != NULL) {
-		db = root;
-		while (db->next != NULL) {
-			db = db->next;
-		}
+	rv = topic_slice_set_decode(&set, msg, cparam->pro_ver, true, &subid);
+	if (rv <= 0) {
+		topic_slice_set_fini(&set);
+		return rv < 0 ? NULL : root;
 	}
+	nni_msg_set_payload_ptr(msg, set.payload);
 
-	if (cparam->pro_ver == MQTT_PROTOCOL_VERSION_v5) {
-		len = get_var_integer(
-		    (uint8_t *) nni_msg_body(msg) + 2, &len_of_varint);
-		payload_ptr =
-		    (uint8_t *) nni_msg_body(msg) + 2 + len + len_of_varint;
-	} else {
-		payload_ptr = (uint8_t *) nni_msg_body(msg) + 2;
-	}
-	nni_msg_set_payload_ptr(msg, payload_ptr);
-	remain = nni_msg_remaining_len(msg) - 2;
-
-	while (bpos < remain) {
-		NNI_GET16(payload_ptr + bpos, len_of_topic);
-
-		if (len_of_topic != 0) {
-
-			log_trace("The current process topic is %s",
-			    payload_ptr + bpos + 2);
-			iter = root;
-			while (iter) {
-				if (strlen(iter->topic) == len_of_topic &&
-				    !strncmp((char *) (payload_ptr + bpos + 2),
-				        iter->topic, len_of_topic)) {
-					repeat = true;
-					bpos += (2 + len_of_topic);
-					if (iter->qos !=
-					    *(payload_ptr + bpos)) {
-						iter->qos =
-						    *(payload_ptr + bpos);
-					}
-					bpos += 1;
-				}
-				iter = iter->next;
-			}
-
-			if (repeat) {
-				repeat = false;
-				continue;
-			}
+	// one pass over the existing table, only qos of them is updated
+	for (iter = root; iter != NULL; iter = iter->next) {
+		size_t len = strlen(iter->topic);
+		if (len > UINT16_MAX)
+			continue;
+		i = topic_slice_set_find(&set, iter->topic, len,
+		    fnv1a_hashn(iter->topic, len));
+		if (i >= 0) {
+			iter->qos            = set.slices[i].option;
+			set.slices[i].flag = 1;
+		}
+		db = iter;
+	}
 
-			if (NULL != db) {
-				tmp = db;
-				db  = db->next;
-			}
-			db       = nng_alloc(sizeof(nano_pipe_db));
-			topic    = nng_alloc(len_of_topic + 1);
-			db->prev = tmp;
-			if (bpos == 0 && root == NULL) {
-				root = db;
-			} else {
-				tmp->next = db;
-			}
-			db->root = root;
-			if (topic == NULL || db == NULL) {
-				nng_free(db, sizeof(nano_pipe_db));
-				nng_free(topic, len_of_topic + 1);
-				NNI_ASSERT("ERROR: nng_alloc");
-				return NULL;
-			} else {
-				bpos += 2;
-			}
-			strncpy(
-			    topic, (char *) payload_ptr + bpos, len_of_topic);
-			topic[len_of_topic] = 0x00;
-			db->topic           = topic;
-			bpos += len_of_topic;
-		} else {
-			NNI_ASSERT("ERROR : topic length error.");
+	for (i = 0; i < (int) cvector_size(set.slices); i++) {
+		topic_slice *ts = &set.slices[i];
+		if (ts->flag != 0)
+			continue;
+		tmp = db;
+		if ((db = nng_alloc(sizeof(nano_pipe_db))) == NULL ||
+		    (db->topic = nng_alloc(ts->len + 1)) == NULL) {
+			nng_free(db, sizeof(nano_pipe_db));
+			NNI_ASSERT("ERROR: nng_alloc");
+			topic_slice_set_fini(&set);
 			return NULL;
 		}
-		db->qos  = *(payload_ptr + bpos);
-		db->next = NULL;
+		memcpy(db->topic, ts->topic, ts->len);
+		db->topic[ts->len] = 0x00;
+		db->qos            = ts->option;
+		db->prev           = tmp;
+		db->next           = NULL;
+		if (root == NULL) {
+			root = db;
+		} else {
+			tmp->next = db;
+		}
+		db->root = root;
 		log_trace("sub topic: %s qos : %x\n", db->topic, db->qos);
-		bpos += 1;
 	}
+	topic_slice_set_fini(&set);
 
 	return root;
 }
@@ -1482,147 +1991,49 @@ nano_msg_ubsub_free(nano_pipe_db *db)
 	return;
 }
 
-static int
-nmq_subinfol_add_or(nni_list *l, struct subinfo *n)
-{
-	struct subinfo *sn = NULL;
-	NNI_LIST_FOREACH(l, sn) {
-		if (0 == strcmp(n->topic, sn->topic)) {
-			return -1;
-		}
-	}
-	nni_list_append(l, n);
-	return 0;
-}
-
-static void *
-nmq_subinfol_rm_or(nni_list *l, struct subinfo *n)
-{
-	struct subinfo *sn = NULL;
-	NNI_LIST_FOREACH(l, sn) {
-		if (0 == strcmp(n->topic, sn->topic)) {
-			break;
-		}
-	}
-	if (sn) {
-		nni_list_remove(l, sn);
-		return sn;
-	}
-	return NULL;
-}
-
 /**
- * @brief decode sub for subid, topics and RAP to subinfol
- * 	  warning only use with sub msg & V5 client
+ * @brief decode topic filters of SUB/UNSUB to a topic_queue, a repeated
+ * 	  filter is listed once with the qos of its last occurrence
  *
- * @param msg
- * @param ptr to subinfol
- * @return int -1: protocol error; -2: unknown error; num:numbers of topics
+ * @param msg SUB/UNSUB packet
+ * @param ver protocol version
+ * @param ptq ptr to topic_queue, release with topic_queue_release
+ * @return int -1: protocol error; -2: unknown error; -3: malformed;
+ *         num: numbers of topics
  */
 int
 nmq_subtopic_decode(nng_msg *msg, uint8_t ver, topic_queue **ptq)
 {
-	char           *topic;
-	uint8_t         *payload_ptr, len_of_varint = 0, *var_ptr;
-	uint32_t        num = 0, len, len_of_str = 0, subid = 0;
-	uint16_t        len_of_topic = 0;
-	size_t          bpos = 0, remain = 0;
-	topic_queue     *tq = NULL;
-	topic_queue     *curtq = NULL;
+	topic_slice *slices = NULL;
+	topic_queue *tq = NULL, *curtq = NULL, *next;
+	int          rv;
 
-	if (!msg)
+	if (!msg || !ptq)
 		return (-1);
 
-	var_ptr = nni_msg_body(msg);
-	len = 0;
-	len_of_varint = 0;
-	// get variable length of properties
-	if (ver == MQTT_PROTOCOL_VERSION_v5) {
-		len = get_var_integer(
-		    (uint8_t *) nni_msg_body(msg) + 2, &len_of_varint);
-		if (len > nni_msg_remaining_len(msg))
-			return -1;
+	if ((rv = nmq_topic_slices_decode(msg, ver, &slices, NULL)) <= 0) {
+		nmq_topic_slices_free(slices);
+		return (rv);
 	}
-	log_trace("prop len %d varint %d remain %d", len, len_of_varint, nni_msg_remaining_len(msg));
-	payload_ptr = (uint8_t *) nni_msg_body(msg) + 2 + len + len_of_varint;
-
-	size_t pos = 2 + len_of_varint;
-	size_t target_pos = 2 + len_of_varint + len;
-	while (pos < target_pos) {
-		switch (*(var_ptr + pos)) {
-		case USER_PROPERTY:
-			// key
-			NNI_GET16(var_ptr + pos, len_of_str);
-			pos += len_of_str;
-			if (pos > target_pos)
-				return (-3);
-			len_of_str = 0;
-			// value
-			NNI_GET16(var_ptr + pos, len_of_str);
-			pos += len_of_str;
-			if (pos > target_pos)
-				return (-3);
-			len_of_str = 0;
-			break;
-		case SUBSCRIPTION_IDENTIFIER:
-			subid = get_var_integer(var_ptr + pos, &len_of_varint);
-			if (subid == 0)
-				return (-1);
-			pos += len_of_varint;
-			break;
-		default:
-			log_error("Invalid property id");
+	for (int i = 0; i < rv; i++) {
+		if ((next = topic_queue_init(slices[i].topic, slices[i].len)) ==
+		    NULL) {
+			topic_queue_release(tq);
+			nmq_topic_slices_free(slices);
 			return (-2);
 		}
-	}
-	if (pos > target_pos || nni_msg_len(msg) < target_pos)
-		return (-2);
-
-	remain = nni_msg_remaining_len(msg) - target_pos;
-	while (bpos < remain) {
-		// Check the index of topic len
-		if (bpos + 2 > remain)
-			return (-3);
-		NNI_GET16(payload_ptr + bpos, len_of_topic);
-		if (len_of_str > remain)
-			return -1;
-		bpos += 2;
-
-		if (len_of_topic == 0)
-			continue;
-		// Check the index of topic body
-		if (bpos + len_of_topic > remain)
-			return (-3);
-
-		if ((topic = nng_alloc(len_of_topic + 1)) == NULL)
-			return (-2);
-
-		strncpy(topic, (char *) payload_ptr + bpos, len_of_topic);
-		topic[len_of_topic] = 0x00;
-
+		next->qos = slices[i].option & 0x03;
 		if (tq == NULL) {
-			tq = nng_alloc(sizeof(topic_queue));
-			curtq = tq;
-			curtq->topic = topic;
-			curtq->next = NULL;
+			tq = next;
 		} else {
-			curtq->next = nng_alloc(sizeof(topic_queue));
-			curtq->next->topic = topic;
-			curtq = curtq->next;
-			curtq->next = NULL;
+			curtq->next = next;
 		}
-
-		bpos += len_of_topic;
-		// Check the index of topic option
-		if (bpos > remain)
-			return (-3);
-
-		bpos += 1;
-		num++;
+		curtq = next;
 	}
+	nmq_topic_slices_free(slices);
 	*ptq = tq;
 
-	return num;
+	return (rv);
 }
 
 /**
@@ -1636,122 +2047,59 @@ nmq_subtopic_decode(nng_msg *msg, uint8_t ver, topic_queue **ptq)
 int
 nmq_subinfo_decode(nng_msg *msg, void *l, uint8_t ver)
 {
-	char           *topic;
-	uint8_t         *payload_ptr, len_of_varint = 0, *var_ptr;
-	uint32_t        num = 0, len = 0, len_of_str = 0, subid = 0;
-	uint16_t        len_of_topic = 0;
-	size_t          bpos = 0, remain = 0;
+	topic_slice_set set;
 	struct subinfo *sn = NULL;
 	nni_list       *ll = l;
+	uint32_t        subid = 0;
+	int             rv, i;
 
 	if (!l || !msg)
 		return (-1);
 
-	var_ptr = nni_msg_body(msg);
-
-	// get variable length of properties
-	if (ver == MQTT_PROTOCOL_VERSION_v5) {
-		len = get_var_integer(
-		    (uint8_t *) nni_msg_body(msg) + 2, &len_of_varint);
-		if (len > nni_msg_remaining_len(msg))
-			return -1;
-	}
-	uint32_t pid = 0;
-	NNI_GET16(var_ptr, pid);
-	if (pid == 0) {
-		log_warn(" 0 Packetid in subscribe request");
-		return -2;
+	if ((rv = topic_slice_set_decode(&set, msg, ver, true, &subid)) <= 0) {
+		topic_slice_set_fini(&set);
+		return (rv);
 	}
 
-	log_trace("prop len %d varint %d remain %d", len, len_of_varint, nni_msg_remaining_len(msg));
-	payload_ptr = (uint8_t *) nni_msg_body(msg) + 2 + len + len_of_varint;
-
-	size_t pos = 2 + len_of_varint, target_pos = 2 + len_of_varint + len;
-	while (pos < target_pos) {
-		switch (*(var_ptr + pos)) {
-		case USER_PROPERTY:
-			// ID Length
-			pos ++;
-			for (int j = 0; j < 2; j++) {
-				len_of_str = 0;
-				// key/Value length
-				NNI_GET16(var_ptr + pos, len_of_str);
-				pos += (2 + len_of_str);
-				// Check the index of properties
-				if (pos > target_pos)
-					return (-3);
-			}
-			break;
-		case SUBSCRIPTION_IDENTIFIER:
-			// count id length in len_of_varint
-			subid = get_var_integer(var_ptr + pos, &len_of_varint);
-			if (subid == 0)
-				return (-1);
-			pos += len_of_varint;
-			break;
-		default:
-			log_error("Invalid property id");
-			return (-2);
+	// existing subscriptions are replaced in place
+	NNI_LIST_FOREACH (ll, sn) {
+		size_t len = strlen(sn->topic);
+		if (len > UINT16_MAX)
+			continue;
+		i = topic_slice_set_find(
+		    &set, sn->topic, len, fnv1a_hashn(sn->topic, len));
+		if (i >= 0) {
+			// qos no_local rap retain_handling
+			memcpy(sn, &set.slices[i].option, 1);
+			sn->subid          = subid;
+			set.slices[i].flag = 1;
 		}
 	}
-	if (pos > target_pos || nni_msg_len(msg) < target_pos)
-		return (-2);
-
-	remain = nni_msg_remaining_len(msg) - target_pos;
-
-	while (bpos < remain) {
-		// Check the index of topic len
-		if (bpos + 2 > remain)
-			return (-3);
-		NNI_GET16(payload_ptr + bpos, len_of_topic);
-		if (len_of_str > remain)
-			return -1;
-		bpos += 2;
 
-		if (len_of_topic == 0)
+	for (i = 0; i < rv; i++) {
+		topic_slice *ts = &set.slices[i];
+		if (ts->flag != 0)
 			continue;
-		// Check the index of topic body
-		if (bpos + len_of_topic > remain)
-			return (-3);
-
-		log_trace(
-		    "The current process topic is %s", payload_ptr + bpos);
-		if ((sn = nng_alloc(sizeof(struct subinfo))) == NULL)
+		if ((sn = nng_alloc(sizeof(struct subinfo))) == NULL) {
+			topic_slice_set_fini(&set);
 			return (-2);
-		if ((topic = nng_alloc(len_of_topic + 1)) == NULL) {
+		}
+		if ((sn->topic = nng_alloc(ts->len + 1)) == NULL) {
 			nng_free(sn, sizeof(struct subinfo));
+			topic_slice_set_fini(&set);
 			return (-2);
 		}
-
-		strncpy(topic, (char *) payload_ptr + bpos, len_of_topic);
-		topic[len_of_topic] = 0x00;
-
-		sn->topic = topic;
-		bpos += len_of_topic;
-		// Check the index of topic option
-		if (bpos > remain)
-			return (-3);
-
-		sn->subid = subid;
+		memcpy(sn->topic, ts->topic, ts->len);
+		sn->topic[ts->len] = 0x00;
+		sn->subid          = subid;
 		// qos no_local rap retain_handling
-		sn->qos      = (uint8_t) ((0x03 & *(payload_ptr + bpos)));
-		sn->no_local = (uint8_t) ((0x04 & *(payload_ptr + bpos)));
-		sn->rap      = (uint8_t) ((0x08 & *(payload_ptr + bpos)) > 0);
-		sn->retain_handling = (uint8_t) ((0x1f & *(payload_ptr + bpos)));
-		memcpy(sn, payload_ptr + bpos, 1);
+		memcpy(sn, &ts->option, 1);
 		NNI_LIST_NODE_INIT(&sn->node);
-
-		if (0 != nmq_subinfol_add_or(ll, sn)) {
-			// already exists
-			nng_free(sn->topic, strlen(sn->topic));
-			nng_free(sn, sizeof(*sn));
-		}
-
-		bpos += 1;
-		num++;
+		nni_list_append(ll, sn);
 	}
+	topic_slice_set_fini(&set);
 
-	return num;
+	return (rv);
 }
 
 /**
@@ -1765,102 +2113,41 @@ nmq_subinfo_decode(nng_msg *msg, void *l, uint8_t ver)
 int
 nmq_unsubinfo_decode(nng_msg *msg, void *l, uint8_t ver)
 {
-	char    *topic;
-	uint8_t  len_of_topic = 0, len_of_varint = 0, *payload_ptr, *var_ptr;
-	uint32_t num = 0, len = 0, len_of_str = 0;
-	size_t   bpos = 0, remain = 0;
-	struct subinfo *sn = NULL, *sn2, snode;
+	topic_slice_set set;
+	struct subinfo *sn = NULL, *next;
 	nni_list       *ll = l;
+	uint32_t        subid;
+	int             rv;
 
 	if (!l || !msg)
 		return (-1);
 	// Check the index of property length
 	if (nni_msg_len(msg) < 3)
 		return (-3);
-	if (ver == MQTT_PROTOCOL_VERSION_v5) {
-		// get Property variable Length
-		len = get_var_integer(
-		    (uint8_t *) nni_msg_body(msg) + 2, &len_of_varint);
-		if (len > nni_msg_remaining_len(msg))
-			return -1;
-	}
-
-
-	var_ptr     = (uint8_t *) nni_msg_body(msg);
-	payload_ptr = (uint8_t *) nni_msg_body(msg) + 2 + len + len_of_varint;
-	size_t pos = 2 + len_of_varint, target_pos = 2 + len_of_varint + len;
-	uint32_t pid = 0;
-	NNI_GET16(var_ptr, pid);
-	if (pid == 0) {
-		log_warn(" 0 Packetid in unsubscribe request");
-		return -2;
-	}
-	while (pos < target_pos) {
-		switch (*(var_ptr + pos)) {
-		case USER_PROPERTY:
-			// ID Length
-			pos ++;
-			for (int j = 0; j < 2; j++) {
-				len_of_str = 0;
-				// key/Value length
-				NNI_GET16(var_ptr + pos, len_of_str);
-				pos += (2 + len_of_str);
-				// Check the index of properties
-				if (pos > target_pos)
-					return (-3);
-			}
-			break;
-		default:
-			log_error("Invalid property id");
-			return (-2);
-		}
-	}
-	if (pos > target_pos || nni_msg_len(msg) < target_pos)
-		return (-2);
-
-	remain = nni_msg_remaining_len(msg) - target_pos;
-
-	while (bpos < remain) {
-		// Check the index of topic len
-		if (bpos + 2 > remain)
-			return (-3);
-		NNI_GET16(payload_ptr + bpos, len_of_topic);
-		bpos += 2;
 
-		if (len_of_topic == 0)
-			continue;
-		// Check the index of topic body
-		if (bpos + len_of_topic > remain)
-			return (-3);
-
-		log_trace(
-		    "The current process topic is %s", payload_ptr + bpos);
-		if ((topic = nng_alloc(len_of_topic + 1)) == NULL)
-			return (-2);
-
-		strncpy(topic, (char *) payload_ptr + bpos, len_of_topic);
-		topic[len_of_topic] = 0x00;
-
-		bpos += len_of_topic;
-		// Check the index of topic option
-		if (bpos > remain) {
-			nng_free(topic, len_of_topic + 1);
-			return (-3);
-		}
-
-		snode.topic = topic;
-		sn = &snode;
-		if (NULL != (sn2 = nmq_subinfol_rm_or(ll, sn))) {
-			log_trace("Topic %s free from subinfol", sn2->topic);
-			nng_free(sn2->topic, strlen(sn2->topic));
-			nng_free(sn2, sizeof(*sn2));
+	if ((rv = topic_slice_set_decode(&set, msg, ver, false, &subid)) <= 0) {
+		topic_slice_set_fini(&set);
+		return (rv);
+	}
+
+	// one pass over subinfol, no topic is copied
+	sn = nni_list_first(ll);
+	while (sn != NULL) {
+		size_t len = strlen(sn->topic);
+		next       = nni_list_next(ll, sn);
+		if (len <= UINT16_MAX &&
+		    topic_slice_set_find(&set, sn->topic, len,
+		        fnv1a_hashn(sn->topic, len)) >= 0) {
+			log_trace("Topic %s free from subinfol", sn->topic);
+			nni_list_remove(ll, sn);
+			nng_free(sn->topic, len);
+			nng_free(sn, sizeof(*sn));
 		}
-		nng_free(topic, len_of_topic+1);
-
-		num++;
+		sn = next;
 	}
+	topic_slice_set_fini(&set);
 
-	return num;
+	return (rv);
 }
 
 
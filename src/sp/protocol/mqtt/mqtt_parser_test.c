@@ -144,6 +144,221 @@ test_hash()
 	NUTS_ASSERT(crc32c_hashn(str2, strlen(str2)) == 788723578);
 }
 
+// Bitwise crc32c, the reference of the table and instruction ones.
+static uint32_t
+crc32c_ref(const uint8_t *buf, size_t n)
+{
+	uint32_t crc = 0xffffffff;
+	while (n--) {
+		crc ^= *buf++;
+		for (int k = 0; k < 8; k++) {
+			crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+		}
+	}
+	return crc ^ 0xffffffff;
+}
+
+static void
+test_hash_crc32c()
+{
+	char buf[1100];
+
+	NUTS_ASSERT(crc32c_hashn("123456789", 9) == 0xe3069283);
+	NUTS_ASSERT(crc32c_hashn_sw("123456789", 9) == 0xe3069283);
+	NUTS_ASSERT(crc32c_hashn(buf, 0) == 0);
+
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = (char) (i * 131 + 7);
+	}
+	// every length up to a few words from every alignment
+	for (size_t off = 0; off < 8; off++) {
+		for (size_t n = 0; n < 80; n++) {
+			uint32_t crc = crc32c_ref((uint8_t *) buf + off, n);
+			NUTS_ASSERT(crc32c_hashn(buf + off, n) == crc);
+			NUTS_ASSERT(crc32c_hashn_sw(buf + off, n) == crc);
+		}
+	}
+	NUTS_ASSERT(crc32c_hashn(buf + 3, 1097) ==
+	    crc32c_ref((uint8_t *) buf + 3, 1097));
+}
+
+static void
+test_hash_wy()
+{
+	char     buf[256];
+	uint64_t h[256];
+
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = (char) i;
+	}
+	// every branch of the length switch, prefixes all differ
+	for (size_t n = 0; n < 256; n++) {
+		h[n] = wy_hashn(buf, n);
+		NUTS_ASSERT(h[n] == wy_hashn(buf, n));
+		for (size_t m = 0; m < n; m++) {
+			NUTS_ASSERT(h[m] != h[n]);
+		}
+	}
+	// one bit flipped changes about half of the bits
+	for (size_t n = 1; n < 100; n++) {
+		buf[n / 2] ^= 1;
+		int bits = __builtin_popcountll(wy_hashn(buf, n) ^ h[n]);
+		buf[n / 2] ^= 1;
+		NUTS_ASSERT(bits > 12 && bits < 52);
+	}
+}
+
+#ifdef NNG_TEST_BENCH
+#define HASH_BENCH_BYTES (64 * 1024 * 1024)
+
+static void
+hash_bench(const char *name, size_t len, uint64_t (*fn)(char *, size_t))
+{
+	static char buf[4096];
+	uint64_t    sum = 0;
+	size_t      n   = HASH_BENCH_BYTES / len;
+
+	memset(buf, 'h', sizeof(buf));
+	nng_time start = nng_clock();
+	for (size_t i = 0; i < n; i++) {
+		buf[0] = (char) i;
+		sum += fn(buf, len);
+	}
+	nng_time end = nng_clock();
+	printf("%-9s %4zu bytes x %8zu %5lums %x\n", name, len, n,
+	    (unsigned long) (end - start), (unsigned) sum);
+}
+
+static uint64_t
+bench_crc32c(char *s, size_t n)
+{
+	return crc32c_hashn(s, n);
+}
+
+static uint64_t
+bench_crc32c_sw(char *s, size_t n)
+{
+	return crc32c_hashn_sw(s, n);
+}
+
+static uint64_t
+bench_crc32(char *s, size_t n)
+{
+	return crc32_hashn(s, n);
+}
+
+static uint64_t
+bench_fnv1a(char *s, size_t n)
+{
+	return fnv1a_hashn(s, n);
+}
+
+static void
+test_hash_bench()
+{
+	size_t lens[] = { 16, 64, 4096 };
+
+	for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		hash_bench("crc32c", lens[i], bench_crc32c);
+		hash_bench("crc32c_sw", lens[i], bench_crc32c_sw);
+		hash_bench("crc32", lens[i], bench_crc32);
+		hash_bench("fnv1a", lens[i], bench_fnv1a);
+		hash_bench("wyhash", lens[i], wy_hashn);
+	}
+}
+#endif
+
+// CONNECT v5 with a will, username and password.
+static uint8_t connect_v5[] = {
+	0x10, 0x23,                        // CONNECT
+	0x00, 0x04, 'M', 'Q', 'T', 'T', 5, // protocol 5
+	0xc6, 0x00, 0x3c, 0x00,            // flags, keepalive 60, no props
+	0x00, 0x03, 'c', 'i', 'd',         // client id
+	0x00,                              // no will props
+	0x00, 0x03, 'w', '/', 't',         // will topic
+	0x00, 0x02, 'h', 'i',              // will msg
+	0x00, 0x02, 'u', '1',              // username
+	0x00, 0x03, 'p', 'w', 'd',         // password
+};
+
+// CONNECT 3.1.1 with an empty client id.
+static uint8_t connect_noid[] = {
+	0x10, 0x0c,
+	0x00, 0x04, 'M', 'Q', 'T', 'T', 4,
+	0x02, 0x00, 0x3c,
+	0x00, 0x00,
+};
+
+static int32_t
+connect_decode(conn_param **cpp, const uint8_t *pkt, size_t len)
+{
+	uint8_t *buf;
+
+	NUTS_PASS(conn_param_alloc(cpp));
+	NUTS_TRUE((buf = nng_alloc(len)) != NULL);
+	memcpy(buf, pkt, len);
+	return (conn_handler(buf, *cpp, len));
+}
+
+static void
+test_conn_handler()
+{
+	conn_param        *cp;
+	const mqtt_string *will;
+	uint8_t            bad[sizeof(connect_v5)];
+
+	NUTS_TRUE(connect_v5[1] == sizeof(connect_v5) - 2);
+	NUTS_TRUE(connect_decode(&cp, connect_v5, sizeof(connect_v5)) == 0);
+	NUTS_MATCH((char *) conn_param_get_pro_name(cp), "MQTT");
+	NUTS_MATCH((char *) conn_param_get_clientid(cp), "cid");
+	will = conn_param_get_will_topic(cp);
+	NUTS_MATCH(will->body, "w/t");
+	will = conn_param_get_will_msg(cp);
+	NUTS_MATCH(will->body, "hi");
+	NUTS_MATCH((char *) conn_param_get_username(cp), "u1");
+	NUTS_MATCH((char *) conn_param_get_password(cp), "pwd");
+	NUTS_TRUE(conn_param_get_protover(cp) == 5);
+	NUTS_TRUE(conn_param_get_keepalive(cp) == 60);
+	conn_param_clone(cp);
+	conn_param_free(cp);
+	NUTS_MATCH((char *) conn_param_get_clientid(cp), "cid");
+	conn_param_free(cp);
+
+	NUTS_TRUE(connect_decode(&cp, connect_noid, sizeof(connect_noid)) == 0);
+	NUTS_TRUE(strncmp((char *) conn_param_get_clientid(cp), "nanomq-", 7) ==
+	    0);
+	conn_param_free(cp);
+
+	// a bad username after the will, which is freed with the packet
+	memcpy(bad, connect_v5, sizeof(bad));
+	bad[sizeof(bad) - 7] = 0xff;
+	NUTS_TRUE(connect_decode(&cp, bad, sizeof(bad)) != 0);
+	conn_param_free(cp);
+}
+
+#ifdef NNG_TEST_BENCH
+// CONNECTs decoded a second, from packet to freed conn_param.
+static void
+test_conn_handler_bench()
+{
+	size_t   n     = 200000;
+	nng_time start = nng_clock();
+	nng_time end;
+
+	for (size_t i = 0; i < n; i++) {
+		conn_param *cp;
+		if (connect_decode(&cp, connect_v5, sizeof(connect_v5)) != 0) {
+			NUTS_TRUE(false);
+		}
+		conn_param_free(cp);
+	}
+	end = nng_clock();
+	printf("connect %8zu in %5lums, %8.0f/s\n", n,
+	    (unsigned long) (end - start),
+	    n * 1000.0 / (end > start ? end - start : 1));
+}
+#endif
+
 static void
 test_topic_filter()
 {
@@ -165,6 +380,142 @@ test_topic_filtern()
 	NUTS_ASSERT(topic_filtern(orgin, input, 11) == false);
 }
 
+static nng_msg *
+subunsub_msg(uint8_t cmd, bool v5, const char **topics, int n)
+{
+	nng_msg *msg;
+	uint8_t  hdr   = cmd | 0x02;
+	uint8_t  pid[] = { 0x00, 0x01 };
+	// property length 2, subscription identifier 7
+	uint8_t props[] = { 0x02, 0x0B, 0x07 };
+	uint8_t noprops = 0x00;
+
+	NUTS_PASS(nng_msg_alloc(&msg, 0));
+	NUTS_PASS(nng_msg_header_append(msg, &hdr, 1));
+	NUTS_PASS(nng_msg_append(msg, pid, sizeof(pid)));
+	if (v5) {
+		if (cmd == CMD_SUBSCRIBE) {
+			NUTS_PASS(nng_msg_append(msg, props, sizeof(props)));
+		} else {
+			NUTS_PASS(nng_msg_append(msg, &noprops, 1));
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		NUTS_PASS(nng_msg_append_u16(msg, strlen(topics[i])));
+		NUTS_PASS(nng_msg_append(msg, topics[i], strlen(topics[i])));
+		if (cmd == CMD_SUBSCRIBE) {
+			uint8_t opt = (uint8_t) (i % 3);
+			NUTS_PASS(nng_msg_append(msg, &opt, 1));
+		}
+	}
+	return msg;
+}
+
+static void
+test_topic_slices_decode()
+{
+	const char  *topics[] = { "a/b", "a/+", "a/b", "#", "a/+" };
+	topic_slice *slices   = NULL;
+	uint32_t     subid    = 0;
+	nng_msg     *msg;
+
+	msg = subunsub_msg(CMD_SUBSCRIBE, true, topics, 5);
+	NUTS_TRUE(nmq_topic_slices_decode(
+	              msg, MQTT_PROTOCOL_VERSION_v5, &slices, &subid) == 3);
+	NUTS_TRUE(subid == 7);
+	// first position, last options win
+	NUTS_TRUE(slices[0].len == 3);
+	NUTS_TRUE(strncmp(slices[0].topic, "a/b", 3) == 0);
+	NUTS_TRUE(slices[0].option == 2);
+	NUTS_TRUE(strncmp(slices[1].topic, "a/+", 3) == 0);
+	NUTS_TRUE(slices[1].option == 1);
+	NUTS_TRUE(slices[2].len == 1 && slices[2].topic[0] == '#');
+	// slices point into the msg body
+	NUTS_TRUE((uint8_t *) slices[0].topic > (uint8_t *) nng_msg_body(msg));
+	NUTS_TRUE((uint8_t *) slices[2].topic <
+	    (uint8_t *) nng_msg_body(msg) + nng_msg_len(msg));
+	nmq_topic_slices_free(slices);
+
+	// truncated packet
+	nng_msg_chop(msg, 2);
+	NUTS_TRUE(nmq_topic_slices_decode(
+	              msg, MQTT_PROTOCOL_VERSION_v5, &slices, &subid) < 0);
+	nng_msg_free(msg);
+
+	msg = subunsub_msg(CMD_UNSUBSCRIBE, false, topics, 5);
+	NUTS_TRUE(nmq_topic_slices_decode(
+	              msg, MQTT_PROTOCOL_VERSION_v311, &slices, NULL) == 3);
+	NUTS_TRUE(slices[1].option == 0);
+	nmq_topic_slices_free(slices);
+	nng_msg_free(msg);
+}
+
+static void
+test_topic_slices_subid_bound()
+{
+	topic_slice *slices = NULL;
+	nng_msg     *msg;
+	uint8_t      hdr = CMD_SUBSCRIBE | 0x02;
+	// subscription identifier continues past the properties
+	uint8_t body[] = { 0x00, 0x01, 0x02, 0x0B, 0x87, 0x00, 0x01, 'a',
+		0x00 };
+
+	NUTS_PASS(nng_msg_alloc(&msg, 0));
+	NUTS_PASS(nng_msg_header_append(msg, &hdr, 1));
+	NUTS_PASS(nng_msg_append(msg, body, sizeof(body)));
+	NUTS_TRUE(nmq_topic_slices_decode(
+	              msg, MQTT_PROTOCOL_VERSION_v5, &slices, NULL) == -3);
+	nmq_topic_slices_free(slices);
+	nng_msg_free(msg);
+}
+
+static void
+test_subtopic_decode()
+{
+	const char  *topics[] = { "a/b", "a/+", "a/b", "#" };
+	topic_queue *tq       = NULL, *iter;
+	nng_msg     *msg;
+
+	msg = subunsub_msg(CMD_SUBSCRIBE, true, topics, 4);
+	NUTS_TRUE(nmq_subtopic_decode(msg, MQTT_PROTOCOL_VERSION_v5, &tq) == 3);
+	iter = tq;
+	NUTS_MATCH(iter->topic, "a/b");
+	NUTS_TRUE(iter->qos == 2);
+	iter = iter->next;
+	NUTS_MATCH(iter->topic, "a/+");
+	NUTS_TRUE(iter->qos == 1);
+	iter = iter->next;
+	NUTS_MATCH(iter->topic, "#");
+	NUTS_TRUE(iter->qos == 0);
+	NUTS_NULL(iter->next);
+	topic_queue_release(tq);
+	nng_msg_free(msg);
+}
+
+static void
+test_topic_slices_decode_many()
+{
+	const char  *topics[1000];
+	char         buf[1000][32];
+	topic_slice *slices = NULL;
+	nng_msg     *msg;
+
+	// every filter sent twice, more than the stack index holds
+	for (int i = 0; i < 1000; i++) {
+		snprintf(buf[i], sizeof(buf[i]), "device/%d/#", i % 500);
+		topics[i] = buf[i];
+	}
+	msg = subunsub_msg(CMD_SUBSCRIBE, false, topics, 1000);
+	NUTS_TRUE(nmq_topic_slices_decode(
+	              msg, MQTT_PROTOCOL_VERSION_v311, &slices, NULL) == 500);
+	for (int i = 0; i < 500; i++) {
+		NUTS_TRUE(slices[i].len == strlen(buf[i]));
+		NUTS_TRUE(strncmp(slices[i].topic, buf[i], slices[i].len) == 0);
+	}
+	nmq_topic_slices_free(slices);
+	nng_msg_free(msg);
+}
+
 NUTS_TESTS = {
 	{ "mqtt_parser pub_extras", test_pub_extra },
 	{ "mqtt_parser utf8_check", test_utf8_check },
@@ -175,9 +526,24 @@ NUTS_TESTS = {
 	{ "mqtt_parser ws_msg_adaptor", test_ws_msg_adaptor },
 	// TODO more tests needed.
 	{ "mqtt_parser hash", test_hash },
+	{ "mqtt_parser hash crc32c", test_hash_crc32c },
+	{ "mqtt_parser hash wyhash", test_hash_wy },
+#ifdef NNG_TEST_BENCH
+	{ "mqtt_parser hash bench", test_hash_bench },
+#endif
+	{ "mqtt_parser conn_handler", test_conn_handler },
+#ifdef NNG_TEST_BENCH
+	{ "mqtt_parser conn_handler bench", test_conn_handler_bench },
+#endif
 	// TODO more tests needed.
 	{ "mqtt_parser topic_filter", test_topic_filter },
 	{ "mqtt_parser topic_filtern", test_topic_filtern },
+	{ "mqtt_parser topic_slices_decode", test_topic_slices_decode },
+	{ "mqtt_parser topic_slices_decode many",
+	    test_topic_slices_decode_many },
+	{ "mqtt_parser topic_slices_decode subid bound",
+	    test_topic_slices_subid_bound },
+	{ "mqtt_parser subtopic_decode", test_subtopic_decode },
 
 	{ NULL, NULL },
 };
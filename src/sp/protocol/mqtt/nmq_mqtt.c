@@ -20,6 +20,7 @@
 #include "nng/supplemental/nanolib/file.h"
 #include "nng/supplemental/nanolib/hash_table.h"
 #include "nng/supplemental/nanolib/mqtt_db.h"
+#include "nng/supplemental/nanolib/trace.h"
 #include "supplemental/mqtt/mqtt_qos_db_api.h"
 
 #define DB_NAME "nano_qos_db.db"
@@ -65,6 +66,12 @@ struct nano_sock {
 #ifdef NNG_SUPP_SQLITE
 	sqlite3 *sqlite_db;
 #endif
+	nni_stat_item st_publish_in;
+	nni_stat_item st_publish_out;
+	nni_stat_item st_dropped;
+	nni_stat_item st_resent;
+	nni_stat_item st_queued;  // in the send cache of pipes
+	nni_stat_item st_waiting; // events in waitlmq
 };
 
 // nano_pipe is our per-pipe protocol private structure.
@@ -172,6 +179,14 @@ nano_nni_lmq_fini(nni_lmq *lmq)
 	nni_free(lmq->lmq_msgs, lmq->lmq_alloc * sizeof(nng_msg *));
 }
 
+// Empties the send cache of a pipe, other than by sending it.
+static void
+nano_pipe_flush_rlmq(nano_pipe *p)
+{
+	nni_stat_dec(&p->broker->st_queued, nni_lmq_len(&p->rlmq));
+	nano_nni_lmq_flush(&p->rlmq, false);
+}
+
 static void
 nano_pipe_timer_cb(void *arg)
 {
@@ -266,6 +281,7 @@ nano_pipe_timer_cb(void *arg)
 				nni_aio_set_msg(&p->aio_send, msg);
 				log_trace(
 				    "resending qos msg packetid: %d", pid);
+				nni_stat_inc(&p->broker->st_resent, 1);
 				nni_pipe_send(p->pipe, &p->aio_send);
 				//  only remove msg from qos_db when get ack
 			}
@@ -392,6 +408,7 @@ nano_ctx_send(void *arg, nni_aio *aio)
 		nni_mtx_unlock(&s->lk);
 		nni_aio_set_msg(aio, NULL);
 		log_warn("pipe id %ld is gone, pub failed", pipe);
+		nni_stat_inc(&s->st_dropped, 1);
 		nni_msg_free(msg);
 		return;
 	}
@@ -425,6 +442,7 @@ nano_ctx_send(void *arg, nni_aio *aio)
 		} else {
 			// only cache QoS messages
 			log_debug("Drop msg due to qos == 0");
+			nni_stat_inc(&s->st_dropped, 1);
 			nni_msg_free(msg);
 		}
 		nni_mtx_unlock(&p->lk);
@@ -432,6 +450,9 @@ nano_ctx_send(void *arg, nni_aio *aio)
 		return;
 	}
 
+	if (nni_msg_get_type(msg) == CMD_PUBLISH) {
+		nni_stat_inc(&s->st_publish_out, 1);
+	}
 	if (!p->busy) {
 		p->busy = true;
 		nni_aio_set_msg(&p->aio_send, msg);
@@ -456,11 +477,14 @@ nano_ctx_send(void *arg, nni_aio *aio)
 				nni_msg *old;
 				nni_lmq_get(&p->rlmq, &old);
 				nni_msg_free(old);
+				nni_stat_dec(&s->st_queued, 1);
+				nni_stat_inc(&s->st_dropped, 1);
 			}
 		} else {
 			// Warning msg lost due to reach the limit of lmq
 			log_warn(
 			    "Warning: msg lost due to reach the limit of lmq");
+			nni_stat_inc(&s->st_dropped, 1);
 			nni_msg_free(msg);
 			nni_mtx_unlock(&p->lk);
 			nni_aio_set_msg(aio, NULL);
@@ -468,7 +492,9 @@ nano_ctx_send(void *arg, nni_aio *aio)
 		}
 	}
 
+	nni_msg_set_trace(msg, trace_now());
 	nni_lmq_put(&p->rlmq, msg);
+	nni_stat_inc(&s->st_queued, 1);
 
 	nni_mtx_unlock(&p->lk);
 	nni_aio_set_msg(aio, NULL);
@@ -484,6 +510,10 @@ nano_sock_fini(void *arg)
 		nni_qos_db_fini_sqlite(s->sqlite_db);
 	}
 #endif
+	// the tree outlives the socket
+	if (s->db != NULL) {
+		dbtree_set_shared_inflight_cb(s->db, NULL, NULL);
+	}
 	nni_id_map_fini(&s->pipes);
 	nni_id_map_fini(&s->cached_sessions);
 	// flush msg and conn params in waitlmq
@@ -498,13 +528,88 @@ nano_sock_fini(void *arg)
 	nni_msg_free(s->pingmsg);
 }
 
+static void
+nano_sock_waiting_update(nni_stat_item *item)
+{
+	nano_sock *s =
+	    (nano_sock *) ((char *) item - offsetof(nano_sock, st_waiting));
+
+	nni_mtx_lock(&s->lk);
+	nni_stat_set_value(item, nni_lmq_len(&s->waitlmq));
+	nni_mtx_unlock(&s->lk);
+}
+
+static void
+nano_add_sock_stat(
+    nni_sock *sock, nni_stat_item *item, const nni_stat_info *info)
+{
+	nni_stat_init(item, info);
+	nni_sock_add_stat(sock, item);
+}
+
+static void
+nano_sock_stats_init(nano_sock *s, nni_sock *sock)
+{
+	static const nni_stat_info publish_in_info = {
+		.si_name   = "publish_in",
+		.si_desc   = "PUBLISH packets received from clients",
+		.si_type   = NNG_STAT_COUNTER,
+		.si_unit   = NNG_UNIT_MESSAGES,
+		.si_atomic = true,
+		.si_percpu = true,
+	};
+	static const nni_stat_info publish_out_info = {
+		.si_name   = "publish_out",
+		.si_desc   = "PUBLISH packets handed to client pipes",
+		.si_type   = NNG_STAT_COUNTER,
+		.si_unit   = NNG_UNIT_MESSAGES,
+		.si_atomic = true,
+		.si_percpu = true,
+	};
+	static const nni_stat_info dropped_info = {
+		.si_name   = "dropped",
+		.si_desc   = "messages dropped on the way to clients",
+		.si_type   = NNG_STAT_COUNTER,
+		.si_unit   = NNG_UNIT_MESSAGES,
+		.si_atomic = true,
+		.si_percpu = true,
+	};
+	static const nni_stat_info resent_info = {
+		.si_name   = "qos_resent",
+		.si_desc   = "QoS messages resent for want of an ack",
+		.si_type   = NNG_STAT_COUNTER,
+		.si_unit   = NNG_UNIT_MESSAGES,
+		.si_atomic = true,
+	};
+	static const nni_stat_info queued_info = {
+		.si_name   = "queued",
+		.si_desc   = "messages waiting in the send caches of pipes",
+		.si_type   = NNG_STAT_LEVEL,
+		.si_unit   = NNG_UNIT_MESSAGES,
+		.si_atomic = true,
+		.si_percpu = true,
+	};
+	static const nni_stat_info waiting_info = {
+		.si_name   = "waiting",
+		.si_desc   = "events waiting for a receiving context",
+		.si_type   = NNG_STAT_LEVEL,
+		.si_unit   = NNG_UNIT_MESSAGES,
+		.si_update = nano_sock_waiting_update,
+	};
+
+	nano_add_sock_stat(sock, &s->st_publish_in, &publish_in_info);
+	nano_add_sock_stat(sock, &s->st_publish_out, &publish_out_info);
+	nano_add_sock_stat(sock, &s->st_dropped, &dropped_info);
+	nano_add_sock_stat(sock, &s->st_resent, &resent_info);
+	nano_add_sock_stat(sock, &s->st_queued, &queued_info);
+	nano_add_sock_stat(sock, &s->st_waiting, &waiting_info);
+}
+
 static void
 nano_sock_init(void *arg, nni_sock *sock)
 {
 	nano_sock *s = arg;
 
-	NNI_ARG_UNUSED(sock);
-
 	nni_mtx_init(&s->lk);
 
 	nni_id_map_init(&s->pipes, 0, 0, false);
@@ -517,6 +622,7 @@ nano_sock_init(void *arg, nni_sock *sock)
 	nni_atomic_set(&s->ttl, 8);
 
 	(void) nano_ctx_init(&s->ctx, s);
+	nano_sock_stats_init(s, sock);
 
 	log_trace("************* nano_sock_init %p *************", s);
 	// We start off without being either readable or writable.
@@ -602,6 +708,7 @@ nano_pipe_fini(void *arg)
 	nni_aio_fini(&p->aio_send);
 	nni_aio_fini(&p->aio_recv);
 	nni_aio_fini(&p->aio_timer);
+	nni_stat_dec(&p->broker->st_queued, nni_lmq_len(&p->rlmq));
 	nano_nni_lmq_fini(&p->rlmq);
 }
 
@@ -819,7 +926,7 @@ close_pipe(nano_pipe *p)
 	if (t == p)
 		nni_id_remove(&s->pipes, nni_pipe_id(p->pipe));
 	nni_mtx_unlock(&s->lk);
-	nano_nni_lmq_flush(&p->rlmq, false);
+	nano_pipe_flush_rlmq(p);
 }
 
 static int
@@ -871,7 +978,7 @@ nano_pipe_close(void *arg)
 					conn_param_free(p->conn_param);
 					nni_list_remove(&s->recvpipes, p);
 				}
-				nano_nni_lmq_flush(&p->rlmq, false);
+				nano_pipe_flush_rlmq(p);
 				nni_mtx_unlock(&s->lk);
 				nni_mtx_unlock(&p->lk);
 				return -1;
@@ -970,6 +1077,11 @@ nano_pipe_send_cb(void *arg)
 
 	nni_aio_set_prov_data(&p->aio_send, 0);
 	if (nni_lmq_get(&p->rlmq, &msg) == 0) {
+		nni_stat_dec(&p->broker->st_queued, 1);
+		if (nni_msg_get_type(msg) == CMD_PUBLISH) {
+			trace_span(
+			    TRACE_QUEUE, nni_msg_get_trace(msg), p->id);
+		}
 		nni_aio_set_msg(&p->aio_send, msg);
 		log_trace("rlmq msg resending! %ld msgs left\n",
 		    nni_lmq_len(&p->rlmq));
@@ -1175,6 +1287,9 @@ nano_pipe_recv_cb(void *arg)
 		break;
 	case CMD_CONNACK:
 	case CMD_PUBLISH:
+		if (type == CMD_PUBLISH) {
+			nni_stat_inc(&s->st_publish_in, 1);
+		}
 		// 1. Clone for App layer 2. Clone should be called before being used
 		conn_param_clone(cparam);
 		break;
@@ -1185,6 +1300,7 @@ nano_pipe_recv_cb(void *arg)
 		p->rid = ackid + 1;
 		if ((qos_msg = nni_qos_db_get(is_sqlite, npipe->nano_qos_db,
 		         npipe->p_id, ackid)) != NULL) {
+			trace_span(TRACE_QOS, nni_msg_get_trace(qos_msg), p->id);
 			nni_qos_db_remove_msg(
 			    is_sqlite, npipe->nano_qos_db, qos_msg);
 			nni_qos_db_remove(
@@ -1207,6 +1323,8 @@ nano_pipe_recv_cb(void *arg)
 		} else {
 			if (nni_lmq_put(&p->rlmq, s->pingmsg) != 0) {
 				nni_msg_free(s->pingmsg);
+			} else {
+				nni_stat_inc(&s->st_queued, 1);
 			}
 		}
 		nni_mtx_unlock(&p->lk);
@@ -1349,6 +1467,36 @@ nano_sock_recv(void *arg, nni_aio *aio)
 	nano_ctx_recv(&s->ctx, aio);
 }
 
+// Queue depth of a pipe for least_inflight $share groups: its send cache
+// and, without sqlite, its unacked QoS messages.  Called by the dbtree
+// with its read lock held.
+static uint32_t
+nano_pipe_inflight(uint32_t pipe_id, void *arg)
+{
+	nano_sock *s = arg;
+	nni_pipe  *npipe;
+	nano_pipe *p;
+	uint32_t   depth = UINT32_MAX;
+
+	// The hold keeps p from being finalized.  s->lk is not taken, as
+	// nano_pipe_close takes it after p->lk.
+	if (nni_pipe_find(&npipe, pipe_id) != 0) {
+		return (depth);
+	}
+	p = npipe->p_proto_data;
+	if (p != NULL && npipe->p_proto_ops.pipe_fini == nano_pipe_fini &&
+	    p->broker == s) {
+		nni_mtx_lock(&p->lk);
+		depth = (uint32_t) nni_lmq_len(&p->rlmq);
+		if (!s->conf->sqlite.enable && npipe->nano_qos_db != NULL) {
+			depth += ((nni_id_map *) npipe->nano_qos_db)->id_count;
+		}
+		nni_mtx_unlock(&p->lk);
+	}
+	nni_pipe_rele(npipe);
+	return (depth);
+}
+
 static void
 nano_sock_setdb(void *arg, void *data)
 {
@@ -1358,6 +1506,17 @@ nano_sock_setdb(void *arg, void *data)
 	s->conf = nano_conf;
 	s->db   = nano_conf->db_root;
 
+	// $share dispatch of the tree follows mqtt.shared_subscription
+	if (s->db != NULL) {
+		conf_shared_sub *shared = &nano_conf->shared_sub;
+		dbtree_set_shared_strategy(s->db, NULL, shared->strategy);
+		for (size_t i = 0; i < shared->count; i++) {
+			dbtree_set_shared_strategy(s->db,
+			    shared->groups[i]->name, shared->groups[i]->strategy);
+		}
+		dbtree_set_shared_inflight_cb(s->db, nano_pipe_inflight, s);
+	}
+
 #ifdef NNG_SUPP_SQLITE
 	if (s->conf->sqlite.enable) {
 
@@ -18,6 +18,7 @@
 #include "nng/protocol/mqtt/mqtt_parser.h"
 #include "nng/supplemental/nanolib/conf.h"
 #include "nng/supplemental/nanolib/mqtt_db.h"
+#include "nng/supplemental/nanolib/trace.h"
 #include "supplemental/mqtt/mqtt_msg.h"
 #include "supplemental/mqtt/mqtt_qos_db_api.h"
 
@@ -43,6 +44,10 @@ struct tcptran_pipe {
 	uint8_t         pro_ver;
 	uint8_t        *conn_buf;
 	uint8_t        *qos_buf; // msg trunk for qos & V4/V5 conversion
+	uint8_t        *rxbuf;   // packets read ahead, rxlen if unbuffered
+	size_t          rxcap;
+	size_t          rxpos; // start of the next packet in rxbuf
+	size_t          rxend; // end of the bytes read into rxbuf
 	nni_aio        *txaio;
 	nni_aio        *rxaio;
 	nni_aio        *qsaio;   // send qos ack/rel
@@ -61,6 +66,8 @@ struct tcptran_pipe {
 	// MQTT V5
 	uint16_t qrecv_quota;
 	uint32_t qsend_quota;
+	uint64_t rxstart; // trace_now() of the first byte of a packet
+	uint64_t txstart; // trace_now() of a publish write
 };
 
 struct tcptran_ep {
@@ -165,6 +172,7 @@ tcptran_pipe_init(void *arg, nni_pipe *npipe)
 	char         *cid;
 	tcptran_pipe *p            = arg;
 	uint32_t      clientid_key = 0;
+	uint8_t      *rxbuf;
 
 	nni_pipe_set_conn_param(npipe, p->tcp_cparam);
 	cid = (char *) conn_param_get_clientid(p->tcp_cparam);
@@ -177,6 +185,15 @@ tcptran_pipe_init(void *arg, nni_pipe *npipe)
 
 	nni_lmq_init(&p->rslmq, 16);
 	p->qos_buf = nng_zalloc(16 + NNI_NANO_MAX_PACKET_SIZE);
+	p->rxbuf   = p->rxlen;
+	p->rxcap   = NNI_NANO_MAX_HEADER_SIZE;
+	p->rxpos   = 0;
+	p->rxend   = 0;
+	if (p->conf != NULL && p->conf->recv_buffer_size > p->rxcap &&
+	    (rxbuf = nng_alloc(p->conf->recv_buffer_size)) != NULL) {
+		p->rxbuf = rxbuf;
+		p->rxcap = p->conf->recv_buffer_size;
+	}
 	log_trace(" ************ tcptran_pipe_init [%p] ************ ", p);
 	return (0);
 }
@@ -206,6 +223,9 @@ tcptran_pipe_fini(void *arg)
 		nni_msg_free(p->rxmsg);
 
 	nng_free(p->qos_buf, 16 + NNI_NANO_MAX_PACKET_SIZE);
+	if (p->rxbuf != NULL && p->rxbuf != p->rxlen) {
+		nng_free(p->rxbuf, p->rxcap);
+	}
 	nng_stream_free(p->conn);
 	nni_aio_free(p->qsaio);
 	nni_aio_free(p->rpaio);
@@ -376,10 +396,10 @@ tcptran_pipe_nego_cb(void *arg)
 			code = SERVER_UNAVAILABLE;
 			goto error;
 		}
-		if ((rv = conn_handler(
-		         p->conn_buf, p->tcp_cparam, p->wantrxhead)) == 0) {
-			nng_free(p->conn_buf, p->wantrxhead);
-			p->conn_buf = NULL;
+		// the packet goes with the strings sliced from it
+		rv = conn_handler(p->conn_buf, p->tcp_cparam, p->wantrxhead);
+		p->conn_buf = NULL;
+		if (rv == 0) {
 			// connection packet handled successfully. clone it for
 			// protocol or app layer
 			conn_param_clone(p->tcp_cparam);
@@ -410,7 +430,6 @@ tcptran_pipe_nego_cb(void *arg)
 			return;
 		} else {
 			log_info("Disconnect Client due to %d parse CONNECT failed", rv);
-			nng_free(p->conn_buf, p->wantrxhead);
 			rv   = NNG_ENOMEM;
 			code = MALFORMED_PACKET;
 			if (p->tcp_cparam->pro_ver == 5) {
@@ -638,6 +657,8 @@ exit:
 		header = nni_msg_header(msg);
 		// parse result code TODO verify bug
 		flag = header[3];
+	} else if (cmd == CMD_PUBLISH) {
+		trace_span(TRACE_WRITE, p->txstart, p->npipe->p_id);
 	}
 	// nni_pipe_bump_tx(p->npipe, n);
 	nni_mtx_unlock(&p->mtx);
@@ -654,140 +675,106 @@ exit:
 }
 
 /*
- * deal with MQTT protocol
- * insure read complete MQTT packet from socket
+ * Takes the next packet out of the receive buffer.  Packets that fit in it
+ * are read many at a time and copied out, larger ones are read straight
+ * into their msg after the bytes already buffered.
+ * Returns 0 with the packet, NNG_EAGAIN when a read has been scheduled for
+ * more of it, or the reason to close the connection for.
  */
-static void
-tcptran_pipe_recv_cb(void *arg)
+static int
+tcptran_pipe_recv_next(tcptran_pipe *p, nni_msg **msgp)
 {
-	nni_aio      *aio = NULL;
-	nni_iov       iov[2];
-	uint8_t       type = 0, rv = 0;
-	uint8_t       pos   = 0;
-	uint32_t      len   = 0;
-	nni_msg      *msg   = NULL, *qmsg = NULL;
-	tcptran_pipe *p     = arg;
-	nni_aio      *rxaio = p->rxaio;
-	bool          ack   = false;
-
-	log_trace("tcptran_pipe_recv_cb %p\n", p);
-	nni_mtx_lock(&p->mtx);
-
-	aio = nni_list_first(&p->recvq);
-
-	if ((rv = nni_aio_result(rxaio)) != 0) {
-		log_warn("nni aio recv error!! %s\n", nng_strerror(rv));
-		nni_pipe_bump_error(p->npipe, rv);
-		if (rv == NNG_ECONNRESET || rv == NNG_ECONNSHUT ||
-		    rv == NNG_ECLOSED) {
-			// peer shutting down
-			rv = NMQ_SERVER_SHUTTING_DOWN;
-		} else if (rv == NNG_ENOMEM) {
-			rv = NMQ_SERVER_BUSY;
-		} else {
-			rv = NMQ_UNSEPECIFY_ERROR;
-		}
-		goto recv_error;
-	}
-
-	p->gotrxhead += nni_aio_count(rxaio);
+	uint8_t *buf   = p->rxbuf + p->rxpos;
+	size_t   avail = p->rxend - p->rxpos;
+	size_t   hlen  = 0;
+	uint32_t len   = 0;
+	nni_msg *msg;
+	nni_iov  iov;
 
-	nni_aio_iov_advance(rxaio, nni_aio_count(rxaio));
-	log_trace("newly recevied %ld totoal received: %ld",
-	    nni_aio_count(rxaio), p->gotrxhead);
-	// not receive enough bytes, deal with remaining length
-	if (nni_aio_iov_count(rxaio) > 0) {
-		log_trace("got: %x %x, %ld!!\n", p->rxlen[0], p->rxlen[1],
-		    strlen((char *) p->rxlen));
-		nng_stream_recv(p->conn, rxaio);
-		nni_mtx_unlock(&p->mtx);
-		return;
-	} else if (p->gotrxhead <= NNI_NANO_MAX_HEADER_SIZE &&
-	    p->rxlen[p->gotrxhead - 1] > 0x7f) {
-		// length error
-		if (p->gotrxhead == NNI_NANO_MAX_HEADER_SIZE) {
-			rv = NNG_EMSGSIZE;
+	// remaining length, as far as it has been read
+	for (size_t i = 1; i < avail && hlen == 0; i++) {
+		len |= (uint32_t) (buf[i] & 0x7f) << (7 * (i - 1));
+		if ((buf[i] & 0x80) == 0) {
+			hlen = i + 1;
+		} else if (i == NNI_NANO_MAX_HEADER_SIZE - 1) {
 			log_warn("MALFORMED_PACKET received.");
-			goto recv_error;
+			return (NNG_EMSGSIZE);
 		}
-		// same packet, continue receving next byte of remaining length
-		iov[0].iov_buf = &p->rxlen[p->gotrxhead];
-		iov[0].iov_len = 1;
-		nni_aio_set_iov(rxaio, 1, iov);
-		nng_stream_recv(p->conn, rxaio);
-		nni_mtx_unlock(&p->mtx);
-		return;
 	}
 
-	if (p->rxmsg == NULL) {
-		if ((rv = mqtt_get_remaining_length(
-		         p->rxlen, p->gotrxhead, &len, &pos)) != 0) {
-			rv = PAYLOAD_FORMAT_INVALID;
-			goto recv_error;
-		}
-
-		// finish fixed header
-		p->wantrxhead = len + p->gotrxhead;
-		// We should have gotten a message header. len -> remaining
-		// length to define how many bytes left
-		log_trace("pipe %p header got: %x %x %x %x %x, %ld!!\n", p,
-		    p->rxlen[0], p->rxlen[1], p->rxlen[2], p->rxlen[3],
-		    p->rxlen[4], p->wantrxhead);
-		// Make sure the message payload is not too big.  If it is
-		// the caller will shut down the pipe.
-		if (len > p->conf->max_packet_size) {
-			// log_error("Size of packet exceeds limitation: 0x95\n");
-			// rv = NMQ_PACKET_TOO_LARGE;
-			// goto recv_error;
-		}
-
-		if ((rv = nni_msg_alloc(&p->rxmsg, (size_t) len)) != 0) {
-			log_error("Mem error %ld\n", (size_t) len);
-			rv = NMQ_SERVER_UNAVAILABLE;
-			goto recv_error;
+	if (hlen == 0 || hlen + len > avail) {
+		if (hlen == 0 || hlen + len <= p->rxcap) {
+			// read the rest in behind what we have
+			if (p->rxpos != 0) {
+				memmove(p->rxbuf, buf, avail);
+				p->rxpos = 0;
+				p->rxend = avail;
+			}
+			iov.iov_buf = p->rxbuf + p->rxend;
+			iov.iov_len = p->rxcap - p->rxend;
+			nni_aio_set_iov(p->rxaio, 1, &iov);
+			nng_stream_recv(p->conn, p->rxaio);
+			return (NNG_EAGAIN);
 		}
+	}
 
-		nni_msg_set_remaining_len(p->rxmsg, len);
-		if ((rv = nni_msg_header_append(p->rxmsg, p->rxlen, pos+1)) != 0) {
-			rv = NMQ_SERVER_UNAVAILABLE;
-			goto recv_error;
-		}
-		// Submit the rest of the data for a read -- seperate Fixed
-		// header with variable header and so on
-		//  we want to read the entire message now.
-		if (len != 0) {
-			iov[0].iov_buf = nni_msg_body(p->rxmsg);
-			iov[0].iov_len = (size_t) len;
-
-			nni_aio_set_iov(rxaio, 1, iov);
-			// second recv action
-			nng_stream_recv(p->conn, rxaio);
-			nni_mtx_unlock(&p->mtx);
-			return;
+	log_trace("pipe %p header got: %x %x, len %u", p, buf[0], buf[1], len);
+	if (nni_msg_alloc(&msg, (size_t) len) != 0) {
+		log_error("Mem error %ld\n", (size_t) len);
+		return (NMQ_SERVER_UNAVAILABLE);
+	}
+	nni_msg_set_remaining_len(msg, len);
+	if (nni_msg_header_append(msg, buf, hlen) != 0) {
+		nni_msg_free(msg);
+		return (NMQ_SERVER_UNAVAILABLE);
+	}
+	if (hlen + len <= avail) {
+		memcpy(nni_msg_body(msg), buf + hlen, len);
+		p->rxpos += hlen + len;
+		if (p->rxpos == p->rxend) {
+			p->rxpos = 0;
+			p->rxend = 0;
 		}
+		*msgp = msg;
+		return (0);
 	}
 
-	// We read a message completely.  Let the user know the good news. use
-	// as application message callback of users
-	nni_aio_list_remove(aio);
-	msg      = p->rxmsg;
-	type     = p->rxlen[0] & 0xf0;
-	p->rxmsg = NULL;
+	// too large for the buffer, which holds nothing past its start
+	memcpy(nni_msg_body(msg), buf + hlen, avail - hlen);
+	p->rxpos    = 0;
+	p->rxend    = 0;
+	p->rxmsg    = msg;
+	iov.iov_buf = (uint8_t *) nni_msg_body(msg) + avail - hlen;
+	iov.iov_len = len - (avail - hlen);
+	nni_aio_set_iov(p->rxaio, 1, &iov);
+	nng_stream_recv(p->conn, p->rxaio);
+	return (NNG_EAGAIN);
+}
+
+/*
+ * Checks a complete packet and sends the acks it needs, before it is
+ * handed to the protocol.  The caller frees the msg if this fails.
+ */
+static int
+tcptran_pipe_recv_msg(tcptran_pipe *p, nni_msg *msg)
+{
+	nni_iov  iov[2];
+	uint8_t  type = *(uint8_t *) nni_msg_header(msg) & 0xf0;
+	int      rv   = 0;
+	nni_msg *qmsg = NULL;
+	bool     ack  = false;
 
 	if (nni_msg_len(msg) == 0 &&
 	    (type == CMD_SUBSCRIBE || type == CMD_PUBLISH ||
 	        type == CMD_UNSUBSCRIBE)) {
 		log_warn("Invalid Packet Type: 0 len received! Connection closed.");
-		rv = MALFORMED_PACKET;
-		goto recv_error;
+		return (MALFORMED_PACKET);
 	} else if (type == CMD_CONNACK) {
 		log_warn("Got invalid CONNACK from client!");
-		rv = MALFORMED_PACKET;
-		goto recv_error;
+		return (MALFORMED_PACKET);
 	} else if (type == CMD_CONNECT) {
 		log_warn("Got invalid CONNECT from client!");
-		rv = MALFORMED_PACKET;
-		goto recv_error;
+		return (MALFORMED_PACKET);
 	}
 	nni_msg_set_conn_param(msg, p->tcp_cparam);
 	nni_msg_set_cmd_type(msg, type);
@@ -808,8 +795,7 @@ tcptran_pipe_recv_cb(void *arg)
 				if (p->qrecv_quota > 0) {
 					p->qrecv_quota--;
 				} else {
-					rv = NMQ_RECEIVE_MAXIMUM_EXCEEDED;
-					goto recv_error;
+					return (NMQ_RECEIVE_MAXIMUM_EXCEEDED);
 				}
 			}
 			if (qos_pac == 1) {
@@ -818,13 +804,11 @@ tcptran_pipe_recv_cb(void *arg)
 				ack_cmd = CMD_PUBREC;
 			} else {
 				log_warn("Wrong QoS level!");
-				rv = PROTOCOL_ERROR;
-				goto recv_error;
+				return (PROTOCOL_ERROR);
 			}
 			if ((packet_id = nni_msg_get_pub_pid(msg)) == 0) {
 				log_warn("0 Packet ID in QoS Message!");
-				rv = PROTOCOL_ERROR;
-				goto recv_error;
+				return (PROTOCOL_ERROR);
 			}
 			ack = true;
 		}
@@ -832,7 +816,7 @@ tcptran_pipe_recv_cb(void *arg)
 		if ((rv = nni_mqtt_pubres_decode(msg, &packet_id, &reason_code,
 		         &prop, p->pro_ver)) != 0) {
 			log_error("decode PUBREC variable header failed!");
-			goto recv_error;
+			return (rv);
 		}
 		ack_cmd = CMD_PUBREL;
 		ack     = true;
@@ -840,13 +824,12 @@ tcptran_pipe_recv_cb(void *arg)
 		// verify msg header
 		uint8_t *header = nni_msg_header(msg);
 		if (*header != 0X62) {
-			rv = PROTOCOL_ERROR;
-			goto recv_error;
+			return (PROTOCOL_ERROR);
 		}
 		if ((rv = nni_mqtt_pubres_decode(msg, &packet_id, &reason_code,
 		         &prop, p->pro_ver)) != 0) {
 			log_error("decode PUBREL variable header failed!");
-			goto recv_error;
+			return (rv);
 		}
 		ack_cmd = CMD_PUBCOMP;
 		ack     = true;
@@ -855,7 +838,7 @@ tcptran_pipe_recv_cb(void *arg)
 		         &prop, p->pro_ver)) != 0) {
 			log_error("decode PUBACK or PUBCOMP variable header "
 			          "failed!");
-			goto recv_error;
+			return (rv);
 		}
 		// MQTT V5 flow control
 		if (p->pro_ver == MQTT_PROTOCOL_VERSION_v5) {
@@ -869,10 +852,7 @@ tcptran_pipe_recv_cb(void *arg)
 		if (nmq_unsubinfo_decode(msg, p->npipe->subinfol,
 								  p->tcp_cparam->pro_ver) < 0) {
 			log_error("Invalid unsubscribe packet!");
-			// nni_msg_free(msg);
-			// conn_param_free(cparam);
-			rv = PROTOCOL_ERROR;
-			goto recv_error;
+			return (PROTOCOL_ERROR);
 		}
 	}
 
@@ -880,9 +860,7 @@ tcptran_pipe_recv_cb(void *arg)
 		// alloc a msg here costs memory. However we must do it for the
 		// sake of compatibility with nng.
 		if ((rv = nni_msg_alloc(&qmsg, 0)) != 0) {
-			ack = false;
-			rv  = NMQ_SERVER_BUSY;
-			goto recv_error;
+			return (NMQ_SERVER_BUSY);
 		}
 		// TODO set reason code or property here if necessary
 		nni_msg_set_cmd_type(qmsg, ack_cmd);
@@ -930,7 +908,78 @@ tcptran_pipe_recv_cb(void *arg)
 					nni_msg_free(qmsg);
 			}
 		}
-		ack = false;
+	}
+
+	if (type == CMD_PUBLISH) {
+		trace_span(TRACE_DECODE, p->rxstart, p->npipe->p_id);
+	}
+	return (0);
+}
+
+/*
+ * deal with MQTT protocol
+ * insure read complete MQTT packet from socket
+ */
+static void
+tcptran_pipe_recv_cb(void *arg)
+{
+	nni_aio      *aio = NULL;
+	int           rv;
+	size_t        n;
+	nni_msg      *msg   = NULL;
+	tcptran_pipe *p     = arg;
+	nni_aio      *rxaio = p->rxaio;
+
+	log_trace("tcptran_pipe_recv_cb %p\n", p);
+	nni_mtx_lock(&p->mtx);
+
+	aio = nni_list_first(&p->recvq);
+
+	if ((rv = nni_aio_result(rxaio)) != 0) {
+		log_warn("nni aio recv error!! %s\n", nng_strerror(rv));
+		nni_pipe_bump_error(p->npipe, rv);
+		if (rv == NNG_ECONNRESET || rv == NNG_ECONNSHUT ||
+		    rv == NNG_ECLOSED) {
+			// peer shutting down
+			rv = NMQ_SERVER_SHUTTING_DOWN;
+		} else if (rv == NNG_ENOMEM) {
+			rv = NMQ_SERVER_BUSY;
+		} else {
+			rv = NMQ_UNSEPECIFY_ERROR;
+		}
+		goto recv_error;
+	}
+
+	n = nni_aio_count(rxaio);
+	log_trace("newly recevied %ld buffered: %ld", n, p->rxend - p->rxpos);
+	if (p->rxmsg != NULL) {
+		// body of a packet larger than the buffer
+		nni_aio_iov_advance(rxaio, n);
+		if (nni_aio_iov_count(rxaio) > 0) {
+			nng_stream_recv(p->conn, rxaio);
+			nni_mtx_unlock(&p->mtx);
+			return;
+		}
+		msg      = p->rxmsg;
+		p->rxmsg = NULL;
+	} else {
+		if (p->rxend == 0) {
+			p->rxstart = trace_now();
+		}
+		p->rxend += n;
+		if ((rv = tcptran_pipe_recv_next(p, &msg)) == NNG_EAGAIN) {
+			nni_mtx_unlock(&p->mtx);
+			return;
+		} else if (rv != 0) {
+			goto recv_error;
+		}
+	}
+
+	// We read a message completely.  Let the user know the good news. use
+	// as application message callback of users
+	nni_aio_list_remove(aio);
+	if ((rv = tcptran_pipe_recv_msg(p, msg)) != 0) {
+		goto recv_error;
 	}
 
 	// keep connection & Schedule next receive
@@ -1166,6 +1215,7 @@ nmq_pipe_send_start_v4(tcptran_pipe *p, nni_msg *msg, nni_aio *aio)
 					    is_sqlite, pipe->nano_qos_db, old);
 				}
 				old = msg;
+				nni_msg_set_trace(old, p->txstart);
 				nni_qos_db_set(is_sqlite, pipe->nano_qos_db,
 				    pipe->p_id, pid, old);
 				nni_qos_db_remove_oldest(is_sqlite,
@@ -1405,6 +1455,7 @@ nmq_pipe_send_start_v5(tcptran_pipe *p, nni_msg *msg, nni_aio *aio)
 						    pipe->nano_qos_db, old);
 					}
 					old = msg;
+					nni_msg_set_trace(old, p->txstart);
 					nni_qos_db_set(is_sqlite,
 					    pipe->nano_qos_db, pipe->p_id, pid, old);
 					nni_qos_db_remove_oldest(is_sqlite,
@@ -1515,6 +1566,7 @@ tcptran_pipe_send_start(tcptran_pipe *p)
 		return;
 	}
 
+	p->txstart = trace_now();
 	if (p->pro_ver == MQTT_PROTOCOL_VERSION_v311 ||
 	    p->pro_ver == MQTT_PROTOCOL_VERSION_v31) {
 		nmq_pipe_send_start_v4(p, msg, aio);
@@ -1611,12 +1663,12 @@ tcptran_pipe_getopt(
 static void
 tcptran_pipe_recv_start(tcptran_pipe *p)
 {
-	nni_aio *rxaio;
-	nni_iov  iov;
+	nni_aio *aio;
+	nni_msg *msg;
+	int      rv;
 	log_trace("*** tcptran_pipe_recv_start ***\n");
 
 	if (p->closed) {
-		nni_aio *aio;
 		while ((aio = nni_list_first(&p->recvq)) != NULL) {
 			nni_list_remove(&p->recvq, aio);
 			nni_aio_finish_error(aio, NNG_ECLOSED);
@@ -1627,14 +1679,22 @@ tcptran_pipe_recv_start(tcptran_pipe *p)
 		return;
 	}
 
-	// Schedule a read of the fixed header.
-	rxaio         = p->rxaio;
-	p->gotrxhead  = 0;
-	p->wantrxhead = NANO_MIN_FIXED_HEADER_LEN;
-	iov.iov_buf   = p->rxlen;
-	iov.iov_len   = NANO_MIN_FIXED_HEADER_LEN;
-	nni_aio_set_iov(rxaio, 1, &iov);
-	nng_stream_recv(p->conn, rxaio);
+	// Deliver a packet already buffered, or schedule a read for one.
+	// Finished async, as the protocol asks for the next from its callback.
+	if ((rv = tcptran_pipe_recv_next(p, &msg)) == NNG_EAGAIN) {
+		return;
+	}
+	aio = nni_list_first(&p->recvq);
+	nni_aio_list_remove(aio);
+	if (rv == 0 && (rv = tcptran_pipe_recv_msg(p, msg)) != 0) {
+		nni_msg_free(msg);
+	}
+	if (rv != 0) {
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_aio_set_msg(aio, msg);
+	nni_aio_finish(aio, 0, nni_msg_len(msg));
 }
 
 // DEAL WITH CONNECT when PIPE INIT
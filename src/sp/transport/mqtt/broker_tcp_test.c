@@ -0,0 +1,512 @@
+#include "nng/protocol/mqtt/mqtt_parser.h"
+#include "nng/protocol/mqtt/nmq_mqtt.h"
+#include "nng/supplemental/nanolib/conf.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/http/http.h"
+#include "nng/supplemental/nanolib/log.h"
+#include <nuts.h>
+
+// MQTT broker TCP transport tests, with a raw stream as the client.
+
+static uint8_t connect_pkt[] = {
+	0x10, 0x10,                         // CONNECT
+	0x00, 0x04, 'M', 'Q', 'T', 'T', 4,  // protocol 3.1.1
+	0x02, 0x00, 0x3c,                   // clean session, keepalive 60
+	0x00, 0x04, 't', 'e', 's', 't',     // client id
+};
+
+static void
+broker_write(nng_stream *c, const void *buf, size_t len)
+{
+	nng_aio *aio;
+	nng_iov  iov;
+
+	iov.iov_buf = (void *) buf;
+	iov.iov_len = len;
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_set_timeout(aio, 5000);
+	while (iov.iov_len > 0) {
+		NUTS_PASS(nng_aio_set_iov(aio, 1, &iov));
+		nng_stream_send(c, aio);
+		nng_aio_wait(aio);
+		NUTS_PASS(nng_aio_result(aio));
+		iov.iov_buf = (uint8_t *) iov.iov_buf + nng_aio_count(aio);
+		iov.iov_len -= nng_aio_count(aio);
+	}
+	nng_aio_free(aio);
+}
+
+static void
+broker_read(nng_stream *c, void *buf, size_t len)
+{
+	nng_aio *aio;
+	nng_iov  iov;
+
+	iov.iov_buf = buf;
+	iov.iov_len = len;
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_set_timeout(aio, 5000);
+	while (iov.iov_len > 0) {
+		NUTS_PASS(nng_aio_set_iov(aio, 1, &iov));
+		nng_stream_recv(c, aio);
+		nng_aio_wait(aio);
+		NUTS_PASS(nng_aio_result(aio));
+		iov.iov_buf = (uint8_t *) iov.iov_buf + nng_aio_count(aio);
+		iov.iov_len -= nng_aio_count(aio);
+	}
+	nng_aio_free(aio);
+}
+
+// Connects a raw client to a broker opened with config, returns its pipe.
+static uint32_t
+broker_connect_conf(nng_socket *sp, nng_stream **cp, conf *config)
+{
+	nng_listener       l;
+	nng_stream_dialer *d;
+	nng_aio           *aio;
+	nng_msg           *msg;
+	char               addr[64];
+	int                port;
+	uint32_t           pipe;
+
+	// a port of the kernel's, test ports may still be in TIME_WAIT as
+	// the local end of an earlier connection
+	sp->data = config;
+	NUTS_PASS(nng_nmq_tcp0_open(sp));
+	NUTS_PASS(nng_listener_create(&l, *sp, "nmq-tcp://127.0.0.1:0"));
+	NUTS_PASS(nng_listener_set(l, NANO_CONF, config, sizeof(conf)));
+	NUTS_PASS(nng_listener_start(l, 0));
+	NUTS_PASS(nng_listener_get_int(l, NNG_OPT_TCP_BOUND_PORT, &port));
+
+	(void) snprintf(addr, sizeof(addr), "tcp://127.0.0.1:%d", port);
+	NUTS_PASS(nng_stream_dialer_alloc(&d, addr));
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_set_timeout(aio, 5000);
+	nng_stream_dialer_dial(d, aio);
+	nng_aio_wait(aio);
+	NUTS_ASSERT(nng_aio_result(aio) == 0);
+	*cp = nng_aio_get_output(aio, 0);
+	nng_aio_free(aio);
+	nng_stream_dialer_free(d);
+
+	broker_write(*cp, connect_pkt, sizeof(connect_pkt));
+	NUTS_PASS(nng_recvmsg(*sp, &msg, 0));
+	NUTS_TRUE(nng_msg_cmd_type(msg) == CMD_CONNACK);
+	pipe = nng_msg_get_pipe(msg).id;
+	// no CONNACK is needed by the raw client
+	conn_param_free(nng_msg_get_conn_param(msg));
+	nng_msg_free(msg);
+	return (pipe);
+}
+
+// Connects a raw client to a broker reading with a buffer of rxbuf bytes.
+static void
+broker_connect(nng_socket *sp, nng_stream **cp, conf **configp, size_t rxbuf)
+{
+	conf *config;
+
+	NUTS_TRUE((config = nng_zalloc(sizeof(conf))) != NULL);
+	conf_init(config);
+	config->recv_buffer_size = rxbuf;
+	*configp                 = config;
+	(void) broker_connect_conf(sp, cp, config);
+}
+
+// The socket owns the conf and frees it when closed.
+static void
+broker_close(nng_socket s, nng_stream *c)
+{
+	nng_msg *msg;
+
+	nng_stream_close(c);
+	nng_stream_free(c);
+	NUTS_PASS(nng_recvmsg(s, &msg, 0));
+	NUTS_TRUE(nng_msg_cmd_type(msg) == CMD_DISCONNECT_EV);
+	// the ref of the event, and the last one of the ended session
+	conn_param_free(nng_msg_get_conn_param(msg));
+	conn_param_free(nng_msg_get_conn_param(msg));
+	nng_msg_free(msg);
+	NUTS_CLOSE(s);
+}
+
+// Appends a QoS 0 PUBLISH of len bytes to topic "t" at buf.
+static size_t
+broker_publish(uint8_t *buf, size_t len)
+{
+	size_t   rlen = 3 + len;
+	size_t   n    = 0;
+	uint8_t *p;
+
+	buf[n++] = CMD_PUBLISH;
+	do {
+		buf[n] = rlen & 0x7f;
+		rlen >>= 7;
+		if (rlen > 0) {
+			buf[n] |= 0x80;
+		}
+	} while (buf[n++] & 0x80);
+	buf[n++] = 0;
+	buf[n++] = 1;
+	buf[n++] = 't';
+	p        = buf + n;
+	for (size_t i = 0; i < len; i++) {
+		p[i] = (uint8_t) i;
+	}
+	return (n + len);
+}
+
+static void
+broker_recv_publish(nng_socket s, size_t len)
+{
+	nng_msg *msg;
+	uint8_t *payload;
+
+	NUTS_PASS(nng_recvmsg(s, &msg, 0));
+	NUTS_TRUE(nng_msg_get_type(msg) == CMD_PUBLISH);
+	NUTS_TRUE(nng_msg_len(msg) == 3 + len);
+	payload = (uint8_t *) nng_msg_body(msg) + 3;
+	for (size_t i = 0; i < len; i++) {
+		if (payload[i] != (uint8_t) i) {
+			NUTS_TRUE(payload[i] == (uint8_t) i);
+			break;
+		}
+	}
+	// cloned for us by the protocol
+	conn_param_free(nng_msg_get_conn_param(msg));
+	nng_msg_free(msg);
+}
+
+// Many packets in one write, with one larger than the read buffer, come
+// up in order and intact, whatever the size of the buffer.
+static void
+test_broker_tcp_coalesced(void)
+{
+	size_t sizes[] = { 0, 64, 4096 };
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		nng_socket  s;
+		nng_stream *c;
+		conf       *config;
+		nng_msg    *msg;
+		uint8_t     buf[1024];
+		uint8_t     pingresp[2];
+		size_t      n = 0;
+
+		broker_connect(&s, &c, &config, sizes[i]);
+		n += broker_publish(buf + n, 1);
+		n += broker_publish(buf + n, 5);
+		n += broker_publish(buf + n, 300);
+		n += broker_publish(buf + n, 20);
+		buf[n++] = CMD_PINGREQ;
+		buf[n++] = 0;
+		broker_write(c, buf, n);
+
+		broker_recv_publish(s, 1);
+		broker_recv_publish(s, 5);
+		broker_recv_publish(s, 300);
+		broker_recv_publish(s, 20);
+		NUTS_PASS(nng_recvmsg(s, &msg, 0));
+		NUTS_TRUE(nng_msg_cmd_type(msg) == CMD_PINGREQ);
+		nng_msg_free(msg);
+		broker_read(c, pingresp, sizeof(pingresp));
+		NUTS_TRUE(pingresp[0] == CMD_PINGRESP);
+		broker_close(s, c);
+	}
+}
+
+// A packet split across writes anywhere, even in its length, is joined.
+static void
+test_broker_tcp_split(void)
+{
+	nng_socket  s;
+	nng_stream *c;
+	conf       *config;
+	uint8_t     buf[512];
+	size_t      n;
+
+	broker_connect(&s, &c, &config, 64);
+	n = broker_publish(buf, 200);
+	NUTS_TRUE(buf[1] & 0x80); // two bytes of length
+	broker_write(c, buf, 2);
+	nng_msleep(20);
+	broker_write(c, buf + 2, 40);
+	nng_msleep(20);
+	broker_write(c, buf + 42, n - 42);
+	broker_recv_publish(s, 200);
+	broker_close(s, c);
+}
+
+// A fifth byte of remaining length closes the connection.
+static void
+test_broker_tcp_malformed(void)
+{
+	nng_socket  s;
+	nng_stream *c;
+	conf       *config;
+	nng_aio    *aio;
+	nng_iov     iov;
+	uint8_t     bad[] = { CMD_PUBLISH, 0xff, 0xff, 0xff, 0xff, 0x01 };
+	uint8_t     b;
+
+	broker_connect(&s, &c, &config, 64);
+	broker_write(c, bad, sizeof(bad));
+
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_set_timeout(aio, 5000);
+	iov.iov_buf = &b;
+	iov.iov_len = 1;
+	NUTS_PASS(nng_aio_set_iov(aio, 1, &iov));
+	nng_stream_recv(c, aio);
+	nng_aio_wait(aio);
+	NUTS_TRUE(nng_aio_result(aio) != 0);
+	NUTS_TRUE(nng_aio_result(aio) != NNG_ETIMEDOUT);
+	nng_aio_free(aio);
+	broker_close(s, c);
+}
+
+// The broker applies the $share strategies of its conf to the tree, and
+// least_inflight sees its pipes: a pipe that is gone is never picked.
+static void
+test_broker_tcp_shared(void)
+{
+	nng_socket             s;
+	nng_stream            *c;
+	conf                  *config;
+	dbtree                *db;
+	conf_shared_sub_group *group;
+	uint32_t               pipe;
+	char                   filter[] = "$share/g1/t";
+	char                   topic[]  = "t";
+
+	dbtree_create(&db);
+	NUTS_TRUE((config = nng_zalloc(sizeof(conf))) != NULL);
+	conf_init(config);
+	NUTS_TRUE((group = nng_zalloc(sizeof(*group))) != NULL);
+	group->name     = nng_strdup("g1");
+	group->strategy = DBTREE_SHARED_LEAST_INFLIGHT;
+	cvector_push_back(config->shared_sub.groups, group);
+	config->shared_sub.count = 1;
+	config->db_root          = db;
+	pipe                     = broker_connect_conf(&s, &c, config);
+
+	dbtree_insert_client(db, filter, pipe);
+	dbtree_insert_client(db, filter, pipe + 1000);
+	for (int i = 0; i < 10; i++) {
+		uint32_t *ids = dbtree_find_shared_clients(db, topic);
+		NUTS_TRUE(cvector_size(ids) == 1);
+		NUTS_TRUE(ids[0] == pipe);
+		cvector_free(ids);
+	}
+	dbtree_delete_client(db, filter, pipe);
+	dbtree_delete_client(db, filter, pipe + 1000);
+	broker_close(s, c);
+	dbtree_destory(db);
+}
+
+// Fetches the statistics served by nng_http_handler_alloc_stats.
+// The connection is closed here, a transaction would tear it down on a
+// task thread that may still run when the test calls nng_fini.
+static char *
+broker_metrics(const char *addr)
+{
+	nng_url         *url;
+	nng_http_client *cli;
+	nng_http_conn   *conn;
+	nng_http_req    *req;
+	nng_http_res    *res;
+	nng_aio         *aio;
+	nng_iov          iov;
+	const char      *ctype;
+	const char      *clen;
+	size_t           len;
+	char            *buf;
+
+	NUTS_PASS(nng_url_parse(&url, addr));
+	NUTS_PASS(nng_http_client_alloc(&cli, url));
+	NUTS_PASS(nng_http_req_alloc(&req, url));
+	NUTS_PASS(nng_http_res_alloc(&res));
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_set_timeout(aio, 5000);
+	nng_http_client_connect(cli, aio);
+	nng_aio_wait(aio);
+	NUTS_ASSERT(nng_aio_result(aio) == 0);
+	conn = nng_aio_get_output(aio, 0);
+	nng_http_conn_write_req(conn, req, aio);
+	nng_aio_wait(aio);
+	NUTS_PASS(nng_aio_result(aio));
+	nng_http_conn_read_res(conn, res, aio);
+	nng_aio_wait(aio);
+	NUTS_PASS(nng_aio_result(aio));
+	NUTS_TRUE(nng_http_res_get_status(res) == NNG_HTTP_STATUS_OK);
+	ctype = nng_http_res_get_header(res, "Content-Type");
+	NUTS_ASSERT(ctype != NULL);
+	NUTS_ASSERT(strstr(ctype, "application/openmetrics-text") == ctype);
+	clen = nng_http_res_get_header(res, "Content-Length");
+	NUTS_ASSERT(clen != NULL);
+	len = (size_t) atol(clen);
+	NUTS_ASSERT((buf = nng_alloc(len + 1)) != NULL);
+	if (len > 0) {
+		iov.iov_buf = buf;
+		iov.iov_len = len;
+		NUTS_PASS(nng_aio_set_iov(aio, 1, &iov));
+		nng_http_conn_read_all(conn, aio);
+		nng_aio_wait(aio);
+		NUTS_PASS(nng_aio_result(aio));
+	}
+	buf[len] = '\0';
+	nng_http_conn_close(conn);
+	nng_aio_free(aio);
+	nng_http_res_free(res);
+	nng_http_req_free(req);
+	nng_http_client_free(cli);
+	nng_url_free(url);
+	return (buf);
+}
+
+// Value of the sample starting with name, the first of its family.
+static long
+broker_metric(const char *buf, const char *name)
+{
+	const char *p;
+
+	if ((p = strstr(buf, name)) == NULL) {
+		NUTS_MSG("%s not in\n%s", name, buf);
+		NUTS_ASSERT(p != NULL);
+	}
+	p = strchr(p, ' ');
+	NUTS_ASSERT(p != NULL);
+	return (strtol(p + 1, NULL, 10));
+}
+
+// Appends a QoS 0 PUBLISH of 5 bytes to topic "m" to msg.
+static void
+broker_publish_msg(nng_msg **msgp, const uint8_t *pkt)
+{
+	NUTS_PASS(nng_msg_alloc(msgp, 0));
+	NUTS_PASS(nng_msg_header_append(*msgp, pkt, 2));
+	NUTS_PASS(nng_msg_append(*msgp, pkt + 2, pkt[1]));
+	nng_msg_set_cmd_type(*msgp, CMD_PUBLISH);
+}
+
+// Sends msg to pipe, or back to the last pipe received from if NULL.
+static void
+broker_send(nng_socket s, nng_msg *msg, uint32_t *pipe)
+{
+	nng_aio *aio;
+
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_set_msg(aio, msg);
+	nng_aio_set_prov_data(aio, pipe);
+	// the broker hands msg to the pipe without finishing the aio
+	nng_send_aio(s, aio);
+	nng_aio_stop(aio);
+	nng_aio_free(aio);
+}
+
+// A publish through the broker is counted on its way in and out, and the
+// counters are served as OpenMetrics over HTTP.
+static void
+test_broker_tcp_metrics(void)
+{
+#ifdef NNG_ENABLE_STATS
+	nng_socket        s;
+	nng_stream       *c;
+	conf             *config;
+	dbtree           *db;
+	nng_msg          *msg;
+	nng_url          *url;
+	nng_http_server  *srv;
+	nng_http_handler *h;
+	nng_sockaddr      sa;
+	char              addr[64];
+	char              name[64];
+	char             *buf;
+	uint32_t          pipe;
+	uint32_t          gone;
+	uint8_t           pkt[16];
+	uint8_t           out[16];
+	uint8_t subscribe[] = { CMD_SUBSCRIBE | 0x02, 6, 0, 1, 0, 1, 'm', 0 };
+	uint8_t suback[]    = { CMD_SUBACK, 3, 0, 1, 0 };
+	size_t  n;
+
+	dbtree_create(&db);
+	NUTS_TRUE((config = nng_zalloc(sizeof(conf))) != NULL);
+	conf_init(config);
+	config->db_root = db;
+	pipe            = broker_connect_conf(&s, &c, config);
+
+	NUTS_PASS(nng_url_parse(&url, "http://127.0.0.1:0/metrics"));
+	NUTS_PASS(nng_http_server_hold(&srv, url));
+	NUTS_PASS(nng_http_handler_alloc_stats(&h, url->u_path));
+	NUTS_PASS(nng_http_server_add_handler(srv, h));
+	NUTS_PASS(nng_http_server_start(srv));
+	NUTS_PASS(nng_http_server_get_addr(srv, &sa));
+	(void) snprintf(addr, sizeof(addr), "http://127.0.0.1:%u/metrics",
+	    nuts_be16(sa.s_in.sa_port));
+
+	// the application adds the subscription and acks it
+	broker_write(c, subscribe, sizeof(subscribe));
+	NUTS_PASS(nng_recvmsg(s, &msg, 0));
+	NUTS_TRUE(nng_msg_cmd_type(msg) == CMD_SUBSCRIBE);
+	conn_param_free(nng_msg_get_conn_param(msg));
+	nng_msg_free(msg);
+	dbtree_insert_client(db, "m", pipe);
+	NUTS_PASS(nng_msg_alloc(&msg, 0));
+	NUTS_PASS(nng_msg_header_append(msg, suback, 2));
+	NUTS_PASS(nng_msg_append(msg, suback + 2, 3));
+	nng_msg_set_cmd_type(msg, CMD_SUBACK);
+	broker_send(s, msg, NULL);
+	broker_read(c, out, sizeof(suback));
+	NUTS_TRUE(memcmp(out, suback, sizeof(suback)) == 0);
+
+	// the publish in goes back out to the subscriber
+	n      = broker_publish(pkt, 5);
+	pkt[4] = 'm';
+	broker_write(c, pkt, n);
+	NUTS_PASS(nng_recvmsg(s, &msg, 0));
+	NUTS_TRUE(nng_msg_cmd_type(msg) == CMD_PUBLISH);
+	conn_param_free(nng_msg_get_conn_param(msg));
+	nng_msg_free(msg);
+	broker_publish_msg(&msg, pkt);
+	broker_send(s, msg, NULL);
+	broker_read(c, out, n);
+	NUTS_TRUE(memcmp(out, pkt, n) == 0);
+
+	// and one to a pipe that is gone is dropped
+	broker_publish_msg(&msg, pkt);
+	gone = pipe + 1000;
+	broker_send(s, msg, &gone);
+
+	buf = broker_metrics(addr);
+	(void) snprintf(name, sizeof(name),
+	    "nng_socket_publish_in_total{socket=\"%d\"}", nng_socket_id(s));
+	NUTS_TRUE(broker_metric(buf, name) == 1);
+	(void) snprintf(name, sizeof(name),
+	    "nng_socket_publish_out_total{socket=\"%d\"}", nng_socket_id(s));
+	NUTS_TRUE(broker_metric(buf, name) == 1);
+	(void) snprintf(name, sizeof(name),
+	    "nng_socket_dropped_total{socket=\"%d\"}", nng_socket_id(s));
+	NUTS_TRUE(broker_metric(buf, name) == 1);
+	(void) snprintf(name, sizeof(name), "nng_socket_queued{socket=\"%d\"}",
+	    nng_socket_id(s));
+	NUTS_TRUE(broker_metric(buf, name) == 0);
+	NUTS_TRUE(broker_metric(buf, "nng_dbtree_subscriptions{") == 1);
+	NUTS_TRUE(broker_metric(buf, "nng_qos_db_msgs") == 0);
+	nng_free(buf, strlen(buf) + 1);
+
+	nng_http_server_release(srv);
+	nng_url_free(url);
+	dbtree_delete_client(db, "m", pipe);
+	broker_close(s, c);
+	dbtree_destory(db);
+#endif
+}
+
+TEST_LIST = {
+	{ "broker tcp coalesced packets", test_broker_tcp_coalesced },
+	{ "broker tcp split packet", test_broker_tcp_split },
+	{ "broker tcp malformed length", test_broker_tcp_malformed },
+	{ "broker tcp shared strategy", test_broker_tcp_shared },
+	{ "broker tcp metrics", test_broker_tcp_metrics },
+	{ NULL, NULL },
+};
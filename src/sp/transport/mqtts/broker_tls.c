@@ -17,6 +17,7 @@
 #include "nng/protocol/mqtt/mqtt.h"
 #include "nng/protocol/mqtt/mqtt_parser.h"
 #include "nng/supplemental/nanolib/conf.h"
+#include "nng/supplemental/nanolib/trace.h"
 #include "nng/supplemental/tls/tls.h"
 #include "supplemental/mqtt/mqtt_msg.h"
 #include "supplemental/mqtt/mqtt_qos_db_api.h"
@@ -64,6 +65,8 @@ struct tlstran_pipe {
 	// MQTT V5
 	uint16_t qrecv_quota;
 	uint32_t qsend_quota;
+	uint64_t rxstart; // trace_now() of the first byte of a packet
+	uint64_t txstart; // trace_now() of a publish write
 };
 
 struct tlstran_ep {
@@ -381,10 +384,10 @@ tlstran_pipe_nego_cb(void *arg)
 			code = SERVER_UNAVAILABLE;
 			goto error;
 		}
-		if ((rv = conn_handler(
-		         p->conn_buf, p->tcp_cparam, p->wantrxhead)) == 0) {
-			nng_free(p->conn_buf, p->wantrxhead);
-			p->conn_buf = NULL;
+		// the packet goes with the strings sliced from it
+		rv = conn_handler(p->conn_buf, p->tcp_cparam, p->wantrxhead);
+		p->conn_buf = NULL;
+		if (rv == 0) {
 			// connection packet handled successfully. clone it for protocol or app layer
 			conn_param_clone(p->tcp_cparam);
 			// Connection is accepted.
@@ -417,7 +420,6 @@ tlstran_pipe_nego_cb(void *arg)
 			return;
 		} else {
 			log_info("Disconnect Client due to %d", rv);
-			nng_free(p->conn_buf, p->wantrxhead);
 			rv = NNG_EPROTO;
 			code = MALFORMED_PACKET;
 			if (p->tcp_cparam->pro_ver == 5) {
@@ -617,6 +619,8 @@ tlstran_pipe_send_cb(void *arg)
 		header = nni_msg_header(msg);
 		// parse result code TODO verify bug
 		flag = header[3];
+	} else if (cmd == CMD_PUBLISH) {
+		trace_span(TRACE_WRITE, p->txstart, p->npipe->p_id);
 	}
 	// nni_pipe_bump_tx(p->npipe, n);
 	nni_mtx_unlock(&p->mtx);
@@ -668,6 +672,9 @@ tlstran_pipe_recv_cb(void *arg)
 		goto recv_error;
 	}
 
+	if (p->gotrxhead == 0) {
+		p->rxstart = trace_now();
+	}
 	p->gotrxhead += nni_aio_count(rxaio);
 
 	nni_aio_iov_advance(rxaio, nni_aio_count(rxaio));
@@ -899,6 +906,9 @@ tlstran_pipe_recv_cb(void *arg)
 		ack = false;
 	}
 
+	if (type == CMD_PUBLISH) {
+		trace_span(TRACE_DECODE, p->rxstart, p->npipe->p_id);
+	}
 	// keep connection & Schedule next receive
 	if (!nni_list_empty(&p->recvq)) {
 		tlstran_pipe_recv_start(p);
@@ -1114,6 +1124,7 @@ tlstran_pipe_send_start_v4(tlstran_pipe *p, nni_msg *msg, nni_aio *aio)
 					    pipe->nano_qos_db, old);
 				}
 				old = msg;
+				nni_msg_set_trace(old, p->txstart);
 				nni_qos_db_set(is_sqlite, pipe->nano_qos_db,
 				    pipe->p_id, pid, old);
 				nni_qos_db_remove_oldest(is_sqlite,
@@ -1369,6 +1380,7 @@ tlstran_pipe_send_start_v5(tlstran_pipe *p, nni_msg *msg, nni_aio *aio)
 						    pipe->nano_qos_db, old);
 					}
 					old = msg;
+					nni_msg_set_trace(old, p->txstart);
 					nni_qos_db_set(is_sqlite,
 					    pipe->nano_qos_db, pipe->p_id, pid,
 					    old);
@@ -1516,6 +1528,7 @@ tlstran_pipe_send_start(tlstran_pipe *p)
 		return;
 	}
 
+	p->txstart = trace_now();
 	if (p->pro_ver == MQTT_PROTOCOL_VERSION_v311 ||
 	    p->pro_ver == MQTT_PROTOCOL_VERSION_v31) {
 		tlstran_pipe_send_start_v4(p, msg, aio);
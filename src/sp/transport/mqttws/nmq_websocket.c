@@ -47,10 +47,13 @@ struct ws_pipe {
 	bool        closed;
 	uint8_t     txlen[NANO_MIN_PACKET_LEN];
 	uint16_t    peer;
-	size_t      gotrxhead;
-	size_t      wantrxhead;
+	uint8_t     rxhead[NNI_NANO_MAX_HEADER_SIZE]; // partial fixed header
+	uint8_t     rxhlen;
+	size_t      gotrxbody;
+	size_t      wantrxbody;
 	conf       *conf;
-	nni_msg    *tmp_msg;
+	nni_msg    *rxmsg;  // pre-sized MQTT packet being reassembled
+	nni_msg    *rxpend; // rest of a WS msg carrying coalesced packets
 	nni_aio    *user_txaio;
 	nni_aio    *user_rxaio;
 	nni_aio    *ep_aio;
@@ -116,18 +119,66 @@ wstran_pipe_qos_send_cb(void *arg)
 	nni_mtx_unlock(&p->mtx);
 	return;
 }
+// The fixed header is complete once we have a remaining length byte
+// without the continuation bit.
+static inline bool
+wstran_pipe_rxhead_done(ws_pipe *p)
+{
+	return (p->rxhlen > 1 && (p->rxhead[p->rxhlen - 1] & 0x80) == 0);
+}
+
+// Prepare the destination of a new MQTT packet once its fixed header is
+// known. The packet is sized exactly once; when the current WS msg holds
+// exactly the rest of the packet (the common case) it is adopted as is.
+static int
+wstran_pipe_rxmsg_alloc(ws_pipe *p, nni_msg **msgp)
+{
+	nni_msg *msg = *msgp;
+	uint8_t  pos = 1;
+	uint32_t len;
+	uint8_t  cmd;
+	int      rv;
+
+	len = get_var_integer(p->rxhead, &pos);
+	cmd = p->rxhead[0] & 0xf0;
+	if (cmd == CMD_CONNECT) {
+		// conn_handler expects the fixed header in front of the body
+		if ((rv = nni_msg_alloc(&p->rxmsg, p->rxhlen + len)) != 0) {
+			return (rv);
+		}
+		memcpy(nni_msg_body(p->rxmsg), p->rxhead, p->rxhlen);
+		p->gotrxbody = p->rxhlen;
+	} else if (msg != NULL && nni_msg_len(msg) == len) {
+		// zero-copy: header trimmed off, body is the packet
+		p->rxmsg     = msg;
+		*msgp        = NULL;
+		p->gotrxbody = len;
+	} else {
+		if ((rv = nni_msg_alloc(&p->rxmsg, len)) != 0) {
+			return (rv);
+		}
+		p->gotrxbody = 0;
+	}
+	p->wantrxbody = nni_msg_len(p->rxmsg);
+	nni_msg_set_cmd_type(p->rxmsg, cmd);
+	nni_msg_set_remaining_len(p->rxmsg, len);
+	nni_msg_header_append(p->rxmsg, p->rxhead, p->rxhlen);
+	return (0);
+}
+
 static void
 wstran_pipe_recv_cb(void *arg)
 {
 	ws_pipe *p = arg;
 	nni_iov  iov[2];
 	uint8_t  rv, pos = 1;
-	uint64_t len = 0;
-	uint8_t *ptr;
+	size_t   n;
 	nni_msg *smsg = NULL, *msg = NULL;
 	nni_aio *raio = p->rxaio;
 	nni_aio *uaio = NULL;
 	bool     ack  = false;
+	uint8_t *pkt;
+	size_t   pkt_len;
 
 	nni_mtx_lock(&p->mtx);
 	p->err_code = MQTT_SUCCESS;
@@ -141,46 +192,70 @@ wstran_pipe_recv_cb(void *arg)
 		goto reset;
 	}
 	msg = nni_aio_get_msg(raio);
+	nni_aio_set_msg(raio, NULL);
 	if (nni_msg_header_len(msg) == 0 && nni_msg_len(msg) == 0) {
 		log_trace("empty msg received! continue next receive");
 		goto recv;
 	}
-	ptr = nni_msg_body(msg);
-	p->gotrxhead += nni_msg_len(msg);
-	log_trace("#### wstran_pipe_recv_cb got %ld msg: %p %x %ld",
-	    p->gotrxhead, ptr, *ptr, nni_msg_len(msg));
-	// first we collect complete Fixheader
-	if (p->tmp_msg == NULL && p->gotrxhead > 0) {
-		if ((rv = nni_msg_alloc(&p->tmp_msg, 0)) != 0) {
-			log_error("mem error %ld\n", (size_t) len);
+	log_trace("#### wstran_pipe_recv_cb got msg: %p %ld", msg,
+	    nni_msg_len(msg));
+	// first we collect complete Fixheader, it may span WS msgs
+	while (p->rxmsg == NULL && !wstran_pipe_rxhead_done(p)) {
+		if (nni_msg_len(msg) == 0) {
+			goto recv;
+		}
+		if (p->rxhlen >= NNI_NANO_MAX_HEADER_SIZE) {
+			// length error
+			rv = NNG_EMSGSIZE;
 			goto reset;
 		}
+		p->rxhead[p->rxhlen++] = *(uint8_t *) nni_msg_body(msg);
+		nni_msg_trim(msg, 1);
 	}
-	// TODO use IOV instead of appending msg
-	nni_msg_append(p->tmp_msg, ptr, nni_msg_len(msg));
-	ptr = nni_msg_body(p->tmp_msg); // packet might be sticky?
-
-	if (p->wantrxhead == 0) {
-		if (p->gotrxhead == 1) {
-			goto recv;
+	if (p->rxmsg == NULL) {
+		if (p->rxhlen + get_var_integer(p->rxhead, &pos) >
+		    p->conf->max_packet_size) {
+			log_trace("size error 0x95\n");
+			rv          = NMQ_PACKET_TOO_LARGE;
+			p->err_code = NMQ_PACKET_TOO_LARGE;
+			p->rxhlen   = 0;
+			nni_msg_free(msg);
+			msg = NULL;
+			goto done;
 		}
-		len = get_var_integer(ptr, &pos);
-		if (*(ptr + pos - 1) > 0x7f) {
-			// continue to next byte of remaining length
-			if (p->gotrxhead >= NNI_NANO_MAX_HEADER_SIZE) {
-				// length error
-				rv = NNG_EMSGSIZE;
-				goto reset;
-			}
-		} else {
-			// Fixed header finished
-			p->wantrxhead = len + pos;
-			nni_msg_set_cmd_type(p->tmp_msg, *ptr & 0xf0);
+		if ((rv = wstran_pipe_rxmsg_alloc(p, &msg)) != 0) {
+			log_error("mem error %d", rv);
+			goto reset;
 		}
 	}
-	if (p->gotrxhead >= p->wantrxhead) {
-		goto done;
+	// scatter the payload of this WS msg straight into the packet
+	if (msg != NULL) {
+		n = nni_msg_len(msg);
+		if (n > p->wantrxbody - p->gotrxbody) {
+			n = p->wantrxbody - p->gotrxbody;
+		}
+		memcpy((uint8_t *) nni_msg_body(p->rxmsg) + p->gotrxbody,
+		    nni_msg_body(msg), n);
+		p->gotrxbody += n;
+		nni_msg_trim(msg, n);
+	}
+	if (p->gotrxbody < p->wantrxbody) {
+		goto recv;
+	}
+	// a complete packet. Coalesced packets left in this WS msg are
+	// parsed from the same buffer on the next receive.
+	if (msg != NULL && nni_msg_len(msg) > 0) {
+		p->rxpend = msg;
+	} else {
+		nni_msg_free(msg);
 	}
+	msg           = NULL;
+	smsg          = p->rxmsg;
+	p->rxmsg      = NULL;
+	p->rxhlen     = 0;
+	p->gotrxbody  = 0;
+	p->wantrxbody = 0;
+	goto done;
 
 recv:
 	nni_msg_free(msg);
@@ -194,26 +269,28 @@ done:
 		uaio = p->ep_aio;
 	}
 	if (uaio != NULL) {
-		if (p->gotrxhead+p->wantrxhead > p->conf->max_packet_size) {
-			log_trace("size error 0x95\n");
-			rv = NMQ_PACKET_TOO_LARGE;
-			nni_msg_free(msg);
-			msg = NULL;
-			p->err_code = NMQ_PACKET_TOO_LARGE;
+		if (p->err_code != MQTT_SUCCESS) {
 			goto skip;
 		}
-		p->gotrxhead  = 0;
-		p->wantrxhead = 0;
-		nni_msg_free(msg);
-		msg = NULL;
-		if (nni_msg_cmd_type(p->tmp_msg) == CMD_CONNECT) {
+		if (nni_msg_cmd_type(smsg) == CMD_CONNECT) {
 			// end of nego
 			if (p->ws_param == NULL) {
 				conn_param_alloc(&p->ws_param);
 			}
-			if (conn_handler(nni_msg_body(p->tmp_msg), p->ws_param,
-			        nni_msg_len(p->tmp_msg)) != 0) {
-				p->closed = true;
+			// conn_param keeps the packet its strings are in
+			pkt_len = nni_msg_len(smsg);
+			if ((pkt = nng_alloc(pkt_len)) == NULL) {
+				nni_msg_free(smsg);
+				smsg        = NULL;
+				p->closed   = true;
+				p->err_code = SERVER_UNAVAILABLE;
+				goto skip;
+			}
+			memcpy(pkt, nni_msg_body(smsg), pkt_len);
+			if (conn_handler(pkt, p->ws_param, pkt_len) != 0) {
+				nni_msg_free(smsg);
+				smsg        = NULL;
+				p->closed   = true;
 				p->err_code = PROTOCOL_ERROR;
 				goto skip;
 			}
@@ -226,22 +303,14 @@ done:
 				p->ws_param->max_packet_size =
 				    p->conf->client_max_packet_size;
 			}
-			nni_msg_free(p->tmp_msg);
-			p->tmp_msg = NULL;
+			nni_msg_free(smsg);
+			smsg = NULL;
 			nni_aio_set_output(uaio, 0, p);
 			// pipe_start_cb send CONNACK
 			nni_aio_finish(uaio, 0, 0);
 			nni_mtx_unlock(&p->mtx);
 			return;
 		} else {
-			if (nni_msg_alloc(&smsg, 0) != 0) {
-				p->err_code = SERVER_UNAVAILABLE;
-				goto skip;
-			}
-			// parse fixed header
-			ws_msg_adaptor(ptr, smsg);
-			nni_msg_free(p->tmp_msg);
-			p->tmp_msg = NULL;
 			nni_msg_set_conn_param(smsg, p->ws_param);
 		}
 
@@ -375,8 +444,9 @@ skip:
 	nni_aio_finish(uaio, 0, 0);
 	return;
 reset:
-	p->gotrxhead  = 0;
-	p->wantrxhead = 0;
+	p->rxhlen     = 0;
+	p->gotrxbody  = 0;
+	p->wantrxbody = 0;
 	// a potential memleak case here
 	nng_stream_close(p->ws);
 	if (p->ep_aio != NULL) {
@@ -393,9 +463,13 @@ reset:
 	nni_mtx_unlock(&p->mtx);
 	if (smsg != NULL)
 		nni_msg_free(smsg);
-	if (p->tmp_msg != NULL) {
-		nni_msg_free(p->tmp_msg);
-		p->tmp_msg = NULL;
+	if (p->rxmsg != NULL) {
+		nni_msg_free(p->rxmsg);
+		p->rxmsg = NULL;
+	}
+	if (p->rxpend != NULL) {
+		nni_msg_free(p->rxpend);
+		p->rxpend = NULL;
 	}
 	if (msg != NULL)
 		nni_msg_free(msg);
@@ -435,7 +509,19 @@ wstran_pipe_recv(void *arg, nni_aio *aio)
 		return;
 	}
 	p->user_rxaio = aio;
-	nng_stream_recv(p->ws, p->rxaio);
+	if (p->rxpend != NULL) {
+		// coalesced packets are left from last WS msg, no need to
+		// read from the stream before they are consumed.
+		nni_msg *msg = p->rxpend;
+		p->rxpend    = NULL;
+		if (nni_aio_begin(p->rxaio) == 0) {
+			nni_aio_finish_msg(p->rxaio, msg);
+		} else {
+			nni_msg_free(msg);
+		}
+	} else {
+		nng_stream_recv(p->ws, p->rxaio);
+	}
 	nni_mtx_unlock(&p->mtx);
 }
 
@@ -961,8 +1047,9 @@ wstran_pipe_init(void *arg, nni_pipe *pipe)
 	nni_pipe_set_conn_param(pipe, p->ws_param);
 	p->npipe      = pipe;
 
-	p->gotrxhead  = 0;
-	p->wantrxhead = 0;
+	p->rxhlen     = 0;
+	p->gotrxbody  = 0;
+	p->wantrxbody = 0;
 	p->ep_aio     = NULL;
 	if (p->closed)
 		return (0);
@@ -997,7 +1084,8 @@ wstran_pipe_fini(void *arg)
 	// due to the messy design of NNG WebSocket
 	nni_aio_wait(p->qsaio);
 	nni_aio_free(p->qsaio);
-	nni_msg_free(p->tmp_msg);
+	nni_msg_free(p->rxmsg);
+	nni_msg_free(p->rxpend);
 	nni_mtx_unlock(&p->mtx);
 	nni_mtx_fini(&p->mtx);
 	nng_free(p->qos_buf, 16 + NNI_NANO_MAX_PACKET_SIZE);
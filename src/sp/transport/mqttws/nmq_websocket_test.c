@@ -0,0 +1,262 @@
+#include "nng/protocol/mqtt/mqtt_parser.h"
+#include "nng/protocol/mqtt/nmq_mqtt.h"
+#include "nng/supplemental/nanolib/conf.h"
+#include <nuts.h>
+
+// MQTT over WebSocket broker tests, with a raw WebSocket as the client.
+// Each ws_write is one WebSocket message (frame).
+
+static uint8_t connect_pkt[] = {
+	0x10, 0x10,                         // CONNECT
+	0x00, 0x04, 'M', 'Q', 'T', 'T', 4,  // protocol 3.1.1
+	0x02, 0x00, 0x3c,                   // clean session, keepalive 60
+	0x00, 0x04, 't', 'e', 's', 't',     // client id
+};
+
+static void
+ws_write(nng_stream *c, const void *buf, size_t len)
+{
+	nng_aio *aio;
+	nng_iov  iov;
+
+	iov.iov_buf = (void *) buf;
+	iov.iov_len = len;
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_set_timeout(aio, 5000);
+	NUTS_PASS(nng_aio_set_iov(aio, 1, &iov));
+	nng_stream_send(c, aio);
+	nng_aio_wait(aio);
+	NUTS_PASS(nng_aio_result(aio));
+	NUTS_TRUE(nng_aio_count(aio) == len);
+	nng_aio_free(aio);
+}
+
+// Reads one WebSocket message, returns its length or -1 on error.
+static int
+ws_read(nng_stream *c, void *buf, size_t len)
+{
+	nng_aio *aio;
+	nng_iov  iov;
+	int      rv;
+
+	iov.iov_buf = buf;
+	iov.iov_len = len;
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_set_timeout(aio, 5000);
+	NUTS_PASS(nng_aio_set_iov(aio, 1, &iov));
+	nng_stream_recv(c, aio);
+	nng_aio_wait(aio);
+	NUTS_TRUE(nng_aio_result(aio) != NNG_ETIMEDOUT);
+	rv = nng_aio_result(aio) == 0 ? (int) nng_aio_count(aio) : -1;
+	nng_aio_free(aio);
+	return (rv);
+}
+
+// Connects a raw client to a broker taking packets up to max bytes.
+static void
+ws_connect(nng_socket *sp, nng_stream **cp, uint64_t max)
+{
+	conf              *config;
+	nng_listener       l;
+	nng_stream_dialer *d;
+	nng_aio           *aio;
+	nng_msg           *msg;
+	char               addr[64];
+	uint16_t           port = nuts_next_port();
+
+	NUTS_TRUE((config = nng_zalloc(sizeof(conf))) != NULL);
+	conf_init(config);
+	config->max_packet_size = max;
+	sp->data                = config;
+	NUTS_PASS(nng_nmq_tcp0_open(sp));
+	(void) snprintf(addr, sizeof(addr), "nmq-ws://127.0.0.1:%u/mqtt", port);
+	NUTS_PASS(nng_listener_create(&l, *sp, addr));
+	NUTS_PASS(nng_listener_set(l, NANO_CONF, config, sizeof(conf)));
+	NUTS_PASS(nng_listener_start(l, 0));
+
+	(void) snprintf(addr, sizeof(addr), "ws://127.0.0.1:%u/mqtt", port);
+	NUTS_PASS(nng_stream_dialer_alloc(&d, addr));
+	NUTS_PASS(nng_stream_dialer_set_string(d, NNG_OPT_WS_PROTOCOL, "mqtt"));
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_set_timeout(aio, 5000);
+	nng_stream_dialer_dial(d, aio);
+	nng_aio_wait(aio);
+	NUTS_PASS(nng_aio_result(aio));
+	*cp = nng_aio_get_output(aio, 0);
+	NUTS_ASSERT(*cp != NULL);
+	nng_aio_free(aio);
+	nng_stream_dialer_free(d);
+
+	ws_write(*cp, connect_pkt, sizeof(connect_pkt));
+	NUTS_PASS(nng_recvmsg(*sp, &msg, 0));
+	NUTS_TRUE(nng_msg_cmd_type(msg) == CMD_CONNACK);
+	// no CONNACK is needed by the raw client
+	conn_param_free(nng_msg_get_conn_param(msg));
+	nng_msg_free(msg);
+}
+
+// The socket owns the conf and frees it when closed.
+static void
+ws_close(nng_socket s, nng_stream *c)
+{
+	nng_msg *msg;
+
+	nng_stream_close(c);
+	nng_stream_free(c);
+	NUTS_PASS(nng_recvmsg(s, &msg, 0));
+	NUTS_TRUE(nng_msg_cmd_type(msg) == CMD_DISCONNECT_EV);
+	// the ref of the event, and the last one of the ended session
+	conn_param_free(nng_msg_get_conn_param(msg));
+	conn_param_free(nng_msg_get_conn_param(msg));
+	nng_msg_free(msg);
+	NUTS_CLOSE(s);
+}
+
+// Appends a QoS 0 PUBLISH of len bytes to topic "t" at buf.
+static size_t
+ws_publish(uint8_t *buf, size_t len)
+{
+	size_t   rlen = 3 + len;
+	size_t   n    = 0;
+	uint8_t *p;
+
+	buf[n++] = CMD_PUBLISH;
+	do {
+		buf[n] = rlen & 0x7f;
+		rlen >>= 7;
+		if (rlen > 0) {
+			buf[n] |= 0x80;
+		}
+	} while (buf[n++] & 0x80);
+	buf[n++] = 0;
+	buf[n++] = 1;
+	buf[n++] = 't';
+	p        = buf + n;
+	for (size_t i = 0; i < len; i++) {
+		p[i] = (uint8_t) i;
+	}
+	return (n + len);
+}
+
+static void
+ws_recv_publish(nng_socket s, size_t len)
+{
+	nng_msg *msg;
+	uint8_t *payload;
+
+	NUTS_PASS(nng_recvmsg(s, &msg, 0));
+	NUTS_TRUE(nng_msg_cmd_type(msg) == CMD_PUBLISH);
+	NUTS_TRUE(nng_msg_len(msg) == 3 + len);
+	payload = (uint8_t *) nng_msg_body(msg) + 3;
+	for (size_t i = 0; i < len; i++) {
+		if (payload[i] != (uint8_t) i) {
+			NUTS_TRUE(payload[i] == (uint8_t) i);
+			break;
+		}
+	}
+	// cloned for us by the protocol
+	conn_param_free(nng_msg_get_conn_param(msg));
+	nng_msg_free(msg);
+}
+
+// A fixed header split across WebSocket messages, even in its length.
+static void
+test_ws_split_header(void)
+{
+	nng_socket  s;
+	nng_stream *c;
+	uint8_t     buf[512];
+	size_t      n;
+
+	ws_connect(&s, &c, 10240);
+	n = ws_publish(buf, 200);
+	NUTS_TRUE(buf[1] & 0x80); // two bytes of length
+	ws_write(c, buf, 1);
+	ws_write(c, buf + 1, 1);
+	ws_write(c, buf + 2, n - 2);
+	ws_recv_publish(s, 200);
+	ws_close(s, c);
+}
+
+// A body split across WebSocket messages.
+static void
+test_ws_split_body(void)
+{
+	nng_socket  s;
+	nng_stream *c;
+	uint8_t     buf[512];
+	size_t      n;
+
+	ws_connect(&s, &c, 10240);
+	n = ws_publish(buf, 300);
+	ws_write(c, buf, 10);
+	ws_write(c, buf + 10, 100);
+	ws_write(c, buf + 110, n - 110);
+	// and one that is a whole WebSocket message on its own
+	n = ws_publish(buf, 5);
+	ws_write(c, buf, n);
+	ws_recv_publish(s, 300);
+	ws_recv_publish(s, 5);
+	ws_close(s, c);
+}
+
+// Packets coalesced into one WebSocket message come up in order, with
+// the last one ending in the next message.
+static void
+test_ws_coalesced(void)
+{
+	nng_socket  s;
+	nng_stream *c;
+	nng_msg    *msg;
+	uint8_t     buf[1024];
+	uint8_t     pingresp[16];
+	size_t      n = 0;
+	size_t      last;
+
+	ws_connect(&s, &c, 10240);
+	n += ws_publish(buf + n, 1);
+	n += ws_publish(buf + n, 5);
+	n += ws_publish(buf + n, 300);
+	buf[n++] = CMD_PINGREQ;
+	buf[n++] = 0;
+	last     = n;
+	n += ws_publish(buf + n, 20);
+	ws_write(c, buf, last + 4);
+	ws_write(c, buf + last + 4, n - last - 4);
+
+	ws_recv_publish(s, 1);
+	ws_recv_publish(s, 5);
+	ws_recv_publish(s, 300);
+	NUTS_PASS(nng_recvmsg(s, &msg, 0));
+	NUTS_TRUE(nng_msg_cmd_type(msg) == CMD_PINGREQ);
+	nng_msg_free(msg);
+	NUTS_TRUE(ws_read(c, pingresp, sizeof(pingresp)) == 2);
+	NUTS_TRUE(pingresp[0] == CMD_PINGRESP);
+	ws_recv_publish(s, 20);
+	ws_close(s, c);
+}
+
+// A packet over max_packet_size closes the connection.
+static void
+test_ws_oversize(void)
+{
+	nng_socket  s;
+	nng_stream *c;
+	uint8_t     buf[512];
+	uint8_t     b[16];
+	size_t      n;
+
+	ws_connect(&s, &c, 256);
+	n = ws_publish(buf, 300);
+	ws_write(c, buf, n);
+	NUTS_TRUE(ws_read(c, b, sizeof(b)) < 0);
+	ws_close(s, c);
+}
+
+TEST_LIST = {
+	{ "nmq websocket split header", test_ws_split_header },
+	{ "nmq websocket split body", test_ws_split_body },
+	{ "nmq websocket coalesced packets", test_ws_coalesced },
+	{ "nmq websocket oversize packet", test_ws_oversize },
+	{ NULL, NULL },
+};
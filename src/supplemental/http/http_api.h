@@ -293,6 +293,10 @@ extern int nni_http_handler_init_static(
 extern int nni_http_handler_init_redirect(
     nni_http_handler **, const char *, uint16_t, const char *);
 
+// nni_http_handler_init_stats creates a handler that serves a snapshot of
+// the statistics in the OpenMetrics text format, for Prometheus to scrape.
+extern int nni_http_handler_init_stats(nni_http_handler **, const char *);
+
 // nni_http_handler_fini destroys a handler.  This should only be done before
 // the handler is added, or after it is deleted.  The server automatically
 // calls this for any handlers still registered with it if it is destroyed.
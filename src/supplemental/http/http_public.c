@@ -573,6 +573,18 @@ nng_http_handler_alloc_redirect(
 #endif
 }
 
+int
+nng_http_handler_alloc_stats(nng_http_handler **hp, const char *uri)
+{
+#ifdef NNG_SUPP_HTTP
+	return (nni_http_handler_init_stats(hp, uri));
+#else
+	NNI_ARG_UNUSED(hp);
+	NNI_ARG_UNUSED(uri);
+	return (NNG_ENOTSUP);
+#endif
+}
+
 int
 nng_http_handler_alloc_static(nng_http_handler **hp, const char *uri,
     const void *data, size_t size, const char *ctype)
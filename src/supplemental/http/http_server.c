@@ -1893,6 +1893,106 @@ nni_http_handler_init_static(nni_http_handler **hpp, const char *uri,
 	return (0);
 }
 
+#define HTTP_STATS_CTYPE \
+	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+typedef struct http_stats {
+	nni_mtx lk;
+	char   *buf; // grows to the largest text written yet
+	size_t  size;
+} http_stats;
+
+static void
+http_handle_stats(nni_aio *aio)
+{
+	http_stats       *hs;
+	nni_http_handler *h;
+	nni_http_res     *r = NULL;
+	nng_stat         *st;
+	size_t            len;
+	int               rv;
+
+	h  = nni_aio_get_input(aio, 1);
+	hs = nni_http_handler_get_data(h);
+
+	if ((rv = nng_stats_get(&st)) != 0) {
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_mtx_lock(&hs->lk);
+	while ((len = nng_stats_openmetrics(st, hs->buf, hs->size)) >=
+	    hs->size) {
+		char  *buf;
+		size_t size = len + len / 4 + 1;
+
+		if ((buf = nni_alloc(size)) == NULL) {
+			rv = NNG_ENOMEM;
+			break;
+		}
+		nni_free(hs->buf, hs->size);
+		hs->buf  = buf;
+		hs->size = size;
+	}
+	if ((rv != 0) || ((rv = nni_http_res_alloc(&r)) != 0) ||
+	    ((rv = nni_http_res_set_header(
+	          r, "Content-Type", HTTP_STATS_CTYPE)) != 0) ||
+	    ((rv = nni_http_res_set_status(r, NNG_HTTP_STATUS_OK)) != 0) ||
+	    ((rv = nni_http_res_copy_data(r, hs->buf, len)) != 0)) {
+		nni_mtx_unlock(&hs->lk);
+		nng_stats_free(st);
+		nni_http_res_free(r);
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_mtx_unlock(&hs->lk);
+	nng_stats_free(st);
+
+	nni_aio_set_output(aio, 0, r);
+	nni_aio_finish(aio, 0, 0);
+}
+
+static void
+http_stats_free(void *arg)
+{
+	http_stats *hs;
+
+	if ((hs = arg) != NULL) {
+		nni_free(hs->buf, hs->size);
+		nni_mtx_fini(&hs->lk);
+		NNI_FREE_STRUCT(hs);
+	}
+}
+
+int
+nni_http_handler_init_stats(nni_http_handler **hpp, const char *uri)
+{
+	nni_http_handler *h;
+	int               rv;
+	http_stats       *hs;
+
+	if ((hs = NNI_ALLOC_STRUCT(hs)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	nni_mtx_init(&hs->lk);
+
+	if ((rv = nni_http_handler_init(&h, uri, http_handle_stats)) != 0) {
+		http_stats_free(hs);
+		return (rv);
+	}
+
+	if ((rv = nni_http_handler_set_data(h, hs, http_stats_free)) != 0) {
+		http_stats_free(hs);
+		nni_http_handler_fini(h);
+		return (rv);
+	}
+
+	// A scrape is a plain GET.
+	nni_http_handler_collect_body(h, true, 0);
+
+	*hpp = h;
+	return (0);
+}
+
 int
 nni_http_server_set_tls(nni_http_server *s, nng_tls_config *tls)
 {
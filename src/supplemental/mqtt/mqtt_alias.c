@@ -0,0 +1,309 @@
+//
+// Copyright 2024 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "mqtt_alias.h"
+#include "mqtt_msg.h"
+#include "nng/mqtt/mqtt_client.h"
+#include "nng/protocol/mqtt/mqtt_parser.h"
+
+#define ALIAS_REMAINING_MAX 268435455
+
+typedef struct {
+	nni_list_node node;
+	uint64_t      hash;
+	char         *topic;
+	uint32_t      len;
+	uint16_t      alias;
+} alias_entry;
+
+struct nni_mqtt_alias {
+	uint16_t   max;
+	uint16_t   used;
+	nni_id_map topics; // topic hash -> entry
+	nni_list   lru;    // least recently used first
+};
+
+int
+nni_mqtt_alias_init(nni_mqtt_alias **ap, uint16_t max)
+{
+	nni_mqtt_alias *a;
+
+	if (max == 0) {
+		return (NNG_EINVAL);
+	}
+	if ((a = NNI_ALLOC_STRUCT(a)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	a->max = max;
+	nni_id_map_init(&a->topics, 0, 0, false);
+	NNI_LIST_INIT(&a->lru, alias_entry, node);
+	*ap = a;
+	return (0);
+}
+
+void
+nni_mqtt_alias_fini(nni_mqtt_alias *a)
+{
+	alias_entry *e;
+
+	while ((e = nni_list_first(&a->lru)) != NULL) {
+		nni_list_remove(&a->lru, e);
+		if (e->topic != NULL) {
+			nni_free(e->topic, e->len);
+		}
+		NNI_FREE_STRUCT(e);
+	}
+	nni_id_map_fini(&a->topics);
+	NNI_FREE_STRUCT(a);
+}
+
+uint16_t
+nni_mqtt_alias_max(nni_mqtt_alias *a)
+{
+	return (a->max);
+}
+
+static int
+alias_varint_get(const uint8_t *buf, size_t len, uint32_t *vp)
+{
+	uint32_t v = 0;
+
+	for (int i = 0; i < 4 && (size_t) i < len; i++) {
+		v |= (uint32_t) (buf[i] & 0x7f) << (7 * i);
+		if ((buf[i] & 0x80) == 0) {
+			*vp = v;
+			return (i + 1);
+		}
+	}
+	return (0);
+}
+
+static int
+alias_varint_put(uint8_t *buf, uint32_t v)
+{
+	int n = 0;
+
+	do {
+		buf[n] = v & 0x7f;
+		v >>= 7;
+		if (v > 0) {
+			buf[n] |= 0x80;
+		}
+		n++;
+	} while (v > 0);
+	return (n);
+}
+
+static int
+alias_varint_len(uint32_t v)
+{
+	return (v < 128 ? 1 : v < 16384 ? 2 : v < 2097152 ? 3 : 4);
+}
+
+// Looks for a Topic Alias, or anything not well formed, in the properties.
+static bool
+alias_props_usable(const uint8_t *p, uint32_t len)
+{
+	uint32_t pos = 0;
+
+	while (pos < len) {
+		uint8_t  id = p[pos++];
+		uint32_t n, v;
+		int      used;
+
+		if (id == TOPIC_ALIAS) {
+			return (false);
+		}
+		switch (property_get_value_type(id)) {
+		case U8:
+			n = 1;
+			break;
+		case U16:
+			n = 2;
+			break;
+		case U32:
+			n = 4;
+			break;
+		case VARINT:
+			if ((used = alias_varint_get(p + pos, len - pos, &v)) ==
+			    0) {
+				return (false);
+			}
+			n = (uint32_t) used;
+			break;
+		case BINARY:
+		case STR:
+			if (len - pos < 2) {
+				return (false);
+			}
+			n = 2 + (p[pos] << 8 | p[pos + 1]);
+			break;
+		case STR_PAIR:
+			if (len - pos < 2) {
+				return (false);
+			}
+			n = 2 + (p[pos] << 8 | p[pos + 1]);
+			if (len - pos < n + 2) {
+				return (false);
+			}
+			n += 2 + (p[pos + n] << 8 | p[pos + n + 1]);
+			break;
+		default:
+			return (false);
+		}
+		if (len - pos < n) {
+			return (false);
+		}
+		pos += n;
+	}
+	return (true);
+}
+
+// Finds the alias of a topic, binding it when the peer does not know it
+// yet and bind is set.  Returns NULL if memory runs out or nothing is bound.
+static alias_entry *
+alias_lookup(nni_mqtt_alias *a, const uint8_t *topic, uint32_t len, bool bind,
+    bool *hit)
+{
+	alias_entry *e;
+	uint64_t     hash = wy_hashn((char *) topic, len);
+
+	e    = nni_id_get(&a->topics, hash);
+	*hit = e != NULL && e->len == len && memcmp(e->topic, topic, len) == 0;
+	if (*hit) {
+		nni_list_remove(&a->lru, e);
+		nni_list_append(&a->lru, e);
+		return (e);
+	}
+	if (!bind) {
+		return (NULL);
+	}
+
+	// A hash collision takes over that binding, like an eviction.
+	if (e == NULL && a->used < a->max) {
+		if ((e = NNI_ALLOC_STRUCT(e)) == NULL) {
+			return (NULL);
+		}
+		e->alias = ++a->used;
+	} else {
+		if (e == NULL) {
+			e = nni_list_first(&a->lru);
+		}
+		nni_list_remove(&a->lru, e);
+		if (e->topic != NULL) {
+			nni_id_remove(&a->topics, e->hash);
+			nni_free(e->topic, e->len);
+			e->topic = NULL;
+			e->len   = 0;
+		}
+	}
+	if (((e->topic = nni_alloc(len)) == NULL) ||
+	    (nni_id_set(&a->topics, hash, e) != 0)) {
+		if (e->topic != NULL) {
+			nni_free(e->topic, len);
+			e->topic = NULL;
+		}
+		// unbound, so it is the first to be reused
+		nni_list_prepend(&a->lru, e);
+		return (NULL);
+	}
+	memcpy(e->topic, topic, len);
+	e->len  = len;
+	e->hash = hash;
+	nni_list_append(&a->lru, e);
+	return (e);
+}
+
+int
+nni_mqtt_alias_publish(nni_mqtt_alias *a, nni_msg *msg, uint8_t *buf,
+    nni_iov *iov, int *niovp, int64_t *saved)
+{
+	uint8_t     *hdr  = nni_msg_header(msg);
+	uint8_t     *body = nni_msg_body(msg);
+	size_t       len  = nni_msg_len(msg);
+	alias_entry *e;
+	uint32_t     tlen, plen, remaining;
+	size_t       pid, pos, rest, n, sent;
+	int          vlen;
+	int          niov = 0;
+	int          room = *niovp;
+	bool         bind;
+	bool         hit;
+
+	if (nni_msg_header_len(msg) < 2 || (hdr[0] & 0xF0) != CMD_PUBLISH ||
+	    len < 2) {
+		return (NNG_ENOTSUP);
+	}
+	tlen = body[0] << 8 | body[1];
+	pid  = (hdr[0] & 0x06) != 0 ? 2 : 0;
+	pos  = 2 + tlen + pid;
+	if (tlen == 0 || pos >= len ||
+	    (vlen = alias_varint_get(body + pos, len - pos, &plen)) == 0 ||
+	    len - pos - vlen < plen ||
+	    !alias_props_usable(body + pos + vlen, plen)) {
+		return (NNG_ENOTSUP);
+	}
+	rest = len - pos - vlen;
+	plen += 3;
+	// sized for a new binding, which can not fail once it is made
+	remaining = (uint32_t) (2 + tlen + pid + alias_varint_len(plen) + 3);
+	if (rest > ALIAS_REMAINING_MAX - remaining) {
+		return (NNG_ENOTSUP);
+	}
+	// a binding takes 2 iovs more than a known alias
+	if (room < (rest > 0 ? 2 : 1)) {
+		return (NNG_ENOSPC);
+	}
+	bind = room >= (rest > 0 ? 4 : 3);
+	if ((e = alias_lookup(a, body + 2, tlen, bind, &hit)) == NULL) {
+		return (bind ? NNG_ENOTSUP : NNG_ENOSPC);
+	}
+	if (hit) {
+		remaining -= tlen;
+		tlen = 0;
+	}
+	remaining += (uint32_t) rest;
+
+	// a binding sends the topic from msg, between two parts of buf
+	n        = 0;
+	buf[n++] = hdr[0];
+	n += alias_varint_put(buf + n, remaining);
+	buf[n++] = (uint8_t) (tlen >> 8);
+	buf[n++] = (uint8_t) tlen;
+	if (tlen > 0) {
+		iov[niov].iov_buf   = buf;
+		iov[niov++].iov_len = n;
+		iov[niov].iov_buf   = body + 2;
+		iov[niov++].iov_len = tlen;
+		buf += n;
+		sent = n + tlen;
+		n    = 0;
+	} else {
+		sent = 0;
+	}
+	memcpy(buf + n, body + pos - pid, pid);
+	n += pid;
+	n += alias_varint_put(buf + n, plen);
+	buf[n++] = TOPIC_ALIAS;
+	buf[n++] = (uint8_t) (e->alias >> 8);
+	buf[n++] = (uint8_t) e->alias;
+	iov[niov].iov_buf   = buf;
+	iov[niov++].iov_len = n;
+	sent += n;
+	if (rest > 0) {
+		iov[niov].iov_buf   = body + pos + vlen;
+		iov[niov++].iov_len = rest;
+		sent += rest;
+	}
+	*niovp = niov;
+	*saved = (int64_t) (nni_msg_header_len(msg) + len) - (int64_t) sent;
+	return (0);
+}
@@ -0,0 +1,44 @@
+//
+// Copyright 2024 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef NNG_MQTT_ALIAS_H
+#define NNG_MQTT_ALIAS_H
+
+#include "core/nng_impl.h"
+
+// Outbound topic aliases of one MQTT v5 connection.  A topic is bound to
+// an alias the first time it is published, later PUBLISH packets carry the
+// alias and an empty topic.  Once the peer's Topic Alias Maximum is used
+// up, the least recently used binding is given to the new topic.
+//
+// The table follows the packets in the order they are written to the
+// connection, so the encoded message is never changed: each write, a
+// resend included, is rewritten against the bindings the peer holds then.
+typedef struct nni_mqtt_alias nni_mqtt_alias;
+
+// Default cap on the bindings a connection keeps, whatever the peer allows.
+#define NNI_MQTT_ALIAS_MAX 1024
+// Room nni_mqtt_alias_publish needs for the header bytes it writes.
+#define NNI_MQTT_ALIAS_HEADER_MAX 16
+
+extern int      nni_mqtt_alias_init(nni_mqtt_alias **, uint16_t);
+extern void     nni_mqtt_alias_fini(nni_mqtt_alias *);
+extern uint16_t nni_mqtt_alias_max(nni_mqtt_alias *);
+
+// nni_mqtt_alias_publish rewrites an encoded v5 PUBLISH into at most four
+// iovs: header bytes written to buf, the topic and the properties and
+// payload of msg.  The int holds the iovs free on entry and the iovs used
+// on return.  It returns the bytes saved, negative when a binding was
+// sent.  It fails with NNG_ENOTSUP for anything it leaves alone, including
+// a PUBLISH that already carries a Topic Alias, and with NNG_ENOSPC,
+// binding nothing, when the topic needs more iovs than are free.
+extern int nni_mqtt_alias_publish(nni_mqtt_alias *, nni_msg *, uint8_t *,
+    nni_iov *, int *, int64_t *);
+
+#endif // NNG_MQTT_ALIAS_H
@@ -735,6 +735,9 @@ void
 nni_mqtt_msg_set_connect_client_id(nni_msg *msg, const char *client_id)
 {
 	nni_mqtt_proto_data *proto_data = nni_msg_get_proto_data(msg);
+	if (proto_data->is_copied) {
+		mqtt_buf_free(&proto_data->payload.connect.client_id);
+	}
 	mqtt_buf_create(&proto_data->payload.connect.client_id,
 	    (const uint8_t *) client_id, (uint32_t) strlen(client_id));
 }
@@ -1044,7 +1047,7 @@ nni_get_conn_param_from_msg(nni_msg *msg)
 	nni_mqtt_proto_data *proto_data = nni_msg_get_proto_data(msg);
 
 	// alloc a new conn_param
-	if ((conn_ctx = nng_alloc(sizeof(conn_param))) == NULL) {
+	if ((conn_ctx = nng_zalloc(sizeof(conn_param))) == NULL) {
 		return NULL;
 	}
 	nni_atomic_init(&conn_ctx->refcnt);
@@ -940,6 +940,90 @@ nng_mqtt_disconnect(nng_socket *sock, uint8_t reason_code, property *pl)
 	return (rv);
 }
 
+// Dialers take over their connmsg, so each one gets its own.
+static int
+mqtt_client_connmsg_dup(nng_msg **dupp, nng_msg *connmsg, int index)
+{
+	nni_mqtt_proto_data *proto_data = nni_msg_get_proto_data(connmsg);
+	mqtt_buf            *id = &proto_data->payload.connect.client_id;
+	nng_msg             *dup;
+	char                *cid;
+	size_t               len = id->length + 8;
+	int                  rv;
+
+	if ((rv = nni_msg_dup(&dup, connmsg)) != 0) {
+		return (rv);
+	}
+	if ((cid = nni_alloc(len)) == NULL) {
+		nni_msg_free(dup);
+		return (NNG_ENOMEM);
+	}
+	snprintf(cid, len, "%.*s-%d", (int) id->length,
+	    id->length > 0 ? (char *) id->buf : "", index);
+	nni_mqtt_msg_set_connect_client_id(dup, cid);
+	nni_free(cid, len);
+	*dupp = dup;
+	return (0);
+}
+
+int
+nng_mqtt_client_dialers_create(nng_dialer *dialers, nng_socket sock,
+    const char *url, nng_msg *connmsg, int count)
+{
+	nng_msg *msg;
+	int      rv = 0;
+	int      i;
+
+	if (connmsg == NULL || count < 1 || count > NNG_MQTT_CLIENT_MAX_CONNS) {
+		return (NNG_EINVAL);
+	}
+	// encoded, the buffers of connmsg are owned and copied by the dup
+	if (nni_mqtt_msg_get_connect_proto_version(connmsg) ==
+	    MQTT_PROTOCOL_VERSION_v5) {
+		rv = nni_mqttv5_msg_encode(connmsg);
+	} else {
+		rv = nni_mqtt_msg_encode(connmsg);
+	}
+	if (rv != MQTT_SUCCESS) {
+		return (NNG_EINVAL);
+	}
+	for (i = 0; i < count; i++) {
+		msg = connmsg;
+		if (i > 0 && (rv = mqtt_client_connmsg_dup(&msg, connmsg, i)) != 0) {
+			break;
+		}
+		if ((rv = nng_dialer_create(&dialers[i], sock, url)) != 0) {
+			if (msg != connmsg) {
+				nng_msg_free(msg);
+			}
+			break;
+		}
+		if ((rv = nng_dialer_set_ptr(
+		         dialers[i], NNG_OPT_MQTT_CONNMSG, msg)) != 0) {
+			if (msg != connmsg) {
+				nng_msg_free(msg);
+			}
+			nng_dialer_close(dialers[i]);
+			break;
+		}
+		if ((rv = nng_socket_set_int(sock, NNG_OPT_MQTT_CONN_DIALER,
+		         nng_dialer_id(dialers[i]))) != 0) {
+			i++;
+			break;
+		}
+	}
+	if (rv != 0) {
+		// connmsg stays with the caller
+		if (i > 0) {
+			nng_dialer_set_ptr(dialers[0], NNG_OPT_MQTT_CONNMSG, NULL);
+		}
+		while (i-- > 0) {
+			nng_dialer_close(dialers[i]);
+		}
+	}
+	return (rv);
+}
+
 int
 nng_mqtt_unsubscribe(nng_socket sock, nng_mqtt_topic *sbs, size_t count, property *pl)
 {
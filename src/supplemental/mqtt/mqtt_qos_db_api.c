@@ -3,6 +3,59 @@
 #include "nng/protocol/mqtt/mqtt_parser.h"
 #endif
 
+#ifdef NNG_ENABLE_STATS
+static const nni_stat_info qos_db_root_info = {
+	.si_name = "qos_db",
+	.si_desc = "in memory QoS message stores",
+	.si_type = NNG_STAT_SCOPE,
+};
+static const nni_stat_info qos_db_msgs_info = {
+	.si_name   = "msgs",
+	.si_desc   = "QoS messages waiting for an ack",
+	.si_type   = NNG_STAT_LEVEL,
+	.si_unit   = NNG_UNIT_MESSAGES,
+	.si_atomic = true,
+};
+
+// Static, so counting never waits for the registration.
+static nni_stat_item qos_db_root = { .si_info = &qos_db_root_info };
+static nni_stat_item qos_db_msgs = { .si_info = &qos_db_msgs_info };
+static nni_mtx       qos_db_stats_lk = NNI_MTX_INITIALIZER;
+static bool          qos_db_stats_registered;
+#endif
+
+void
+nni_qos_db_stats_init(void)
+{
+#ifdef NNG_ENABLE_STATS
+	nni_mtx_lock(&qos_db_stats_lk);
+	if (!qos_db_stats_registered) {
+		nni_stat_add(&qos_db_root, &qos_db_msgs);
+		nni_stat_register(&qos_db_root);
+		qos_db_stats_registered = true;
+	}
+	nni_mtx_unlock(&qos_db_stats_lk);
+#endif
+}
+
+static void
+qos_db_stats_count(uint64_t add, uint64_t sub)
+{
+#ifdef NNG_ENABLE_STATS
+	nni_stat_inc(&qos_db_msgs, add);
+	nni_stat_dec(&qos_db_msgs, sub);
+#else
+	NNI_ARG_UNUSED(add);
+	NNI_ARG_UNUSED(sub);
+#endif
+}
+
+void
+nni_qos_db_stats_drop(nni_id_map *db)
+{
+	qos_db_stats_count(0, db->id_count);
+}
+
 void
 nni_qos_db_set(bool is_sqlite, void *db, uint32_t pipe_id, uint16_t packet_id,
     nng_msg *msg)
@@ -19,7 +72,10 @@ nni_qos_db_set(bool is_sqlite, void *db, uint32_t pipe_id, uint16_t packet_id,
 		NNI_ARG_UNUSED(msg);
 #endif
 	} else {
+		uint32_t count = ((nni_id_map *) (db))->id_count;
+
 		nni_id_set((nni_id_map *) (db), packet_id, msg);
+		qos_db_stats_count(((nni_id_map *) (db))->id_count - count, 0);
 	}
 }
 
@@ -72,7 +128,9 @@ nni_qos_db_remove(
 #endif
 	} else {
 		NNI_ARG_UNUSED(pipe_id);
-		nni_id_remove((nni_id_map *) (db), packet_id);
+		if (nni_id_remove((nni_id_map *) (db), packet_id) == 0) {
+			qos_db_stats_count(0, 1);
+		}
 	}
 }
 
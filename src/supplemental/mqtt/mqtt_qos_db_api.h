@@ -17,13 +17,20 @@
 	{                                                        \
 		db = nng_zalloc(sizeof(nni_id_map));             \
 		nni_id_map_init((nni_id_map *) db, 0, 0, false); \
+		nni_qos_db_stats_init();                         \
 	}
 #define nni_qos_db_fini_id_hash(db)                                \
 	{                                                          \
+		nni_qos_db_stats_drop((nni_id_map *) (db));        \
 		nni_id_map_fini((nni_id_map *) (db));              \
 		nni_free((nni_id_map *) (db), sizeof(nni_id_map)); \
 	}
 
+// The messages in all in memory dbs, made by nni_qos_db_init_id_hash, are
+// counted in the stats, in the "qos_db" scope.
+extern void nni_qos_db_stats_init(void);
+extern void nni_qos_db_stats_drop(nni_id_map *);
+
 #define nni_qos_db_init_id_hash_with_opt(db, lo, hi, randomize)        \
 	{                                                              \
 		db = nng_zalloc(sizeof(nni_id_map));                   \
@@ -4,6 +4,7 @@
 #include "nng/nng.h"
 #include "nng/protocol/mqtt/mqtt_parser.h"
 
+#include "mqtt_alias.h"
 #include "mqtt_msg.h"
 #include "nuts.h"
 
@@ -1578,6 +1579,43 @@ test_property_api(void)
 	NUTS_PASS(mqtt_property_free(plist));
 }
 
+// A topic binds only when its 4 iovs fit, a known alias needs 2.
+void
+test_alias_publish_room(void)
+{
+	nni_mqtt_alias *a;
+	nng_msg        *msg;
+	uint8_t         buf[NNI_MQTT_ALIAS_HEADER_MAX];
+	nni_iov         iov[4];
+	int             n;
+	int64_t         saved;
+
+	NUTS_PASS(nng_mqtt_msg_alloc(&msg, 0));
+	nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_PUBLISH);
+	nng_mqtt_msg_set_publish_topic(msg, "/nanomq/alias/room");
+	nng_mqtt_msg_set_publish_payload(msg, (uint8_t *) "hello", 5);
+	NUTS_PASS(nng_mqttv5_msg_encode(msg));
+	NUTS_PASS(nni_mqtt_alias_init(&a, 2));
+
+	n = 2;
+	NUTS_FAIL(nni_mqtt_alias_publish(a, msg, buf, iov, &n, &saved),
+	    NNG_ENOSPC);
+	n = 4;
+	NUTS_PASS(nni_mqtt_alias_publish(a, msg, buf, iov, &n, &saved));
+	NUTS_TRUE(n == 4);
+	NUTS_TRUE(saved == -3);
+	n = 2;
+	NUTS_PASS(nni_mqtt_alias_publish(a, msg, buf, iov, &n, &saved));
+	NUTS_TRUE(n == 2);
+	NUTS_TRUE(saved == (int64_t) strlen("/nanomq/alias/room") - 3);
+	n = 1;
+	NUTS_FAIL(nni_mqtt_alias_publish(a, msg, buf, iov, &n, &saved),
+	    NNG_ENOSPC);
+
+	nni_mqtt_alias_fini(a);
+	nng_msg_free(msg);
+}
+
 TEST_LIST = {
 	// TODO: there is still some encode & decode functions should be
 	// tested.
@@ -1630,5 +1668,6 @@ TEST_LIST = {
 	{ "test topic_qos create & free", test_topic_qos_array_create_free },
 	{ "test topic create & free", test_topic_array_create_free },
 	{ "test property api", test_property_api },
+	{ "alias publish room", test_alias_publish_room },
 	{ NULL, NULL },
 };
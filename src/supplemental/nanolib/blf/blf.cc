@@ -1,4 +1,5 @@
 #include "nng/supplemental/nanolib/blf.h"
+#include "nng/supplemental/nanolib/file_catalog.h"
 #include "nng/supplemental/nanolib/log.h"
 #include "nng/supplemental/nanolib/queue.h"
 #include <Vector/BLF.h>
@@ -28,6 +29,8 @@ static atomic_bool is_available = { false };
 	while (!is_available) \
 		nng_msleep(10);
 static conf_blf *g_conf = NULL;
+// key ranges of finished files in blf_file_queue
+static file_catalog *blf_catalog = NULL;
 
 #define DO_IT_IF_NOT_NULL(func, arg1, arg2) \
 	if (arg1) {                         \
@@ -36,19 +39,6 @@ static conf_blf *g_conf = NULL;
 
 #define FREE_IF_NOT_NULL(free, size) DO_IT_IF_NOT_NULL(nng_free, free, size)
 
-#define json_read_num(structure, field, key, jso)                             \
-	do {                                                                  \
-		cJSON *jso_key = cJSON_GetObjectItem(jso, key);               \
-		if (NULL == jso_key) {                                        \
-			log_debug("Config %s is not set, use default!", key); \
-			break;                                                \
-		}                                                             \
-		if (cJSON_IsNumber(jso_key)) {                                \
-			if (jso_key->valuedouble > 0)                         \
-				(structure)->field = jso_key->valuedouble;    \
-		}                                                             \
-	} while (0);
-
 CircularQueue   blf_queue;
 CircularQueue   blf_file_queue;
 pthread_mutex_t blf_queue_mutex     = PTHREAD_MUTEX_INITIALIZER;
@@ -165,6 +155,7 @@ static int
 remove_old_file(void)
 {
 	char *filename = (char *) DEQUEUE(blf_file_queue);
+	file_catalog_remove(blf_catalog, filename);
 	if (remove(filename) == 0) {
 		log_debug("File '%s' removed successfully.\n", filename);
 	} else {
@@ -194,34 +185,403 @@ update_blf_file_ranges(conf_blf *conf, blf_object *elem, blf_file_range *range)
 	}
 }
 
-void
-read_binary_data(const std::string &inputString, unsigned int inputSize,
-    array<uint8_t, 8> &data)
+static inline uint64_t
+get_le(const uint8_t *p, int n)
 {
-	std::vector<unsigned char> binaryData;
-	for (size_t i = 0; 2 * i < inputString.length(); i++) {
-		std::istringstream iss(inputString.substr(2 * i, 2));
-		unsigned int       value;
-		iss >> std::hex >> value;
-		data[i] = (static_cast<unsigned char>(value));
+	uint64_t v = 0;
+	for (int i = n - 1; i >= 0; i--) {
+		v = (v << 8) | p[i];
 	}
+	return v;
 }
 
-void
-blf_write_can_message(Vector::BLF::File &file, cJSON *jso)
-{
-	/* write a CanMessage */
-	// puts(cJSON_Print(jso));
-	auto *canMessage = new Vector::BLF::CanMessage;
-	json_read_num(canMessage, id, "id", jso);
-	json_read_num(canMessage, objectTimeStamp, "t", jso);
-	json_read_num(canMessage, channel, "bus", jso);
-	json_read_num(canMessage, flags, "d", jso);
-	json_read_num(canMessage, dlc, "l", jso);
-	cJSON *data = cJSON_GetObjectItem(jso, "data");
-	// printf("ori: %s\n", data->valuestring);
-	read_binary_data(data->valuestring, canMessage->dlc, canMessage->data);
-	file.write(canMessage);
+static inline void
+put_le(uint8_t *p, uint64_t v, int n)
+{
+	for (int i = 0; i < n; i++, v >>= 8) {
+		p[i] = (uint8_t) v;
+	}
+}
+
+size_t
+blf_can_frames_encode(
+    const blf_can_frame *frames, uint32_t count, uint8_t *buf, size_t len)
+{
+	size_t need = BLF_CAN_MAGIC_LEN + (size_t) count * BLF_CAN_FRAME_SIZE;
+	if (len < need) {
+		return 0;
+	}
+	memcpy(buf, BLF_CAN_MAGIC, BLF_CAN_MAGIC_LEN);
+	uint8_t *p = buf + BLF_CAN_MAGIC_LEN;
+	for (uint32_t i = 0; i < count; i++, p += BLF_CAN_FRAME_SIZE) {
+		put_le(p, frames[i].timestamp, 8);
+		put_le(p + 8, frames[i].id, 4);
+		put_le(p + 12, frames[i].bus, 2);
+		p[14] = frames[i].flags;
+		p[15] = frames[i].dlc;
+		memcpy(p + 16, frames[i].data, 8);
+	}
+	return need;
+}
+
+static int
+blf_decode_binary(
+    const uint8_t *payload, uint32_t len, blf_can_frame_cb cb, void *arg)
+{
+	blf_can_frame frame;
+	uint32_t      count = (len - BLF_CAN_MAGIC_LEN) / BLF_CAN_FRAME_SIZE;
+
+	if ((len - BLF_CAN_MAGIC_LEN) % BLF_CAN_FRAME_SIZE != 0) {
+		log_error("Binary CAN frames of bad length %u", len);
+		return -1;
+	}
+	const uint8_t *p = payload + BLF_CAN_MAGIC_LEN;
+	for (uint32_t i = 0; i < count; i++, p += BLF_CAN_FRAME_SIZE) {
+		frame.timestamp = get_le(p, 8);
+		frame.id        = (uint32_t) get_le(p + 8, 4);
+		frame.bus       = (uint16_t) get_le(p + 12, 2);
+		frame.flags     = p[14];
+		frame.dlc       = p[15];
+		memcpy(frame.data, p + 16, 8);
+		cb(&frame, arg);
+	}
+	return (int) count;
+}
+
+static inline int
+hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return 0;
+}
+
+// Two hex characters a byte, at most 8 bytes.
+static void
+read_hex_data(const char *hex, size_t len, uint8_t data[8])
+{
+	for (size_t i = 0; i < 8 && 2 * i + 1 < len; i++) {
+		data[i] = (uint8_t) (hex_value(hex[2 * i]) << 4 |
+		    hex_value(hex[2 * i + 1]));
+	}
+}
+
+// Numbers of a frame are only taken if positive, as before.
+static void
+frame_set_num(blf_can_frame *frame, const char *key, size_t klen, uint64_t v)
+{
+	if (v == 0) {
+		return;
+	}
+	if (klen == 2 && strncasecmp(key, "id", 2) == 0) {
+		frame->id = (uint32_t) v;
+	} else if (klen == 1 && (key[0] == 't' || key[0] == 'T')) {
+		frame->timestamp = v;
+	} else if (klen == 3 && strncasecmp(key, "bus", 3) == 0) {
+		frame->bus = (uint16_t) v;
+	} else if (klen == 1 && (key[0] == 'd' || key[0] == 'D')) {
+		frame->flags = (uint8_t) v;
+	} else if (klen == 1 && (key[0] == 'l' || key[0] == 'L')) {
+		frame->dlc = (uint8_t) v;
+	}
+}
+
+// Scanner of the JSON frames, no allocation and no copy. It only knows
+// integers and strings without escapes in the fields it reads, anything
+// else fails and the message goes to cJSON.
+struct json_scan {
+	const char *p;
+	const char *end;
+};
+
+static inline void
+scan_ws(json_scan *s)
+{
+	while (s->p < s->end &&
+	    (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r'))
+		s->p++;
+}
+
+static inline bool
+scan_char(json_scan *s, char c)
+{
+	scan_ws(s);
+	if (s->p < s->end && *s->p == c) {
+		s->p++;
+		return true;
+	}
+	return false;
+}
+
+static bool
+scan_string(json_scan *s, const char **str, size_t *len, bool *escaped)
+{
+	if (!scan_char(s, '"')) {
+		return false;
+	}
+	*str     = s->p;
+	*escaped = false;
+	while (s->p < s->end && *s->p != '"') {
+		if (*s->p == '\\') {
+			*escaped = true;
+			s->p++;
+		}
+		s->p++;
+	}
+	if (s->p >= s->end) {
+		return false;
+	}
+	*len = s->p - *str;
+	s->p++;
+	return true;
+}
+
+static bool
+scan_skip(json_scan *s)
+{
+	const char *str;
+	size_t      len;
+	bool        escaped;
+	int         depth = 0;
+
+	scan_ws(s);
+	do {
+		if (s->p >= s->end) {
+			return false;
+		}
+		switch (*s->p) {
+		case '"':
+			if (!scan_string(s, &str, &len, &escaped)) {
+				return false;
+			}
+			continue;
+		case '{':
+		case '[':
+			depth++;
+			break;
+		case '}':
+		case ']':
+			if (depth == 0) {
+				return true;
+			}
+			depth--;
+			break;
+		case ',':
+			if (depth == 0) {
+				return true;
+			}
+			break;
+		default:
+			break;
+		}
+		s->p++;
+	} while (depth > 0 || (s->p < s->end && *s->p != ',' &&
+	             *s->p != '}' && *s->p != ']'));
+	return true;
+}
+
+// Positive integer, negative ones are read as 0. Fails on fractions.
+static bool
+scan_uint(json_scan *s, uint64_t *v)
+{
+	bool neg = false;
+
+	scan_ws(s);
+	if (s->p < s->end && *s->p == '-') {
+		neg = true;
+		s->p++;
+	}
+	if (s->p >= s->end || *s->p < '0' || *s->p > '9') {
+		return false;
+	}
+	*v = 0;
+	while (s->p < s->end && *s->p >= '0' && *s->p <= '9') {
+		*v = *v * 10 + (*s->p++ - '0');
+	}
+	if (s->p < s->end &&
+	    (*s->p == '.' || *s->p == 'e' || *s->p == 'E')) {
+		return false;
+	}
+	if (neg) {
+		*v = 0;
+	}
+	return true;
+}
+
+static bool
+scan_frame(json_scan *s, blf_can_frame *frame)
+{
+	const char *key, *str;
+	size_t      klen, len;
+	bool        escaped;
+	uint64_t    v;
+
+	memset(frame, 0, sizeof(*frame));
+	if (!scan_char(s, '{')) {
+		return false;
+	}
+	if (scan_char(s, '}')) {
+		return true;
+	}
+	do {
+		if (!scan_string(s, &key, &klen, &escaped) ||
+		    !scan_char(s, ':')) {
+			return false;
+		}
+		scan_ws(s);
+		if (s->p >= s->end) {
+			return false;
+		}
+		if (klen == 4 && strncasecmp(key, "data", 4) == 0 &&
+		    *s->p == '"') {
+			if (!scan_string(s, &str, &len, &escaped) || escaped) {
+				return false;
+			}
+			read_hex_data(str, len, frame->data);
+		} else if ((*s->p >= '0' && *s->p <= '9') || *s->p == '-') {
+			if (!scan_uint(s, &v)) {
+				return false;
+			}
+			frame_set_num(frame, key, klen, v);
+		} else if (!scan_skip(s)) {
+			return false;
+		}
+	} while (scan_char(s, ','));
+	return scan_char(s, '}');
+}
+
+// Frames are collected first, so a message failing half way is not
+// written twice. The buffer is kept for the next messages.
+static bool
+blf_decode_json_fast(const uint8_t *payload, uint32_t len,
+    vector<blf_can_frame> &frames)
+{
+	json_scan   s = { (const char *) payload, (const char *) payload + len };
+	const char *key;
+	size_t      klen;
+	bool        escaped;
+
+	frames.clear();
+	if (!scan_char(&s, '{')) {
+		return false;
+	}
+	if (scan_char(&s, '}')) {
+		return true;
+	}
+	do {
+		if (!scan_string(&s, &key, &klen, &escaped) ||
+		    !scan_char(&s, ':')) {
+			return false;
+		}
+		if (klen != 6 || strncasecmp(key, "frames", 6) != 0) {
+			if (!scan_skip(&s)) {
+				return false;
+			}
+			continue;
+		}
+		if (!scan_char(&s, '[')) {
+			return false;
+		}
+		if (scan_char(&s, ']')) {
+			continue;
+		}
+		do {
+			frames.emplace_back();
+			if (!scan_frame(&s, &frames.back())) {
+				return false;
+			}
+		} while (scan_char(&s, ','));
+		if (!scan_char(&s, ']')) {
+			return false;
+		}
+		// the first frames array, as cJSON_GetObjectItem
+		return true;
+	} while (scan_char(&s, ','));
+	return scan_char(&s, '}');
+}
+
+#define json_read_frame_num(frame, field, key, jso)                \
+	do {                                                       \
+		cJSON *jso_key = cJSON_GetObjectItem(jso, key);    \
+		if (cJSON_IsNumber(jso_key) &&                     \
+		    jso_key->valuedouble > 0) {                    \
+			(frame)->field = jso_key->valuedouble;     \
+		}                                                  \
+	} while (0)
+
+static int
+blf_decode_json(
+    const uint8_t *payload, uint32_t len, blf_can_frame_cb cb, void *arg)
+{
+	static thread_local vector<blf_can_frame> frames;
+	blf_can_frame                             frame;
+	int                                       count = 0;
+
+	if (blf_decode_json_fast(payload, len, frames)) {
+		for (auto &f : frames) {
+			cb(&f, arg);
+		}
+		return (int) frames.size();
+	}
+
+	cJSON *jso = cJSON_ParseWithLength((const char *) payload, len);
+	if (jso == NULL) {
+		log_error("Failed to parse CAN frames");
+		return -1;
+	}
+	cJSON *jso_frames = cJSON_GetObjectItem(jso, "frames");
+	cJSON *jso_frame  = NULL;
+	cJSON_ArrayForEach(jso_frame, jso_frames)
+	{
+		memset(&frame, 0, sizeof(frame));
+		json_read_frame_num(&frame, id, "id", jso_frame);
+		json_read_frame_num(&frame, timestamp, "t", jso_frame);
+		json_read_frame_num(&frame, bus, "bus", jso_frame);
+		json_read_frame_num(&frame, flags, "d", jso_frame);
+		json_read_frame_num(&frame, dlc, "l", jso_frame);
+		cJSON *data = cJSON_GetObjectItem(jso_frame, "data");
+		if (cJSON_IsString(data)) {
+			read_hex_data(data->valuestring,
+			    strlen(data->valuestring), frame.data);
+		}
+		cb(&frame, arg);
+		count++;
+	}
+	cJSON_Delete(jso);
+	return count;
+}
+
+int
+blf_can_frames_decode(
+    const uint8_t *payload, uint32_t len, blf_can_frame_cb cb, void *arg)
+{
+	if (payload == NULL || cb == NULL) {
+		return -1;
+	}
+	if (len >= BLF_CAN_MAGIC_LEN &&
+	    memcmp(payload, BLF_CAN_MAGIC, BLF_CAN_MAGIC_LEN) == 0) {
+		return blf_decode_binary(payload, len, cb, arg);
+	}
+	return blf_decode_json(payload, len, cb, arg);
+}
+
+static void
+blf_write_can_message(const blf_can_frame *frame, void *arg)
+{
+	Vector::BLF::File *file = (Vector::BLF::File *) arg;
+	// the file frees written objects
+	auto *canMessage            = new Vector::BLF::CanMessage;
+	canMessage->id              = frame->id;
+	canMessage->objectTimeStamp = frame->timestamp;
+	canMessage->channel         = frame->bus;
+	canMessage->flags           = frame->flags;
+	canMessage->dlc             = frame->dlc;
+	memcpy(canMessage->data.data(), frame->data, 8);
+	file->write(canMessage);
 }
 
 int
@@ -237,26 +597,38 @@ blf_write_core(
 	}
 
 	for (uint32_t i = old_index; i <= new_index; i++) {
-
-		cJSON *jso = cJSON_ParseWithLength(
-		    (const char *) elem->darray[i], elem->dsize[i]);
-		cJSON *frames = cJSON_GetObjectItem(jso, "frames");
-		cJSON *frame  = NULL;
-		cJSON_ArrayForEach(frame, frames)
-		{
-			/* write a CanMessage */
-			blf_write_can_message(file, frame);
+		if (blf_can_frames_decode(elem->darray[i], elem->dsize[i],
+		        blf_write_can_message, &file) < 0) {
+			log_warn("Skip malformed CAN message of key %" PRIu64,
+			    elem->keys[i]);
 		}
-
-        cJSON_Delete(jso);
 	}
 
-
 	/* close file */
 	file.close();
 	return 0;
 }
 
+static void
+blf_catalog_add(const char *path, uint64_t key_start, uint64_t key_end)
+{
+	struct stat        st;
+	file_catalog_entry ent;
+
+	ent.start_key = key_start;
+	ent.end_key   = key_end;
+	ent.topic     = NULL;
+	ent.path      = path;
+	ent.md5       = NULL;
+	ent.size      = stat(path, &st) == 0 ? st.st_size : 0;
+	pthread_mutex_lock(&blf_queue_mutex);
+	// in step with blf_file_queue
+	if (file_catalog_add(blf_catalog, &ent) != 0) {
+		log_error("Failed to add %s to catalog", path);
+	}
+	pthread_mutex_unlock(&blf_queue_mutex);
+}
+
 int
 blf_write(conf_blf *conf, blf_object *elem)
 {
@@ -285,7 +657,9 @@ again:
 		    blf_file_range_alloc(old_index, new_index, filename);
 		update_blf_file_ranges(conf, elem, range);
 		// write value
-		blf_write_core(filename, elem, old_index, new_index);
+		if (blf_write_core(filename, elem, old_index, new_index) == 0) {
+			blf_catalog_add(filename, key_start, key_end);
+		}
 		old_index = new_index;
 
 		if (new_index != elem->size - 1)
@@ -352,6 +726,10 @@ int
 blf_write_launcher(conf_blf *conf)
 {
 	g_conf = conf;
+	if (blf_catalog == NULL && file_catalog_create(&blf_catalog) != 0) {
+		log_error("Failed to create blf file catalog.");
+		return -1;
+	}
 	INIT_QUEUE(blf_queue);
 	INIT_QUEUE(blf_file_queue);
 	is_available = true;
@@ -360,30 +738,6 @@ blf_write_launcher(conf_blf *conf)
 	return 0;
 }
 
-static void
-get_range(const char *name, uint64_t range[2])
-{
-	const char *start = strrchr(name, '-');
-	sscanf(start, "-%ld~%ld.parquet", &range[0], &range[1]);
-	return;
-}
-
-static bool
-compare_callback(void *name, uint64_t key)
-{
-	uint64_t range[2] = { 0 };
-	get_range((const char *) name, range);
-	return (key >= range[0] && key <= range[1]);
-}
-
-static bool
-compare_callback_span(void *name, uint64_t low, uint64_t high)
-{
-	uint64_t range[2] = { 0 };
-	get_range((const char *) name, range);
-	return !(low > range[1] || high < range[0]);
-}
-
 const char *
 blf_find(uint64_t key)
 {
@@ -391,19 +745,7 @@ blf_find(uint64_t key)
         log_error("BLF is not ready or not launch!");
         return NULL;
     }
-	WAIT_FOR_AVAILABLE
-	const char *value = NULL;
-	void       *elem  = NULL;
-	pthread_mutex_lock(&blf_queue_mutex);
-	FOREACH_QUEUE(blf_file_queue, elem)
-	{
-		if (elem && compare_callback(elem, key)) {
-			value = nng_strdup((char *) elem);
-			break;
-		}
-	}
-	pthread_mutex_unlock(&blf_queue_mutex);
-	return value;
+	return file_catalog_find(blf_catalog, key, NULL);
 }
 
 const char **
@@ -419,35 +761,6 @@ blf_find_span(uint64_t start_key, uint64_t end_key, uint32_t *size)
 		return NULL;
 	}
 
-	WAIT_FOR_AVAILABLE
-
-	uint64_t     low        = start_key;
-	uint64_t     high       = end_key;
-	uint32_t     local_size = 0;
-	const char  *value      = NULL;
-	const char **array      = NULL;
-	const char **ret        = NULL;
-	void        *elem       = NULL;
-
-	pthread_mutex_lock(&blf_queue_mutex);
-	if (blf_file_queue.size != 0) {
-		array = (const char **) nng_alloc(
-		    sizeof(char *) * blf_file_queue.size);
-
-		ret = array;
-		FOREACH_QUEUE(blf_file_queue, elem)
-		{
-			if (elem) {
-				if (compare_callback_span(elem, low, high)) {
-					++local_size;
-					value    = nng_strdup((char *) elem);
-					*array++ = value;
-				}
-			}
-		}
-	}
-
-	pthread_mutex_unlock(&blf_queue_mutex);
-	(*size) = local_size;
-	return ret;
+	return (const char **) file_catalog_find_span(
+	    blf_catalog, start_key, end_key, NULL, size);
 }
@@ -0,0 +1,215 @@
+#include "nng/supplemental/nanolib/blf.h"
+#include "nng/supplemental/util/platform.h"
+#include <nuts.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_FRAMES 100 // frames of a message
+#define BENCH_MSGS 10000
+#define BENCH_BUF 16384
+
+#ifdef NNG_TEST_BENCH
+static char bench_dir[]    = "/tmp/nanomq-blf-test";
+static char bench_prefix[] = "bench";
+#endif
+
+static void
+bench_frame(blf_can_frame *frame, uint32_t i)
+{
+	frame->timestamp = 1700000000000000000ull + i;
+	frame->id        = 0x100 + i;
+	frame->bus       = 1 + i % 2;
+	frame->flags     = 1;
+	frame->dlc       = 8;
+	for (int j = 0; j < 8; j++) {
+		frame->data[j] = (uint8_t) (i + j);
+	}
+}
+
+// JSON message of frames, t is written as a fraction if frac.
+static size_t
+bench_json(char *buf, size_t len, uint32_t count, bool frac)
+{
+	size_t n = snprintf(buf, len, "{\"vin\":\"v1\",\"frames\":[");
+	for (uint32_t i = 0; i < count; i++) {
+		blf_can_frame f;
+		bench_frame(&f, i);
+		n += snprintf(buf + n, len - n,
+		    "%s{\"id\":%u,\"t\":%llu%s,\"bus\":%u,\"d\":%u,\"l\":%u,"
+		    "\"data\":\"",
+		    i == 0 ? "" : ",", f.id, (unsigned long long) f.timestamp,
+		    frac ? ".0" : "", f.bus, f.flags, f.dlc);
+		for (int j = 0; j < 8; j++) {
+			n += snprintf(buf + n, len - n, "%02X", f.data[j]);
+		}
+		n += snprintf(buf + n, len - n, "\"}");
+	}
+	n += snprintf(buf + n, len - n, "]}");
+	NUTS_ASSERT(n < len);
+	return n;
+}
+
+typedef struct {
+	uint32_t count;
+	bool     bad;
+} bench_check;
+
+static void
+bench_check_cb(const blf_can_frame *frame, void *arg)
+{
+	bench_check  *chk = arg;
+	blf_can_frame f;
+
+	bench_frame(&f, chk->count++);
+	// doubles of cJSON lose the low digits of t
+	if (frame->id != f.id || frame->bus != f.bus ||
+	    frame->flags != f.flags || frame->dlc != f.dlc ||
+	    memcmp(frame->data, f.data, 8) != 0 ||
+	    frame->timestamp / 1000 != f.timestamp / 1000) {
+		chk->bad = true;
+	}
+}
+
+static void
+bench_count_cb(const blf_can_frame *frame, void *arg)
+{
+	(void) frame;
+	(*(uint64_t *) arg)++;
+}
+
+static void
+test_blf_frames_decode(void)
+{
+	blf_can_frame frames[BENCH_FRAMES];
+	uint8_t       bin[BENCH_BUF];
+	char          json[BENCH_BUF];
+	bench_check   chk;
+	size_t        n;
+
+	for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+		bench_frame(&frames[i], i);
+	}
+	NUTS_TRUE(blf_can_frames_encode(frames, BENCH_FRAMES, bin, 10) == 0);
+	n = blf_can_frames_encode(frames, BENCH_FRAMES, bin, sizeof(bin));
+	NUTS_TRUE(n == BLF_CAN_MAGIC_LEN + BENCH_FRAMES * BLF_CAN_FRAME_SIZE);
+
+	memset(&chk, 0, sizeof(chk));
+	NUTS_TRUE(blf_can_frames_decode(bin, n, bench_check_cb, &chk) ==
+	    BENCH_FRAMES);
+	NUTS_TRUE(chk.count == BENCH_FRAMES && !chk.bad);
+	NUTS_TRUE(blf_can_frames_decode(bin, n - 1, bench_check_cb, &chk) < 0);
+
+	// fast path and cJSON
+	for (int frac = 0; frac < 2; frac++) {
+		n = bench_json(json, sizeof(json), BENCH_FRAMES, frac);
+		memset(&chk, 0, sizeof(chk));
+		NUTS_TRUE(blf_can_frames_decode((uint8_t *) json, n,
+		              bench_check_cb, &chk) == BENCH_FRAMES);
+		NUTS_TRUE(chk.count == BENCH_FRAMES && !chk.bad);
+	}
+
+	const char *other = "{ \"meta\" : {\"a\":[1,{\"b\":\"}\"}]}, "
+	                    "\"frames\" : [ { \"x\":\"y\\\"\", \"id\":-3, "
+	                    "\"l\":2, \"data\":\"ABCDzz\" }, {} ] }";
+	uint64_t    count = 0;
+	NUTS_TRUE(blf_can_frames_decode((uint8_t *) other, strlen(other),
+	              bench_count_cb, &count) == 2);
+	NUTS_TRUE(count == 2);
+	NUTS_TRUE(blf_can_frames_decode((uint8_t *) other, 10, bench_count_cb,
+	              &count) < 0);
+}
+
+#ifdef NNG_TEST_BENCH
+static void
+bench_decode(const char *name, const uint8_t *msg, size_t len)
+{
+	uint64_t count = 0;
+	nng_time start = nng_clock();
+	for (int i = 0; i < BENCH_MSGS; i++) {
+		blf_can_frames_decode(msg, len, bench_count_cb, &count);
+	}
+	nng_time end = nng_clock();
+	NUTS_TRUE(count == (uint64_t) BENCH_MSGS * BENCH_FRAMES);
+	printf("blf decode %-8s %12.0f frames/s\n", name,
+	    count / ((end - start + 1) / 1000.0));
+}
+
+static void
+test_blf_decode_bench(void)
+{
+	blf_can_frame frames[BENCH_FRAMES];
+	uint8_t       bin[BENCH_BUF];
+	char          json[BENCH_BUF];
+	size_t        n;
+
+	for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+		bench_frame(&frames[i], i);
+	}
+	n = blf_can_frames_encode(frames, BENCH_FRAMES, bin, sizeof(bin));
+	bench_decode("binary", bin, n);
+	n = bench_json(json, sizeof(json), BENCH_FRAMES, false);
+	bench_decode("json", (uint8_t *) json, n);
+	n = bench_json(json, sizeof(json), BENCH_FRAMES, true);
+	bench_decode("cjson", (uint8_t *) json, n);
+}
+
+// One batch of binary messages through the writer.
+static void
+test_blf_write_bench(void)
+{
+	static conf_blf conf;
+	blf_can_frame   frames[BENCH_FRAMES];
+	uint8_t         bin[BENCH_BUF];
+	nng_aio        *aio;
+	uint32_t        rows = BENCH_MSGS / 10;
+	size_t          n;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.enable           = true;
+	conf.dir              = bench_dir;
+	conf.file_name_prefix = bench_prefix;
+	conf.file_count       = 5;
+	conf.file_size        = 10240 * 1024;
+	NUTS_PASS(blf_write_launcher(&conf));
+
+	for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+		bench_frame(&frames[i], i);
+	}
+	n = blf_can_frames_encode(frames, BENCH_FRAMES, bin, sizeof(bin));
+
+	uint64_t *keys   = nng_alloc(sizeof(uint64_t) * rows);
+	uint8_t **darray = nng_alloc(sizeof(uint8_t *) * rows);
+	uint32_t *dsize  = nng_alloc(sizeof(uint32_t) * rows);
+	NUTS_ASSERT(keys != NULL && darray != NULL && dsize != NULL);
+	for (uint32_t i = 0; i < rows; i++) {
+		keys[i]   = i;
+		darray[i] = bin;
+		dsize[i]  = n;
+	}
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_begin(aio);
+	blf_object *obj =
+	    blf_object_alloc(keys, darray, dsize, rows, aio, NULL);
+
+	nng_time start = nng_clock();
+	NUTS_PASS(blf_write_batch_async(obj));
+	nng_aio_wait(aio);
+	nng_time end = nng_clock();
+	NUTS_PASS(nng_aio_result(aio));
+	// size of written batch
+	free(nng_aio_get_msg(aio));
+	nng_aio_free(aio);
+
+	printf("blf write binary %12.0f frames/s\n",
+	    (double) rows * BENCH_FRAMES / ((end - start + 1) / 1000.0));
+}
+#endif
+
+NUTS_TESTS = {
+	{ "blf frames decode", test_blf_frames_decode },
+#ifdef NNG_TEST_BENCH
+	{ "blf decode bench", test_blf_decode_bench },
+	{ "blf write bench", test_blf_write_bench },
+#endif
+	{ NULL, NULL },
+};
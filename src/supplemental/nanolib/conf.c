@@ -448,6 +448,10 @@ conf_basic_parse(conf *config, const char *path)
 		                line, sz, "client_max_packet_size")) != NULL) {
 			config->client_max_packet_size = atoi(value) * 1024;
 			nng_strfree(value);
+		} else if ((value = get_conf_value(
+		                line, sz, "recv_buffer_size")) != NULL) {
+			config->recv_buffer_size = atoi(value) * 1024;
+			nng_strfree(value);
 		} else if ((value = get_conf_value(line, sz, "msq_len")) !=
 		    NULL) {
 			config->msq_len = atoi(value);
@@ -670,6 +674,7 @@ conf_log_init(conf_log *log)
 	log->rotation_sz_str = NULL;
 	log->rotation_sz     = 10 * 1024;
 	log->rotation_count  = 5;
+	log->async           = false;
 }
 
 static void
@@ -890,6 +895,7 @@ conf_init(conf *nanomq_conf)
 
 	nanomq_conf->max_packet_size        = (10240 * 1024);
 	nanomq_conf->client_max_packet_size = (10240 * 1024);
+	nanomq_conf->recv_buffer_size       = 0;
 
 	int ncpu = nni_plat_ncpu();
 
@@ -905,6 +911,10 @@ conf_init(conf *nanomq_conf)
 	nanomq_conf->max_awaiting_rel = 10;
 	nanomq_conf->await_rel_timeout = 10;
 
+	nanomq_conf->shared_sub.strategy = DBTREE_SHARED_ROUND_ROBIN;
+	nanomq_conf->shared_sub.count    = 0;
+	nanomq_conf->shared_sub.groups   = NULL;
+
 	nanomq_conf->allow_anonymous = true;
 	nanomq_conf->ipc_internal    = true;
 
@@ -957,9 +967,20 @@ conf_init(conf *nanomq_conf)
 	nanomq_conf->parquet.limit_frequency  = 5;
 	nanomq_conf->parquet.file_count       = 5;
 	nanomq_conf->parquet.file_size        = (10240 * 1024);
+	nanomq_conf->parquet.row_group_size   = 0;
+	nanomq_conf->parquet.page_index       = false;
+	nanomq_conf->parquet.bloom_filter     = false;
+	nanomq_conf->parquet.write_threads    = 1;
+	nanomq_conf->parquet.write_queue_limit= 16;
+	nanomq_conf->parquet.compact          = false;
+	nanomq_conf->parquet.compact_interval = 60;
+	nanomq_conf->parquet.compact_rate     = 0;
+	nanomq_conf->parquet.retention_size   = 0;
+	nanomq_conf->parquet.retention_age    = 0;
 	nanomq_conf->parquet.comp_type        = UNCOMPRESSED;
 	nanomq_conf->parquet.file_name_prefix = NULL;
 	nanomq_conf->parquet.dir              = NULL;
+	nanomq_conf->parquet.columns          = NULL;
 
 	nanomq_conf->blf.enable           = false;
 	nanomq_conf->blf.file_count       = 5;
@@ -1217,6 +1238,24 @@ print_parquet_conf(conf_parquet *parquet)
 	log_info("parquet file_name_prefix: %s", parquet->file_name_prefix);
 	log_info("parquet file_count:       %d", parquet->file_count);
 	log_info("parquet file_size:        %d", parquet->file_size);
+	log_info("parquet row_group_size:   %u", parquet->row_group_size);
+	log_info("parquet page_index:       %s",
+	    parquet->page_index ? "enable" : "disable");
+	log_info("parquet bloom_filter:     %s",
+	    parquet->bloom_filter ? "enable" : "disable");
+	log_info("parquet write_threads:    %u", parquet->write_threads);
+	log_info("parquet write_queue_limit:%u", parquet->write_queue_limit);
+	if (parquet->columns) {
+		log_info("parquet columns:          %s", parquet->columns);
+	}
+	log_info("parquet compact:          %s",
+	    parquet->compact ? "enable" : "disable");
+	log_info("parquet compact_interval: %lus",
+	    parquet->compact_interval);
+	log_info("parquet compact_rate:     %lu", parquet->compact_rate);
+	log_info("parquet retention_size:   %lu", parquet->retention_size);
+	log_info("parquet retention_age:    %lus",
+	    parquet->retention_age);
 	log_info("parquet limit_frequency:  %d", parquet->limit_frequency);
 }
 
@@ -1360,12 +1399,20 @@ print_conf(conf *nanomq_conf)
 	log_info("max_packet_size:          %d", nanomq_conf->max_packet_size);
 	log_info("client_max_packet_size:   %d",
 	    nanomq_conf->client_max_packet_size);
+	log_info("recv_buffer_size:         %lu",
+	    (unsigned long) nanomq_conf->recv_buffer_size);
 	log_info("max_mqueue_len:           %d", nanomq_conf->msq_len);
 	log_info("max_inflight_window:      %d", nanomq_conf->max_inflight_window);
 	log_info("max_awaiting_rel:         %ds", nanomq_conf->max_awaiting_rel);
 	log_info("await_rel_timeout:        %ds", nanomq_conf->await_rel_timeout);
 	log_info("retry_interval:           %ds", nanomq_conf->qos_duration);
 	log_info("keepalive_multiplier:     %f", nanomq_conf->backoff);
+	log_info("shared sub strategy:      %d", nanomq_conf->shared_sub.strategy);
+	for (size_t i = 0; i < nanomq_conf->shared_sub.count; i++) {
+		log_info("shared sub group %s:     %d",
+		    nanomq_conf->shared_sub.groups[i]->name,
+		    nanomq_conf->shared_sub.groups[i]->strategy);
+	}
 
 	if (nanomq_conf->http_server.enable) {
 		conf_http_server hs = nanomq_conf->http_server;
@@ -3085,6 +3132,8 @@ conf_bridge_node_init(conf_bridge_node *node)
 	node->name           = NULL;
 	node->enable         = false;
 	node->parallel       = 2;
+	node->connections    = 1;
+	node->dispatch       = 0;
 	node->address        = NULL;
 	node->host           = NULL;
 	node->port           = 1883;
@@ -3306,6 +3355,15 @@ conf_bridge_node_parse_with_name(const char *path,const char *key_prefix, const
 		                key_prefix, name, ".parallel")) != NULL) {
 			node->parallel = atoi(value);
 			free(value);
+		} else if ((value = get_conf_value_with_prefix2(line, sz,
+		                key_prefix, name, ".connections")) != NULL) {
+			node->connections = atoi(value);
+			free(value);
+		} else if ((value = get_conf_value_with_prefix2(line, sz,
+		                key_prefix, name, ".dispatch")) != NULL) {
+			node->dispatch =
+			    nni_strcasecmp(value, "round_robin") == 0 ? 1 : 0;
+			free(value);
 		} else if ((value = get_conf_value_with_prefix2(line, sz,
 		                key_prefix, name, ".max_send_queue_len")) != NULL) {
 			node->max_send_queue_len = atoi(value);
@@ -3392,6 +3450,16 @@ conf_bridge_node_parse_with_name(const char *path,const char *key_prefix, const
 	conf_tls_parse(&node->tls, path, key_prefix, prefix2);
 	nng_strfree(prefix2);
 
+	// NNG_MQTT_CLIENT_MAX_CONNS, and a ctx for each connection
+	if (node->connections < 1) {
+		node->connections = 1;
+	} else if (node->connections > 16) {
+		node->connections = 16;
+	}
+	if (node->parallel < node->connections) {
+		node->parallel = node->connections;
+	}
+
 	return node;
 }
 
@@ -3637,6 +3705,10 @@ print_bridge_conf(conf_bridge *bridge, const char *prefix)
 		    node->name, node->backoff_max);
 		log_info("%sbridge.mqtt.%s.max_parallel_processes:     %ld", prefix,
 		    node->name, node->parallel);
+		log_info("%sbridge.mqtt.%s.connections:                %u", prefix,
+		    node->name, node->connections);
+		log_info("%sbridge.mqtt.%s.dispatch:                   %s", prefix,
+		    node->name, node->dispatch == 1 ? "round_robin" : "hash_topic");
 		log_info("%sbridge.mqtt.%s.resend_interval:            %ld", prefix,
 		    node->name, node->resend_interval);
 		log_info("%sbridge.mqtt.%s.resend_wait:                %ld", prefix,
@@ -4398,6 +4470,7 @@ conf_parquet_destroy(conf_parquet *parquet)
 	if (parquet) {
 		nng_strfree(parquet->dir);
 		nng_strfree(parquet->file_name_prefix);
+		nng_strfree(parquet->columns);
 
 		if (parquet->encryption.enable) {
 			nng_strfree(parquet->encryption.key);
@@ -4408,6 +4481,18 @@ conf_parquet_destroy(conf_parquet *parquet)
 }
 #endif
 
+static void
+conf_shared_sub_destroy(conf_shared_sub *shared)
+{
+	for (size_t i = 0; i < shared->count; i++) {
+		nng_strfree(shared->groups[i]->name);
+		NNI_FREE_STRUCT(shared->groups[i]);
+	}
+	cvector_free(shared->groups);
+	shared->groups = NULL;
+	shared->count  = 0;
+}
+
 void
 conf_fini(conf *nanomq_conf)
 {
@@ -4437,6 +4522,7 @@ conf_fini(conf *nanomq_conf)
 	conf_auth_http_destroy(&nanomq_conf->auth_http);
 	conf_auth_destroy(&nanomq_conf->auths);
 	conf_exchange_destroy(&nanomq_conf->exchange);
+	conf_shared_sub_destroy(&nanomq_conf->shared_sub);
 #if defined(ENABLE_LOG)
 	conf_log_destroy(&nanomq_conf->log);
 #endif
@@ -95,6 +95,12 @@ test_conf_parse_ver2(void)
 	NUTS_TRUE(conf != NULL);
 	conf_parse_ver2(conf);
 	NUTS_TRUE(strncmp(conf->url, "nmq-tcp://0.0.0.0:1883", 22) == 0);
+	NUTS_TRUE(conf->shared_sub.strategy == DBTREE_SHARED_ROUND_ROBIN);
+	NUTS_TRUE(conf->shared_sub.count == 2);
+	NUTS_MATCH(conf->shared_sub.groups[0]->name, "g1");
+	NUTS_TRUE(conf->shared_sub.groups[0]->strategy == DBTREE_SHARED_STICKY);
+	NUTS_TRUE(
+	    conf->shared_sub.groups[1]->strategy == DBTREE_SHARED_HASH_TOPIC);
 
 	print_conf(conf);
 
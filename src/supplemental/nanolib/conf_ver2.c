@@ -2,6 +2,7 @@
 
 #include "nanolib.h"
 #include "nng/exchange/exchange.h"
+#include "nng/mqtt/mqtt_client.h"
 #include "nng/nng.h"
 #include "nng/supplemental/nanolib/acl_conf.h"
 #include "nng/supplemental/nanolib/cJSON.h"
@@ -57,6 +58,21 @@ static enum_map compress_type[] = {
 	{ -1, NULL },
 };
 
+static enum_map shared_strategy_type[] = {
+	{ DBTREE_SHARED_ROUND_ROBIN, "round_robin" },
+	{ DBTREE_SHARED_STICKY, "sticky" },
+	{ DBTREE_SHARED_HASH_TOPIC, "hash_topic" },
+	{ DBTREE_SHARED_LEAST_INFLIGHT, "least_inflight" },
+	{ DBTREE_SHARED_RANDOM, "random" },
+	{ -1, NULL },
+};
+
+static enum_map bridge_dispatch_type[] = {
+	{ NNG_MQTT_DISPATCH_TOPIC, "hash_topic" },
+	{ NNG_MQTT_DISPATCH_ROUND_ROBIN, "round_robin" },
+	{ -1, NULL },
+};
+
 static enum_map encryption_type[] = { { AES_GCM_V1, "aes_gcm_v1" },
 	{ AES_GCM_CTR_V1, "aes_gcm_ctr_v1" } };
 
@@ -338,6 +354,7 @@ conf_basic_parse_ver2(conf *config, cJSON *jso)
 		hocon_read_num(config, property_size, jso_mqtt);
 		hocon_read_size(config, max_packet_size, jso_mqtt);
 		config->client_max_packet_size = config->max_packet_size;
+		hocon_read_size(config, recv_buffer_size, jso_mqtt);
 		hocon_read_num_base(
 		    config, msq_len, "max_mqueue_len", jso_mqtt);
 		hocon_read_time_base(
@@ -348,6 +365,27 @@ conf_basic_parse_ver2(conf *config, cJSON *jso)
 		hocon_read_num(config, max_inflight_window, jso_mqtt);
 		hocon_read_time(config, max_awaiting_rel, jso_mqtt);
 		hocon_read_time(config, await_rel_timeout, jso_mqtt);
+
+		cJSON *jso_shared =
+		    hocon_get_obj("shared_subscription", jso_mqtt);
+		if (jso_shared) {
+			conf_shared_sub *shared = &(config->shared_sub);
+			hocon_read_enum(
+			    shared, strategy, jso_shared, shared_strategy_type);
+			cJSON *jso_groups = hocon_get_obj("groups", jso_shared);
+			cJSON *jso_group  = NULL;
+			cJSON_ArrayForEach(jso_group, jso_groups)
+			{
+				conf_shared_sub_group *group =
+				    NNI_ALLOC_STRUCT(group);
+				group->name     = nng_strdup(jso_group->string);
+				group->strategy = shared->strategy;
+				hocon_read_enum(group, strategy, jso_group,
+				    shared_strategy_type);
+				cvector_push_back(shared->groups, group);
+			}
+			shared->count = cvector_size(shared->groups);
+		}
 	}
 
 	cJSON *jso_listeners = cJSON_GetObjectItem(jso, "listeners");
@@ -562,6 +600,7 @@ conf_log_parse_ver2(conf *config, cJSON *jso)
 
 		hocon_read_str(log, dir, jso_log);
 		hocon_read_str(log, file, jso_log);
+		hocon_read_bool(log, async, jso_log);
 		cJSON *jso_log_rotation = hocon_get_obj("rotation", jso_log);
 		hocon_read_size_base(
 		    log, rotation_sz, "size", jso_log_rotation);
@@ -1289,6 +1328,15 @@ conf_bridge_node_parse(
 	}
 
 	hocon_read_num_base(node, parallel, "max_parallel_processes", obj);
+	hocon_read_num(node, connections, obj);
+	hocon_read_enum(node, dispatch, obj, bridge_dispatch_type);
+	// NNG_MQTT_CLIENT_MAX_CONNS, and a ctx for each connection
+	if (node->connections > NNG_MQTT_CLIENT_MAX_CONNS) {
+		node->connections = NNG_MQTT_CLIENT_MAX_CONNS;
+	}
+	if (node->parallel < node->connections) {
+		node->parallel = node->connections;
+	}
 	update_bridge_node_vin(node, CONF_NODE_SUBSCRIPTION);
 	update_bridge_node_vin(node, CONF_NODE_FORWARD);
 	hocon_read_num(node, max_recv_queue_len, obj);
@@ -1473,8 +1521,19 @@ conf_parquet_parse_ver2(conf *config, cJSON *jso)
 		hocon_read_num(parquet, limit_frequency, jso_parquet);
 		hocon_read_num(parquet, file_count, jso_parquet);
 		hocon_read_size(parquet, file_size, jso_parquet);
+		hocon_read_num(parquet, row_group_size, jso_parquet);
+		hocon_read_bool(parquet, page_index, jso_parquet);
+		hocon_read_bool(parquet, bloom_filter, jso_parquet);
+		hocon_read_num(parquet, write_threads, jso_parquet);
+		hocon_read_num(parquet, write_queue_limit, jso_parquet);
+		hocon_read_bool(parquet, compact, jso_parquet);
+		hocon_read_time(parquet, compact_interval, jso_parquet);
+		hocon_read_size(parquet, compact_rate, jso_parquet);
+		hocon_read_size(parquet, retention_size, jso_parquet);
+		hocon_read_time(parquet, retention_age, jso_parquet);
 		hocon_read_str(parquet, dir, jso_parquet);
 		hocon_read_str(parquet, file_name_prefix, jso_parquet);
+		hocon_read_str(parquet, columns, jso_parquet);
 		update_parquet_vin(parquet);
 		hocon_read_enum_base(parquet, comp_type, "compress",
 		    jso_parquet, compress_type);
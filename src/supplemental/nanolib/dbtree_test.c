@@ -373,8 +373,150 @@ dbtree_test(void)
 	puts("---------------TEST FINISHED----------------\n");
 }
 
+#define SHARED_CONSUMERS 1000
+#define SHARED_ROUNDS 100
+
+static uint32_t shared_hits[SHARED_CONSUMERS + 1];
+
+static uint32_t
+shared_inflight_cb(uint32_t pipe_id, void *arg)
+{
+	(void) arg;
+	return shared_hits[pipe_id];
+}
+
+// Dispatch with 1k consumers per group, check fairness of every strategy.
+static void
+test_shared_dispatch(void)
+{
+	char        filter1[] = "$share/g1/dev/+/temp";
+	char        filter2[] = "$share/g2/dev/+/hum";
+	char        topic[]   = "dev/42/temp";
+	char        topic2[]  = "dev/42/hum";
+
+	dbtree_create(&db);
+	for (uint32_t i = 1; i <= SHARED_CONSUMERS; i++) {
+		dbtree_insert_client(db, filter1, i);
+		dbtree_insert_client(db, filter2, i);
+	}
+	dbtree_set_shared_inflight_cb(db, shared_inflight_cb, NULL);
+
+	for (int s = DBTREE_SHARED_ROUND_ROBIN; s <= DBTREE_SHARED_RANDOM;
+	     s++) {
+		uint32_t min = UINT32_MAX, max = 0;
+		size_t   n   = SHARED_CONSUMERS * SHARED_ROUNDS;
+
+		memset(shared_hits, 0, sizeof(shared_hits));
+		dbtree_set_shared_strategy(db, "g1", s);
+		for (size_t i = 0; i < n; i++) {
+			uint32_t *ids = dbtree_find_shared_clients(db, topic);
+			NUTS_TRUE(cvector_size(ids) == 1);
+			shared_hits[ids[0]]++;
+			cvector_free(ids);
+		}
+		for (uint32_t i = 1; i <= SHARED_CONSUMERS; i++) {
+			min = shared_hits[i] < min ? shared_hits[i] : min;
+			max = shared_hits[i] > max ? shared_hits[i] : max;
+		}
+		switch (s) {
+		case DBTREE_SHARED_ROUND_ROBIN:
+		case DBTREE_SHARED_LEAST_INFLIGHT:
+			// perfectly balanced
+			NUTS_TRUE(min >= SHARED_ROUNDS);
+			NUTS_TRUE(min == max);
+			break;
+		case DBTREE_SHARED_STICKY:
+		case DBTREE_SHARED_HASH_TOPIC:
+			// g1 always hits the same consumer
+			NUTS_TRUE(max >= SHARED_CONSUMERS * SHARED_ROUNDS);
+			break;
+		default:
+			// binomial, mean SHARED_ROUNDS and deviation about
+			// a tenth of it, 5 deviations away is out
+			NUTS_TRUE(min >= SHARED_ROUNDS / 2);
+			NUTS_TRUE(max <= SHARED_ROUNDS * 2);
+			break;
+		}
+	}
+
+	// g2 kept the default strategy through all of it
+	memset(shared_hits, 0, sizeof(shared_hits));
+	for (size_t i = 0; i < SHARED_CONSUMERS; i++) {
+		uint32_t *ids = dbtree_find_shared_clients(db, topic2);
+		NUTS_TRUE(cvector_size(ids) == 1);
+		shared_hits[ids[0]]++;
+		cvector_free(ids);
+	}
+	for (uint32_t i = 1; i <= SHARED_CONSUMERS; i++) {
+		NUTS_TRUE(shared_hits[i] == 1);
+	}
+
+	for (uint32_t i = 1; i <= SHARED_CONSUMERS; i++) {
+		dbtree_delete_client(db, filter1, i);
+		dbtree_delete_client(db, filter2, i);
+	}
+	dbtree_destory(db);
+}
+
+#define STICKY_PUBLISHERS 1000
+
+// Sticky dispatch keeps every publisher on its own subscriber.
+static void
+test_shared_sticky(void)
+{
+	char     filter[] = "$share/g/dev/+/temp";
+	char     topic[]  = "dev/42/temp";
+	uint32_t picked[STICKY_PUBLISHERS + 1];
+	uint32_t used = 0, moved = 0;
+	uint32_t *ids;
+
+	dbtree_create(&db);
+	for (uint32_t i = 1; i <= SHARED_CONSUMERS; i++) {
+		dbtree_insert_client(db, filter, i);
+	}
+	dbtree_set_shared_strategy(db, "g", DBTREE_SHARED_STICKY);
+
+	memset(shared_hits, 0, sizeof(shared_hits));
+	for (uint32_t p = 1; p <= STICKY_PUBLISHERS; p++) {
+		ids = dbtree_find_shared_clients_from(db, topic, p);
+		NUTS_TRUE(cvector_size(ids) == 1);
+		picked[p] = ids[0];
+		if (shared_hits[ids[0]]++ == 0) {
+			used++;
+		}
+		cvector_free(ids);
+		for (int r = 0; r < 10; r++) {
+			ids = dbtree_find_shared_clients_from(db, topic, p);
+			NUTS_TRUE(ids[0] == picked[p]);
+			cvector_free(ids);
+		}
+	}
+	// spread over the group, 1 - 1/e of it on average
+	NUTS_TRUE(used > SHARED_CONSUMERS / 2);
+
+	// only publishers of the one that left move
+	dbtree_delete_client(db, filter, picked[1]);
+	for (uint32_t p = 1; p <= STICKY_PUBLISHERS; p++) {
+		ids = dbtree_find_shared_clients_from(db, topic, p);
+		if (picked[p] == picked[1]) {
+			NUTS_TRUE(ids[0] != picked[1]);
+		} else if (ids[0] != picked[p]) {
+			moved++;
+		}
+		cvector_free(ids);
+	}
+	NUTS_TRUE(moved == 0);
+
+	for (uint32_t i = 1; i <= SHARED_CONSUMERS; i++) {
+		dbtree_delete_client(db, filter, i);
+	}
+	dbtree_destory(db);
+}
+
 TEST_LIST = {
    {"dbtree_test", dbtree_test},
+   {"dbtree shared dispatch", test_shared_dispatch},
+   {"dbtree shared sticky", test_shared_sticky},
 
    {NULL, NULL} 
 };
\ No newline at end of file
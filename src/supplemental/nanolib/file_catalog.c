@@ -0,0 +1,441 @@
+//
+// Copyright 2024 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+// Catalog of persisted files by key range.
+// Files are kept in an immutable array sorted by start key, along with the
+// running max of end keys, so both point and span lookups are two binary
+// searches. Readers only bump a counter around the walk. Updates are
+// serialized, copy the array and publish it; replaced arrays (and removed
+// entries) are retired and freed once no reader is in flight.
+
+#include <string.h>
+
+#include "core/nng_impl.h"
+#include "nng/supplemental/nanolib/file_catalog.h"
+
+typedef struct catalog_entry catalog_entry;
+typedef struct catalog_snap  catalog_snap;
+
+struct catalog_entry {
+	file_catalog_entry e;
+	size_t             sz;
+	catalog_entry     *next; // removed along with
+};
+
+struct catalog_snap {
+	size_t          count;
+	size_t          sz;
+	catalog_snap   *next;    // retired list
+	catalog_entry  *removed; // list freed along with this snapshot
+	catalog_entry **entries; // sorted by start key
+	uint64_t       *max_end; // max end key of entries[0..i]
+};
+
+struct file_catalog {
+	nni_atomic_ptr snap;
+	nni_atomic_int readers;
+	nni_mtx        mtx; // serializes updates
+	catalog_snap  *retired;
+};
+
+static catalog_snap *
+catalog_snap_alloc(size_t count)
+{
+	catalog_snap *snap;
+	size_t        sz = sizeof(*snap) +
+	    count * (sizeof(catalog_entry *) + sizeof(uint64_t));
+
+	if ((snap = nni_zalloc(sz)) == NULL) {
+		return NULL;
+	}
+	snap->count   = count;
+	snap->sz      = sz;
+	snap->max_end = (uint64_t *) (snap + 1);
+	snap->entries = (catalog_entry **) (snap->max_end + count);
+	return snap;
+}
+
+static void
+catalog_snap_index(catalog_snap *snap)
+{
+	uint64_t max = 0;
+
+	for (size_t i = 0; i < snap->count; i++) {
+		if (snap->entries[i]->e.end_key > max || i == 0) {
+			max = snap->entries[i]->e.end_key;
+		}
+		snap->max_end[i] = max;
+	}
+}
+
+static void
+catalog_entry_free(catalog_entry *ent)
+{
+	catalog_entry *next;
+
+	for (; ent != NULL; ent = next) {
+		next = ent->next;
+		nni_free(ent, ent->sz);
+	}
+}
+
+static catalog_entry *
+catalog_entry_alloc(const file_catalog_entry *src)
+{
+	catalog_entry *ent;
+	const char    *topic = src->topic != NULL ? src->topic : "";
+	const char    *md5   = src->md5 != NULL ? src->md5 : "";
+	size_t         tlen  = strlen(topic) + 1;
+	size_t         plen  = strlen(src->path) + 1;
+	size_t         mlen  = strlen(md5) + 1;
+	size_t         sz    = sizeof(*ent) + tlen + plen + mlen;
+	char          *buf;
+
+	if ((ent = nni_alloc(sz)) == NULL) {
+		return NULL;
+	}
+	// strings are packed right after the entry
+	buf         = (char *) (ent + 1);
+	ent->e      = *src;
+	ent->sz     = sz;
+	ent->next   = NULL;
+	ent->e.path = memcpy(buf, src->path, plen);
+	buf += plen;
+	ent->e.topic = memcpy(buf, topic, tlen);
+	buf += tlen;
+	ent->e.md5 = memcpy(buf, md5, mlen);
+	return ent;
+}
+
+// Free retired snapshots if no reader is in flight. Anyone still walking
+// a retired snapshot bumped the counter before loading it, which was before
+// it got replaced. Called with update lock held.
+static void
+catalog_reclaim(file_catalog *cat)
+{
+	catalog_snap *snap, *next;
+
+	if (cat->retired == NULL || nni_atomic_get(&cat->readers) != 0) {
+		return;
+	}
+	for (snap = cat->retired; snap != NULL; snap = next) {
+		next = snap->next;
+		catalog_entry_free(snap->removed);
+		nni_free(snap, snap->sz);
+	}
+	cat->retired = NULL;
+}
+
+// Called with update lock held
+static void
+catalog_publish(file_catalog *cat, catalog_snap *snap, catalog_entry *removed)
+{
+	catalog_snap *old = nni_atomic_get_ptr(&cat->snap);
+
+	catalog_snap_index(snap);
+	nni_atomic_set_ptr(&cat->snap, snap);
+	old->removed = removed;
+	old->next    = cat->retired;
+	cat->retired = old;
+	catalog_reclaim(cat);
+}
+
+static catalog_snap *
+catalog_read_begin(file_catalog *cat)
+{
+	nni_atomic_inc(&cat->readers);
+	return nni_atomic_get_ptr(&cat->snap);
+}
+
+static void
+catalog_read_end(file_catalog *cat)
+{
+	nni_atomic_dec(&cat->readers);
+}
+
+int
+file_catalog_create(file_catalog **catp)
+{
+	file_catalog *cat;
+	catalog_snap *snap;
+
+	if ((cat = NNI_ALLOC_STRUCT(cat)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if ((snap = catalog_snap_alloc(0)) == NULL) {
+		NNI_FREE_STRUCT(cat);
+		return (NNG_ENOMEM);
+	}
+	nni_mtx_init(&cat->mtx);
+	nni_atomic_init(&cat->readers);
+	nni_atomic_set_ptr(&cat->snap, snap);
+	*catp = cat;
+	return (0);
+}
+
+void
+file_catalog_destroy(file_catalog *cat)
+{
+	catalog_snap *snap;
+
+	if (cat == NULL) {
+		return;
+	}
+	nni_mtx_lock(&cat->mtx);
+	catalog_reclaim(cat);
+	nni_mtx_unlock(&cat->mtx);
+
+	snap = nni_atomic_get_ptr(&cat->snap);
+	for (size_t i = 0; i < snap->count; i++) {
+		nni_free(snap->entries[i], snap->entries[i]->sz);
+	}
+	nni_free(snap, snap->sz);
+	nni_mtx_fini(&cat->mtx);
+	NNI_FREE_STRUCT(cat);
+}
+
+int
+file_catalog_add(file_catalog *cat, const file_catalog_entry *entry)
+{
+	if (entry == NULL) {
+		return (NNG_EINVAL);
+	}
+	return (file_catalog_replace(cat, NULL, 0, entry));
+}
+
+int
+file_catalog_remove(file_catalog *cat, const char *path)
+{
+	if (path == NULL) {
+		return (NNG_EINVAL);
+	}
+	return (file_catalog_replace(cat, &path, 1, NULL));
+}
+
+static bool
+catalog_has_path(const catalog_entry *ent, const char **paths, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (strcmp(ent->e.path, paths[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int
+file_catalog_replace(file_catalog *cat, const char **paths, size_t count,
+    const file_catalog_entry *entry)
+{
+	catalog_snap  *old, *snap;
+	catalog_entry *ent     = NULL;
+	catalog_entry *removed = NULL;
+	size_t         n, pos;
+
+	if (cat == NULL || (paths == NULL && count > 0) ||
+	    (entry != NULL &&
+	        (entry->path == NULL || entry->start_key > entry->end_key))) {
+		return (NNG_EINVAL);
+	}
+	if (entry != NULL && (ent = catalog_entry_alloc(entry)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+
+	nni_mtx_lock(&cat->mtx);
+	old = nni_atomic_get_ptr(&cat->snap);
+	for (size_t i = 0; i < count; i++) {
+		for (pos = 0; pos < old->count; pos++) {
+			if (strcmp(old->entries[pos]->e.path, paths[i]) == 0) {
+				break;
+			}
+		}
+		if (pos == old->count) {
+			nni_mtx_unlock(&cat->mtx);
+			catalog_entry_free(ent);
+			return (NNG_ENOENT);
+		}
+	}
+	n = 0;
+	for (pos = 0; pos < old->count; pos++) {
+		n += catalog_has_path(old->entries[pos], paths, count);
+	}
+	if ((snap = catalog_snap_alloc(
+	         old->count - n + (ent != NULL ? 1 : 0))) == NULL) {
+		nni_mtx_unlock(&cat->mtx);
+		catalog_entry_free(ent);
+		return (NNG_ENOMEM);
+	}
+	n = 0;
+	for (pos = 0; pos < old->count; pos++) {
+		catalog_entry *e = old->entries[pos];
+		if (catalog_has_path(e, paths, count)) {
+			e->next = removed;
+			removed = e;
+			continue;
+		}
+		snap->entries[n++] = e;
+	}
+	if (ent != NULL) {
+		// after the files of same start key, new files mostly go last
+		pos = n;
+		while (pos > 0 &&
+		    snap->entries[pos - 1]->e.start_key > ent->e.start_key) {
+			pos--;
+		}
+		memmove(snap->entries + pos + 1, snap->entries + pos,
+		    (n - pos) * sizeof(catalog_entry *));
+		snap->entries[pos] = ent;
+	}
+	catalog_publish(cat, snap, removed);
+	nni_mtx_unlock(&cat->mtx);
+	return (0);
+}
+
+size_t
+file_catalog_count(file_catalog *cat)
+{
+	size_t count;
+
+	count = catalog_read_begin(cat)->count;
+	catalog_read_end(cat);
+	return count;
+}
+
+bool
+file_catalog_contains(file_catalog *cat, const char *path)
+{
+	catalog_snap *snap  = catalog_read_begin(cat);
+	bool          found = false;
+
+	for (size_t i = 0; i < snap->count && !found; i++) {
+		found = strcmp(snap->entries[i]->e.path, path) == 0;
+	}
+	catalog_read_end(cat);
+	return found;
+}
+
+// Entries in [*first, *last) may overlap [start_key, end_key]: the ones
+// starting no later than end_key, past the last one ending before
+// start_key. Both bounds are binary searches as start keys and max_end are
+// sorted.
+static void
+catalog_span(catalog_snap *snap, uint64_t start_key, uint64_t end_key,
+    size_t *first, size_t *last)
+{
+	size_t lo = 0, hi = snap->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (snap->entries[mid]->e.start_key <= end_key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*last = lo;
+
+	lo = 0;
+	hi = *last;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (snap->max_end[mid] < start_key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*first = lo;
+}
+
+static bool
+catalog_match(const catalog_entry *ent, uint64_t start_key, const char *topic)
+{
+	return ent->e.end_key >= start_key &&
+	    (topic == NULL || strcmp(ent->e.topic, topic) == 0);
+}
+
+size_t
+file_catalog_foreach_span(file_catalog *cat, uint64_t start_key,
+    uint64_t end_key, const char *topic, file_catalog_cb cb, void *arg)
+{
+	catalog_snap *snap;
+	size_t        first, last, n = 0;
+
+	if (cat == NULL || start_key > end_key) {
+		return 0;
+	}
+	snap = catalog_read_begin(cat);
+	catalog_span(snap, start_key, end_key, &first, &last);
+	for (size_t i = first; i < last; i++) {
+		if (catalog_match(snap->entries[i], start_key, topic)) {
+			n++;
+			if (!cb(&snap->entries[i]->e, arg)) {
+				break;
+			}
+		}
+	}
+	catalog_read_end(cat);
+	return n;
+}
+
+char *
+file_catalog_find(file_catalog *cat, uint64_t key, const char *topic)
+{
+	catalog_snap *snap;
+	size_t        first, last;
+	char         *path = NULL;
+
+	if (cat == NULL) {
+		return NULL;
+	}
+	snap = catalog_read_begin(cat);
+	catalog_span(snap, key, key, &first, &last);
+	for (size_t i = first; i < last; i++) {
+		if (catalog_match(snap->entries[i], key, topic)) {
+			path = nni_strdup(snap->entries[i]->e.path);
+			break;
+		}
+	}
+	catalog_read_end(cat);
+	return path;
+}
+
+char **
+file_catalog_find_span(file_catalog *cat, uint64_t start_key,
+    uint64_t end_key, const char *topic, uint32_t *size)
+{
+	catalog_snap *snap;
+	size_t        first, last;
+	uint32_t      n     = 0;
+	char        **paths = NULL;
+
+	*size = 0;
+	if (cat == NULL || start_key > end_key) {
+		return NULL;
+	}
+	snap = catalog_read_begin(cat);
+	catalog_span(snap, start_key, end_key, &first, &last);
+	for (size_t i = first; i < last; i++) {
+		if (catalog_match(snap->entries[i], start_key, topic)) {
+			n++;
+		}
+	}
+	if (n > 0 && (paths = nni_alloc(n * sizeof(char *))) != NULL) {
+		n = 0;
+		for (size_t i = first; i < last; i++) {
+			if (catalog_match(snap->entries[i], start_key, topic)) {
+				paths[n++] =
+				    nni_strdup(snap->entries[i]->e.path);
+			}
+		}
+		*size = n;
+	}
+	catalog_read_end(cat);
+	return paths;
+}
@@ -0,0 +1,245 @@
+#include "nng/supplemental/nanolib/file_catalog.h"
+#include "nng/supplemental/util/platform.h"
+#include <nuts.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CATALOG_FILES 10000
+#define CATALOG_LOOKUPS 1000000
+#define CATALOG_WINDOW 64
+#define CATALOG_READERS 4
+
+static void
+catalog_add(file_catalog *cat, const char *topic, uint64_t start,
+    uint64_t end)
+{
+	char               path[64];
+	file_catalog_entry ent = { 0 };
+
+	snprintf(path, sizeof(path), "/tmp/%s-%llu~%llu", topic,
+	    (unsigned long long) start, (unsigned long long) end);
+	ent.start_key = start;
+	ent.end_key   = end;
+	ent.topic     = topic;
+	ent.path      = path;
+	ent.md5       = "d41d8cd98f00b204e9800998ecf8427e";
+	ent.size      = end - start;
+	NUTS_PASS(file_catalog_add(cat, &ent));
+}
+
+static void
+free_paths(char **paths, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		nng_strfree(paths[i]);
+	}
+	nng_free(paths, n * sizeof(char *));
+}
+
+static void
+test_catalog_find(void)
+{
+	file_catalog *cat;
+	char         *path;
+	char        **paths;
+	uint32_t      n;
+
+	NUTS_PASS(file_catalog_create(&cat));
+	NUTS_NULL(file_catalog_find(cat, 0, NULL));
+	catalog_add(cat, "a", 100, 199);
+	catalog_add(cat, "a", 0, 99);
+	catalog_add(cat, "b", 50, 149);
+	catalog_add(cat, "a", 200, 299);
+	// long file of an other topic, spans over the others
+	catalog_add(cat, "c", 10, 1000);
+	NUTS_TRUE(file_catalog_count(cat) == 5);
+
+	path = file_catalog_find(cat, 120, "a");
+	NUTS_MATCH(path, "/tmp/a-100~199");
+	nng_strfree(path);
+	path = file_catalog_find(cat, 120, "b");
+	NUTS_MATCH(path, "/tmp/b-50~149");
+	nng_strfree(path);
+	path = file_catalog_find(cat, 500, NULL);
+	NUTS_MATCH(path, "/tmp/c-10~1000");
+	nng_strfree(path);
+	path = file_catalog_find(cat, 500, "a");
+	NUTS_NULL(path);
+
+	// in start key order
+	paths = file_catalog_find_span(cat, 99, 200, "a", &n);
+	NUTS_TRUE(n == 3);
+	NUTS_MATCH(paths[0], "/tmp/a-0~99");
+	NUTS_MATCH(paths[1], "/tmp/a-100~199");
+	NUTS_MATCH(paths[2], "/tmp/a-200~299");
+	free_paths(paths, n);
+	paths = file_catalog_find_span(cat, 150, 160, NULL, &n);
+	NUTS_TRUE(n == 2);
+	NUTS_MATCH(paths[0], "/tmp/c-10~1000");
+	NUTS_MATCH(paths[1], "/tmp/a-100~199");
+	free_paths(paths, n);
+	paths = file_catalog_find_span(cat, 1001, 2000, NULL, &n);
+	NUTS_NULL(paths);
+	NUTS_TRUE(n == 0);
+
+	NUTS_TRUE(file_catalog_contains(cat, "/tmp/b-50~149"));
+	NUTS_PASS(file_catalog_remove(cat, "/tmp/b-50~149"));
+	NUTS_FAIL(file_catalog_remove(cat, "/tmp/b-50~149"), NNG_ENOENT);
+	NUTS_TRUE(!file_catalog_contains(cat, "/tmp/b-50~149"));
+	NUTS_NULL(file_catalog_find(cat, 120, "b"));
+	NUTS_TRUE(file_catalog_count(cat) == 4);
+
+	file_catalog_destroy(cat);
+}
+
+// Files merged by compaction are swapped in one update.
+static void
+test_catalog_replace(void)
+{
+	file_catalog      *cat;
+	file_catalog_entry ent   = { 0 };
+	const char        *old[] = { "/tmp/a-0~99", "/tmp/a-100~199" };
+	const char        *bad[] = { "/tmp/a-0~99", "/tmp/none" };
+	char             **paths;
+	uint32_t           n;
+
+	NUTS_PASS(file_catalog_create(&cat));
+	catalog_add(cat, "a", 0, 99);
+	catalog_add(cat, "a", 100, 199);
+	catalog_add(cat, "a", 200, 299);
+
+	ent.start_key = 0;
+	ent.end_key   = 199;
+	ent.topic     = "a";
+	ent.path      = "/tmp/a-0~199";
+	NUTS_FAIL(file_catalog_replace(cat, bad, 2, &ent), NNG_ENOENT);
+	NUTS_TRUE(file_catalog_count(cat) == 3);
+	NUTS_PASS(file_catalog_replace(cat, old, 2, &ent));
+	NUTS_TRUE(file_catalog_count(cat) == 2);
+
+	paths = file_catalog_find_span(cat, 50, 250, "a", &n);
+	NUTS_TRUE(n == 2);
+	NUTS_MATCH(paths[0], "/tmp/a-0~199");
+	NUTS_MATCH(paths[1], "/tmp/a-200~299");
+	free_paths(paths, n);
+	NUTS_TRUE(!file_catalog_contains(cat, "/tmp/a-100~199"));
+
+	file_catalog_destroy(cat);
+}
+
+typedef struct {
+	file_catalog *cat;
+	bool          stop;
+	uint64_t      lookups;
+	uint64_t      bad;
+} catalog_reader;
+
+static bool
+catalog_check_cb(const file_catalog_entry *ent, void *arg)
+{
+	uint64_t key = *(uint64_t *) arg;
+	uint64_t start, end;
+
+	if (sscanf(ent->path, "/tmp/t-%llu~%llu", (unsigned long long *) &start,
+	        (unsigned long long *) &end) != 2 ||
+	    start != ent->start_key || end != ent->end_key || key < start ||
+	    key > end) {
+		*(uint64_t *) arg = UINT64_MAX;
+		return false;
+	}
+	return true;
+}
+
+static void
+catalog_reader_cb(void *arg)
+{
+	catalog_reader *rd  = arg;
+	uint64_t        key = 0;
+
+	while (!rd->stop) {
+		uint64_t k = key % (CATALOG_FILES * 10);
+		file_catalog_foreach_span(
+		    rd->cat, k, k, "t", catalog_check_cb, &k);
+		if (k == UINT64_MAX) {
+			rd->bad++;
+		}
+		rd->lookups++;
+		key += 7919;
+	}
+}
+
+// Lookups never block while the writer keeps rolling a window of files.
+static void
+test_catalog_concurrent(void)
+{
+	file_catalog  *cat;
+	nng_thread    *thrs[CATALOG_READERS];
+	catalog_reader rds[CATALOG_READERS];
+	char           path[64];
+
+	NUTS_PASS(file_catalog_create(&cat));
+	for (int i = 0; i < CATALOG_READERS; i++) {
+		memset(&rds[i], 0, sizeof(rds[i]));
+		rds[i].cat = cat;
+		NUTS_PASS(nng_thread_create(&thrs[i], catalog_reader_cb, &rds[i]));
+	}
+	for (uint64_t i = 0; i < CATALOG_FILES; i++) {
+		catalog_add(cat, "t", i * 10, i * 10 + 9);
+		if (i >= CATALOG_WINDOW) {
+			uint64_t old = i - CATALOG_WINDOW;
+			snprintf(path, sizeof(path), "/tmp/t-%llu~%llu",
+			    (unsigned long long) old * 10,
+			    (unsigned long long) old * 10 + 9);
+			NUTS_PASS(file_catalog_remove(cat, path));
+		}
+	}
+	for (int i = 0; i < CATALOG_READERS; i++) {
+		rds[i].stop = true;
+		nng_thread_destroy(thrs[i]);
+		NUTS_TRUE(rds[i].bad == 0);
+		NUTS_TRUE(rds[i].lookups > 0);
+	}
+	NUTS_TRUE(file_catalog_count(cat) == CATALOG_WINDOW);
+	file_catalog_destroy(cat);
+}
+
+#ifdef NNG_TEST_BENCH
+static void
+test_catalog_bench(void)
+{
+	file_catalog *cat;
+	char         *path;
+	uint64_t      found = 0;
+
+	NUTS_PASS(file_catalog_create(&cat));
+	for (uint64_t i = 0; i < CATALOG_FILES; i++) {
+		catalog_add(cat, i % 2 ? "odd" : "even", i * 10, i * 10 + 9);
+	}
+
+	nng_time start = nng_clock();
+	for (uint64_t i = 0; i < CATALOG_LOOKUPS; i++) {
+		uint64_t key = (i * 7919) % (CATALOG_FILES * 10);
+		path = file_catalog_find(cat, key, (key / 10) % 2 ? "odd" : "even");
+		if (path != NULL) {
+			found++;
+			nng_strfree(path);
+		}
+	}
+	nng_time end = nng_clock();
+	NUTS_TRUE(found == CATALOG_LOOKUPS);
+	printf("catalog %d files, %d lookups %lums\n", CATALOG_FILES,
+	    CATALOG_LOOKUPS, (unsigned long) (end - start));
+
+	file_catalog_destroy(cat);
+}
+#endif
+
+TEST_LIST = {
+	{ "file catalog find", test_catalog_find },
+	{ "file catalog replace", test_catalog_replace },
+	{ "file catalog concurrent", test_catalog_concurrent },
+#ifdef NNG_TEST_BENCH
+	{ "file catalog bench", test_catalog_bench },
+#endif
+	{ NULL, NULL },
+};
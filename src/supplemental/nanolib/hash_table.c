@@ -23,7 +23,7 @@
 static dbhash_atpair_t *dbhash_atpair_alloc(uint32_t alias, const char *topic);
 static void             dbhash_atpair_free(dbhash_atpair_t *atpair);
 
-KHASH_MAP_INIT_INT(alias_table, dbhash_atpair_t **)
+KHASH_MAP_INIT_INT_WY(alias_table, dbhash_atpair_t **)
 static nni_rwlock alias_lock;
 static khash_t(alias_table) *ah = NULL;
 
@@ -140,7 +140,7 @@ dbhash_destroy_alias_table(void)
 	ah = NULL;
 }
 
-KHASH_MAP_INIT_INT(pipe_table, topic_queue *)
+KHASH_MAP_INIT_INT_WY(pipe_table, topic_queue *)
 static nni_rwlock pipe_lock;
 static khash_t(pipe_table) *ph = NULL;
 
@@ -681,7 +681,7 @@ dbhash_print_topic_queue(uint32_t id)
  */
 
 // mqtt_hash<uint32_t, topic_queue *> _cached_topic_hash;
-KHASH_MAP_INIT_INT(_cached_topic_hash, topic_queue *)
+KHASH_MAP_INIT_INT_WY(_cached_topic_hash, topic_queue *)
 static khash_t(_cached_topic_hash) *ch = NULL;
 static nni_rwlock cached_lock;
 
@@ -34,6 +34,8 @@ typedef struct {
 	uint8_t   level;
 	nng_mtx * mtx;
 	conf_log *config;
+	uint64_t  written; // bytes in file, tracked by the async writer
+	bool      sized;
 } log_callback;
 
 static struct {
@@ -42,6 +44,18 @@ static struct {
 	log_callback callbacks[MAX_CALLBACKS];
 } L;
 
+typedef struct {
+	char name[32];
+	int  level;
+} log_module;
+
+// Overrides are meant to be set at start up, readers take no lock.
+static nni_mtx    log_module_mtx = NNI_MTX_INITIALIZER;
+static log_module log_modules[LOG_MAX_MODULES];
+static int        log_modules_n = 0;
+
+int log_level_max = -1;
+
 static const char *level_strings[] = {
 	"FATAL",
 	"ERROR",
@@ -63,6 +77,8 @@ static const char *level_colors[] = {
 #endif
 
 static void file_rotation(FILE *fp, conf_log *config);
+static void log_level_update(void);
+static void file_rotate(FILE *fp, conf_log *config);
 
 static void
 stdout_callback(log_event *ev)
@@ -278,6 +294,34 @@ log_level_num(const char *level)
 	return -1;
 }
 
+// Most verbose level any record can be written at.
+static void
+log_level_update(void)
+{
+	int level = -1;
+
+	// held to the store, so the last update wins with the latest level
+	nni_mtx_lock(&log_module_mtx);
+	for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+		if (L.callbacks[i].level > level) {
+			level = L.callbacks[i].level;
+		}
+	}
+	if (level >= 0) {
+		for (int i = 0; i < log_modules_n; i++) {
+			if (log_modules[i].level > level) {
+				level = log_modules[i].level;
+			}
+		}
+	}
+#if defined(_MSC_VER)
+	*(volatile int *) &log_level_max = level;
+#else
+	__atomic_store_n(&log_level_max, level, __ATOMIC_RELAXED);
+#endif
+	nni_mtx_unlock(&log_module_mtx);
+}
+
 void
 log_set_level(int level)
 {
@@ -297,6 +341,7 @@ log_add_callback(
 				.mtx    = (nng_mtx *) mtx,
 				.config = config,
 			};
+			log_level_update();
 			return 0;
 		}
 	}
@@ -306,7 +351,66 @@ log_add_callback(
 void
 log_clear_callback()
 {
+	log_async_stop();
 	memset(L.callbacks, 0, sizeof(log_callback) * MAX_CALLBACKS);
+	log_level_update();
+}
+
+int
+log_set_module_level(const char *module, int level)
+{
+	int i;
+
+	if (module == NULL || strlen(module) >= sizeof(log_modules[0].name) ||
+	    level > NNG_LOG_TRACE) {
+		return NNG_EINVAL;
+	}
+	nni_mtx_lock(&log_module_mtx);
+	for (i = 0; i < log_modules_n; i++) {
+		if (strcmp(log_modules[i].name, module) == 0) {
+			break;
+		}
+	}
+	if (level < 0) {
+		if (i < log_modules_n) {
+			log_modules[i] = log_modules[--log_modules_n];
+		}
+	} else if (i < log_modules_n) {
+		log_modules[i].level = level;
+	} else if (log_modules_n == LOG_MAX_MODULES) {
+		nni_mtx_unlock(&log_module_mtx);
+		return NNG_ENOMEM;
+	} else {
+		snprintf(log_modules[i].name, sizeof(log_modules[i].name), "%s",
+		    module);
+		log_modules[i].level = level;
+		log_modules_n++;
+	}
+	nni_mtx_unlock(&log_module_mtx);
+	log_level_update();
+	return 0;
+}
+
+// Level of the module of file, -1 if it has no override.
+static int
+log_module_level(const char *file)
+{
+	const char *name = file;
+	size_t      len;
+
+	for (const char *p = file; *p != '\0'; p++) {
+		if (*p == '/' || *p == '\\') {
+			name = p + 1;
+		}
+	}
+	len = strcspn(name, ".");
+	for (int i = 0; i < log_modules_n; i++) {
+		if (strncmp(log_modules[i].name, name, len) == 0 &&
+		    log_modules[i].name[len] == '\0') {
+			return log_modules[i].level;
+		}
+	}
+	return -1;
 }
 
 static void
@@ -344,58 +448,66 @@ file_rotation(FILE *fp, conf_log *config)
 	}
 
 	if (sz >= config->rotation_sz) {
-		char *index_file =
-		    nano_concat_path(config->dir, INDEX_FILE_NAME);
-		char * index_data = NULL;
-		size_t size       = 0;
-		size_t index      = 1;
-		char   buf[4]     = { 0 };
-
-		if ((rv = nni_plat_file_get(
-		         index_file, (void **) &index_data, &size)) == 0) {
-			memcpy(buf, index_data, size);
-			if (1 != sscanf(buf, "%zu", &index)) {
-				index = 1;
-			}
-			nni_free(index_data, size);
+		file_rotate(fp, config);
+	}
+}
+
+// Renames the log file to the next backup of the index file and reopens it.
+static void
+file_rotate(FILE *fp, conf_log *config)
+{
+	int rv;
+	char *index_file =
+	    nano_concat_path(config->dir, INDEX_FILE_NAME);
+	char * index_data = NULL;
+	size_t size       = 0;
+	size_t index      = 1;
+	char   buf[4]     = { 0 };
+
+	if ((rv = nni_plat_file_get(
+	         index_file, (void **) &index_data, &size)) == 0) {
+		memcpy(buf, index_data, size);
+		if (1 != sscanf(buf, "%zu", &index)) {
+			index = 1;
 		}
+		nni_free(index_data, size);
+	}
 
-		size_t log_name_len = strlen(config->abs_path) + 20;
-		char * log_name     = nni_zalloc(log_name_len);
-		snprintf(
-		    log_name, log_name_len, "%s.%lu", config->file, index);
-		char *backup_log_path =
-		    nano_concat_path(config->dir, log_name);
-		if (fp)
-			fclose(fp);
-		fp = NULL;
-		remove(backup_log_path);
-		rename(config->abs_path, backup_log_path);
-		nni_free(log_name, log_name_len);
-		nni_strfree(backup_log_path);
+	size_t log_name_len = strlen(config->abs_path) + 20;
+	char * log_name     = nni_zalloc(log_name_len);
+	snprintf(
+	    log_name, log_name_len, "%s.%lu", config->file, index);
+	char *backup_log_path =
+	    nano_concat_path(config->dir, log_name);
+	if (fp)
+		fclose(fp);
+	fp = NULL;
+	remove(backup_log_path);
+	rename(config->abs_path, backup_log_path);
+	nni_free(log_name, log_name_len);
+	nni_strfree(backup_log_path);
 #ifndef NNG_PLATFORM_WINDOWS
-		if (nng_access(config->dir, W_OK) < 0) {
-			fprintf(stderr, "open path %s failed\n",
-					config->dir);
-			config->fp = NULL;
-			return;
-		}
+	if (nng_access(config->dir, W_OK) < 0) {
+		fprintf(stderr, "open path %s failed\n",
+				config->dir);
+		config->fp = NULL;
+		return;
+	}
 #endif
-		fp           = fopen(config->abs_path, "a");
-		config->fp   = fp;
-		char num[20] = { 0 };
-		index++; // increase index
-		if (index > config->rotation_count) {
-			index = 1;
-		}
-		snprintf(num, 20, "%zu", index);
-		if ((rv = nni_plat_file_put(index_file, num, strlen(num))) !=
-		    0) {
-			fprintf(stderr, "write to file %s failed: %s\n",
-			    index_file, nng_strerror(rv));
-		}
-		nni_strfree(index_file);
+	fp           = fopen(config->abs_path, "a");
+	config->fp   = fp;
+	char num[20] = { 0 };
+	index++; // increase index
+	if (index > config->rotation_count) {
+		index = 1;
+	}
+	snprintf(num, 20, "%zu", index);
+	if ((rv = nni_plat_file_put(index_file, num, strlen(num))) !=
+	    0) {
+		fprintf(stderr, "write to file %s failed: %s\n",
+		    index_file, nng_strerror(rv));
 	}
+	nni_strfree(index_file);
 }
 
 int
@@ -419,11 +531,418 @@ init_event(log_event *ev, void *udata, conf_log *config)
 	ev->config = config;
 }
 
+#if defined(NNG_PLATFORM_POSIX)
+
+#include <pthread.h>
+
+// Async logging: each thread formats its records into a ring of its own,
+// one writer thread drains all rings into the console and file callbacks.
+// Producers block only on a push racing log_async_stop, a record is dropped
+// and counted when its ring is full or the writer has stopped. Timestamps
+// use the second cached by the writer. Other callbacks stay synchronous.
+
+#define LOG_ASYNC_MSG 448
+
+typedef struct {
+	const char *file;
+	const char *func;
+	int         line;
+	int         tid;
+	uint8_t     level;
+	int8_t      module_level; // override of the callback level or -1
+	char        time[20];
+	char        msg[LOG_ASYNC_MSG];
+} log_record;
+
+typedef struct log_ring log_ring;
+struct log_ring {
+	nni_atomic_u64  head; // next record of the owner thread
+	nni_atomic_u64  tail; // next record of the writer
+	nni_atomic_bool dead; // owner thread has exited
+	size_t          slots;
+	log_record     *recs;
+	int             tid;
+	time_t          sec; // second of the cached time
+	char            time[20];
+	log_ring       *next;
+};
+
+static struct {
+	nni_mtx         mtx;
+	nni_cv          cv;
+	nni_thr         thr;
+	pthread_key_t   key;
+	bool            key_init;
+	bool            stop;
+	bool            done; // writer has exited after its last drain
+	size_t          slots;
+	log_ring       *rings;
+	nni_atomic_bool running;
+	nni_atomic_u64  dropped;
+	nni_atomic_u64  now; // seconds, refreshed by the writer
+	uint64_t        reported;
+} A = {
+	.mtx = NNI_MTX_INITIALIZER,
+	.cv  = NNI_CV_INITIALIZER(&A.mtx),
+};
+
+static bool
+log_async_sink(log_callback *cb)
+{
+	return cb->fn == stdout_callback || cb->fn == file_callback;
+}
+
+static void
+log_ring_exit(void *arg)
+{
+	log_ring *r = arg;
+	nni_atomic_set_bool(&r->dead, true);
+}
+
+static log_ring *
+log_ring_get(void)
+{
+	log_ring *r;
+
+	if ((r = pthread_getspecific(A.key)) != NULL) {
+		return r;
+	}
+	if ((r = nni_zalloc(sizeof(*r))) == NULL) {
+		return NULL;
+	}
+	nni_mtx_lock(&A.mtx);
+	r->slots = A.slots;
+	nni_mtx_unlock(&A.mtx);
+	if ((r->recs = nni_alloc(r->slots * sizeof(log_record))) == NULL) {
+		nni_free(r, sizeof(*r));
+		return NULL;
+	}
+	nni_atomic_init64(&r->head);
+	nni_atomic_init64(&r->tail);
+	nni_atomic_init_bool(&r->dead);
+#if (NNG_PLATFORM_DARWIN)
+	r->tid = nni_plat_getpid();
+#else
+	r->tid = syscall(__NR_gettid);
+#endif
+	pthread_setspecific(A.key, r);
+	nni_mtx_lock(&A.mtx);
+	r->next = A.rings;
+	A.rings = r;
+	nni_mtx_unlock(&A.mtx);
+	return r;
+}
+
+// A push raced log_async_stop. Waits for the writer to exit, the record at
+// head is lost unless its last drain wrote it or a new writer was started.
+static void
+log_async_reclaim(log_ring *r, uint64_t head)
+{
+	nni_mtx_lock(&A.mtx);
+	while (!A.done && !nni_atomic_get_bool(&A.running)) {
+		nni_cv_wait(&A.cv);
+	}
+	if (A.done && nni_atomic_get64(&r->tail) <= head) {
+		nni_atomic_set64(&r->head, head);
+		nni_atomic_inc64(&A.dropped);
+	}
+	nni_mtx_unlock(&A.mtx);
+}
+
+static void
+log_async_push(int level, int module_level, const char *file, int line,
+    const char *func, const char *fmt, va_list ap)
+{
+	log_ring   *r;
+	log_record *rec;
+	uint64_t    head, tail;
+	time_t      now;
+
+	if (!nni_atomic_get_bool(&A.running) || (r = log_ring_get()) == NULL) {
+		nni_atomic_inc64(&A.dropped);
+		return;
+	}
+	head = nni_atomic_get64(&r->head);
+	tail = nni_atomic_get64(&r->tail);
+	if (head - tail >= r->slots) {
+		nni_atomic_inc64(&A.dropped);
+		return;
+	}
+	now = (time_t) nni_atomic_get64(&A.now);
+	if (now != r->sec) {
+		struct tm tm;
+		nano_localtime(&now, &tm);
+		strftime(r->time, sizeof(r->time), "%Y-%m-%d %H:%M:%S", &tm);
+		r->sec = now;
+	}
+	rec               = &r->recs[head % r->slots];
+	rec->file         = file;
+	rec->func         = func;
+	rec->line         = line;
+	rec->tid          = r->tid;
+	rec->level        = (uint8_t) level;
+	rec->module_level = (int8_t) module_level;
+	memcpy(rec->time, r->time, sizeof(rec->time));
+	vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+	nni_atomic_set64(&r->head, head + 1);
+	if (!nni_atomic_get_bool(&A.running)) {
+		log_async_reclaim(r, head);
+		return;
+	}
+
+	// wake the writer early on bursts only
+	if (head - tail == r->slots / 2) {
+		nni_mtx_lock(&A.mtx);
+		nni_cv_wake(&A.cv);
+		nni_mtx_unlock(&A.mtx);
+	}
+}
+
+static void
+log_async_file(log_callback *cb, log_record *rec)
+{
+	conf_log *config = cb->config;
+	int       n;
+
+	if (config->fp == NULL) {
+		if ((config->fp = fopen(config->abs_path, "a")) == NULL) {
+			return;
+		}
+		cb->sized = false;
+	}
+	if (!cb->sized) {
+		fseek(config->fp, 0, SEEK_END);
+		long pos    = ftell(config->fp);
+		cb->written = pos > 0 ? (uint64_t) pos : 0;
+		cb->sized   = true;
+	}
+	n = fprintf(config->fp, "%s [%i] %-5s %s:%d: %s\n", rec->time,
+	    rec->tid, level_strings[rec->level], rec->file, rec->line,
+	    rec->msg);
+	if (n > 0) {
+		cb->written += (uint64_t) n;
+	}
+	if (cb->written >= config->rotation_sz) {
+		file_rotate(config->fp, config);
+		cb->written = 0;
+	}
+}
+
+static void
+log_async_write(log_record *rec)
+{
+	for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+		log_callback *cb = &L.callbacks[i];
+		int level = rec->module_level >= 0 ? rec->module_level
+		                                   : cb->level;
+		if (!log_async_sink(cb) || rec->level > level) {
+			continue;
+		}
+		if (cb->mtx != NULL) {
+			nng_mtx_lock(cb->mtx);
+		}
+		if (cb->fn == file_callback) {
+			log_async_file(cb, rec);
+		} else {
+#ifdef LOG_USE_COLOR
+			fprintf(cb->udata,
+			    "%s [%i] %s%-5s\x1b[0m \x1b[0m%s:%d \x1b[0m %s: "
+			    "%s\n",
+			    rec->time, rec->tid, level_colors[rec->level],
+			    level_strings[rec->level], rec->file, rec->line,
+			    rec->func, rec->msg);
+#else
+			fprintf(cb->udata, "%s [%i] %-5s %s:%d %s: %s\n",
+			    rec->time, rec->tid, level_strings[rec->level],
+			    rec->file, rec->line, rec->func, rec->msg);
+#endif
+		}
+		if (cb->mtx != NULL) {
+			nng_mtx_unlock(cb->mtx);
+		}
+	}
+}
+
+static void
+log_async_flush(void)
+{
+	for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+		log_callback *cb = &L.callbacks[i];
+		if (cb->fn == file_callback && cb->config->fp != NULL) {
+			fflush(cb->config->fp);
+		} else if (cb->fn == stdout_callback) {
+			fflush(cb->udata);
+		}
+	}
+}
+
+// Writes all queued records, frees rings of exited threads once empty.
+static size_t
+log_async_drain(void)
+{
+	log_ring  *r;
+	log_ring **pr;
+	size_t     n = 0;
+	uint64_t   dropped;
+
+	nni_mtx_lock(&A.mtx);
+	r = A.rings;
+	nni_mtx_unlock(&A.mtx);
+	// rings are only added in front and only removed here
+	for (; r != NULL; r = r->next) {
+		uint64_t head = nni_atomic_get64(&r->head);
+		uint64_t tail = nni_atomic_get64(&r->tail);
+		for (; tail != head; tail++) {
+			log_async_write(&r->recs[tail % r->slots]);
+			n++;
+		}
+		nni_atomic_set64(&r->tail, tail);
+	}
+
+	if ((dropped = nni_atomic_get64(&A.dropped)) != A.reported) {
+		log_record rec = {
+			.file         = __FILE__,
+			.func         = __FUNCTION__,
+			.line         = __LINE__,
+			.level        = NNG_LOG_WARN,
+			.module_level = -1,
+		};
+		const time_t now = time(NULL);
+		struct tm    tm;
+		nano_localtime(&now, &tm);
+		strftime(rec.time, sizeof(rec.time), "%Y-%m-%d %H:%M:%S", &tm);
+		snprintf(rec.msg, sizeof(rec.msg),
+		    "%llu log records dropped",
+		    (unsigned long long) (dropped - A.reported));
+		log_async_write(&rec);
+		A.reported = dropped;
+	}
+	if (n > 0) {
+		log_async_flush();
+	}
+
+	nni_mtx_lock(&A.mtx);
+	pr = &A.rings;
+	while ((r = *pr) != NULL) {
+		if (nni_atomic_get_bool(&r->dead) &&
+		    nni_atomic_get64(&r->head) == nni_atomic_get64(&r->tail)) {
+			*pr = r->next;
+			nni_free(r->recs, r->slots * sizeof(log_record));
+			nni_free(r, sizeof(*r));
+		} else {
+			pr = &r->next;
+		}
+	}
+	nni_mtx_unlock(&A.mtx);
+	return n;
+}
+
+static void
+log_async_writer(void *arg)
+{
+	NNI_ARG_UNUSED(arg);
+	nni_mtx_lock(&A.mtx);
+	for (;;) {
+		bool stop = A.stop;
+		nni_mtx_unlock(&A.mtx);
+		nni_atomic_set64(&A.now, (uint64_t) time(NULL));
+		size_t n = log_async_drain();
+		nni_mtx_lock(&A.mtx);
+		if (stop) {
+			break;
+		}
+		if (n == 0 && !A.stop) {
+			nni_cv_until(&A.cv, nni_clock() + LOG_ASYNC_INTERVAL);
+		}
+	}
+	A.done = true;
+	nni_cv_wake(&A.cv);
+	nni_mtx_unlock(&A.mtx);
+}
+
+int
+log_async_start(size_t slots)
+{
+	int rv;
+
+	nni_mtx_lock(&A.mtx);
+	if (nni_atomic_get_bool(&A.running)) {
+		nni_mtx_unlock(&A.mtx);
+		return NNG_EBUSY;
+	}
+	if (!A.key_init) {
+		if (pthread_key_create(&A.key, log_ring_exit) != 0) {
+			nni_mtx_unlock(&A.mtx);
+			return NNG_ENOMEM;
+		}
+		A.key_init = true;
+	}
+	// takes effect for threads logging for the first time
+	A.slots = slots > 0 ? slots : LOG_ASYNC_SLOTS;
+	A.stop  = false;
+	A.done  = false;
+	nni_atomic_set64(&A.now, (uint64_t) time(NULL));
+	if ((rv = nni_thr_init(&A.thr, log_async_writer, NULL)) != 0) {
+		nni_mtx_unlock(&A.mtx);
+		return rv;
+	}
+	nni_thr_set_name(&A.thr, "nng:log");
+	nni_atomic_set_bool(&A.running, true);
+	nni_thr_run(&A.thr);
+	nni_mtx_unlock(&A.mtx);
+	return 0;
+}
+
+void
+log_async_stop(void)
+{
+	nni_mtx_lock(&A.mtx);
+	if (!nni_atomic_get_bool(&A.running)) {
+		nni_mtx_unlock(&A.mtx);
+		return;
+	}
+	nni_atomic_set_bool(&A.running, false);
+	A.stop = true;
+	nni_cv_wake(&A.cv);
+	nni_mtx_unlock(&A.mtx);
+	// the writer drains what is queued before it exits
+	nni_thr_fini(&A.thr);
+}
+
+uint64_t
+log_async_dropped(void)
+{
+	return nni_atomic_get64(&A.dropped);
+}
+
+#else
+
+int
+log_async_start(size_t slots)
+{
+	NNI_ARG_UNUSED(slots);
+	return NNG_ENOTSUP;
+}
+
+void
+log_async_stop(void)
+{
+}
+
+uint64_t
+log_async_dropped(void)
+{
+	return 0;
+}
+
+#endif
+
 void
 log_log(int level, const char *file, int line, const char *func,
     const char *fmt, ...)
 {
 	const char *file_name = file;
+	bool        async     = false;
 
 	log_event ev = {
 		.fmt   = fmt,
@@ -433,9 +952,19 @@ log_log(int level, const char *file, int line, const char *func,
 		.func  = func,
 	};
 
+	int module_level = log_modules_n > 0 ? log_module_level(file) : -1;
+#if defined(NNG_PLATFORM_POSIX)
+	bool running = nni_atomic_get_bool(&A.running);
+#endif
 	for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
 		log_callback *cb = &L.callbacks[i];
-		if (level <= cb->level) {
+		if (level <= (module_level >= 0 ? module_level : cb->level)) {
+#if defined(NNG_PLATFORM_POSIX)
+			if (running && log_async_sink(cb)) {
+				async = true;
+				continue;
+			}
+#endif
 			init_event(&ev, cb->udata, cb->config);
 			va_start(ev.ap, fmt);
 			if (cb->mtx == NULL) {
@@ -448,4 +977,14 @@ log_log(int level, const char *file, int line, const char *func,
 			va_end(ev.ap);
 		}
 	}
+#if defined(NNG_PLATFORM_POSIX)
+	if (async) {
+		va_list ap;
+		va_start(ap, fmt);
+		log_async_push(level, module_level, file, line, func, fmt, ap);
+		va_end(ap);
+	}
+#else
+	NNI_ARG_UNUSED(async);
+#endif
 }
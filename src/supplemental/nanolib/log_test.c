@@ -0,0 +1,272 @@
+#ifndef ENABLE_LOG
+#define ENABLE_LOG
+#endif
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+#include <nuts.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_DIR "/tmp/nanomq-log-test"
+#define LOG_THREADS 4
+#define LOG_RECORDS 5000
+#define BENCH_RECORDS 100000
+
+static void
+log_conf(conf_log *config, const char *file, uint64_t rotation_sz)
+{
+	static char path[128];
+
+	NUTS_ASSERT(system("rm -rf " LOG_DIR " && mkdir -p " LOG_DIR) == 0);
+	memset(config, 0, sizeof(*config));
+	snprintf(path, sizeof(path), "%s/%s", LOG_DIR, file);
+	config->type           = LOG_TO_FILE;
+	config->level          = NNG_LOG_INFO;
+	config->dir            = LOG_DIR;
+	config->file           = (char *) file;
+	config->abs_path       = path;
+	config->rotation_sz    = rotation_sz;
+	config->rotation_count = 5;
+}
+
+static size_t
+log_lines(const char *path, const char *match)
+{
+	FILE  *fp;
+	char   line[1024];
+	size_t n = 0;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		return 0;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strstr(line, match) != NULL) {
+			n++;
+		}
+	}
+	fclose(fp);
+	return n;
+}
+
+static void
+log_writer_cb(void *arg)
+{
+	int id = *(int *) arg;
+
+	for (int i = 0; i < LOG_RECORDS; i++) {
+		log_log(NNG_LOG_INFO, __FILE__, __LINE__, __FUNCTION__,
+		    "record %d of thread %d", i, id);
+		if (i % 256 == 0) {
+			nng_msleep(1);
+		}
+	}
+}
+
+// Every record written or counted as dropped, none at filtered levels.
+static void
+test_log_async(void)
+{
+	conf_log    config;
+	nng_thread *thrs[LOG_THREADS];
+	int         ids[LOG_THREADS];
+	uint64_t    dropped = log_async_dropped();
+
+	log_conf(&config, "async.log", 1024 * 1024 * 1024);
+	NUTS_PASS(log_add_fp(NULL, NNG_LOG_INFO, NULL, &config));
+	NUTS_PASS(log_async_start(0));
+	NUTS_FAIL(log_async_start(0), NNG_EBUSY);
+
+	for (int i = 0; i < LOG_THREADS; i++) {
+		ids[i] = i;
+		NUTS_PASS(nng_thread_create(&thrs[i], log_writer_cb, &ids[i]));
+	}
+	log_log(NNG_LOG_DEBUG, __FILE__, __LINE__, __FUNCTION__, "filtered");
+	for (int i = 0; i < LOG_THREADS; i++) {
+		nng_thread_destroy(thrs[i]);
+	}
+	log_clear_callback();
+	if (config.fp != NULL) {
+		fclose(config.fp);
+	}
+
+	dropped = log_async_dropped() - dropped;
+	NUTS_TRUE(log_lines(config.abs_path, "record ") + dropped ==
+	    LOG_THREADS * LOG_RECORDS);
+	NUTS_TRUE(log_lines(config.abs_path, "filtered") == 0);
+	NUTS_TRUE(log_lines(config.abs_path, " INFO ") >= 1);
+}
+
+// Records racing the stop are written or counted, none is lost silently.
+static void
+test_log_async_stop(void)
+{
+	conf_log    config;
+	nng_thread *thrs[LOG_THREADS];
+	int         ids[LOG_THREADS];
+	nng_mtx    *mtx;
+	uint64_t    dropped = log_async_dropped();
+
+	// whole lines once the callbacks are synchronous again
+	NUTS_PASS(nng_mtx_alloc(&mtx));
+	log_conf(&config, "stop.log", 1024 * 1024 * 1024);
+	NUTS_PASS(log_add_fp(NULL, NNG_LOG_INFO, mtx, &config));
+	NUTS_PASS(log_async_start(0));
+	for (int i = 0; i < LOG_THREADS; i++) {
+		ids[i] = i;
+		NUTS_PASS(nng_thread_create(&thrs[i], log_writer_cb, &ids[i]));
+	}
+	nng_msleep(LOG_ASYNC_INTERVAL);
+	log_async_stop();
+	for (int i = 0; i < LOG_THREADS; i++) {
+		nng_thread_destroy(thrs[i]);
+	}
+	log_clear_callback();
+	if (config.fp != NULL) {
+		fclose(config.fp);
+	}
+
+	nng_mtx_free(mtx);
+
+	dropped = log_async_dropped() - dropped;
+	NUTS_TRUE(log_lines(config.abs_path, "record ") + dropped ==
+	    LOG_THREADS * LOG_RECORDS);
+}
+
+// Rotation follows the bytes written, no stat per record.
+static void
+test_log_async_rotation(void)
+{
+	conf_log config;
+	char     path[128];
+
+	log_conf(&config, "rotate.log", 4096);
+	NUTS_PASS(log_add_fp(NULL, NNG_LOG_INFO, NULL, &config));
+	NUTS_PASS(log_async_start(0));
+	for (int i = 0; i < 200; i++) {
+		log_log(NNG_LOG_WARN, __FILE__, __LINE__, __FUNCTION__,
+		    "rotation record %d", i);
+		if (i % 16 == 0) {
+			nng_msleep(LOG_ASYNC_INTERVAL * 2);
+		}
+	}
+	log_clear_callback();
+	if (config.fp != NULL) {
+		fclose(config.fp);
+	}
+
+	snprintf(path, sizeof(path), "%s/rotate.log.1", LOG_DIR);
+	NUTS_TRUE(log_lines(path, "rotation record") > 0);
+	snprintf(path, sizeof(path), "%s/rotate.log.2", LOG_DIR);
+	NUTS_TRUE(log_lines(path, "rotation record") > 0);
+}
+
+#ifdef NNG_TEST_BENCH
+static nng_time
+log_bench(conf_log *config, bool async)
+{
+	log_add_fp(NULL, NNG_LOG_INFO, NULL, config);
+	if (async) {
+		NUTS_PASS(log_async_start(BENCH_RECORDS));
+	}
+	nng_time start = nng_clock();
+	for (int i = 0; i < BENCH_RECORDS; i++) {
+		log_log(NNG_LOG_INFO, __FILE__, __LINE__, __FUNCTION__,
+		    "bench record %d of %s", i, "client");
+	}
+	nng_time end = nng_clock();
+	log_clear_callback();
+	if (config->fp != NULL) {
+		fclose(config->fp);
+		config->fp = NULL;
+	}
+	return end - start;
+}
+
+// Time spent in log_log by the caller.
+static void
+test_log_bench(void)
+{
+	conf_log config;
+	nng_time sync_ms, async_ms;
+	uint64_t dropped = log_async_dropped();
+
+	log_conf(&config, "bench.log", 1024 * 1024 * 1024);
+	sync_ms  = log_bench(&config, false);
+	async_ms = log_bench(&config, true);
+	dropped = log_async_dropped() - dropped;
+	NUTS_TRUE(log_lines(config.abs_path, "bench record") + dropped ==
+	    2 * BENCH_RECORDS);
+	printf("log %d records, sync %lums, async %lums\n", BENCH_RECORDS,
+	    (unsigned long) sync_ms, (unsigned long) async_ms);
+}
+#endif
+
+static int log_evals;
+
+static int
+log_eval(void)
+{
+	return ++log_evals;
+}
+
+// Filtered calls never evaluate their arguments.
+static void
+test_log_level_gate(void)
+{
+	conf_log config;
+
+	log_conf(&config, "gate.log", 1024 * 1024);
+	NUTS_TRUE(log_level_max_load() == -1);
+	log_error("no callback %d", log_eval());
+	NUTS_TRUE(log_evals == 0);
+
+	NUTS_PASS(log_add_fp(NULL, NNG_LOG_WARN, NULL, &config));
+	NUTS_TRUE(log_level_max_load() == NNG_LOG_WARN);
+	log_info("below level %d", log_eval());
+	NUTS_TRUE(log_evals == 0);
+	log_warn("at level %d", log_eval());
+	NUTS_TRUE(log_evals == 1);
+
+	// one module logs more, others keep the callback level
+	NUTS_FAIL(log_set_module_level("log_test", NNG_LOG_TRACE + 1),
+	    NNG_EINVAL);
+	NUTS_PASS(log_set_module_level("log_test", NNG_LOG_DEBUG));
+	NUTS_PASS(log_set_module_level("broker_tcp", NNG_LOG_INFO));
+	NUTS_TRUE(log_level_max_load() == NNG_LOG_DEBUG);
+	log_debug("module debug %d", log_eval());
+	NUTS_TRUE(log_evals == 2);
+	log_log(NNG_LOG_DEBUG, "src/other.c", __LINE__, __FUNCTION__,
+	    "other debug");
+	log_log(NNG_LOG_INFO, "src/sp/broker_tcp.c", __LINE__, __FUNCTION__,
+	    "broker info");
+
+	// compiled out for the rest of this file
+#undef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL NNG_LOG_INFO
+	log_debug("compiled out %d", log_eval());
+	NUTS_TRUE(log_evals == 2);
+
+	NUTS_PASS(log_set_module_level("log_test", -1));
+	NUTS_PASS(log_set_module_level("broker_tcp", -1));
+	NUTS_TRUE(log_level_max_load() == NNG_LOG_WARN);
+	log_clear_callback();
+	NUTS_TRUE(log_level_max_load() == -1);
+	fclose(config.fp);
+
+	NUTS_TRUE(log_lines(config.abs_path, "at level 1") == 1);
+	NUTS_TRUE(log_lines(config.abs_path, "module debug 2") == 1);
+	NUTS_TRUE(log_lines(config.abs_path, "broker info") == 1);
+	NUTS_TRUE(log_lines(config.abs_path, "other debug") == 0);
+}
+
+TEST_LIST = {
+	{ "log level gate", test_log_level_gate },
+	{ "log async", test_log_async },
+	{ "log async stop", test_log_async_stop },
+	{ "log async rotation", test_log_async_rotation },
+#ifdef NNG_TEST_BENCH
+	{ "log bench", test_log_bench },
+#endif
+	{ NULL, NULL },
+};
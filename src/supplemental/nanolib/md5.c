@@ -63,6 +63,21 @@ void MD5Final(MD5_CTX *context, unsigned char digest[16])
 	MD5Encode(digest, context->state, 16);
 }
 
+/* Finish the digest as a hex string, md5_str needs MD5_STR_LEN + 1 bytes. */
+void MD5FinalString(MD5_CTX *context, char *md5_str)
+{
+	int i;
+	unsigned char md5_value[MD5_SIZE];
+
+	MD5Final(context, md5_value);
+
+	// convert md5 value to md5 string
+	for(i = 0; i < MD5_SIZE; i++)
+	{
+		snprintf(md5_str + i*2, 2+1, "%02x", md5_value[i]);
+	}
+}
+
 void MD5Encode(unsigned char *output,unsigned int *input,unsigned int len)
 {
 	unsigned int i = 0;
@@ -183,8 +198,6 @@ void MD5Transform(unsigned int state[4], unsigned char block[64])
 
 int ComputeStringMD5(unsigned char *dest_str, unsigned int dest_len, char *md5_str)
 {
-	int i;
-	unsigned char md5_value[MD5_SIZE];
 	MD5_CTX md5;
 
 	// init md5
@@ -192,24 +205,16 @@ int ComputeStringMD5(unsigned char *dest_str, unsigned int dest_len, char *md5_s
 
 	MD5Update(&md5, dest_str, dest_len);
 
-	MD5Final(&md5, md5_value);
-
-	// convert md5 value to md5 string
-	for(i = 0; i < MD5_SIZE; i++)
-	{
-		snprintf(md5_str + i*2, 2+1, "%02x", md5_value[i]);
-	}
+	MD5FinalString(&md5, md5_str);
 
 	return 0;
 }
 
 int ComputeFileMD5(const char *file_path, char *md5_str)
 {
-	int i;
 	int fd;
 	int ret;
 	unsigned char data[READ_DATA_SIZE];
-	unsigned char md5_value[MD5_SIZE];
 	MD5_CTX md5;
 
 	fd = open(file_path, O_RDONLY);
@@ -241,12 +246,7 @@ int ComputeFileMD5(const char *file_path, char *md5_str)
 
 	close(fd);
 
-	MD5Final(&md5, md5_value);
-
-	for(i = 0; i < MD5_SIZE; i++)
-	{
-		snprintf(md5_str + i*2, 2+1, "%02x", md5_value[i]);
-	}
+	MD5FinalString(&md5, md5_str);
 
 	return 0;
 }
@@ -12,16 +12,13 @@
 #include <time.h>
 
 #include "core/nng_impl.h"
+#include "nng/protocol/mqtt/mqtt_parser.h"
 #include "nng/supplemental/nanolib/binary_search.h"
 #include "nng/supplemental/nanolib/cvector.h"
 #include "nng/supplemental/nanolib/hash_table.h"
 #include "nng/supplemental/nanolib/mqtt_db.h"
 #include "nng/supplemental/nanolib/log.h"
-
-#define ROUND_ROBIN
-// #define RANDOM
-
-static size_t acnt;
+#include "nng/supplemental/nanolib/trace.h"
 
 typedef struct dbtree_node dbtree_node;
 
@@ -33,13 +30,33 @@ struct dbtree_node {
 	cvector(uint32_t) clients;
 	cvector(dbtree_node *) child;
 	nni_rwlock rwlock;
+	// dispatch state of shared subscription
+	nni_atomic_u64 cursor;
 };
 
+typedef struct {
+	char                  *group;
+	dbtree_shared_strategy strategy;
+} dbtree_shared_group;
+
 struct dbtree {
 	dbtree_node *root;
 	nni_rwlock   rwlock;
+	// shared subscription dispatch
+	dbtree_shared_strategy shared_strategy;
+	cvector(dbtree_shared_group) shared_groups;
+	uint32_t (*inflight_cb)(uint32_t pipe_id, void *arg);
+	void *inflight_arg;
+	// retain msgs ordered by topic, answers wildcard queries
+	retain_db *retains;
+	// stats
+	nni_stat_item st_root;
+	nni_stat_item st_subscriptions;
+	nni_stat_hist st_match;
 };
 
+static nni_atomic_int dbtree_ids;
+
 /**
  * @brief node_cmp - A callback to compare different node
  * @param x - normally x is dbtree_node
@@ -390,6 +407,7 @@ dbtree_node_new(char *topic)
 	node->well    = -1;
 	node->plus    = -1;
 
+	nni_atomic_init64(&node->cursor);
 	nni_rwlock_init(&node->rwlock);
 	return node;
 }
@@ -414,6 +432,40 @@ dbtree_node_free(dbtree_node *node)
 	}
 }
 
+static void
+dbtree_stats_init(dbtree *db)
+{
+	static const nni_stat_info root_info = {
+		.si_name = "dbtree",
+		.si_desc = "topic tree statistics",
+		.si_type = NNG_STAT_SCOPE,
+	};
+	static const nni_stat_info subscriptions_info = {
+		.si_name   = "subscriptions",
+		.si_desc   = "client subscriptions in the tree",
+		.si_type   = NNG_STAT_LEVEL,
+		.si_atomic = true,
+	};
+	static const nni_stat_info match_info = {
+		.si_name   = "match_us",
+		.si_desc   = "time taken to find the subscribers of a topic, "
+		             "sampled while tracing",
+		.si_type   = NNG_STAT_HISTOGRAM,
+		.si_unit   = NNG_UNIT_MICROS,
+		.si_atomic = true,
+	};
+
+	int id = nni_atomic_inc_nv(&dbtree_ids);
+
+	nni_stat_init(&db->st_root, &root_info);
+	nni_stat_init(&db->st_subscriptions, &subscriptions_info);
+	nni_stat_add(&db->st_root, &db->st_subscriptions);
+	nni_stat_hist_init(&db->st_match, &match_info);
+	nni_stat_add(&db->st_root, &db->st_match.sh_item);
+	nni_stat_set_id(&db->st_root, id);
+	nni_stat_register(&db->st_root);
+}
+
 /**
  * @brief dbtree_create - Create a dbtree, declare a global variable as func
  * para
@@ -429,9 +481,13 @@ dbtree_create(dbtree **db)
 	dbtree_node *node = dbtree_node_new("\0");
 	(*db)->root       = node;
 	nni_rwlock_init(&(*db)->rwlock);
-#ifdef RANDOM
-	srand(time(NULL));
-#endif
+	(*db)->shared_strategy = DBTREE_SHARED_ROUND_ROBIN;
+	(*db)->shared_groups   = NULL;
+	if (retain_db_create(&(*db)->retains) != 0) {
+		log_error("retain db create failed, wildcard retain disabled");
+		(*db)->retains = NULL;
+	}
+	dbtree_stats_init(*db);
 	return;
 }
 
@@ -444,6 +500,12 @@ void
 dbtree_destory(dbtree *db)
 {
 	if (db) {
+		nni_stat_unregister(&db->st_root);
+		for (size_t i = 0; i < cvector_size(db->shared_groups); i++) {
+			nni_strfree(db->shared_groups[i].group);
+		}
+		cvector_free(db->shared_groups);
+		retain_db_destroy(db->retains);
 		dbtree_node_free(db->root);
 		free(db);
 		db = NULL;
@@ -509,80 +571,90 @@ is_plus(char *topic_data)
 }
 
 /**
- * @brief dbtree_node_insert - insert node until topic_queue is NULL
+ * @brief dbtree_node_child - find the child of node for one topic level,
+ * insert it if not exist
  * @param node - dbtree_node
- * @param topic_queue - topic queue position
- * @param client - client info
- * @return void
+ * @param topic_data - topic in one level
+ * @return child node
  */
 static dbtree_node *
-dbtree_node_insert(dbtree_node *node, char **topic_queue)
+dbtree_node_child(dbtree_node *node, char *topic_data)
 {
-	if (node == NULL || topic_queue == NULL) {
-		log_warn("node or topic_queue is NULL");
-		return NULL;
-	}
+	dbtree_node *new_node = NULL;
+	if (is_well(topic_data)) {
+		if (node->well != -1) {
+			new_node = node->child[node->well];
+		} else {
+			if (node->plus == 0) {
+				node->plus = 1;
+			}
 
-	while (*topic_queue) {
-		dbtree_node *new_node = NULL;
-		if (is_well(*topic_queue)) {
-			if (node->well != -1) {
-				new_node = node->child[node->well];
-			} else {
-				if (node->plus == 0) {
-					node->plus = 1;
-				}
+			node->well = 0;
+			new_node   = dbtree_node_new(topic_data);
+			cvector_insert(
+			    node->child, (size_t) node->well, new_node);
+		}
 
-				node->well = 0;
-				new_node   = dbtree_node_new(*topic_queue);
-				cvector_insert(node->child,
-				    (size_t) node->well, new_node);
+	} else if (is_plus(topic_data)) {
+		if (node->plus != -1) {
+			new_node = node->child[node->plus];
+		} else {
+			if (node->well == 0) {
+				node->well = 1;
 			}
 
-		} else if (is_plus(*topic_queue)) {
-			if (node->plus != -1) {
-				new_node = node->child[node->plus];
-			} else {
-				if (node->well == 0) {
-					node->well = 1;
-				}
+			node->plus = 0;
+			new_node   = dbtree_node_new(topic_data);
+			cvector_insert(
+			    node->child, (size_t) node->plus, new_node);
+		}
+	} else {
+		size_t l = skip_wildcard(node);
+		if (l == cvector_size(node->child)) {
+			new_node = dbtree_node_new(topic_data);
+			cvector_push_back(node->child, new_node);
 
-				node->plus = 0;
-				new_node   = dbtree_node_new(*topic_queue);
-				cvector_insert(node->child,
-				    (size_t) node->plus, new_node);
-			}
 		} else {
-			size_t l = skip_wildcard(node);
-			if (l == cvector_size(node->child)) {
-				new_node = dbtree_node_new(*topic_queue);
-				cvector_push_back(node->child, new_node);
+			size_t index = 0;
+			if (false ==
+			    binary_search((void **) node->child, l, &index,
+			        topic_data, node_cmp)) {
+				new_node = dbtree_node_new(topic_data);
 
-			} else {
-				size_t index = 0;
-				if (false ==
-				    binary_search((void **) node->child, l,
-				        &index, *topic_queue, node_cmp)) {
-					new_node =
-					    dbtree_node_new(*topic_queue);
-
-					//  TODO
-					if (index ==
-					    cvector_size(node->child)) {
-						cvector_push_back(
-						    node->child, new_node);
-					} else {
-						cvector_insert(node->child,
-						    index, new_node);
-					}
+				//  TODO
+				if (index == cvector_size(node->child)) {
+					cvector_push_back(node->child, new_node);
 				} else {
-					new_node = node->child[index];
+					cvector_insert(
+					    node->child, index, new_node);
 				}
+			} else {
+				new_node = node->child[index];
 			}
 		}
+	}
+
+	return new_node;
+}
+
+/**
+ * @brief dbtree_node_insert - insert node until topic_queue is NULL
+ * @param node - dbtree_node
+ * @param topic_queue - topic queue position
+ * @param client - client info
+ * @return void
+ */
+static dbtree_node *
+dbtree_node_insert(dbtree_node *node, char **topic_queue)
+{
+	if (node == NULL || topic_queue == NULL) {
+		log_warn("node or topic_queue is NULL");
+		return NULL;
+	}
 
+	while (*topic_queue) {
+		node = dbtree_node_child(node, *topic_queue);
 		topic_queue++;
-		node = new_node;
 	}
 
 	return node;
@@ -658,7 +730,9 @@ search_insert_node(dbtree *db, char *topic, void *args,
 		}
 	}
 
-	void *ret = inserter(node, args);
+	size_t n   = cvector_size(node->clients);
+	void  *ret = inserter(node, args);
+	nni_stat_inc(&db->st_subscriptions, cvector_size(node->clients) - n);
 	nni_rwlock_unlock(&(db->rwlock));
 	topic_queue_free(for_free);
 	return ret;
@@ -673,14 +747,14 @@ dbtree_insert_client(dbtree *db, char *topic, uint32_t pipe_id)
 
 /**
  * @brief collect_clients - Get all clients in nodes
- * @param vec - all clients obey this rule will insert
+ * @param vec - all nodes with clients obey this rule will insert
  * @param nodes - all node need to be compare
  * @param nodes_t - all node need to be compare next time
  * @param topic_queue - topic queue position
- * @return all clients on lots of nodes
+ * @return all nodes which have matched clients
  */
-static uint32_t **
-collect_clients(uint32_t **vec, dbtree_node **nodes, dbtree_node ***nodes_t,
+static dbtree_node **
+collect_clients(dbtree_node **vec, dbtree_node **nodes, dbtree_node ***nodes_t,
     char **topic_queue)
 {
 	// TODO insert sort for clients
@@ -700,8 +774,7 @@ collect_clients(uint32_t **vec, dbtree_node **nodes, dbtree_node ***nodes_t,
 		if (node_t->well != -1) {
 			if (!cvector_empty(child[node_t->well]->clients)) {
 				log_debug("Find # tag");
-				cvector_push_back(
-				    vec, child[node_t->well]->clients);
+				cvector_push_back(vec, child[node_t->well]);
 			}
 		}
 
@@ -711,7 +784,7 @@ collect_clients(uint32_t **vec, dbtree_node **nodes, dbtree_node ***nodes_t,
 				if (!cvector_empty(
 				        child[node_t->plus]->clients)) {
 					cvector_push_back(
-					    vec, child[node_t->plus]->clients);
+					    vec, child[node_t->plus]);
 				}
 
 			} else {
@@ -736,7 +809,7 @@ collect_clients(uint32_t **vec, dbtree_node **nodes, dbtree_node ***nodes_t,
 				if (!cvector_empty(t->clients)) {
 					log_debug(
 					    "Searching client: %s", t->topic);
-					cvector_push_back(vec, t->clients);
+					cvector_push_back(vec, t);
 				}
 
 				if (t->well != -1) {
@@ -745,8 +818,7 @@ collect_clients(uint32_t **vec, dbtree_node **nodes, dbtree_node ***nodes_t,
 						log_debug(
 						    "Searching client: %s",
 						    t->topic);
-						cvector_push_back(
-						    vec, t->clients);
+						cvector_push_back(vec, t);
 					}
 				}
 
@@ -765,30 +837,31 @@ collect_clients(uint32_t **vec, dbtree_node **nodes, dbtree_node ***nodes_t,
 // TODO
 /**
  * @brief iterate_client - Deduplication for all clients
- * @param v - client
+ * @param v - nodes with clients
  * @return pipe id vector
  */
 static uint32_t *
-iterate_client(uint32_t **v)
+iterate_client(dbtree_node **v)
 {
 	cvector(uint32_t) ids = NULL;
 
 	if (v) {
 		for (size_t i = 0; i < cvector_size(v); ++i) {
+			uint32_t *clients = v[i]->clients;
 
-			for (size_t j = 0; j < cvector_size(v[i]); j++) {
+			for (size_t j = 0; j < cvector_size(clients); j++) {
 				size_t index = 0;
 
 				if (false ==
 				    binary_search_uint32(
-				        ids, 0, &index, v[i][j], ids_cmp)) {
+				        ids, 0, &index, clients[j], ids_cmp)) {
 					if (cvector_empty(ids) ||
 					    index == cvector_size(ids)) {
 						cvector_push_back(
-						    ids, v[i][j]);
+						    ids, clients[j]);
 					} else {
 						cvector_insert(
-						    ids, index, v[i][j]);
+						    ids, index, clients[j]);
 					}
 				}
 			}
@@ -813,7 +886,7 @@ search_client(dbtree *db, char *topic)
 	nni_rwlock_rdlock(&(db->rwlock));
 
 	dbtree_node *node              = db->root;
-	cvector(uint32_t *) pipe_ids   = NULL;
+	cvector(dbtree_node *) pipe_ids = NULL;
 	cvector(dbtree_node *) nodes   = NULL;
 	cvector(dbtree_node *) nodes_t = NULL;
 
@@ -847,7 +920,19 @@ search_client(dbtree *db, char *topic)
 uint32_t *
 dbtree_find_clients(dbtree *db, char *topic)
 {
-	return search_client(db, topic);
+	// timed only while tracing, no clock read otherwise
+	uint64_t  start = trace_now();
+	uint32_t *ret   = search_client(db, topic);
+
+	if (start != 0) {
+#ifdef NNG_ENABLE_STATS
+		if (db != NULL) {
+			nni_stat_hist_add(&db->st_match, trace_clock() - start);
+		}
+#endif
+		trace_span(TRACE_MATCH, start, 0);
+	}
+	return ret;
 }
 
 /**
@@ -1003,7 +1088,10 @@ dbtree_delete_client(dbtree *db, char *topic, uint32_t pipe_id)
 	}
 
 	if (node->child) {
+		size_t n = cvector_size(node->child[index]->clients);
 		delete_dbtree_client(node->child[index], pipe_id);
+		nni_stat_dec(&db->st_subscriptions,
+		    n - cvector_size(node->child[index]->clients));
 		delete_dbtree_node(node, index);
 	}
 
@@ -1045,6 +1133,18 @@ insert_dbtree_retain(dbtree_node *node, void *args)
 nng_msg *
 dbtree_insert_retain(dbtree *db, char *topic, nng_msg *ret_msg)
 {
+	nng_msg *old;
+
+	if (db != NULL && topic != NULL && db->retains != NULL) {
+		// the index holds its own ref
+		if (ret_msg != NULL) {
+			nng_msg_clone(ret_msg);
+		}
+		if ((old = retain_db_insert(db->retains, topic, ret_msg)) !=
+		    NULL) {
+			nng_msg_free(old);
+		}
+	}
 	return search_insert_node(db, topic, ret_msg, insert_dbtree_retain);
 }
 
@@ -1180,6 +1280,34 @@ collect_retains(void **vec, dbtree_node **nodes,
 	return (struct nng_msg **)vec;
 }
 
+/**
+ * @brief find_retain_wildcard - Get retain msgs matching a wildcard filter
+ * from the topic ordered index, only the range sharing the literal prefix
+ * of the filter is scanned.
+ * @param db - dbtree
+ * @param topic - topic filter
+ * @return nng_msg pointer vector
+ */
+static nng_msg **
+find_retain_wildcard(dbtree *db, char *topic)
+{
+	cvector(nng_msg *) rets = NULL;
+	retain_cursor *cur;
+	nng_msg       *msgs[64];
+	size_t         n;
+
+	if (retain_cursor_open(db->retains, topic, &cur) != 0) {
+		return NULL;
+	}
+	while ((n = retain_cursor_next(cur, msgs, 64)) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			cvector_push_back(rets, msgs[i]);
+		}
+	}
+	retain_cursor_close(cur);
+	return rets;
+}
+
 nng_msg **
 dbtree_find_retain(dbtree *db, char *topic)
 {
@@ -1188,6 +1316,9 @@ dbtree_find_retain(dbtree *db, char *topic)
 		log_error("db or topic is NULL");
 		return NULL;
 	}
+	if (db->retains != NULL && strpbrk(topic, "+#") != NULL) {
+		return find_retain_wildcard(db, topic);
+	}
 	char **topic_queue = topic_parse(topic);
 	char **for_free    = topic_queue;
 	nni_rwlock_rdlock(&(db->rwlock));
@@ -1244,6 +1375,12 @@ dbtree_delete_retain(dbtree *db, char *topic)
 		log_debug("db or topic is NULL");
 		return NULL;
 	}
+	if (db->retains != NULL) {
+		nng_msg *old = retain_db_delete(db->retains, topic);
+		if (old != NULL) {
+			nng_msg_free(old);
+		}
+	}
 	nni_rwlock_wrlock(&(db->rwlock));
 
 	char **       topic_queue = topic_parse(topic);
@@ -1315,50 +1452,173 @@ mem_free:
 	return ret;
 }
 
-// TODO only use one of vector
-static uint32_t *
-iterate_shared_client(uint32_t **v)
+void
+dbtree_set_shared_strategy(
+    dbtree *db, const char *group, dbtree_shared_strategy strategy)
 {
-	cvector(uint32_t) ids = NULL;
+	if (db == NULL) {
+		return;
+	}
+	nni_rwlock_wrlock(&(db->rwlock));
+	if (group == NULL) {
+		db->shared_strategy = strategy;
+		nni_rwlock_unlock(&(db->rwlock));
+		return;
+	}
+	for (size_t i = 0; i < cvector_size(db->shared_groups); i++) {
+		if (strcmp(db->shared_groups[i].group, group) == 0) {
+			db->shared_groups[i].strategy = strategy;
+			nni_rwlock_unlock(&(db->rwlock));
+			return;
+		}
+	}
+	dbtree_shared_group g = { .group = nni_strdup(group),
+		.strategy                = strategy };
+	cvector_push_back(db->shared_groups, g);
+	nni_rwlock_unlock(&(db->rwlock));
+}
 
-	if (v) {
-		for (size_t i = 0; i < cvector_size(v); ++i) {
-			// Dispatch strategy.
-#ifdef RANDOM
-			int index = rand();
-#elif defined(ROUND_ROBIN)
-			size_t index = acnt;
-#endif
-			// Get one pipe id from pipe id vector.
-			// This vector is from a node.
-			size_t j = index % cvector_size(v[i]);
+void
+dbtree_set_shared_inflight_cb(
+    dbtree *db, uint32_t (*cb)(uint32_t pipe_id, void *arg), void *arg)
+{
+	if (db == NULL) {
+		return;
+	}
+	nni_rwlock_wrlock(&(db->rwlock));
+	db->inflight_cb  = cb;
+	db->inflight_arg = arg;
+	nni_rwlock_unlock(&(db->rwlock));
+}
 
-			index = 0;
-			// Deduplicate id.
-			if (false ==
-			    binary_search_uint32(
-			        ids, 0, &index, v[i][j], ids_cmp)) {
-				if (cvector_empty(ids) ||
-				    (size_t) index == cvector_size(ids)) {
-					cvector_push_back(ids, v[i][j]);
-				} else {
-					cvector_insert(ids, index, v[i][j]);
+static dbtree_shared_strategy
+shared_group_strategy(dbtree *db, const char *group)
+{
+	for (size_t i = 0; i < cvector_size(db->shared_groups); i++) {
+		if (strcmp(db->shared_groups[i].group, group) == 0) {
+			return db->shared_groups[i].strategy;
+		}
+	}
+	return db->shared_strategy;
+}
+
+/**
+ * @brief shared_next - Advance the dispatch cursor of a node.
+ * Readers only hold the tree read lock, so it must be atomic.
+ * @param node - dbtree_node
+ * @return cursor value before advancing
+ */
+static uint64_t
+shared_next(dbtree_node *node)
+{
+	uint64_t cnt;
+	do {
+		cnt = nni_atomic_get64(&node->cursor);
+	} while (!nni_atomic_cas64(&node->cursor, cnt, cnt + 1));
+	return cnt;
+}
+
+static uint64_t
+shared_mix(uint64_t x)
+{
+	// splitmix64 finalizer, cheap and well distributed
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/**
+ * @brief shared_sticky - Highest random weight of publisher and client,
+ * a publisher keeps its subscriber as long as that one stays in the group
+ * and no state is kept for it.
+ * @param clients - subscribers of the filter
+ * @param n - number of clients
+ * @param pub_id - pipe id of the publisher
+ * @return pipe id
+ */
+static uint32_t
+shared_sticky(uint32_t *clients, size_t n, uint32_t pub_id)
+{
+	uint32_t best  = clients[0];
+	uint64_t score = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		uint64_t w = shared_mix(((uint64_t) pub_id << 32) | clients[i]);
+		if (w >= score) {
+			score = w;
+			best  = clients[i];
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief shared_dispatch - Pick one subscriber of a shared subscription
+ * @param db - dbtree
+ * @param node - node of a $share/group/filter with clients
+ * @param strategy - dispatch strategy of the group
+ * @param topic - topic of the publish
+ * @param pub_id - pipe id of the publisher
+ * @return pipe id
+ */
+static uint32_t
+shared_dispatch(dbtree *db, dbtree_node *node,
+    dbtree_shared_strategy strategy, char *topic, uint32_t pub_id)
+{
+	uint32_t *clients = node->clients;
+	size_t    n       = cvector_size(clients);
+
+	switch (strategy) {
+	case DBTREE_SHARED_STICKY:
+		return shared_sticky(clients, n, pub_id);
+	case DBTREE_SHARED_HASH_TOPIC:
+		return clients[fnv1a_hashn(topic, strlen(topic)) % n];
+	case DBTREE_SHARED_LEAST_INFLIGHT:
+		if (db->inflight_cb != NULL) {
+			// Rotate the start point so ties are shared
+			size_t   start = shared_next(node) % n;
+			uint32_t best  = clients[start];
+			uint32_t min   = db->inflight_cb(best, db->inflight_arg);
+			for (size_t i = 1; i < n && min > 0; i++) {
+				uint32_t c = clients[(start + i) % n];
+				uint32_t d = db->inflight_cb(c, db->inflight_arg);
+				if (d < min) {
+					min  = d;
+					best = c;
 				}
 			}
+			return best;
 		}
-		acnt++;
-		if (acnt == ULLONG_MAX) {
-			acnt = 0;
-		}
+		break;
+	case DBTREE_SHARED_RANDOM:
+		return clients[shared_mix(shared_next(node)) % n];
+	default:
+		break;
 	}
 
-	return ids;
+	return clients[shared_next(node) % n];
+}
+
+static int
+shared_id_cmp(const void *x, const void *y)
+{
+	uint32_t a = *(const uint32_t *) x;
+	uint32_t b = *(const uint32_t *) y;
+	return a < b ? -1 : (a > b ? 1 : 0);
 }
 
 uint32_t *
 dbtree_find_shared_clients(dbtree *db, char *topic)
 {
-	cvector(uint32_t *) ids        = NULL;
+	return dbtree_find_shared_clients_from(db, topic, 0);
+}
+
+uint32_t *
+dbtree_find_shared_clients_from(dbtree *db, char *topic, uint32_t pub_id)
+{
+	cvector(uint32_t) ret          = NULL;
+	cvector(dbtree_node *) ids     = NULL;
 	cvector(dbtree_node *) nodes_p = NULL;
 	cvector(dbtree_node *) nodes_q = NULL;
 	bool   equal                   = false;
@@ -1383,31 +1643,55 @@ dbtree_find_shared_clients(dbtree *db, char *topic)
 	dbtree_node **nlist = shared->child;
 
 	char **topic_queue = topic_parse(topic);
-	char **for_free    = topic_queue;
 
-	// Push all shared child.
+	log_debug("nodes size: %lu", cvector_size(nlist));
+	// Every group dispatches on its own.
 	for (size_t i = 0; i < cvector_size(nlist); i++) {
-		dbtree_node *node = nlist[i];
-		if (node->child && *node->child) {
-			cvector_push_back(nodes_p, node);
+		dbtree_node *group = nlist[i];
+		char       **tq    = topic_queue;
+		if (!(group->child && *group->child)) {
+			continue;
+		}
+		cvector_push_back(nodes_p, group);
+		while (*tq && (!cvector_empty(nodes_p))) {
+			ids = collect_clients(ids, nodes_p, &nodes_q, tq);
+			tq++;
+			if (*tq == NULL) {
+				break;
+			}
+			ids = collect_clients(ids, nodes_q, &nodes_p, tq);
+			tq++;
+		}
+		cvector_set_size(nodes_p, 0);
+		cvector_set_size(nodes_q, 0);
+
+		dbtree_shared_strategy strategy =
+		    shared_group_strategy(db, group->topic);
+		for (size_t j = 0; j < cvector_size(ids); j++) {
+			if (cvector_empty(ids[j]->clients)) {
+				continue;
+			}
+			cvector_push_back(ret,
+			    shared_dispatch(
+			        db, ids[j], strategy, topic, pub_id));
 		}
+		cvector_set_size(ids, 0);
 	}
+	nni_rwlock_unlock(&(db->rwlock));
 
-	log_debug("nodes size: %lu", cvector_size(nlist));
-	while (*topic_queue && (!cvector_empty(nodes_p))) {
-
-		ids = collect_clients(ids, nodes_p, &nodes_q, topic_queue);
-		topic_queue++;
-		if (*topic_queue == NULL) {
-			break;
+	// Deduplicate id.
+	if (cvector_size(ret) > 1) {
+		size_t n = 1;
+		qsort(ret, cvector_size(ret), sizeof(uint32_t), shared_id_cmp);
+		for (size_t i = 1; i < cvector_size(ret); i++) {
+			if (ret[i] != ret[n - 1]) {
+				ret[n++] = ret[i];
+			}
 		}
-		ids = collect_clients(ids, nodes_q, &nodes_p, topic_queue);
-		topic_queue++;
+		cvector_set_size(ret, n);
 	}
 
-	uint32_t *ret = iterate_shared_client(ids);
-	nni_rwlock_unlock(&(db->rwlock));
-	topic_queue_free(for_free);
+	topic_queue_free(topic_queue);
 	cvector_free(nodes_p);
 	cvector_free(nodes_q);
 	cvector_free(ids);
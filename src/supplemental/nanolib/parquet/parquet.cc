@@ -1,20 +1,37 @@
 #include <arrow/io/file.h>
+#include <arrow/util/config.h>
+#include <parquet/statistics.h>
 #include <parquet/stream_reader.h>
 #include <parquet/stream_writer.h>
+#if ARROW_VERSION_MAJOR >= 12
+#include <parquet/page_index.h>
+#endif
 
+#include "nng/mqtt/mqtt_client.h"
+#include "nng/supplemental/nanolib/file_catalog.h"
 #include "nng/supplemental/nanolib/log.h"
 #include "nng/supplemental/nanolib/md5.h"
 #include "nng/supplemental/nanolib/parquet.h"
 #include "nng/supplemental/nanolib/queue.h"
+#include "nng/supplemental/nanolib/cJSON.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/rule.h"
 #include <assert.h>
 #include <atomic>
 #include <dirent.h>
+#include <errno.h>
 #include <fstream>
 #include <inttypes.h>
 #include <iostream>
+#include <list>
+#include <mutex>
+#include <algorithm>
 #include <string>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <thread>
+#include <time.h>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 using parquet::ConvertedType;
@@ -39,11 +56,34 @@ atomic_bool is_available = false;
 
 #define UINT64_MAX_DIGITS 20
 
-CircularQueue        parquet_queue;
 CircularQueue        parquet_file_queue;
-pthread_mutex_t      parquet_queue_mutex     = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t       parquet_queue_not_empty = PTHREAD_COND_INITIALIZER;
-static conf_parquet *g_conf                  = NULL;
+pthread_mutex_t      parquet_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static conf_parquet *g_conf              = NULL;
+
+// One write thread with its own queue. Batches of a topic always go to the
+// same writer, so files of a topic are written in order while topics are
+// flushed in parallel.
+struct parquet_writer {
+	uint32_t        id;
+	CircularQueue   queue;
+	pthread_mutex_t mtx;
+	pthread_cond_t  not_empty;
+	pthread_cond_t  not_full;
+	pthread_t       thread;
+	bool            running;
+	bool            stop; // exit once the queue is drained
+};
+
+static parquet_writer *parquet_writers      = NULL;
+static uint32_t        parquet_writer_count = 0;
+// key ranges of parquet_file_queue, for lookups without the queue lock
+static file_catalog *parquet_catalog = NULL;
+
+static pthread_t       parquet_compact_thread;
+static bool            parquet_compact_running = false;
+static bool            parquet_compact_stop    = false;
+static pthread_mutex_t parquet_compact_mtx     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  parquet_compact_cv      = PTHREAD_COND_INITIALIZER;
 
 static bool
 directory_exists(const std::string &directory_path)
@@ -61,22 +101,25 @@ create_directory(const std::string &directory_path)
 	return (status == 0);
 }
 
+// Writers may flush the same key range of different topics at once, the
+// name of a file being written carries the writer id.
 static char *
-get_file_name(conf_parquet *conf, uint64_t key_start, uint64_t key_end)
+get_file_name(conf_parquet *conf, uint32_t writer, uint64_t key_start,
+    uint64_t key_end)
 {
 	char *file_name = NULL;
 	char *dir       = conf->dir;
 	char *prefix    = conf->file_name_prefix;
 
 	file_name = (char *) malloc(strlen(prefix) + strlen(dir) +
-	    UINT64_MAX_DIGITS + UINT64_MAX_DIGITS + 16);
+	    UINT64_MAX_DIGITS + UINT64_MAX_DIGITS + 32);
 	if (file_name == NULL) {
 		log_error("Failed to allocate memory for file name.");
 		return NULL;
 	}
 
-	sprintf(file_name, "%s/%s-%" PRIu64 "~%" PRIu64 ".parquet", dir,
-	    prefix, key_start, key_end);
+	sprintf(file_name, "%s/%s-%" PRIu32 "-%" PRIu64 "~%" PRIu64 ".parquet",
+	    dir, prefix, writer, key_start, key_end);
 	return file_name;
 }
 
@@ -114,11 +157,15 @@ get_random_file_name(char *prefix, uint64_t key_start, uint64_t key_end)
 	return file_name;
 }
 
+static void parquet_reader_evict(const char *filename);
+
 static int
 remove_old_file(void)
 {
 	int   ret      = 0;
 	char *filename = (char *) DEQUEUE(parquet_file_queue);
+	file_catalog_remove(parquet_catalog, filename);
+	parquet_reader_evict(filename);
 	if (remove(filename) == 0) {
 		log_debug("File '%s' removed successfully.\n", filename);
 	} else {
@@ -131,6 +178,82 @@ remove_old_file(void)
 	return ret;
 }
 
+// Hashes the bytes on their way to the file, the digest of a parquet file
+// is ready once it is closed without reading it back.
+class md5_output_stream : public arrow::io::OutputStream {
+public:
+	explicit md5_output_stream(shared_ptr<arrow::io::OutputStream> sink)
+	    : sink_(std::move(sink))
+	{
+		MD5Init(&ctx_);
+	}
+
+	arrow::Status
+	Write(const void *data, int64_t nbytes) override
+	{
+		ARROW_RETURN_NOT_OK(sink_->Write(data, nbytes));
+		const uint8_t *p = (const uint8_t *) data;
+		size_ += nbytes;
+		// MD5Update takes an unsigned int length
+		while (nbytes > 0) {
+			unsigned int n = (unsigned int) std::min<int64_t>(
+			    nbytes, 1U << 30);
+			MD5Update(&ctx_, (unsigned char *) p, n);
+			p += n;
+			nbytes -= n;
+		}
+		return arrow::Status::OK();
+	}
+
+	arrow::Status
+	Flush() override
+	{
+		return sink_->Flush();
+	}
+
+	arrow::Status
+	Close() override
+	{
+		if (!finished_) {
+			MD5FinalString(&ctx_, md5_);
+			finished_ = true;
+		}
+		return sink_->Close();
+	}
+
+	arrow::Result<int64_t>
+	Tell() const override
+	{
+		return sink_->Tell();
+	}
+
+	bool
+	closed() const override
+	{
+		return sink_->closed();
+	}
+
+	// valid after Close
+	const char *
+	md5() const
+	{
+		return md5_;
+	}
+
+	uint64_t
+	size() const
+	{
+		return size_;
+	}
+
+private:
+	shared_ptr<arrow::io::OutputStream> sink_;
+	MD5_CTX                             ctx_;
+	char                                md5_[MD5_STR_LEN + 1] = { 0 };
+	uint64_t                            size_                 = 0;
+	bool                                finished_             = false;
+};
+
 static shared_ptr<GroupNode>
 setup_schema()
 {
@@ -146,6 +269,301 @@ setup_schema()
 	    GroupNode::Make("schema", Repetition::REQUIRED, fields));
 }
 
+// Columns decoded from the messages, written after key and data. They are
+// picked by conf->columns, the select list of a rule sql.
+struct parquet_column {
+	rule_type      type;
+	string         name;
+	vector<string> path; // of RULE_PAYLOAD_FIELD
+};
+
+static vector<parquet_column> parquet_columns;
+
+static int
+parquet_columns_parse(const char *columns)
+{
+	conf_rule cr;
+	string    sql = string("SELECT ") + columns + " FROM \"parquet\"";
+
+	memset(&cr, 0, sizeof(cr));
+	if (!rule_sql_parse(&cr, sql.data()) || cvector_size(cr.rules) != 1) {
+		log_error("Failed to parse parquet columns: %s", columns);
+		return -1;
+	}
+	rule *r = &cr.rules[0];
+	// names of rule_type
+	static const char *names[] = { "qos", "id", "topic", "clientid",
+		"username", "password", "timestamp" };
+	for (int i = RULE_QOS; i <= RULE_TIMESTAMP; i++) {
+		if (!r->flag[i]) {
+			continue;
+		}
+		if (i == RULE_PASSWORD) {
+			log_warn("parquet never writes password column");
+			continue;
+		}
+		parquet_column col;
+		col.type = (rule_type) i;
+		col.name = r->as[i] != NULL ? r->as[i] : names[i];
+		parquet_columns.push_back(col);
+	}
+	for (size_t i = 0; i < cvector_size(r->payload); i++) {
+		rule_payload  *pl = r->payload[i];
+		parquet_column col;
+		col.type = RULE_PAYLOAD_FIELD;
+		col.name = pl->pas;
+		for (size_t j = 0; j < cvector_size(pl->psa); j++) {
+			col.path.push_back(pl->psa[j]);
+		}
+		parquet_columns.push_back(col);
+	}
+	rule_free(r);
+	cvector_free(cr.rules);
+	return 0;
+}
+
+// Values of a decoded column for the rows of one file, only non null
+// values are kept as parquet expects.
+struct parquet_column_values {
+	Type::type                 type;
+	ConvertedType::type        converted;
+	vector<int16_t>            def;
+	vector<int32_t>            i32;
+	vector<int64_t>            i64;
+	vector<double>             dbl;
+	vector<uint8_t>            bln;
+	vector<parquet::ByteArray> ba;
+};
+
+// Decoded columns of rows [start, end] of elem. Parsed payloads and
+// printed JSON are kept until the file is written.
+struct parquet_decoded {
+	vector<parquet_column_values> cols;
+	vector<cJSON *>               payloads;
+	vector<char *>                printed;
+
+	parquet_decoded() {}
+	parquet_decoded(parquet_object *elem, uint32_t start, uint32_t end);
+	~parquet_decoded();
+	shared_ptr<GroupNode> schema(shared_ptr<GroupNode> base);
+};
+
+static void
+column_add_str(parquet_column_values &cv, const uint8_t *ptr, size_t len)
+{
+	if (ptr == NULL) {
+		cv.def.push_back(0);
+		return;
+	}
+	cv.def.push_back(1);
+	cv.ba.emplace_back((uint32_t) len, ptr);
+}
+
+static void
+column_add_int(parquet_column_values &cv, bool valid, int64_t v)
+{
+	cv.def.push_back(valid ? 1 : 0);
+	if (!valid) {
+		return;
+	}
+	if (cv.type == Type::INT32) {
+		cv.i32.push_back((int32_t) v);
+	} else {
+		cv.i64.push_back(v);
+	}
+}
+
+static cJSON *
+payload_field(cJSON *jso, const vector<string> &path)
+{
+	for (size_t i = 0; i < path.size() && jso != NULL; i++) {
+		jso = cJSON_GetObjectItem(jso, path[i].c_str());
+	}
+	return jso;
+}
+
+// Fields of JSON payload are typed by the first row having them.
+static void
+column_type_of_field(parquet_column_values &cv, const vector<cJSON *> &items)
+{
+	cv.type      = Type::BYTE_ARRAY;
+	cv.converted = ConvertedType::UTF8;
+	for (cJSON *item : items) {
+		if (item == NULL || cJSON_IsNull(item)) {
+			continue;
+		}
+		if (cJSON_IsNumber(item)) {
+			cv.type      = Type::DOUBLE;
+			cv.converted = ConvertedType::NONE;
+		} else if (cJSON_IsBool(item)) {
+			cv.type      = Type::BOOLEAN;
+			cv.converted = ConvertedType::NONE;
+		}
+		return;
+	}
+}
+
+parquet_decoded::parquet_decoded(
+    parquet_object *elem, uint32_t start, uint32_t end)
+{
+	uint32_t rows = end - start + 1;
+
+	if (parquet_columns.empty()) {
+		return;
+	}
+	for (auto &col : parquet_columns) {
+		if (col.type == RULE_PAYLOAD_FIELD) {
+			payloads.resize(rows, NULL);
+			break;
+		}
+	}
+	for (uint32_t i = 0; i < payloads.size(); i++) {
+		payloads[i] =
+		    cJSON_ParseWithLength((const char *) elem->darray[start + i],
+		        elem->dsize[start + i]);
+	}
+
+	cols.resize(parquet_columns.size());
+	for (size_t c = 0; c < parquet_columns.size(); c++) {
+		parquet_column        &col = parquet_columns[c];
+		parquet_column_values &cv  = cols[c];
+
+		cv.def.reserve(rows);
+		switch (col.type) {
+		case RULE_QOS:
+			cv.type      = Type::INT32;
+			cv.converted = ConvertedType::UINT_8;
+			break;
+		case RULE_ID:
+			cv.type      = Type::INT32;
+			cv.converted = ConvertedType::UINT_16;
+			break;
+		case RULE_TIMESTAMP:
+			cv.type      = Type::INT64;
+			cv.converted = ConvertedType::TIMESTAMP_MILLIS;
+			break;
+		case RULE_PAYLOAD_FIELD:
+			break;
+		default:
+			cv.type      = Type::BYTE_ARRAY;
+			cv.converted = ConvertedType::UTF8;
+			break;
+		}
+
+		vector<cJSON *> items;
+		if (col.type == RULE_PAYLOAD_FIELD) {
+			items.resize(rows);
+			for (uint32_t i = 0; i < rows; i++) {
+				items[i] = payload_field(payloads[i], col.path);
+			}
+			column_type_of_field(cv, items);
+		}
+
+		for (uint32_t i = 0; i < rows; i++) {
+			nng_msg *msg = elem->msgs != NULL ? elem->msgs[start + i]
+			                                  : NULL;
+			bool     pub = msg != NULL && nng_msg_header_len(msg) > 0 &&
+			    nng_msg_get_type(msg) == CMD_PUBLISH &&
+			    nng_msg_len(msg) >= 2;
+			uint8_t *body  = pub ? (uint8_t *) nng_msg_body(msg) : NULL;
+			size_t   tlen  = pub ? (body[0] << 8 | body[1]) : 0;
+			uint8_t  qos   = pub ? (*nng_msg_header_ptr(msg) & 0x06) >> 1
+			                     : 0;
+			conn_param *cp = msg != NULL
+			    ? (conn_param *) nng_msg_get_conn_param(msg)
+			    : NULL;
+			const uint8_t *str;
+
+			if (pub && tlen + 2 > nng_msg_len(msg)) {
+				pub = false;
+			}
+			switch (col.type) {
+			case RULE_QOS:
+				column_add_int(cv, pub, qos);
+				break;
+			case RULE_ID:
+				column_add_int(cv,
+				    pub && qos > 0 && tlen + 4 <= nng_msg_len(msg),
+				    pub ? body[tlen + 2] << 8 | body[tlen + 3] : 0);
+				break;
+			case RULE_TIMESTAMP:
+				column_add_int(cv, msg != NULL,
+				    msg != NULL ? nng_msg_get_timestamp(msg) : 0);
+				break;
+			case RULE_TOPIC:
+				column_add_str(cv, pub ? body + 2 : NULL, tlen);
+				break;
+			case RULE_CLIENTID:
+			case RULE_USERNAME:
+				str = cp == NULL ? NULL
+				    : col.type == RULE_CLIENTID
+				    ? conn_param_get_clientid(cp)
+				    : conn_param_get_username(cp);
+				column_add_str(cv, str,
+				    str != NULL ? strlen((const char *) str) : 0);
+				break;
+			case RULE_PAYLOAD_FIELD: {
+				cJSON *item = items[i];
+				if (cv.type == Type::DOUBLE) {
+					cv.def.push_back(cJSON_IsNumber(item));
+					if (cJSON_IsNumber(item)) {
+						cv.dbl.push_back(item->valuedouble);
+					}
+				} else if (cv.type == Type::BOOLEAN) {
+					cv.def.push_back(cJSON_IsBool(item));
+					if (cJSON_IsBool(item)) {
+						cv.bln.push_back(cJSON_IsTrue(item));
+					}
+				} else if (cJSON_IsString(item)) {
+					column_add_str(cv,
+					    (const uint8_t *) item->valuestring,
+					    strlen(item->valuestring));
+				} else if (item != NULL && !cJSON_IsNull(item)) {
+					char *s = cJSON_PrintUnformatted(item);
+					printed.push_back(s);
+					column_add_str(cv, (const uint8_t *) s,
+					    s != NULL ? strlen(s) : 0);
+				} else {
+					column_add_str(cv, NULL, 0);
+				}
+				break;
+			}
+			default:
+				column_add_str(cv, NULL, 0);
+				break;
+			}
+		}
+	}
+}
+
+parquet_decoded::~parquet_decoded()
+{
+	for (char *s : printed) {
+		cJSON_free(s);
+	}
+	for (cJSON *jso : payloads) {
+		cJSON_Delete(jso);
+	}
+}
+
+shared_ptr<GroupNode>
+parquet_decoded::schema(shared_ptr<GroupNode> base)
+{
+	if (cols.empty()) {
+		return base;
+	}
+	parquet::schema::NodeVector fields;
+	for (int i = 0; i < base->field_count(); i++) {
+		fields.push_back(base->field(i));
+	}
+	for (size_t c = 0; c < cols.size(); c++) {
+		fields.push_back(PrimitiveNode::Make(parquet_columns[c].name,
+		    Repetition::OPTIONAL, cols[c].type, cols[c].converted));
+	}
+	return static_pointer_cast<GroupNode>(
+	    GroupNode::Make("schema", Repetition::REQUIRED, fields));
+}
+
 parquet_file_range *
 parquet_file_range_alloc(uint32_t start_idx, uint32_t end_idx, char *filename)
 {
@@ -176,6 +594,8 @@ parquet_object_alloc(uint64_t *keys, uint8_t **darray, uint32_t *dsize,
 	elem->size           = size;
 	elem->aio            = aio;
 	elem->arg            = arg;
+	elem->topic          = NULL;
+	elem->msgs           = NULL;
 	elem->ranges         = new parquet_file_ranges;
 	elem->ranges->range  = NULL;
 	elem->ranges->start  = 0;
@@ -206,53 +626,69 @@ parquet_object_free(parquet_object *elem)
 	}
 }
 
-int
-parquet_write_batch_async(parquet_object *elem)
+// FNV-1a of topic, NULL topic goes to the first writer.
+static parquet_writer *
+parquet_writer_of(const char *topic)
 {
-	if (g_conf == NULL || g_conf->enable == false) {
-		log_error("Parquet is not ready or not launch!");
-		return -1;
+	uint32_t hash = 2166136261u;
+
+	if (topic == NULL) {
+		return &parquet_writers[0];
 	}
-	elem->type = WRITE_TO_NORMAL;
-	log_debug("WAIT_FOR_AVAILABLE");
-	WAIT_FOR_AVAILABLE
-	log_debug("WAIT_FOR parquet_queue_mutex");
-	pthread_mutex_lock(&parquet_queue_mutex);
-	if (IS_EMPTY(parquet_queue)) {
-		pthread_cond_broadcast(&parquet_queue_not_empty);
-		log_debug("broadcast signal!");
+	for (const char *c = topic; *c != '\0'; c++) {
+		hash = (hash ^ (uint8_t) *c) * 16777619u;
 	}
-	ENQUEUE(parquet_queue, elem);
-	log_debug("enqueue element.");
-
-	pthread_mutex_unlock(&parquet_queue_mutex);
-
-	return 0;
+	return &parquet_writers[hash % parquet_writer_count];
 }
 
-int
-parquet_write_batch_tmp_async(parquet_object *elem)
+// Blocks while the writer is write_queue_limit batches behind, which holds
+// the ringbuffer flushing to it until the files catch up.
+static int
+parquet_writer_enqueue(parquet_object *elem, parquet_write_type type)
 {
 	if (g_conf == NULL || g_conf->enable == false) {
 		log_error("Parquet is not ready or not launch!");
 		return -1;
 	}
-	elem->type = WRITE_TO_TEMP;
+	elem->type = type;
 	log_debug("WAIT_FOR_AVAILABLE");
 	WAIT_FOR_AVAILABLE
-	log_debug("WAIT_FOR parquet_queue_mutex");
-	pthread_mutex_lock(&parquet_queue_mutex);
-	if (IS_EMPTY(parquet_queue)) {
-		pthread_cond_broadcast(&parquet_queue_not_empty);
+	parquet_writer *w     = parquet_writer_of(elem->topic);
+	uint32_t        limit = g_conf->write_queue_limit;
+
+	pthread_mutex_lock(&w->mtx);
+	while (!w->stop && limit != 0 &&
+	    (uint32_t) QUEUE_SIZE(w->queue) >= limit) {
+		log_debug("parquet writer %u is full, wait", w->id);
+		pthread_cond_wait(&w->not_full, &w->mtx);
 	}
-	ENQUEUE(parquet_queue, elem);
-	log_debug("enqueue element.");
-
-	pthread_mutex_unlock(&parquet_queue_mutex);
+	if (w->stop) {
+		pthread_mutex_unlock(&w->mtx);
+		log_error("Parquet writer %u is stopped!", w->id);
+		return -1;
+	}
+	if (IS_EMPTY(w->queue)) {
+		pthread_cond_signal(&w->not_empty);
+	}
+	ENQUEUE(w->queue, elem);
+	log_debug("enqueue element to writer %u.", w->id);
+	pthread_mutex_unlock(&w->mtx);
 
 	return 0;
 }
 
+int
+parquet_write_batch_async(parquet_object *elem)
+{
+	return parquet_writer_enqueue(elem, WRITE_TO_NORMAL);
+}
+
+int
+parquet_write_batch_tmp_async(parquet_object *elem)
+{
+	return parquet_writer_enqueue(elem, WRITE_TO_TEMP);
+}
+
 shared_ptr<parquet::FileEncryptionProperties>
 parquet_set_encryption(conf_parquet *conf)
 {
@@ -274,6 +710,132 @@ parquet_set_encryption(conf_parquet *conf)
 	return encryption_configurations;
 }
 
+static shared_ptr<parquet::WriterProperties>
+parquet_writer_properties(conf_parquet *conf)
+{
+	parquet::WriterProperties::Builder builder;
+
+	// Statistics carry min/max key of every row group, so readers can
+	// skip row groups without decoding them.
+	builder.created_by("NanoMQ")
+	    ->version(parquet::ParquetVersion::PARQUET_2_6)
+	    ->data_page_version(parquet::ParquetDataPageVersion::V2)
+	    ->compression(
+	        static_cast<arrow::Compression::type>(conf->comp_type))
+	    ->enable_statistics();
+
+#if ARROW_VERSION_MAJOR >= 12
+	if (conf->page_index) {
+		builder.enable_write_page_index();
+	} else {
+		builder.disable_write_page_index();
+	}
+#else
+	if (conf->page_index) {
+		log_warn("page index needs Arrow 12 or later, ignored");
+	}
+#endif
+
+	if (conf->bloom_filter) {
+#if ARROW_VERSION_MAJOR >= 25
+		parquet::BloomFilterOptions bloom_options;
+		builder.enable_bloom_filter("key", bloom_options);
+#else
+		log_warn("bloom filter writing needs Arrow 25 or later, "
+		         "ignored");
+#endif
+	}
+
+	if (conf->encryption.enable) {
+		shared_ptr<parquet::FileEncryptionProperties>
+		    encryption_configurations;
+		encryption_configurations = parquet_set_encryption(conf);
+		builder.encryption(encryption_configurations);
+	}
+
+	return builder.build();
+}
+
+// Write rows [start, end] of elem. Each column of a row group is handed to
+// the writer in one batch, rows are split into row groups of
+// conf->row_group_size.
+static void
+parquet_write_rows(conf_parquet *conf, parquet::ParquetFileWriter *writer,
+    parquet_object *elem, uint32_t start, uint32_t end,
+    parquet_decoded &decoded)
+{
+	vector<size_t> next(decoded.cols.size(), 0);
+
+	uint32_t total = end - start + 1;
+	uint32_t rows  = conf->row_group_size;
+
+	if (rows == 0 || rows > total) {
+		rows = total;
+	}
+
+	vector<int16_t>            def_levels(rows, 1);
+	vector<parquet::ByteArray> values(rows);
+
+	for (uint32_t done = 0; done < total; done += rows) {
+		uint32_t off = start + done;
+		uint32_t n   = std::min(rows, total - done);
+
+		parquet::RowGroupWriter *rg_writer = writer->AppendRowGroup();
+
+		parquet::Int64Writer *int64_writer =
+		    static_cast<parquet::Int64Writer *>(
+		        rg_writer->NextColumn());
+		int64_writer->WriteBatch(n, def_levels.data(), nullptr,
+		    reinterpret_cast<const int64_t *>(elem->keys + off));
+
+		for (uint32_t i = 0; i < n; i++) {
+			values[i].ptr = elem->darray[off + i];
+			values[i].len = elem->dsize[off + i];
+		}
+		parquet::ByteArrayWriter *ba_writer =
+		    static_cast<parquet::ByteArrayWriter *>(
+		        rg_writer->NextColumn());
+		ba_writer->WriteBatch(n, def_levels.data(), nullptr, values.data());
+
+		for (size_t c = 0; c < decoded.cols.size(); c++) {
+			parquet_column_values &cv  = decoded.cols[c];
+			const int16_t         *def = cv.def.data() + done;
+			size_t                 v   = next[c];
+
+			auto *col = rg_writer->NextColumn();
+			switch (cv.type) {
+			case Type::INT32:
+				static_cast<parquet::Int32Writer *>(col)->WriteBatch(
+				    n, def, nullptr, cv.i32.data() + v);
+				break;
+			case Type::INT64:
+				static_cast<parquet::Int64Writer *>(col)->WriteBatch(
+				    n, def, nullptr, cv.i64.data() + v);
+				break;
+			case Type::DOUBLE:
+				static_cast<parquet::DoubleWriter *>(col)->WriteBatch(
+				    n, def, nullptr, cv.dbl.data() + v);
+				break;
+			case Type::BOOLEAN:
+				static_assert(sizeof(bool) == sizeof(uint8_t), "");
+				static_cast<parquet::BoolWriter *>(col)->WriteBatch(n,
+				    def, nullptr,
+				    reinterpret_cast<const bool *>(cv.bln.data()) + v);
+				break;
+			default:
+				static_cast<parquet::ByteArrayWriter *>(col)
+				    ->WriteBatch(n, def, nullptr, cv.ba.data() + v);
+				break;
+			}
+			for (uint32_t i = 0; i < n; i++) {
+				next[c] += def[i];
+			}
+		}
+
+		rg_writer->Close();
+	}
+}
+
 static int
 compute_new_index(parquet_object *obj, uint32_t index, uint32_t file_size)
 {
@@ -333,57 +895,19 @@ again:
 		    parquet_file_range_alloc(old_index, new_index, filename);
 		update_parquet_file_ranges(conf, elem, range);
 
-		// Create a ParquetFileWriter instance
-		parquet::WriterProperties::Builder builder;
-
-		builder.created_by("NanoMQ")
-		    ->version(parquet::ParquetVersion::PARQUET_2_6)
-		    ->data_page_version(parquet::ParquetDataPageVersion::V2)
-		    ->compression(static_cast<arrow::Compression::type>(
-		        conf->comp_type));
-
-		if (conf->encryption.enable) {
-			shared_ptr<parquet::FileEncryptionProperties>
-			    encryption_configurations;
-			encryption_configurations =
-			    parquet_set_encryption(conf);
-			builder.encryption(encryption_configurations);
-		}
-
-		shared_ptr<parquet::WriterProperties> props = builder.build();
+		shared_ptr<parquet::WriterProperties> props =
+		    parquet_writer_properties(conf);
+		parquet_decoded decoded(elem, old_index, new_index);
 		using FileClass = arrow::io::FileOutputStream;
 		shared_ptr<FileClass> out_file;
 		PARQUET_ASSIGN_OR_THROW(out_file, FileClass::Open(filename));
 		std::shared_ptr<parquet::ParquetFileWriter> file_writer =
-		    parquet::ParquetFileWriter::Open(out_file, schema, props);
-
-		// Append a RowGroup with a specific number of rows.
-		parquet::RowGroupWriter *rg_writer =
-		    file_writer->AppendRowGroup();
-
-		// Write the Int64 column
-		parquet::Int64Writer *int64_writer =
-		    static_cast<parquet::Int64Writer *>(
-		        rg_writer->NextColumn());
-		for (uint32_t i = old_index; i <= new_index; i++) {
-			int64_t value            = elem->keys[i];
-			int16_t definition_level = 1;
-			int64_writer->WriteBatch(
-			    1, &definition_level, nullptr, &value);
-		}
+		    parquet::ParquetFileWriter::Open(
+		        out_file, decoded.schema(schema), props);
 
-		// Write the ByteArray column. Make every alternate values NULL
-		parquet::ByteArrayWriter *ba_writer =
-		    static_cast<parquet::ByteArrayWriter *>(
-		        rg_writer->NextColumn());
-		for (uint32_t i = old_index; i <= new_index; i++) {
-			parquet::ByteArray value;
-			int16_t            definition_level = 1;
-			value.ptr                           = elem->darray[i];
-			value.len                           = elem->dsize[i];
-			ba_writer->WriteBatch(
-			    1, &definition_level, nullptr, &value);
-		}
+		parquet_write_rows(conf, file_writer.get(), elem, old_index,
+		    new_index, decoded);
+		file_writer->Close();
 
 		old_index = new_index;
 
@@ -396,26 +920,20 @@ again:
 	parquet_object_free(elem);
 	return 0;
 }
-char *
-compute_and_rename_file_withMD5(char *filename, conf_parquet *conf, char *topic)
+// {dir}/{prefix}_{topic}_{md5}-{start_key}~{end_key}.parquet
+static char *
+rename_file_withMD5(char *filename, conf_parquet *conf, const char *topic,
+    const char *md5_buffer, uint64_t range[2])
 {
-	char md5_buffer[MD5_LEN + 1];
-	log_debug("compute md5");
-	int ret = ComputeFileMD5(filename, md5_buffer);
-	if (ret != 0) {
-		log_error("Failed to calculate md5sum");
-		ret = remove(filename);
-		if (ret != 0) {
-			log_error("Failed to remove file %s errno: %d",
-			    filename, errno);
-		}
+	int   ret;
+	char *md5_file_name = NULL;
 
-		free(filename);
-		return NULL;
+	if (topic == NULL) {
+		topic = "";
 	}
-
-	char *md5_file_name = (char *) malloc(
-	    strlen(filename) + strlen("_") + strlen(topic) + strlen("_") + strlen(md5_buffer) + 2);
+	md5_file_name = (char *) malloc(strlen(conf->dir) +
+	    strlen(conf->file_name_prefix) + strlen(topic) +
+	    strlen(md5_buffer) + UINT64_MAX_DIGITS + UINT64_MAX_DIGITS + 16);
 	if (md5_file_name == NULL) {
 		log_error("Failed to allocate memory for file name.");
 		ret = remove(filename);
@@ -428,17 +946,9 @@ compute_and_rename_file_withMD5(char *filename, conf_parquet *conf, char *topic)
 		return NULL;
 	}
 
-	strncpy(md5_file_name, filename,
-	    strlen(conf->dir) + strlen(conf->file_name_prefix) + 1);
-	md5_file_name[strlen(conf->dir) + strlen(conf->file_name_prefix) + 1] =
-	    '\0';
-
-	strcat(md5_file_name, "_");
-	strcat(md5_file_name, topic);
-	strcat(md5_file_name, "_");
-	strcat(md5_file_name, md5_buffer);
-	strcat(md5_file_name,
-	    filename + strlen(conf->dir) + strlen(conf->file_name_prefix) + 1);
+	sprintf(md5_file_name,
+	    "%s/%s_%s_%s-%" PRIu64 "~%" PRIu64 ".parquet", conf->dir,
+	    conf->file_name_prefix, topic, md5_buffer, range[0], range[1]);
 	log_info("trying to rename... %s to %s", filename, md5_file_name);
 	ret = rename(filename, md5_file_name);
 	if (ret != 0) {
@@ -459,46 +969,80 @@ compute_and_rename_file_withMD5(char *filename, conf_parquet *conf, char *topic)
 	return md5_file_name;
 }
 
+static void
+parquet_catalog_add(const char *path, uint64_t key_start, uint64_t key_end,
+    const char *topic, const char *md5, uint64_t size)
+{
+	file_catalog_entry ent;
+
+	ent.start_key = key_start;
+	ent.end_key   = key_end;
+	ent.topic     = topic;
+	ent.path      = path;
+	ent.md5       = md5;
+	ent.size      = size;
+	if (file_catalog_add(parquet_catalog, &ent) != 0) {
+		log_error("Failed to add %s to catalog", path);
+	}
+}
+
+// Rename a finished file with its md5 and hand it to the readers.
+static int
+parquet_file_publish(conf_parquet *conf, char *filename, uint64_t range[2],
+    char *topic, const char *md5, uint64_t size)
+{
+	char *md5_file_name =
+	    rename_file_withMD5(filename, conf, topic, md5, range);
+	if (md5_file_name == nullptr) {
+		return -1;
+	}
+
+	log_debug("wait for parquet_queue_mutex");
+	pthread_mutex_lock(&parquet_queue_mutex);
+	if (file_catalog_contains(parquet_catalog, md5_file_name)) {
+		// same content written again, rename replaced the file
+		pthread_mutex_unlock(&parquet_queue_mutex);
+		free(md5_file_name);
+		return 0;
+	}
+	ENQUEUE(parquet_file_queue, md5_file_name);
+	parquet_catalog_add(
+	    md5_file_name, range[0], range[1], topic, md5, size);
+
+	if (QUEUE_SIZE(parquet_file_queue) > conf->file_count) {
+		remove_old_file();
+	}
+
+	pthread_mutex_unlock(&parquet_queue_mutex);
+	return 0;
+}
+
 int
-parquet_write(
-    conf_parquet *conf, shared_ptr<GroupNode> schema, parquet_object *elem)
+parquet_write(conf_parquet *conf, uint32_t writer,
+    shared_ptr<GroupNode> schema, parquet_object *elem)
 {
 	uint32_t old_index      = 0;
 	uint32_t new_index      = 0;
 	char    *last_file_name = NULL;
+	uint64_t last_range[2]  = { 0 };
+	uint64_t last_size      = 0;
+	char     last_md5[MD5_STR_LEN + 1];
 again:
 
 	if (last_file_name != NULL) {
-		char *md5_file_name =
-		    compute_and_rename_file_withMD5(last_file_name, conf, elem->topic);
-		if (md5_file_name == nullptr) {
+		if (parquet_file_publish(conf, last_file_name, last_range,
+		        elem->topic, last_md5, last_size) != 0) {
 			log_error("Failed to rename file with md5");
 			parquet_object_free(elem);
 			return -1;
 		}
-
-		char md5_buffer[MD5_LEN + 1];
-		log_debug("compute md5 after rename");
-		int ret = ComputeFileMD5(md5_file_name, md5_buffer);
-		if (ret != 0) {
-			log_error("Failed to calculate md5sum");
-		}
-		log_debug("wait for parquet_queue_mutex");
-		pthread_mutex_lock(&parquet_queue_mutex);
-		ENQUEUE(parquet_file_queue, md5_file_name);
-
-		if (QUEUE_SIZE(parquet_file_queue) > conf->file_count) {
-			remove_old_file();
-		}
-
-		pthread_mutex_unlock(&parquet_queue_mutex);
 		last_file_name = NULL;
 	}
 	log_debug("parquet_write");
 	new_index = compute_new_index(elem, old_index, conf->file_size);
 	uint64_t key_start = elem->keys[old_index];
 	uint64_t key_end   = elem->keys[new_index];
-	char    *filename  = get_file_name(conf, key_start, key_end);
+	char    *filename  = get_file_name(conf, writer, key_start, key_end);
 	if (filename == NULL) {
 		parquet_object_free(elem);
 		log_error("Failed to get file name");
@@ -510,92 +1054,43 @@ again:
 		    parquet_file_range_alloc(old_index, new_index, filename);
 		update_parquet_file_ranges(conf, elem, range);
 
-		// Create a ParquetFileWriter instance
-		parquet::WriterProperties::Builder builder;
-		log_debug("init builder");
-		builder.created_by("NanoMQ")
-		    ->version(parquet::ParquetVersion::PARQUET_2_6)
-		    ->data_page_version(parquet::ParquetDataPageVersion::V2)
-		    ->compression(static_cast<arrow::Compression::type>(
-		        conf->comp_type));
-		log_debug("check encry");
-		if (conf->encryption.enable) {
-			shared_ptr<parquet::FileEncryptionProperties>
-			    encryption_configurations;
-			encryption_configurations =
-			    parquet_set_encryption(conf);
-			builder.encryption(encryption_configurations);
-		}
-
-		shared_ptr<parquet::WriterProperties> props = builder.build();
+		shared_ptr<parquet::WriterProperties> props =
+		    parquet_writer_properties(conf);
+		parquet_decoded decoded(elem, old_index, new_index);
 		using FileClass = arrow::io::FileOutputStream;
 		shared_ptr<FileClass> out_file;
 		PARQUET_ASSIGN_OR_THROW(out_file, FileClass::Open(filename));
+		auto md5_out = std::make_shared<md5_output_stream>(out_file);
 		std::shared_ptr<parquet::ParquetFileWriter> file_writer =
-		    parquet::ParquetFileWriter::Open(out_file, schema, props);
+		    parquet::ParquetFileWriter::Open(
+		        md5_out, decoded.schema(schema), props);
 
-		// Append a RowGroup with a specific number of rows.
-		parquet::RowGroupWriter *rg_writer =
-		    file_writer->AppendRowGroup();
+		log_debug("start doing batch write");
+		parquet_write_rows(conf, file_writer.get(), elem, old_index,
+		    new_index, decoded);
+		file_writer->Close();
+		// parquet writer leaves the sink open
+		PARQUET_THROW_NOT_OK(md5_out->Close());
+		log_debug("stop doing batch write");
 
-		// Write the Int64 column
-		log_debug("start doing int64 write");
-		parquet::Int64Writer *int64_writer =
-		    static_cast<parquet::Int64Writer *>(
-		        rg_writer->NextColumn());
-		for (uint32_t i = old_index; i <= new_index; i++) {
-			int64_t value            = elem->keys[i];
-			int16_t definition_level = 1;
-			int64_writer->WriteBatch(
-			    1, &definition_level, nullptr, &value);
-		}
-		log_debug("stop doing int64 write");
-
-		// Write the ByteArray column. Make every alternate values NULL
-		parquet::ByteArrayWriter *ba_writer =
-		    static_cast<parquet::ByteArrayWriter *>(
-		        rg_writer->NextColumn());
-		for (uint32_t i = old_index; i <= new_index; i++) {
-			parquet::ByteArray value;
-			int16_t            definition_level = 1;
-			value.ptr                           = elem->darray[i];
-			value.len                           = elem->dsize[i];
-			ba_writer->WriteBatch(
-			    1, &definition_level, nullptr, &value);
-		}
-		log_debug("stop doing ByteArray write");
-
-		old_index = new_index;
+		old_index = new_index;
 
 		last_file_name = filename;
+		last_range[0]  = key_start;
+		last_range[1]  = key_end;
+		last_size      = md5_out->size();
+		strcpy(last_md5, md5_out->md5());
 
 		if (new_index != elem->size - 1)
 			goto again;
 	}
 	if (last_file_name != NULL) {
-		char *md5_file_name =
-		    compute_and_rename_file_withMD5(last_file_name, conf, elem->topic);
-		if (md5_file_name == nullptr) {
+		if (parquet_file_publish(conf, last_file_name, last_range,
+		        elem->topic, last_md5, last_size) != 0) {
 			parquet_object_free(elem);
 			log_error("fail to get md5 from parquet file");
 			return -1;
 		}
-
-		char md5_buffer[MD5_LEN + 1];
-		log_debug("compute md5 after rename");
-		int ret = ComputeFileMD5(md5_file_name, md5_buffer);
-		if (ret != 0) {
-			log_error("Failed to calculate md5sum");
-		}
-		log_debug("wait for parquet_queue_mutex");
-		pthread_mutex_lock(&parquet_queue_mutex);
-		ENQUEUE(parquet_file_queue, md5_file_name);
-
-		if (QUEUE_SIZE(parquet_file_queue) > conf->file_count) {
-			remove_old_file();
-		}
-
-		pthread_mutex_unlock(&parquet_queue_mutex);
 		last_file_name = NULL;
 	}
 
@@ -605,40 +1100,34 @@ again:
 }
 
 void *
-parquet_write_loop_v2(void *config)
+parquet_write_loop_v2(void *arg)
 {
-	if (config == NULL) {
-		log_error("parquet conf is NULL");
-	}
-
-	conf_parquet *conf = (conf_parquet *) config;
-	if (!directory_exists(conf->dir)) {
-		if (!create_directory(conf->dir)) {
-			log_error("Failed to create directory %s", conf->dir);
-			return NULL;
-		}
-	}
+	parquet_writer *w    = (parquet_writer *) arg;
+	conf_parquet   *conf = g_conf;
 
 	shared_ptr<GroupNode> schema = setup_schema();
 
 	while (true) {
 		// wait for mqtt messages to send method request
-		pthread_mutex_lock(&parquet_queue_mutex);
+		pthread_mutex_lock(&w->mtx);
 
-		while (IS_EMPTY(parquet_queue)) {
-			pthread_cond_wait(
-			    &parquet_queue_not_empty, &parquet_queue_mutex);
+		while (IS_EMPTY(w->queue) && !w->stop) {
+			pthread_cond_wait(&w->not_empty, &w->mtx);
+		}
+		if (IS_EMPTY(w->queue)) {
+			pthread_mutex_unlock(&w->mtx);
+			break;
 		}
 
-		log_debug("fetch element from parquet queue");
-		parquet_object *ele =
-		    (parquet_object *) DEQUEUE(parquet_queue);
+		log_debug("fetch element from parquet writer %u", w->id);
+		parquet_object *ele = (parquet_object *) DEQUEUE(w->queue);
+		pthread_cond_broadcast(&w->not_full);
 
-		pthread_mutex_unlock(&parquet_queue_mutex);
+		pthread_mutex_unlock(&w->mtx);
 
 		switch (ele->type) {
 		case WRITE_TO_NORMAL:
-			parquet_write(conf, schema, ele);
+			parquet_write(conf, w->id, schema, ele);
 			break;
 		case WRITE_TO_TEMP:
 			parquet_write_tmp(conf, schema, ele);
@@ -650,6 +1139,34 @@ parquet_write_loop_v2(void *config)
 	return NULL;
 }
 
+// {dir}/{prefix}_{topic}_{md5}-{start_key}~{end_key}.parquet, names are
+// only parsed for the files left by the last run.
+static void
+parquet_catalog_load(conf_parquet *conf, const char *path)
+{
+	uint64_t    range[2] = { 0 };
+	size_t      plen     = strlen(conf->file_name_prefix);
+	const char *name     = path + strlen(conf->dir) + 1;
+	const char *dash     = strrchr(name, '-');
+	string      topic;
+	string      md5;
+
+	if (dash == NULL ||
+	    sscanf(dash, "-%" SCNu64 "~%" SCNu64, &range[0], &range[1]) !=
+	        2) {
+		log_warn("Unknown parquet file name %s", path);
+		return;
+	}
+	if ((size_t) (dash - name) >= plen + MD5_LEN + 2 &&
+	    name[plen] == '_' && dash[-MD5_LEN - 1] == '_') {
+		topic.assign(name + plen + 1, dash - MD5_LEN - 1);
+		md5.assign(dash - MD5_LEN, MD5_LEN);
+	}
+	struct stat st;
+	parquet_catalog_add(path, range[0], range[1], topic.c_str(),
+	    md5.c_str(), stat(path, &st) == 0 ? st.st_size : 0);
+}
+
 static void
 parquet_file_queue_init(conf_parquet *conf)
 {
@@ -697,6 +1214,7 @@ parquet_file_queue_init(conf_parquet *conf)
 					}
 				}
 				ENQUEUE(parquet_file_queue, file_path);
+				parquet_catalog_load(conf, file_path);
 			}
 		}
 		int load_num =
@@ -712,49 +1230,119 @@ parquet_file_queue_init(conf_parquet *conf)
 	}
 }
 
+static void *parquet_compact_loop(void *arg);
+
 int
 parquet_write_launcher(conf_parquet *conf)
 {
+	if (parquet_writers != NULL) {
+		log_warn("parquet is launched already");
+		return 0;
+	}
 	// Using a global variable g_conf temporarily, because it is
 	// inconvenient to access conf in exchange.
 	g_conf = conf;
-	INIT_QUEUE(parquet_queue);
-	parquet_file_queue_init(conf);
-	is_available = true;
-	pthread_t write_thread;
-	int result = 0;
-	result = pthread_create(&write_thread, NULL, parquet_write_loop_v2, conf);
-	if (result != 0) {
-		log_error("Failed to create parquet write thread.");
+	if (parquet_catalog == NULL &&
+	    file_catalog_create(&parquet_catalog) != 0) {
+		log_error("Failed to create parquet file catalog.");
 		return -1;
 	}
+	if (!directory_exists(conf->dir)) {
+		if (!create_directory(conf->dir)) {
+			log_error("Failed to create directory %s", conf->dir);
+			return -1;
+		}
+	}
+	parquet_columns.clear();
+	if (conf->columns != NULL && parquet_columns_parse(conf->columns) != 0) {
+		return -1;
+	}
+	parquet_file_queue_init(conf);
 
-	return 0;
-}
+	uint32_t count = conf->write_threads > 0 ? conf->write_threads : 1;
+	parquet_writers = new parquet_writer[count];
+	for (uint32_t i = 0; i < count; i++) {
+		parquet_writer *w = &parquet_writers[i];
+		w->id             = i;
+		w->running        = false;
+		w->stop           = false;
+		INIT_QUEUE(w->queue);
+		pthread_mutex_init(&w->mtx, NULL);
+		pthread_cond_init(&w->not_empty, NULL);
+		pthread_cond_init(&w->not_full, NULL);
+	}
+	parquet_writer_count = count;
+	is_available         = true;
+	for (uint32_t i = 0; i < count; i++) {
+		int result = pthread_create(&parquet_writers[i].thread, NULL,
+		    parquet_write_loop_v2, &parquet_writers[i]);
+		if (result != 0) {
+			log_error("Failed to create parquet write thread.");
+			parquet_write_stop();
+			return -1;
+		}
+		parquet_writers[i].running = true;
+	}
+	log_info("parquet launched %u write threads", count);
+
+	if (conf->compact || conf->retention_size > 0 ||
+	    conf->retention_age > 0) {
+		parquet_compact_stop = false;
+		if (pthread_create(&parquet_compact_thread, NULL,
+		        parquet_compact_loop, conf) != 0) {
+			log_error("Failed to create parquet compact thread.");
+			parquet_write_stop();
+			return -1;
+		}
+		parquet_compact_running = true;
+	}
 
-static void
-get_range(const char *name, uint64_t range[2])
-{
-	//{prefix}_{md5}-{start_key}~{end_key}.parquet
-	const char *start = strrchr(name, '-');
-	sscanf(start, "-%ld~%ld.parquet", &range[0], &range[1]);
-	return;
+	return 0;
 }
 
-static bool
-compare_callback(void *name, uint64_t key)
+void
+parquet_write_stop(void)
 {
-	uint64_t range[2] = { 0 };
-	get_range((const char *) name, range);
-	return (key >= range[0] && key <= range[1]);
-}
+	if (parquet_writers == NULL) {
+		return;
+	}
+	if (parquet_compact_running) {
+		pthread_mutex_lock(&parquet_compact_mtx);
+		parquet_compact_stop = true;
+		pthread_cond_signal(&parquet_compact_cv);
+		pthread_mutex_unlock(&parquet_compact_mtx);
+		pthread_join(parquet_compact_thread, NULL);
+		parquet_compact_running = false;
+	}
+	for (uint32_t i = 0; i < parquet_writer_count; i++) {
+		parquet_writer *w = &parquet_writers[i];
+		pthread_mutex_lock(&w->mtx);
+		w->stop = true;
+		pthread_cond_broadcast(&w->not_empty);
+		pthread_cond_broadcast(&w->not_full);
+		pthread_mutex_unlock(&w->mtx);
+		if (w->running) {
+			pthread_join(w->thread, NULL);
+		}
+		DESTROY_QUEUE(w->queue);
+		pthread_mutex_destroy(&w->mtx);
+		pthread_cond_destroy(&w->not_empty);
+		pthread_cond_destroy(&w->not_full);
+	}
+	is_available = false;
+	delete[] parquet_writers;
+	parquet_writers      = NULL;
+	parquet_writer_count = 0;
 
-static bool
-compare_callback_span(void *name, uint64_t low, uint64_t high)
-{
-	uint64_t range[2] = { 0 };
-	get_range((const char *) name, range);
-	return !(low > range[1] || high < range[0]);
+	pthread_mutex_lock(&parquet_queue_mutex);
+	while (!IS_EMPTY(parquet_file_queue)) {
+		free(DEQUEUE(parquet_file_queue));
+	}
+	DESTROY_QUEUE(parquet_file_queue);
+	pthread_mutex_unlock(&parquet_queue_mutex);
+	file_catalog_destroy(parquet_catalog);
+	parquet_catalog = NULL;
+	g_conf          = NULL;
 }
 
 const char *
@@ -764,19 +1352,7 @@ parquet_find(uint64_t key)
 		log_error("Parquet is not ready or not launch!");
 		return NULL;
 	}
-	WAIT_FOR_AVAILABLE
-	const char *value = NULL;
-	void       *elem  = NULL;
-	pthread_mutex_lock(&parquet_queue_mutex);
-	FOREACH_QUEUE(parquet_file_queue, elem)
-	{
-		if (elem && compare_callback(elem, key)) {
-			value = nng_strdup((char *) elem);
-			break;
-		}
-	}
-	pthread_mutex_unlock(&parquet_queue_mutex);
-	return value;
+	return file_catalog_find(parquet_catalog, key, NULL);
 }
 
 const char **
@@ -792,37 +1368,8 @@ parquet_find_span(uint64_t start_key, uint64_t end_key, uint32_t *size)
 		return NULL;
 	}
 
-	WAIT_FOR_AVAILABLE
-
-	uint64_t     low        = start_key;
-	uint64_t     high       = end_key;
-	uint32_t     local_size = 0;
-	const char  *value      = NULL;
-	const char **array      = NULL;
-	const char **ret        = NULL;
-	void        *elem       = NULL;
-
-	pthread_mutex_lock(&parquet_queue_mutex);
-	if (parquet_file_queue.size != 0) {
-		array = (const char **) nng_alloc(
-		    sizeof(char *) * parquet_file_queue.size);
-
-		ret = array;
-		FOREACH_QUEUE(parquet_file_queue, elem)
-		{
-			if (elem) {
-				if (compare_callback_span(elem, low, high)) {
-					++local_size;
-					value    = nng_strdup((char *) elem);
-					*array++ = value;
-				}
-			}
-		}
-	}
-
-	pthread_mutex_unlock(&parquet_queue_mutex);
-	(*size) = local_size;
-	return ret;
+	return (const char **) file_catalog_find_span(
+	    parquet_catalog, start_key, end_key, NULL, size);
 }
 
 void
@@ -851,283 +1398,353 @@ parquet_read_set_property(
 	return;
 }
 
-static uint8_t *
-parquet_read(conf_parquet *conf, char *filename, uint64_t key, uint32_t *len)
+// Open readers are kept in a small LRU, so queries hitting the same file
+// skip the open and the footer decode. A reader is not thread safe, the
+// entry lock is held while reading through it.
+#define PARQUET_READER_CACHE_SIZE 8
+
+struct parquet_reader_entry {
+	std::mutex                                  mtx;
+	std::unique_ptr<parquet::ParquetFileReader> reader;
+	std::shared_ptr<parquet::FileMetaData>      metadata;
+};
+
+typedef std::list<
+    std::pair<std::string, std::shared_ptr<parquet_reader_entry>>>
+    parquet_reader_list;
+
+static std::mutex          reader_cache_mtx;
+static parquet_reader_list reader_cache;
+static std::unordered_map<std::string, parquet_reader_list::iterator>
+    reader_cache_map;
+
+// May throw if the file can not be opened.
+static shared_ptr<parquet_reader_entry>
+parquet_reader_get(conf_parquet *conf, const char *filename)
 {
-	conf                                 = g_conf;
-	std::string               path_int64 = "key";
-	std::string               path_str   = "data";
+	std::string name(filename);
+	{
+		std::lock_guard<std::mutex> lk(reader_cache_mtx);
+		auto it = reader_cache_map.find(name);
+		if (it != reader_cache_map.end()) {
+			reader_cache.splice(
+			    reader_cache.begin(), reader_cache, it->second);
+			return it->second->second;
+		}
+	}
+
 	parquet::ReaderProperties reader_properties =
 	    parquet::default_reader_properties();
-
 	parquet_read_set_property(reader_properties, conf);
 
-	// Create a ParquetReader instance
-	std::string exception_msg = "";
-	try {
-		std::unique_ptr<parquet::ParquetFileReader> parquet_reader =
-		    parquet::ParquetFileReader::OpenFile(
-		        filename, false, reader_properties);
-
-		// Get the File MetaData
-		std::shared_ptr<parquet::FileMetaData> file_metadata =
-		    parquet_reader->metadata();
-
-		int num_row_groups =
-		    file_metadata
-		        ->num_row_groups(); // Get the number of RowGroups
-		int num_columns =
-		    file_metadata->num_columns(); // Get the number of Columns
-		assert(num_columns == 2);
+	auto entry    = std::make_shared<parquet_reader_entry>();
+	entry->reader = parquet::ParquetFileReader::OpenFile(
+	    filename, false, reader_properties);
+	entry->metadata = entry->reader->metadata();
+	// key and data, then decoded columns if any
+	assert(entry->metadata->num_columns() >= 2);
+
+	std::lock_guard<std::mutex> lk(reader_cache_mtx);
+	auto it = reader_cache_map.find(name);
+	if (it != reader_cache_map.end()) {
+		// opened by someone else meanwhile
+		return it->second->second;
+	}
+	reader_cache.emplace_front(name, entry);
+	reader_cache_map[name] = reader_cache.begin();
+	if (reader_cache.size() > PARQUET_READER_CACHE_SIZE) {
+		reader_cache_map.erase(reader_cache.back().first);
+		reader_cache.pop_back();
+	}
+	return entry;
+}
 
-		for (int r = 0; r < num_row_groups; ++r) {
+static void
+parquet_reader_evict(const char *filename)
+{
+	std::lock_guard<std::mutex> lk(reader_cache_mtx);
+	auto it = reader_cache_map.find(filename);
+	if (it != reader_cache_map.end()) {
+		reader_cache.erase(it->second);
+		reader_cache_map.erase(it);
+	}
+}
 
-			std::shared_ptr<parquet::RowGroupReader>
-			    row_group_reader = parquet_reader->RowGroup(
-			        r); // Get the RowGroup Reader
-			int64_t values_read = 0;
-			int64_t rows_read   = 0;
-			int16_t definition_level;
-			int16_t repetition_level;
-			std::shared_ptr<parquet::ColumnReader> column_reader;
-
-			// Get the Column Reader for the Int64 column
-			column_reader = row_group_reader->Column(0);
-			parquet::Int64Reader *int64_reader =
-			    static_cast<parquet::Int64Reader *>(
-			        column_reader.get());
-
-			int i = 0;
-			while (int64_reader->HasNext()) {
-				int64_t value;
-				rows_read = int64_reader->ReadBatch(1,
-				    &definition_level, &repetition_level,
-				    &value, &values_read);
-				if (1 == rows_read && 1 == values_read) {
-					if (((uint64_t) value) == key)
-						break;
-				}
-				i++;
-			}
+static parquet_data_packet *
+parquet_data_packet_alloc(const uint8_t *data, uint32_t size)
+{
+	parquet_data_packet *pack =
+	    (parquet_data_packet *) malloc(sizeof(parquet_data_packet));
+	if (pack == NULL) {
+		return NULL;
+	}
+	pack->data = (uint8_t *) malloc(size);
+	if (pack->data == NULL && size != 0) {
+		free(pack);
+		return NULL;
+	}
+	memcpy(pack->data, data, size);
+	pack->size = size;
+	return pack;
+}
 
-			// Get the Column Reader for the ByteArray column
-			column_reader = row_group_reader->Column(1);
-			parquet::ByteArrayReader *ba_reader =
-			    static_cast<parquet::ByteArrayReader *>(
-			        column_reader.get());
+// Decode the keys of row group r which may be in [lo, hi], they are the
+// keys of rows [*first, *first + keys.size()). Row group statistics prune
+// the whole group, the page index (if written) narrows the decoded rows to
+// the pages overlapping the range. Returns false if nothing is in range.
+// Called with entry lock held.
+static bool
+parquet_read_keys(parquet_reader_entry *entry, int r, uint64_t lo,
+    uint64_t hi, int64_t *first, vector<uint64_t> &keys)
+{
+	auto    rg_meta = entry->metadata->RowGroup(r);
+	auto    chunk   = rg_meta->ColumnChunk(0);
+	int64_t begin   = 0;
+	int64_t end     = rg_meta->num_rows();
+
+	// Keys are UINT_64, min and max are in unsigned order
+	if (chunk->is_stats_set()) {
+		auto stats = static_pointer_cast<parquet::Int64Statistics>(
+		    chunk->statistics());
+		if (stats->HasMinMax() &&
+		    (hi < (uint64_t) stats->min() ||
+		        lo > (uint64_t) stats->max())) {
+			return false;
+		}
+	}
 
-			if (ba_reader->HasNext()) {
-				ba_reader->Skip(i);
+#if ARROW_VERSION_MAJOR >= 12
+	auto pi_reader = entry->reader->GetPageIndexReader();
+	auto rg_pi     = pi_reader ? pi_reader->RowGroup(r) : nullptr;
+	auto ci        = rg_pi ? rg_pi->GetColumnIndex(0) : nullptr;
+	auto oi        = rg_pi ? rg_pi->GetOffsetIndex(0) : nullptr;
+	if (ci != nullptr && oi != nullptr) {
+		auto idx = static_pointer_cast<parquet::Int64ColumnIndex>(ci);
+		const auto &pages      = oi->page_locations();
+		int64_t     page_begin = -1;
+		int64_t     page_end   = end;
+		for (size_t p = 0; p < pages.size(); p++) {
+			if (idx->null_pages()[p] ||
+			    hi < (uint64_t) idx->min_values()[p] ||
+			    lo > (uint64_t) idx->max_values()[p]) {
+				continue;
 			}
-
-			if (ba_reader->HasNext()) {
-				parquet::ByteArray value;
-				rows_read =
-				    ba_reader->ReadBatch(1, &definition_level,
-				        nullptr, &value, &values_read);
-				if (1 == rows_read && 1 == values_read) {
-					uint8_t *ret = (uint8_t *) malloc(
-					    value.len * sizeof(uint8_t));
-					memcpy(ret, value.ptr, value.len);
-					*len = value.len;
-					return ret;
-				}
+			if (page_begin < 0) {
+				page_begin = pages[p].first_row_index;
 			}
+			page_end = p + 1 < pages.size()
+			    ? pages[p + 1].first_row_index
+			    : end;
 		}
-
-	} catch (const std::exception &e) {
-		exception_msg = e.what();
-		log_error("exception_msg=[%s]", exception_msg.c_str());
+		if (page_begin < 0) {
+			return false;
+		}
+		begin = page_begin;
+		end   = page_end;
 	}
+#endif
 
-	return NULL;
-}
+	auto column_reader = entry->reader->RowGroup(r)->Column(0);
+	auto int64_reader =
+	    static_cast<parquet::Int64Reader *>(column_reader.get());
+	if (begin > 0 && int64_reader->Skip(begin) != begin) {
+		return false;
+	}
 
-static vector<int>
-get_keys_indexes(
-    parquet::Int64Reader *int64_reader, const vector<uint64_t> &keys)
-{
-	vector<int> index_vector;
-	int64_t     values_read = 0;
-	int64_t     rows_read   = 0;
-	int16_t     definition_level;
-	int16_t     repetition_level;
-
-	int  index     = 0;
-	for (const auto &key : keys) {
-		bool found = false;
-		while (int64_reader->HasNext()) {
-			int64_t value;
-			rows_read =
-			    int64_reader->ReadBatch(1, &definition_level,
-			        &repetition_level, &value, &values_read);
-			if (1 == rows_read && 1 == values_read) {
-				if (((uint64_t) value) == key) {
-					index_vector.push_back(index++);
-					found = true;
-					break;
-				}
-			}
-			index++;
-		}
-		if (!found) {
-			index_vector.push_back(-1);
+	vector<int16_t> def_levels(end - begin);
+	keys.resize(end - begin);
+	int64_t got = 0;
+	while (got < end - begin && int64_reader->HasNext()) {
+		int64_t values_read = 0;
+		int64_t rows_read   = int64_reader->ReadBatch(end - begin - got,
+		      def_levels.data() + got, nullptr,
+		      (int64_t *) keys.data() + got, &values_read);
+		if (rows_read != values_read) {
+			log_error("null key in row group %d", r);
+			return false;
 		}
+		got += rows_read;
 	}
-
-	return index_vector;
+	keys.resize(got);
+	*first = begin;
+	return got > 0;
 }
 
-static vector<int>
-get_keys_indexes_fuzing(
-    parquet::Int64Reader *int64_reader, uint64_t start_key, uint64_t end_key)
+// Copy the data of the rows (sorted and unique) of a row group into packs,
+// a run of consecutive rows is decoded in one batch. Rows not read are
+// left NULL. Called with entry lock held.
+static void
+parquet_read_datas(parquet_reader_entry *entry, int r,
+    const vector<int64_t> &rows, parquet_data_packet **packs)
 {
-	vector<int> index_vector;
-	int64_t     values_read = 0;
-	int64_t     rows_read   = 0;
-	int16_t     definition_level;
-	int16_t     repetition_level;
-
-	int  index = 0;
-	bool found = false;
-
-	while (int64_reader->HasNext()) {
-		int64_t value;
-		rows_read = int64_reader->ReadBatch(1, &definition_level,
-		    &repetition_level, &value, &values_read);
-		if (1 == rows_read && 1 == values_read) {
-			if (((uint64_t) value) >= start_key) {
-				index_vector.push_back(index++);
-				found = true;
-				break;
-			}
-			index++;
+	auto column_reader = entry->reader->RowGroup(r)->Column(1);
+	auto ba_reader =
+	    static_cast<parquet::ByteArrayReader *>(column_reader.get());
+	vector<parquet::ByteArray> values;
+	vector<int16_t>            def_levels;
+	int64_t                    pos = 0;
+
+	for (size_t i = 0; i < rows.size();) {
+		size_t run = 1;
+		while (i + run < rows.size() &&
+		    rows[i + run] == rows[i] + (int64_t) run) {
+			run++;
 		}
-	}
-	if (!found) {
-		index_vector.push_back(-1);
-		index_vector.push_back(-1);
-	} else {
-		found = false;
-		while (int64_reader->HasNext()) {
-			int64_t value;
-			rows_read =
-			    int64_reader->ReadBatch(1, &definition_level,
-			        &repetition_level, &value, &values_read);
-			if (1 == rows_read && 1 == values_read) {
-				if (((uint64_t) value) > end_key) {
-					index_vector.push_back(index - 1);
-					found = true;
-					break;
-				} else if (((uint64_t) value) == end_key) {
-					index_vector.push_back(index);
-					found = true;
-					break;
-				}
-				index++;
+		if (rows[i] > pos) {
+			pos += ba_reader->Skip(rows[i] - pos);
+		}
+		if (pos != rows[i]) {
+			return;
+		}
+		values.resize(run);
+		def_levels.resize(run);
+		size_t got = 0;
+		while (got < run && ba_reader->HasNext()) {
+			int64_t values_read = 0;
+			int64_t rows_read   = ba_reader->ReadBatch(run - got,
+			      def_levels.data(), nullptr, values.data(),
+			      &values_read);
+			if (rows_read != values_read) {
+				log_error("null data in row group %d", r);
+				return;
 			}
+			for (int64_t k = 0; k < rows_read; k++) {
+				packs[i + got + k] = parquet_data_packet_alloc(
+				    values[k].ptr, values[k].len);
+			}
+			got += rows_read;
+			pos += rows_read;
 		}
-
-		if (!found) {
-			index_vector.push_back(index - 1);
+		if (got < run) {
+			return;
 		}
+		i += run;
 	}
+}
 
-	return index_vector;
+// Index of key in keys, -1 if not found. Keys are written in order, binary
+// search is used unless the writer was fed out of order keys.
+static int64_t
+parquet_key_index(const vector<uint64_t> &keys, bool sorted, uint64_t key)
+{
+	vector<uint64_t>::const_iterator it;
+	if (sorted) {
+		it = std::lower_bound(keys.begin(), keys.end(), key);
+	} else {
+		it = std::find(keys.begin(), keys.end(), key);
+	}
+	if (it == keys.end() || *it != key) {
+		return -1;
+	}
+	return it - keys.begin();
 }
 
-static vector<parquet_data_packet *>
-parquet_read(conf_parquet *conf, char *filename, vector<uint64_t> keys)
+// Look up keys in a file, packs[i] is set to the data of keys[i] or NULL.
+static void
+parquet_read_packets(const char *filename, const vector<uint64_t> &keys,
+    vector<parquet_data_packet *> &packs)
 {
-	conf = g_conf;
-	vector<parquet_data_packet *> ret_vec;
-	std::string                   path_int64 = "key";
-	std::string                   path_str   = "data";
-	parquet::ReaderProperties     reader_properties =
-	    parquet::default_reader_properties();
+	packs.assign(keys.size(), NULL);
+	if (keys.empty()) {
+		return;
+	}
 
-	parquet_read_set_property(reader_properties, conf);
-	vector<int> index_vector(keys.size());
+	// requests in key order, so each row group is decoded once for the
+	// range of keys still pending
+	vector<size_t> pending(keys.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		pending[i] = i;
+	}
+	std::stable_sort(pending.begin(), pending.end(),
+	    [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
 
-	// Create a ParquetReader instance
-	std::string exception_msg = "";
 	try {
-		std::unique_ptr<parquet::ParquetFileReader> parquet_reader =
-		    parquet::ParquetFileReader::OpenFile(
-		        filename, false, reader_properties);
-
-		// Get the File MetaData
-		std::shared_ptr<parquet::FileMetaData> file_metadata =
-		    parquet_reader->metadata();
-
-		int num_row_groups =
-		    file_metadata
-		        ->num_row_groups(); // Get the number of RowGroups
-		int num_columns =
-		    file_metadata->num_columns(); // Get the number of Columns
-		assert(num_columns == 2);
-
-		for (int r = 0; r < num_row_groups; ++r) {
-
-			std::shared_ptr<parquet::RowGroupReader>
-			    row_group_reader = parquet_reader->RowGroup(
-			        r); // Get the RowGroup Reader
-			int64_t values_read = 0;
-			int64_t rows_read   = 0;
-			int16_t definition_level;
-			std::shared_ptr<parquet::ColumnReader> column_reader;
-
-			column_reader = row_group_reader->Column(0);
-			parquet::Int64Reader *int64_reader =
-			    static_cast<parquet::Int64Reader *>(
-			        column_reader.get());
-
-			index_vector = get_keys_indexes(int64_reader, keys);
-			// Get the Column Reader for the ByteArray column
-			column_reader = row_group_reader->Column(1);
-			parquet::ByteArrayReader *ba_reader =
-			    static_cast<parquet::ByteArrayReader *>(
-			        column_reader.get());
-
-			for (const auto &index : index_vector) {
-				if (-1 == index) {
-					ret_vec.push_back(NULL);
-					continue;
+		auto entry = parquet_reader_get(g_conf, filename);
+		std::lock_guard<std::mutex> lk(entry->mtx);
+		int num_row_groups = entry->metadata->num_row_groups();
+
+		for (int r = 0; r < num_row_groups && !pending.empty(); ++r) {
+			vector<uint64_t> rg_keys;
+			int64_t          first = 0;
+			if (!parquet_read_keys(entry.get(), r,
+			        keys[pending.front()], keys[pending.back()],
+			        &first, rg_keys)) {
+				continue;
+			}
+			bool sorted =
+			    std::is_sorted(rg_keys.begin(), rg_keys.end());
+
+			// (row, request) of the keys found in this group
+			vector<pair<int64_t, size_t>> hits;
+			vector<size_t>                missed;
+			for (size_t i : pending) {
+				int64_t idx =
+				    parquet_key_index(rg_keys, sorted, keys[i]);
+				if (idx < 0) {
+					missed.push_back(i);
+				} else {
+					hits.emplace_back(first + idx, i);
 				}
+			}
+			if (hits.empty()) {
+				continue;
+			}
+			pending.swap(missed);
+			std::sort(hits.begin(), hits.end());
 
-				if (ba_reader->HasNext()) {
-					ba_reader->Skip(index - 1);
+			vector<int64_t> rows;
+			for (const auto &hit : hits) {
+				if (rows.empty() || rows.back() != hit.first) {
+					rows.push_back(hit.first);
 				}
-
-				if (ba_reader->HasNext()) {
-					parquet::ByteArray value;
-					rows_read = ba_reader->ReadBatch(1,
-					    &definition_level, nullptr, &value,
-					    &values_read);
-					if (1 == rows_read &&
-					    1 == values_read) {
-						parquet_data_packet *pack =
-						    (parquet_data_packet *)
-						        malloc(sizeof(
-						            parquet_data_packet));
-						pack->data =
-						    (uint8_t *) malloc(
-						        value.len *
-						        sizeof(uint8_t));
-						memcpy(pack->data, value.ptr,
-						    value.len);
-						pack->size = value.len;
-						ret_vec.push_back(pack);
-					}
+			}
+			vector<parquet_data_packet *> datas(rows.size(), NULL);
+			parquet_read_datas(entry.get(), r, rows, datas.data());
+
+			// same key asked more than once gets its own copy
+			vector<bool> taken(rows.size(), false);
+			size_t       j = 0;
+			for (const auto &hit : hits) {
+				while (rows[j] != hit.first) {
+					j++;
+				}
+				parquet_data_packet *pack = datas[j];
+				if (pack != NULL && taken[j]) {
+					pack = parquet_data_packet_alloc(
+					    pack->data, pack->size);
 				}
+				packs[hit.second] = pack;
+				taken[j]          = true;
 			}
 		}
-
 	} catch (const std::exception &e) {
-		exception_msg = e.what();
-		log_error("exception_msg=[%s]", exception_msg.c_str());
+		log_error("exception_msg=[%s]", e.what());
 	}
+}
 
+static uint8_t *
+parquet_read(conf_parquet *conf, char *filename, uint64_t key, uint32_t *len)
+{
+	vector<parquet_data_packet *> packs;
+	(void) conf;
+
+	parquet_read_packets(filename, vector<uint64_t>{ key }, packs);
+	if (packs[0] == NULL) {
+		return NULL;
+	}
+	uint8_t *ret = packs[0]->data;
+	*len         = packs[0]->size;
+	free(packs[0]);
+	return ret;
+}
+
+static vector<parquet_data_packet *>
+parquet_read(conf_parquet *conf, char *filename, vector<uint64_t> keys)
+{
+	vector<parquet_data_packet *> ret_vec;
+	(void) conf;
+
+	parquet_read_packets(filename, keys, ret_vec);
 	return ret_vec;
 }
 
@@ -1140,25 +1757,12 @@ parquet_find_data_packet(
 		log_error("Parquet is not ready or not launch!");
 		return ret_vec;
 	}
-	WAIT_FOR_AVAILABLE
-	void *elem = NULL;
-	pthread_mutex_lock(&parquet_queue_mutex);
-	FOREACH_QUEUE(parquet_file_queue, elem)
-	{
-		if (elem && nng_strcasecmp((char *) elem, filename) == 0) {
-			goto find;
-		}
-	}
-
-find:
-	pthread_mutex_unlock(&parquet_queue_mutex);
 
-	if (elem) {
-		ret_vec = parquet_read(conf, (char *) elem, keys);
+	if (file_catalog_contains(parquet_catalog, filename)) {
+		ret_vec = parquet_read(conf, filename, keys);
 	} else {
-
 		ret_vec.resize(keys.size(), nullptr);
-		log_debug("Not find file %s in file queue", (char *) elem);
+		log_debug("Not find file %s in file queue", filename);
 	}
 	return ret_vec;
 }
@@ -1170,22 +1774,10 @@ parquet_find_data_packet(conf_parquet *conf, char *filename, uint64_t key)
 		log_error("Parquet is not ready or not launch!");
 		return NULL;
 	}
-	WAIT_FOR_AVAILABLE
-	void *elem = NULL;
-	pthread_mutex_lock(&parquet_queue_mutex);
-	FOREACH_QUEUE(parquet_file_queue, elem)
-	{
-		if (elem && nng_strcasecmp((char *) elem, filename) == 0) {
-			goto find;
-		}
-	}
 
-find:
-	pthread_mutex_unlock(&parquet_queue_mutex);
-
-	if (elem) {
+	if (file_catalog_contains(parquet_catalog, filename)) {
 		uint32_t size = 0;
-		uint8_t *data = parquet_read(conf, (char *) elem, key, &size);
+		uint8_t *data = parquet_read(conf, filename, key, &size);
 		if (size) {
 			parquet_data_packet *pack =
 			    (parquet_data_packet *) malloc(
@@ -1193,12 +1785,12 @@ find:
 			pack->data = data;
 			pack->size = size;
 			return pack;
-		} else {
-			log_debug(
-			    "No key %ld in file: %s", key, (char *) elem);
 		}
+		free(data);
+		log_debug("No key %ld in file: %s", key, filename);
+		return NULL;
 	}
-	log_debug("Not find file %s in file queue", (char *) elem);
+	log_debug("Not find file %s in file queue", filename);
 	return NULL;
 }
 
@@ -1239,139 +1831,78 @@ parquet_find_data_packets(
 	return packets;
 }
 
+// Data of all rows with key in [keys[0], keys[1]], in file order.
 static vector<parquet_data_packet *>
 parquet_read_span(conf_parquet *conf, const char *filename, uint64_t keys[2])
 {
-	conf = g_conf;
 	vector<parquet_data_packet *> ret_vec;
-	std::string                   path_int64 = "key";
-	std::string                   path_str   = "data";
-	parquet::ReaderProperties     reader_properties =
-	    parquet::default_reader_properties();
+	(void) conf;
 
-	parquet_read_set_property(reader_properties, conf);
-	vector<int> index_vector(2);
-
-	// Create a ParquetReader instance
-	std::string exception_msg = "";
 	try {
-		std::unique_ptr<parquet::ParquetFileReader> parquet_reader =
-		    parquet::ParquetFileReader::OpenFile(
-		        filename, false, reader_properties);
-
-		// Get the File MetaData
-		std::shared_ptr<parquet::FileMetaData> file_metadata =
-		    parquet_reader->metadata();
-
-		int num_row_groups =
-		    file_metadata
-		        ->num_row_groups(); // Get the number of RowGroups
-		int num_columns =
-		    file_metadata->num_columns(); // Get the number of Columns
-		assert(num_row_groups == 1);
-		assert(num_columns == 2);
+		auto entry = parquet_reader_get(g_conf, filename);
+		std::lock_guard<std::mutex> lk(entry->mtx);
+		int num_row_groups = entry->metadata->num_row_groups();
 
 		for (int r = 0; r < num_row_groups; ++r) {
-
-			std::shared_ptr<parquet::RowGroupReader>
-			    row_group_reader = parquet_reader->RowGroup(
-			        r); // Get the RowGroup Reader
-			int64_t values_read = 0;
-			int64_t rows_read   = 0;
-			std::shared_ptr<parquet::ColumnReader> column_reader;
-
-			column_reader = row_group_reader->Column(0);
-			parquet::Int64Reader *int64_reader =
-			    static_cast<parquet::Int64Reader *>(
-			        column_reader.get());
-
-			index_vector = get_keys_indexes_fuzing(
-			    int64_reader, keys[0], keys[1]);
-			if (-1 == index_vector[0] || -1 == index_vector[1]) {
-				ret_vec.push_back(NULL);
-				return ret_vec;
-			}
-			// Get the Column Reader for the ByteArray column
-			column_reader = row_group_reader->Column(1);
-			auto ba_reader =
-			    dynamic_pointer_cast<parquet::ByteArrayReader>(
-			        column_reader);
-
-			if (ba_reader->HasNext()) {
-				ba_reader->Skip(index_vector[0] - 1);
+			vector<uint64_t> rg_keys;
+			vector<int64_t>  rows;
+			int64_t          first = 0;
+			if (!parquet_read_keys(entry.get(), r, keys[0],
+			        keys[1], &first, rg_keys)) {
+				continue;
 			}
-
-			if (ba_reader->HasNext()) {
-				int64_t batch_size =
-				    index_vector[1] - index_vector[0] + 1;
-				std::vector<parquet::ByteArray> values(
-				    batch_size);
-				std::vector<int16_t> definition_levels(batch_size); // Use a vector for definition levels
-				parquet::ByteArray value;
-				rows_read = ba_reader->ReadBatch(batch_size,
-				    definition_levels.data(), nullptr, values.data(),
-				    &values_read);
-				if (batch_size == rows_read &&
-				    batch_size == values_read) {
-					for (int64_t b = 0; b < batch_size;
-					     b++) {
-						parquet_data_packet *pack =
-						    (parquet_data_packet *)
-						        malloc(sizeof(
-						            parquet_data_packet));
-						if (!pack) {
-							log_error("Memory allocation failed for parquet_data_packet");
-							for (auto p : ret_vec) {
-								free(p->data);
-								free(p);
-							}
-							return vector<parquet_data_packet *>();
-						}
-						pack->data =
-						    (uint8_t *) malloc(
-						        values[b].len *
-						        sizeof(uint8_t));
-						memcpy(pack->data,
-						    values[b].ptr,
-						    values[b].len);
-						pack->size = values[b].len;
-						ret_vec.push_back(pack);
+			if (std::is_sorted(rg_keys.begin(), rg_keys.end())) {
+				auto lo = std::lower_bound(
+				    rg_keys.begin(), rg_keys.end(), keys[0]);
+				auto hi = std::upper_bound(
+				    lo, rg_keys.end(), keys[1]);
+				for (auto it = lo; it != hi; it++) {
+					rows.push_back(
+					    first + (it - rg_keys.begin()));
+				}
+			} else {
+				for (size_t i = 0; i < rg_keys.size(); i++) {
+					if (rg_keys[i] >= keys[0] &&
+					    rg_keys[i] <= keys[1]) {
+						rows.push_back(first + i);
 					}
 				}
 			}
+			if (rows.empty()) {
+				continue;
+			}
 
+			size_t base = ret_vec.size();
+			ret_vec.resize(base + rows.size(), NULL);
+			parquet_read_datas(
+			    entry.get(), r, rows, ret_vec.data() + base);
 		}
-
 	} catch (const std::exception &e) {
-		exception_msg = e.what();
-		log_error("exception_msg=[%s]", exception_msg.c_str());
+		log_error("exception_msg=[%s]", e.what());
 	}
 
+	// callers walk the packets, never hand out holes
+	size_t n = ret_vec.size();
+	ret_vec.erase(std::remove(ret_vec.begin(), ret_vec.end(), nullptr),
+	    ret_vec.end());
+	if (ret_vec.size() != n) {
+		log_error("%zu rows of %s not read", n - ret_vec.size(),
+		    filename);
+	}
 	return ret_vec;
 }
 
-typedef enum {
-	START_KEY,
-	END_KEY
-} key_type;
+typedef struct {
+	string   path;
+	uint64_t range[2];
+} parquet_span_file;
 
-static uint64_t
-get_key(const char *filename, key_type type)
+static bool
+parquet_span_file_cb(const file_catalog_entry *entry, void *arg)
 {
-	uint64_t range[2] = { 0 };
-	uint64_t res      = 0;
-	get_range(filename, range);
-	switch (type) {
-	case START_KEY:
-		res = range[0];
-		break;
-	case END_KEY:
-		res = range[1];
-		break;
-	default:
-		break;
-	}
-	return res;
+	auto files = (vector<parquet_span_file> *) arg;
+	files->push_back({ entry->path, { entry->start_key, entry->end_key } });
+	return true;
 }
 
 parquet_data_packet **
@@ -1379,32 +1910,24 @@ parquet_find_data_span_packets(conf_parquet *conf, uint64_t start_key, uint64_t
 {
 	vector<parquet_data_packet *> ret_vec;
 	parquet_data_packet         **packets = NULL;
-	uint32_t                      len     = 0;
+	vector<parquet_span_file>     files;
 
-	const char **filenames = parquet_find_span(start_key, end_key, &len);
+	if (g_conf == NULL || g_conf->enable == false) {
+		log_error("Parquet is not ready or not launch!");
+		return NULL;
+	}
 
-	for (uint32_t i = 0; i < len; i++) {
-		if (strstr(filenames[i], topic) == NULL) {
-			nng_strfree((char*)filenames[i]);
-			continue;
-		}
+	file_catalog_foreach_span(parquet_catalog, start_key, end_key, topic,
+	    parquet_span_file_cb, &files);
 
+	for (auto &file : files) {
 		uint64_t keys[2];
-		keys[0]  = start_key;
-		keys[1]  = end_key;
-		if (len > 1) {
-			keys[0] = i == 0 ? start_key
-			                 : get_key(filenames[i], START_KEY);
-			keys[1] = i == (len - 1)
-			    ? end_key
-			    : get_key(filenames[i], END_KEY);
-		}
+		keys[0] = std::max(start_key, file.range[0]);
+		keys[1] = std::min(end_key, file.range[1]);
 
-		auto tmp = parquet_read_span(conf, filenames[i], keys);
+		auto tmp = parquet_read_span(conf, file.path.c_str(), keys);
 		ret_vec.insert(ret_vec.end(), tmp.begin(), tmp.end());
-		nng_strfree((char*)filenames[i]);
 	}
-	nng_free(filenames, len);
 
 	if (!ret_vec.empty()) {
 		packets = (parquet_data_packet **) malloc(
@@ -1415,3 +1938,432 @@ parquet_find_data_span_packets(conf_parquet *conf, uint64_t start_key, uint64_t
 
 	return packets;
 }
+
+// Compaction and retention. Runs of adjacent small files of a topic are
+// merged into one key sorted file, the merged file replaces them in the
+// catalog in one update, so a span lookup sees either all the old files or
+// the new one and never both.
+
+struct compact_file {
+	string   path;
+	string   topic;
+	string   md5;
+	uint64_t range[2];
+	uint64_t size;
+};
+
+static std::mutex compact_mtx;
+
+static bool
+compact_collect_cb(const file_catalog_entry *entry, void *arg)
+{
+	auto files = (vector<compact_file> *) arg;
+	files->push_back({ entry->path, entry->topic ? entry->topic : "",
+	    entry->md5 ? entry->md5 : "", { entry->start_key, entry->end_key },
+	    entry->size });
+	return true;
+}
+
+// Keeps the bytes done since start under conf->compact_rate per second.
+static void
+compact_throttle(conf_parquet *conf, nng_time start, uint64_t done)
+{
+	if (conf->compact_rate == 0) {
+		return;
+	}
+	nng_time due = start + done * 1000 / conf->compact_rate;
+	nng_time now = nng_clock();
+	if (due > now) {
+		nng_msleep(due - now);
+	}
+}
+
+// Remove path from parquet_file_queue, keeping the order of the others.
+// Called with parquet_queue_mutex held.
+static void
+parquet_file_queue_drop(const char *path)
+{
+	int n = QUEUE_SIZE(parquet_file_queue);
+	for (int i = 0; i < n; i++) {
+		char *name = (char *) DEQUEUE(parquet_file_queue);
+		if (strcmp(name, path) == 0) {
+			free(name);
+		} else {
+			ENQUEUE(parquet_file_queue, name);
+		}
+	}
+}
+
+// Called with parquet_queue_mutex held.
+static void
+parquet_file_delete(const char *path)
+{
+	file_catalog_remove(parquet_catalog, path);
+	parquet_reader_evict(path);
+	if (remove(path) != 0) {
+		log_error("Failed to remove file %s errno: %d", path, errno);
+	}
+	parquet_file_queue_drop(path);
+}
+
+// Read keys and data of a file with two columns, data are appended to
+// blob, offs holds offset and length of each row.
+static bool
+parquet_compact_read(conf_parquet *conf, const string &path,
+    vector<uint64_t> &keys, vector<uint8_t> &blob,
+    vector<std::pair<size_t, uint32_t>> &offs)
+{
+	try {
+		parquet::ReaderProperties props =
+		    parquet::default_reader_properties();
+		parquet_read_set_property(props, conf);
+		auto reader =
+		    parquet::ParquetFileReader::OpenFile(path, false, props);
+		auto md = reader->metadata();
+		if (md->num_columns() != 2) {
+			return false;
+		}
+
+		vector<int16_t>            def;
+		vector<parquet::ByteArray> values;
+		for (int r = 0; r < md->num_row_groups(); r++) {
+			auto    rg   = reader->RowGroup(r);
+			int64_t rows = rg->metadata()->num_rows();
+			size_t  base = keys.size();
+
+			def.resize(rows);
+			keys.resize(base + rows);
+			auto key_col = rg->Column(0);
+			auto key_reader =
+			    static_cast<parquet::Int64Reader *>(key_col.get());
+			int64_t got = 0;
+			while (got < rows && key_reader->HasNext()) {
+				int64_t values_read = 0;
+				int64_t rows_read   = key_reader->ReadBatch(
+				      rows - got, def.data(), nullptr,
+				      (int64_t *) keys.data() + base + got,
+				      &values_read);
+				if (rows_read != values_read) {
+					log_error("null key in %s", path.c_str());
+					return false;
+				}
+				got += rows_read;
+			}
+			if (got != rows) {
+				return false;
+			}
+
+			values.resize(rows);
+			auto data_col = rg->Column(1);
+			auto ba_reader =
+			    static_cast<parquet::ByteArrayReader *>(
+			        data_col.get());
+			got = 0;
+			while (got < rows && ba_reader->HasNext()) {
+				int64_t values_read = 0;
+				int64_t rows_read   = ba_reader->ReadBatch(
+				      rows - got, def.data(), nullptr,
+				      values.data(), &values_read);
+				if (rows_read != values_read) {
+					log_error("null data in %s", path.c_str());
+					return false;
+				}
+				for (int64_t k = 0; k < rows_read; k++) {
+					offs.push_back(
+					    { blob.size(), values[k].len });
+					blob.insert(blob.end(), values[k].ptr,
+					    values[k].ptr + values[k].len);
+				}
+				got += rows_read;
+			}
+			if (got != rows) {
+				return false;
+			}
+		}
+	} catch (const std::exception &e) {
+		log_error("Failed to read %s: %s", path.c_str(), e.what());
+		return false;
+	}
+	return true;
+}
+
+// Merge files, all of one topic, into one key sorted file and swap it in.
+static int
+parquet_compact_files(conf_parquet *conf, const vector<compact_file> &files)
+{
+	vector<uint64_t>                    keys;
+	vector<uint8_t>                     blob;
+	vector<std::pair<size_t, uint32_t>> offs;
+	nng_time                            start = nng_clock();
+	uint64_t                            done  = 0;
+	time_t                              mtime = 0;
+
+	for (auto &f : files) {
+		struct stat st;
+		if (stat(f.path.c_str(), &st) != 0 ||
+		    !parquet_compact_read(conf, f.path, keys, blob, offs)) {
+			return -1;
+		}
+		mtime = std::max(mtime, st.st_mtime);
+		done += f.size;
+		compact_throttle(conf, start, done);
+	}
+	if (keys.size() != offs.size() || keys.empty()) {
+		return -1;
+	}
+
+	vector<uint32_t> order(keys.size());
+	for (uint32_t i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(),
+	    [&keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+	vector<uint64_t>  skeys(order.size());
+	vector<uint8_t *> darray(order.size());
+	vector<uint32_t>  dsize(order.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		skeys[i]  = keys[order[i]];
+		darray[i] = blob.data() + offs[order[i]].first;
+		dsize[i]  = offs[order[i]].second;
+	}
+
+	parquet_object obj;
+	memset(&obj, 0, sizeof(obj));
+	obj.keys   = skeys.data();
+	obj.darray = darray.data();
+	obj.dsize  = dsize.data();
+	obj.size   = skeys.size();
+
+	uint64_t range[2] = { skeys.front(), skeys.back() };
+	char    *filename = (char *) malloc(strlen(conf->dir) +
+	       strlen(conf->file_name_prefix) + UINT64_MAX_DIGITS * 2 + 16);
+	if (filename == NULL) {
+		return -1;
+	}
+	sprintf(filename, "%s/%s-c-%" PRIu64 "~%" PRIu64 ".parquet",
+	    conf->dir, conf->file_name_prefix, range[0], range[1]);
+
+	uint64_t size;
+	char     md5[MD5_STR_LEN + 1];
+	try {
+		parquet_decoded decoded;
+		using FileClass = arrow::io::FileOutputStream;
+		shared_ptr<FileClass> out_file;
+		PARQUET_ASSIGN_OR_THROW(out_file, FileClass::Open(filename));
+		auto md5_out = std::make_shared<md5_output_stream>(out_file);
+		auto file_writer = parquet::ParquetFileWriter::Open(md5_out,
+		    setup_schema(), parquet_writer_properties(conf));
+		parquet_write_rows(
+		    conf, file_writer.get(), &obj, 0, obj.size - 1, decoded);
+		file_writer->Close();
+		PARQUET_THROW_NOT_OK(md5_out->Close());
+		size = md5_out->size();
+		strcpy(md5, md5_out->md5());
+	} catch (const std::exception &e) {
+		log_error("Failed to write %s: %s", filename, e.what());
+		remove(filename);
+		free(filename);
+		return -1;
+	}
+	done += size;
+
+	// age of merged rows is the age of the newest source
+	struct timeval times[2] = { { mtime, 0 }, { mtime, 0 } };
+	if (utimes(filename, times) != 0) {
+		log_warn("Failed to set mtime of %s errno: %d", filename, errno);
+	}
+
+	const string &topic = files.front().topic;
+	char         *merged =
+	    rename_file_withMD5(filename, conf, topic.c_str(), md5, range);
+	if (merged == NULL) {
+		return -1;
+	}
+
+	vector<const char *> paths;
+	for (auto &f : files) {
+		paths.push_back(f.path.c_str());
+	}
+
+	pthread_mutex_lock(&parquet_queue_mutex);
+	bool known = file_catalog_contains(parquet_catalog, merged);
+	bool gone  = false;
+	for (auto &f : files) {
+		if (f.path == merged ||
+		    !file_catalog_contains(parquet_catalog, f.path.c_str())) {
+			gone = true;
+		}
+	}
+	if (gone || known) {
+		// rotated out meanwhile, or the same rows exist already
+		pthread_mutex_unlock(&parquet_queue_mutex);
+		if (!known) {
+			remove(merged);
+		}
+		free(merged);
+		return -1;
+	}
+
+	file_catalog_entry ent;
+	ent.start_key = range[0];
+	ent.end_key   = range[1];
+	ent.topic     = topic.c_str();
+	ent.path      = merged;
+	ent.md5       = md5;
+	ent.size      = size;
+	if (file_catalog_replace(
+	        parquet_catalog, paths.data(), paths.size(), &ent) != 0) {
+		pthread_mutex_unlock(&parquet_queue_mutex);
+		remove(merged);
+		free(merged);
+		return -1;
+	}
+
+	// merged file takes the place of the oldest source in rotation
+	int n = QUEUE_SIZE(parquet_file_queue);
+	for (int i = 0; i < n; i++) {
+		char *name = (char *) DEQUEUE(parquet_file_queue);
+		auto  it   = std::find_if(paths.begin(), paths.end(),
+		       [name](const char *p) { return strcmp(p, name) == 0; });
+		if (it == paths.end()) {
+			ENQUEUE(parquet_file_queue, name);
+			continue;
+		}
+		if (merged != NULL) {
+			ENQUEUE(parquet_file_queue, merged);
+			merged = NULL;
+		}
+		parquet_reader_evict(name);
+		if (remove(name) != 0) {
+			log_error("Failed to remove file %s errno: %d", name,
+			    errno);
+		}
+		free(name);
+	}
+	pthread_mutex_unlock(&parquet_queue_mutex);
+	free(merged);
+
+	log_info("compacted %zu files into %" PRIu64 "~%" PRIu64 ", %zu rows",
+	    files.size(), range[0], range[1], skeys.size());
+	compact_throttle(conf, start, done);
+	return 0;
+}
+
+// Merge runs of adjacent files of a topic smaller than half of file_size,
+// each run up to file_size in total.
+static int
+parquet_compact(conf_parquet *conf)
+{
+	vector<compact_file> files;
+	int                  merged = 0;
+
+	file_catalog_foreach_span(
+	    parquet_catalog, 0, UINT64_MAX, NULL, compact_collect_cb, &files);
+	std::stable_sort(files.begin(), files.end(),
+	    [](const compact_file &a, const compact_file &b) {
+		    return a.topic < b.topic;
+	    });
+
+	uint64_t small = (uint64_t) conf->file_size / 2;
+	for (size_t i = 0; i < files.size();) {
+		vector<compact_file> run;
+		uint64_t             total = 0;
+		size_t               j     = i;
+		while (j < files.size() && files[j].topic == files[i].topic &&
+		    files[j].size < small &&
+		    total + files[j].size <= (uint64_t) conf->file_size) {
+			total += files[j].size;
+			run.push_back(files[j++]);
+		}
+		if (run.size() >= 2 && parquet_compact_files(conf, run) == 0) {
+			merged++;
+		}
+		i = j > i ? j : i + 1;
+	}
+	return merged;
+}
+
+// Remove files older than retention_age, then the oldest files while all
+// files take more than retention_size.
+static void
+parquet_retention(conf_parquet *conf)
+{
+	vector<std::pair<string, uint64_t>> files;
+	uint64_t                            total = 0;
+	time_t                              now   = time(NULL);
+	void                               *elem;
+
+	pthread_mutex_lock(&parquet_queue_mutex);
+	FOREACH_QUEUE(parquet_file_queue, elem)
+	{
+		files.push_back({ (const char *) elem, 0 });
+	}
+	// queue is in written order, oldest first
+	for (auto it = files.begin(); it != files.end();) {
+		struct stat st;
+		if (stat(it->first.c_str(), &st) != 0) {
+			it = files.erase(it);
+			continue;
+		}
+		if (conf->retention_age > 0 && now > st.st_mtime &&
+		    (uint64_t) (now - st.st_mtime) > conf->retention_age) {
+			log_info("%s is older than retention_age",
+			    it->first.c_str());
+			parquet_file_delete(it->first.c_str());
+			it = files.erase(it);
+			continue;
+		}
+		it->second = st.st_size;
+		total += st.st_size;
+		it++;
+	}
+	for (auto &f : files) {
+		if (conf->retention_size == 0 || total <= conf->retention_size) {
+			break;
+		}
+		log_info("%s is over retention_size", f.first.c_str());
+		parquet_file_delete(f.first.c_str());
+		total -= f.second;
+	}
+	pthread_mutex_unlock(&parquet_queue_mutex);
+}
+
+int
+parquet_compact_run(void)
+{
+	if (g_conf == NULL || parquet_catalog == NULL) {
+		return -1;
+	}
+	std::lock_guard<std::mutex> lk(compact_mtx);
+	parquet_retention(g_conf);
+	return g_conf->compact ? parquet_compact(g_conf) : 0;
+}
+
+static void *
+parquet_compact_loop(void *arg)
+{
+	conf_parquet *conf     = (conf_parquet *) arg;
+	uint64_t      interval = conf->compact_interval;
+
+	if (interval == 0) {
+		interval = 60;
+	}
+	pthread_mutex_lock(&parquet_compact_mtx);
+	while (!parquet_compact_stop) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += interval;
+		if (pthread_cond_timedwait(
+		        &parquet_compact_cv, &parquet_compact_mtx, &ts) !=
+		        ETIMEDOUT ||
+		    parquet_compact_stop) {
+			continue;
+		}
+		pthread_mutex_unlock(&parquet_compact_mtx);
+		parquet_compact_run();
+		pthread_mutex_lock(&parquet_compact_mtx);
+	}
+	pthread_mutex_unlock(&parquet_compact_mtx);
+	return NULL;
+}
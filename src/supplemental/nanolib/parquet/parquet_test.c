@@ -0,0 +1,439 @@
+#include "nng/supplemental/nanolib/parquet.h"
+#include "nng/supplemental/util/platform.h"
+#include <nuts.h>
+#include <stdio.h>
+#include <string.h>
+
+// Timings are printed with NNG_TEST_BENCH, on full size batches
+#ifdef NNG_TEST_BENCH
+#define BENCH_ROWS 100000
+#else
+#define BENCH_ROWS 10000
+#endif
+#define BENCH_PAYLOAD 256
+#define BENCH_LOOKUPS 1000
+#define BENCH_SPAN 1000
+#define BENCH_TOPICS 8
+
+static char bench_dir[]    = "/tmp/nanomq-parquet-test";
+static char bench_prefix[] = "bench";
+static char bench_topic[]  = "bench";
+
+static conf_parquet bench_conf;
+
+// Batch of rows keys, finishes aio when written.
+static parquet_object *
+bench_object(uint8_t *payload, uint32_t rows, char *topic, nng_aio *aio)
+{
+	uint64_t *keys   = nng_alloc(sizeof(uint64_t) * rows);
+	uint8_t **darray = nng_alloc(sizeof(uint8_t *) * rows);
+	uint32_t *dsize  = nng_alloc(sizeof(uint32_t) * rows);
+
+	NUTS_ASSERT(keys != NULL && darray != NULL && dsize != NULL);
+	for (uint32_t i = 0; i < rows; i++) {
+		keys[i]   = i;
+		darray[i] = payload + (i % 64);
+		dsize[i]  = BENCH_PAYLOAD;
+	}
+
+	nng_aio_begin(aio);
+	parquet_object *obj =
+	    parquet_object_alloc(keys, darray, dsize, rows, aio, NULL);
+	NUTS_ASSERT(obj != NULL);
+	obj->topic = topic;
+	return obj;
+}
+
+static void
+bench_wait(nng_aio *aio)
+{
+	nng_aio_wait(aio);
+	NUTS_PASS(nng_aio_result(aio));
+	// size of written batch
+	free(nng_aio_get_msg(aio));
+	nng_aio_free(aio);
+}
+
+// Flush one ring worth of messages, with the write throughput reported.
+static void
+bench_write(conf_parquet *conf, uint8_t *payload, const char *name)
+{
+	nng_aio *aio;
+
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	parquet_object *obj =
+	    bench_object(payload, BENCH_ROWS, bench_topic, aio);
+
+	nng_time start = nng_clock();
+	NUTS_PASS(parquet_write_batch_async(obj));
+	bench_wait(aio);
+	nng_time end = nng_clock();
+
+#ifdef NNG_TEST_BENCH
+	double secs = (end - start + 1) / 1000.0;
+	printf("parquet %-24s %8.1f MB/s %10.0f rows/s\n", name,
+	    (double) BENCH_ROWS * BENCH_PAYLOAD / secs / (1024 * 1024),
+	    BENCH_ROWS / secs);
+#else
+	(void) name;
+	(void) (end - start);
+#endif
+}
+
+// Launch the writers once per process, the payload of row i starts at
+// payload[i % 64].
+static uint8_t *
+bench_launch(uint32_t threads, char *columns)
+{
+	static uint8_t payload[BENCH_PAYLOAD + 64];
+	conf_parquet  *conf = &bench_conf;
+
+	if (conf->enable) {
+		return payload;
+	}
+	for (int i = 0; i < BENCH_PAYLOAD + 64; i++) {
+		payload[i] = 'a' + i % 26;
+	}
+	memset(conf, 0, sizeof(*conf));
+	conf->enable           = true;
+	conf->dir              = bench_dir;
+	conf->file_name_prefix = bench_prefix;
+	conf->file_count       = 2 * BENCH_TOPICS;
+	conf->write_threads    = threads;
+	conf->columns          = columns;
+	conf->file_size        = 10240 * 1024;
+	conf->comp_type        = UNCOMPRESSED;
+	NUTS_PASS(parquet_write_launcher(conf));
+	return payload;
+}
+
+static void
+test_parquet_write(void)
+{
+	conf_parquet *conf    = &bench_conf;
+	uint8_t      *payload = bench_launch(1, NULL);
+
+	bench_write(conf, payload, "uncompressed");
+	conf->comp_type = ZSTD;
+	bench_write(conf, payload, "zstd");
+	conf->comp_type = SNAPPY;
+	bench_write(conf, payload, "snappy");
+
+	conf->comp_type      = UNCOMPRESSED;
+	conf->row_group_size = 10000;
+	bench_write(conf, payload, "uncompressed rg 10k");
+	conf->page_index   = true;
+	conf->bloom_filter = true;
+	bench_write(conf, payload, "rg 10k index bloom");
+	conf->row_group_size = 0;
+	conf->page_index     = false;
+	conf->bloom_filter   = false;
+}
+
+static void
+bench_check_packet(parquet_data_packet *pack, uint64_t key)
+{
+	NUTS_ASSERT(pack != NULL);
+	NUTS_TRUE(pack->size == BENCH_PAYLOAD);
+	NUTS_TRUE(pack->data[0] == 'a' + (key % 64) % 26);
+	free(pack->data);
+	free(pack);
+}
+
+// Point lookups and span reads over the files written by the write test.
+static void
+test_parquet_read(void)
+{
+	conf_parquet         *conf = &bench_conf;
+	parquet_data_packet **packs;
+	uint32_t              size = 0;
+
+	conf->row_group_size = 10000;
+	conf->page_index     = true;
+	bench_write(conf, bench_launch(1, NULL), "rg 10k index");
+
+	nng_time start = nng_clock();
+	for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+		uint64_t    key      = (i * 7919) % BENCH_ROWS;
+		const char *filename = parquet_find(key);
+		NUTS_ASSERT(filename != NULL);
+		bench_check_packet(
+		    parquet_find_data_packet(NULL, (char *) filename, key),
+		    key);
+		nng_strfree((char *) filename);
+	}
+	nng_time mid = nng_clock();
+
+	for (uint32_t i = 0; i < BENCH_LOOKUPS / 10; i++) {
+		uint64_t key = (i * 7919) % (BENCH_ROWS - BENCH_SPAN);
+		packs        = parquet_find_data_span_packets(
+                    NULL, key, key + BENCH_SPAN - 1, &size, bench_topic);
+		NUTS_ASSERT(packs != NULL);
+		NUTS_TRUE(size >= BENCH_SPAN);
+		for (uint32_t j = 0; j < size; j++) {
+			NUTS_TRUE(packs[j] != NULL);
+			NUTS_TRUE(packs[j]->size == BENCH_PAYLOAD);
+			free(packs[j]->data);
+			free(packs[j]);
+		}
+		free(packs);
+	}
+	nng_time end = nng_clock();
+
+#ifdef NNG_TEST_BENCH
+	printf("parquet %d lookups %lums, %d spans of %d %lums\n",
+	    BENCH_LOOKUPS, (unsigned long) (mid - start), BENCH_LOOKUPS / 10,
+	    BENCH_SPAN, (unsigned long) (end - mid));
+#else
+	(void) (end - mid);
+	(void) (mid - start);
+#endif
+}
+
+// One ring per topic flushing at once, a writer queue holds at most one
+// pending flush, the others wait in parquet_write_batch_async.
+static void
+bench_topics(uint32_t threads)
+{
+	nng_aio *aios[BENCH_TOPICS];
+	char     topics[BENCH_TOPICS][16];
+	uint32_t rows    = BENCH_ROWS / 4;
+	uint8_t *payload = bench_launch(threads, NULL);
+
+	bench_conf.write_queue_limit = 1;
+	nng_time start               = nng_clock();
+	for (int i = 0; i < BENCH_TOPICS; i++) {
+		snprintf(topics[i], sizeof(topics[i]), "topic-%d", i);
+		NUTS_PASS(nng_aio_alloc(&aios[i], NULL, NULL));
+		NUTS_PASS(parquet_write_batch_async(
+		    bench_object(payload, rows, topics[i], aios[i])));
+	}
+	for (int i = 0; i < BENCH_TOPICS; i++) {
+		bench_wait(aios[i]);
+	}
+	nng_time end = nng_clock();
+
+#ifdef NNG_TEST_BENCH
+	double secs = (end - start + 1) / 1000.0;
+	printf("parquet %d topics %u threads %8.1f MB/s %10.0f rows/s\n",
+	    BENCH_TOPICS, threads,
+	    (double) BENCH_TOPICS * rows * BENCH_PAYLOAD / secs /
+	        (1024 * 1024),
+	    BENCH_TOPICS * rows / secs);
+#else
+	(void) (end - start);
+#endif
+
+	for (int i = 0; i < BENCH_TOPICS; i++) {
+		parquet_data_packet **packs;
+		uint32_t              size = 0;
+
+		packs = parquet_find_data_span_packets(
+		    NULL, 0, rows - 1, &size, topics[i]);
+		NUTS_ASSERT(packs != NULL);
+		NUTS_TRUE(size == rows);
+		for (uint32_t j = 0; j < size; j++) {
+			NUTS_TRUE(packs[j]->size == BENCH_PAYLOAD);
+			free(packs[j]->data);
+			free(packs[j]);
+		}
+		free(packs);
+	}
+}
+
+static void
+test_parquet_topics(void)
+{
+	bench_topics(1);
+}
+
+static void
+test_parquet_topic_pool(void)
+{
+	bench_topics(4);
+}
+
+// Publish packet of qos 1, payload is JSON but for every tenth row.
+static nng_msg *
+columns_msg(uint32_t i)
+{
+	nng_msg *msg;
+	char     payload[128];
+	uint8_t  topic[] = { 0, 8, 's', 'e', 'n', 's', 'o', 'r', '/', '1' };
+	int      len;
+
+	if (i % 10 == 0) {
+		len = snprintf(payload, sizeof(payload), "raw %u", i);
+	} else {
+		len = snprintf(payload, sizeof(payload),
+		    "{\"temp\":%u.5,\"dev\":{\"name\":\"d%u\"},\"ok\":%s}",
+		    i, i % 3, i % 2 ? "true" : "false");
+	}
+	NUTS_PASS(nng_msg_alloc(&msg, 0));
+	NUTS_PASS(nng_msg_header_append_u16(
+	    msg, 0x32 << 8 | (sizeof(topic) + 2 + len)));
+	NUTS_PASS(nng_msg_append(msg, topic, sizeof(topic)));
+	NUTS_PASS(nng_msg_append_u16(msg, i + 1));
+	NUTS_PASS(nng_msg_append(msg, payload, len));
+	nng_msg_set_payload_ptr(
+	    msg, (uint8_t *) nng_msg_body(msg) + sizeof(topic) + 2);
+	nng_msg_set_timestamp(msg, 1700000000000 + i);
+	return msg;
+}
+
+// Decoded columns go along with key and data, which are read as before.
+static void
+test_parquet_columns(void)
+{
+	uint32_t              rows = 1000;
+	nng_aio              *aio;
+	nng_msg             **msgs = nng_alloc(sizeof(nng_msg *) * rows);
+	uint64_t             *keys = nng_alloc(sizeof(uint64_t) * rows);
+	uint8_t             **darray = nng_alloc(sizeof(uint8_t *) * rows);
+	uint32_t             *dsize  = nng_alloc(sizeof(uint32_t) * rows);
+	parquet_data_packet **packs;
+	uint32_t              size = 0;
+	char                  columns[] =
+	    "topic, qos, id, timestamp, clientid, payload.temp as temp, "
+	    "payload.dev.name as dev, payload.ok";
+
+	bench_launch(1, columns);
+	for (uint32_t i = 0; i < rows; i++) {
+		msgs[i]   = columns_msg(i);
+		keys[i]   = i;
+		darray[i] = nng_msg_payload_ptr(msgs[i]);
+		dsize[i]  = (uint8_t *) nng_msg_body(msgs[i]) +
+		    nng_msg_len(msgs[i]) - darray[i];
+	}
+	NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+	nng_aio_begin(aio);
+	parquet_object *obj =
+	    parquet_object_alloc(keys, darray, dsize, rows, aio, NULL);
+	obj->topic = "columns";
+	obj->msgs  = msgs;
+	NUTS_PASS(parquet_write_batch_async(obj));
+	bench_wait(aio);
+
+	packs = parquet_find_data_span_packets(
+	    NULL, 0, rows - 1, &size, "columns");
+	NUTS_ASSERT(packs != NULL);
+	NUTS_TRUE(size == rows);
+	// keys, darray and dsize went with obj
+	for (uint32_t i = 0; i < size; i++) {
+		uint8_t *payload = nng_msg_payload_ptr(msgs[i]);
+		NUTS_TRUE(packs[i]->size ==
+		    (uint8_t *) nng_msg_body(msgs[i]) + nng_msg_len(msgs[i]) -
+		        payload);
+		NUTS_TRUE(memcmp(packs[i]->data, payload, packs[i]->size) == 0);
+		free(packs[i]->data);
+		free(packs[i]);
+	}
+	free(packs);
+	for (uint32_t i = 0; i < rows; i++) {
+		nng_msg_free(msgs[i]);
+	}
+	nng_free(msgs, sizeof(nng_msg *) * rows);
+}
+
+// Number of files overlapping [start, end].
+static uint32_t
+compact_files(uint64_t start, uint64_t end)
+{
+	uint32_t     size  = 0;
+	const char **files = parquet_find_span(start, end, &size);
+
+	for (uint32_t i = 0; i < size; i++) {
+		nng_strfree((char *) files[i]);
+	}
+	if (files != NULL) {
+		nng_free(files, sizeof(char *) * size);
+	}
+	return size;
+}
+
+// Small files written out of key order are merged into one key sorted
+// file, span reads see the same rows before and after. Keys are above the
+// files left by the other tests.
+static void
+test_parquet_compact(void)
+{
+	conf_parquet         *conf    = &bench_conf;
+	uint8_t              *payload = bench_launch(1, NULL);
+	parquet_data_packet **packs;
+	char                  topic[] = "compact";
+	uint64_t              base    = 1ull << 40;
+	uint32_t              rows    = 512;
+	uint32_t              count   = 6;
+	uint32_t              size    = 0;
+
+	for (uint32_t b = count; b-- > 0;) {
+		nng_aio *aio;
+		NUTS_PASS(nng_aio_alloc(&aio, NULL, NULL));
+		parquet_object *obj = bench_object(payload, rows, topic, aio);
+		for (uint32_t i = 0; i < rows; i++) {
+			obj->keys[i] += base + b * rows;
+		}
+		NUTS_PASS(parquet_write_batch_async(obj));
+		bench_wait(aio);
+	}
+	packs = parquet_find_data_span_packets(
+	    NULL, base, base + count * rows - 1, &size, topic);
+	NUTS_TRUE(size == count * rows);
+	for (uint32_t i = 0; i < size; i++) {
+		bench_check_packet(packs[i], i);
+	}
+	free(packs);
+	NUTS_TRUE(compact_files(base, base + count * rows - 1) == count);
+
+	conf->compact = true;
+	NUTS_TRUE(parquet_compact_run() >= 1);
+	NUTS_TRUE(compact_files(base, base + count * rows - 1) == 1);
+
+	packs = parquet_find_data_span_packets(
+	    NULL, base, base + count * rows - 1, &size, topic);
+	NUTS_ASSERT(packs != NULL);
+	NUTS_TRUE(size == count * rows);
+	for (uint32_t i = 0; i < size; i++) {
+		bench_check_packet(packs[i], i);
+	}
+	free(packs);
+
+	conf->retention_size = 1;
+	parquet_compact_run();
+	NUTS_NULL(parquet_find(base));
+	conf->compact        = false;
+	conf->retention_size = 0;
+}
+
+// Launching twice keeps one set of writers, stopping frees them and the
+// files written are found again by the next launch.
+static void
+test_parquet_relaunch(void)
+{
+	conf_parquet *conf    = &bench_conf;
+	uint8_t      *payload = bench_launch(1, NULL);
+	const char   *filename;
+
+	NUTS_PASS(parquet_write_launcher(conf));
+	parquet_write_stop();
+	parquet_write_stop();
+	NUTS_NULL(parquet_find(0));
+
+	NUTS_PASS(parquet_write_launcher(conf));
+	filename = parquet_find(0);
+	NUTS_ASSERT(filename != NULL);
+	nng_strfree((char *) filename);
+	bench_write(conf, payload, "relaunched");
+	parquet_write_stop();
+}
+
+NUTS_TESTS = {
+	{ "parquet write", test_parquet_write },
+	{ "parquet read", test_parquet_read },
+	{ "parquet topics", test_parquet_topics },
+	{ "parquet topic pool", test_parquet_topic_pool },
+	{ "parquet columns", test_parquet_columns },
+	{ "parquet compact", test_parquet_compact },
+	{ "parquet relaunch", test_parquet_relaunch },
+	{ NULL, NULL },
+};
@@ -0,0 +1,381 @@
+//
+// Copyright 2024 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+// Retained message store ordered by topic.
+// Topics are kept in a skip list, so a wildcard subscription only walks
+// the range sharing the literal prefix of its filter. Results are handed
+// out in bounded batches through a cursor, the lock is released between
+// batches and publishing never waits for a whole subtree walk.
+
+#include <string.h>
+
+#include "core/nng_impl.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/nanolib/mqtt_db.h"
+
+#define RETAIN_DB_MAX_LEVEL 24
+// max nodes scanned with lock held in one round of a cursor
+#define RETAIN_DB_SCAN_LIMIT 1024
+
+typedef struct retain_node retain_node;
+
+struct retain_node {
+	char        *topic;
+	nng_msg     *msg;
+	int          level;
+	retain_node *next[];
+};
+
+struct retain_db {
+	retain_node *head;
+	int          level;
+	size_t       count;
+	uint64_t     seed;
+	nni_rwlock   rwlock;
+};
+
+struct retain_cursor {
+	retain_db *rdb;
+	char      *filter;
+	char      *prefix; // literal part of filter
+	size_t     prefix_len;
+	char      *last; // last topic visited
+	bool       done;
+};
+
+static retain_node *
+retain_node_new(const char *topic, nng_msg *msg, int level)
+{
+	retain_node *node;
+
+	node = nni_zalloc(sizeof(*node) + level * sizeof(retain_node *));
+	if (node == NULL) {
+		return NULL;
+	}
+	if (topic != NULL && (node->topic = nni_strdup(topic)) == NULL) {
+		nni_free(node, sizeof(*node) + level * sizeof(retain_node *));
+		return NULL;
+	}
+	node->msg   = msg;
+	node->level = level;
+	return node;
+}
+
+static void
+retain_node_free(retain_node *node)
+{
+	nni_strfree(node->topic);
+	nni_free(node, sizeof(*node) + node->level * sizeof(retain_node *));
+}
+
+// Called with write lock held
+static int
+retain_random_level(retain_db *rdb)
+{
+	int      level = 1;
+	uint64_t x     = rdb->seed;
+
+	// xorshift64
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	rdb->seed = x;
+	while ((x & 3) == 0 && level < RETAIN_DB_MAX_LEVEL) {
+		level++;
+		x >>= 2;
+	}
+	return level;
+}
+
+// First node with topic >= key (or > key if strict), fills update[] with
+// the predecessors on each level when it is given.
+static retain_node *
+retain_seek(retain_db *rdb, const char *key, bool strict,
+    retain_node **update)
+{
+	retain_node *x = rdb->head;
+
+	for (int i = rdb->level - 1; i >= 0; i--) {
+		while (x->next[i] != NULL) {
+			int rv = strcmp(x->next[i]->topic, key);
+			if (rv < 0 || (strict && rv == 0)) {
+				x = x->next[i];
+			} else {
+				break;
+			}
+		}
+		if (update != NULL) {
+			update[i] = x;
+		}
+	}
+	return x->next[0];
+}
+
+int
+retain_db_create(retain_db **rdbp)
+{
+	retain_db *rdb;
+
+	if ((rdb = NNI_ALLOC_STRUCT(rdb)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	rdb->head = retain_node_new(NULL, NULL, RETAIN_DB_MAX_LEVEL);
+	if (rdb->head == NULL) {
+		NNI_FREE_STRUCT(rdb);
+		return (NNG_ENOMEM);
+	}
+	rdb->level = 1;
+	rdb->seed  = ((uint64_t) nni_random() << 32) | nni_random() | 1;
+	nni_rwlock_init(&rdb->rwlock);
+	*rdbp = rdb;
+	return (0);
+}
+
+void
+retain_db_destroy(retain_db *rdb)
+{
+	retain_node *node, *next;
+
+	if (rdb == NULL) {
+		return;
+	}
+	node = rdb->head->next[0];
+	while (node != NULL) {
+		next = node->next[0];
+		nng_msg_free(node->msg);
+		retain_node_free(node);
+		node = next;
+	}
+	retain_node_free(rdb->head);
+	nni_rwlock_fini(&rdb->rwlock);
+	NNI_FREE_STRUCT(rdb);
+}
+
+nng_msg *
+retain_db_insert(retain_db *rdb, const char *topic, nng_msg *msg)
+{
+	retain_node *update[RETAIN_DB_MAX_LEVEL];
+	retain_node *node;
+	nng_msg     *old = NULL;
+	int          level;
+
+	if (rdb == NULL || topic == NULL) {
+		return NULL;
+	}
+	if (msg == NULL) {
+		return retain_db_delete(rdb, topic);
+	}
+
+	nni_rwlock_wrlock(&rdb->rwlock);
+	node = retain_seek(rdb, topic, false, update);
+	if (node != NULL && strcmp(node->topic, topic) == 0) {
+		old       = node->msg;
+		node->msg = msg;
+		nni_rwlock_unlock(&rdb->rwlock);
+		return old;
+	}
+	level = retain_random_level(rdb);
+	if ((node = retain_node_new(topic, msg, level)) == NULL) {
+		nni_rwlock_unlock(&rdb->rwlock);
+		log_error("retain db out of memory, drop %s", topic);
+		// hand it back, so the caller frees it
+		return msg;
+	}
+	for (int i = rdb->level; i < level; i++) {
+		update[i] = rdb->head;
+	}
+	if (level > rdb->level) {
+		rdb->level = level;
+	}
+	for (int i = 0; i < level; i++) {
+		node->next[i]      = update[i]->next[i];
+		update[i]->next[i] = node;
+	}
+	rdb->count++;
+	nni_rwlock_unlock(&rdb->rwlock);
+	return NULL;
+}
+
+nng_msg *
+retain_db_delete(retain_db *rdb, const char *topic)
+{
+	retain_node *update[RETAIN_DB_MAX_LEVEL];
+	retain_node *node;
+	nng_msg     *old;
+
+	if (rdb == NULL || topic == NULL) {
+		return NULL;
+	}
+	nni_rwlock_wrlock(&rdb->rwlock);
+	node = retain_seek(rdb, topic, false, update);
+	if (node == NULL || strcmp(node->topic, topic) != 0) {
+		nni_rwlock_unlock(&rdb->rwlock);
+		return NULL;
+	}
+	for (int i = 0; i < node->level; i++) {
+		update[i]->next[i] = node->next[i];
+	}
+	while (rdb->level > 1 && rdb->head->next[rdb->level - 1] == NULL) {
+		rdb->level--;
+	}
+	rdb->count--;
+	nni_rwlock_unlock(&rdb->rwlock);
+
+	old = node->msg;
+	retain_node_free(node);
+	return old;
+}
+
+size_t
+retain_db_count(retain_db *rdb)
+{
+	size_t count;
+
+	nni_rwlock_rdlock(&rdb->rwlock);
+	count = rdb->count;
+	nni_rwlock_unlock(&rdb->rwlock);
+	return count;
+}
+
+/**
+ * @brief retain_topic_match - MQTT topic filter match, wildcards never
+ * match topics start with '$' at the first level.
+ * @param filter - topic filter
+ * @param topic - topic name
+ * @return true if matched
+ */
+static bool
+retain_topic_match(const char *filter, const char *topic)
+{
+	if (*topic == '$' && (*filter == '+' || *filter == '#')) {
+		return false;
+	}
+	while (*filter != '\0') {
+		if (*filter == '#') {
+			return true;
+		}
+		if (*filter == '+') {
+			while (*topic != '\0' && *topic != '/') {
+				topic++;
+			}
+			filter++;
+		} else {
+			while (*filter != '\0' && *filter != '/') {
+				if (*filter++ != *topic++) {
+					return false;
+				}
+			}
+			if (*topic != '\0' && *topic != '/') {
+				return false;
+			}
+		}
+		if (*filter == '\0') {
+			return *topic == '\0';
+		}
+		// both at '/'
+		if (*topic == '\0') {
+			// "a/#" matches "a"
+			return strcmp(filter, "/#") == 0;
+		}
+		filter++;
+		topic++;
+	}
+	return *topic == '\0';
+}
+
+int
+retain_cursor_open(retain_db *rdb, const char *filter, retain_cursor **curp)
+{
+	retain_cursor *cur;
+	size_t         len;
+
+	if (rdb == NULL || filter == NULL) {
+		return (NNG_EINVAL);
+	}
+	if ((cur = NNI_ALLOC_STRUCT(cur)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if ((cur->filter = nni_strdup(filter)) == NULL ||
+	    (cur->prefix = nni_strdup(filter)) == NULL) {
+		nni_strfree(cur->filter);
+		NNI_FREE_STRUCT(cur);
+		return (NNG_ENOMEM);
+	}
+	// Literal levels before the first wildcard bound the range, the
+	// separator is dropped since "a/#" matches "a" as well.
+	len = strcspn(cur->prefix, "+#");
+	if (cur->prefix[len] != '\0' && len > 0) {
+		len--;
+	}
+	cur->prefix[len] = '\0';
+	cur->prefix_len  = len;
+	cur->rdb         = rdb;
+	*curp            = cur;
+	return (0);
+}
+
+size_t
+retain_cursor_next(retain_cursor *cur, nng_msg **msgs, size_t batch)
+{
+	retain_node *node;
+	size_t       n = 0;
+
+	while (n == 0 && !cur->done) {
+		size_t scanned = 0;
+
+		nni_rwlock_rdlock(&cur->rdb->rwlock);
+		if (cur->last != NULL) {
+			node = retain_seek(cur->rdb, cur->last, true, NULL);
+		} else {
+			node = retain_seek(cur->rdb, cur->prefix, false, NULL);
+		}
+		while (node != NULL && n < batch &&
+		    scanned < RETAIN_DB_SCAN_LIMIT) {
+			if (strncmp(node->topic, cur->prefix,
+			        cur->prefix_len) != 0) {
+				node = NULL;
+				break;
+			}
+			if (retain_topic_match(cur->filter, node->topic)) {
+				// remember to free the ref!
+				nng_msg_clone(node->msg);
+				msgs[n++] = node->msg;
+			}
+			scanned++;
+			if (n == batch || scanned == RETAIN_DB_SCAN_LIMIT) {
+				break;
+			}
+			node = node->next[0];
+		}
+		if (node == NULL) {
+			cur->done = true;
+		} else {
+			// resume after this one next time
+			nni_strfree(cur->last);
+			cur->last = nni_strdup(node->topic);
+			if (cur->last == NULL) {
+				cur->done = true;
+			}
+		}
+		nni_rwlock_unlock(&cur->rdb->rwlock);
+	}
+	return n;
+}
+
+void
+retain_cursor_close(retain_cursor *cur)
+{
+	if (cur == NULL) {
+		return;
+	}
+	nni_strfree(cur->filter);
+	nni_strfree(cur->prefix);
+	nni_strfree(cur->last);
+	NNI_FREE_STRUCT(cur);
+}
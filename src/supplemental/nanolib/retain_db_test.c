@@ -0,0 +1,179 @@
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/mqtt_db.h"
+#include "nng/supplemental/util/platform.h"
+#include <nuts.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RETAIN_TOPICS 100000
+#define RETAIN_BATCH 64
+
+static nng_msg *
+retain_msg(const char *topic)
+{
+	nng_msg *msg;
+	NUTS_PASS(nng_msg_alloc(&msg, 0));
+	NUTS_PASS(nng_msg_append(msg, topic, strlen(topic) + 1));
+	return msg;
+}
+
+static size_t
+retain_query(retain_db *rdb, const char *filter, const char *expect)
+{
+	retain_cursor *cur;
+	nng_msg       *msgs[RETAIN_BATCH];
+	size_t         n, total = 0;
+
+	NUTS_PASS(retain_cursor_open(rdb, filter, &cur));
+	while ((n = retain_cursor_next(cur, msgs, RETAIN_BATCH)) > 0) {
+		NUTS_TRUE(n <= RETAIN_BATCH);
+		for (size_t i = 0; i < n; i++) {
+			if (expect != NULL) {
+				NUTS_MATCH(nng_msg_body(msgs[i]), expect);
+			}
+			nng_msg_free(msgs[i]);
+		}
+		total += n;
+	}
+	retain_cursor_close(cur);
+	return total;
+}
+
+static void
+test_retain_db_match(void)
+{
+	retain_db *rdb;
+	char      *topics[] = { "a", "a/b", "a/b/c", "a/c", "ab", "ab/b",
+                "$SYS/a", "b/b/c" };
+
+	NUTS_PASS(retain_db_create(&rdb));
+	for (size_t i = 0; i < sizeof(topics) / sizeof(topics[0]); i++) {
+		nng_msg *old =
+		    retain_db_insert(rdb, topics[i], retain_msg(topics[i]));
+		NUTS_NULL(old);
+	}
+	NUTS_TRUE(retain_db_count(rdb) == 8);
+
+	NUTS_TRUE(retain_query(rdb, "a/b", "a/b") == 1);
+	NUTS_TRUE(retain_query(rdb, "a/#", NULL) == 4);
+	NUTS_TRUE(retain_query(rdb, "a/+", NULL) == 2);
+	NUTS_TRUE(retain_query(rdb, "+/b/c", NULL) == 2);
+	NUTS_TRUE(retain_query(rdb, "+", NULL) == 2);
+	NUTS_TRUE(retain_query(rdb, "#", NULL) == 7);
+	NUTS_TRUE(retain_query(rdb, "$SYS/#", "$SYS/a") == 1);
+	NUTS_TRUE(retain_query(rdb, "c/#", NULL) == 0);
+
+	// replace and delete
+	nng_msg *old = retain_db_insert(rdb, "a/b", retain_msg("a/b"));
+	NUTS_TRUE(old != NULL);
+	nng_msg_free(old);
+	old = retain_db_delete(rdb, "a/b");
+	NUTS_TRUE(old != NULL);
+	nng_msg_free(old);
+	old = retain_db_delete(rdb, "a/b");
+	NUTS_NULL(old);
+	NUTS_TRUE(retain_query(rdb, "a/#", NULL) == 3);
+	NUTS_TRUE(retain_db_count(rdb) == 7);
+
+	retain_db_destroy(rdb);
+}
+
+// Wildcard query over many retained topics is streamed in batches, while
+// publishing goes on between the batches.
+static void
+test_retain_db_stream(void)
+{
+	retain_db     *rdb;
+	retain_cursor *cur;
+	nng_msg       *msgs[RETAIN_BATCH];
+	char           topic[64];
+	size_t         n, total = 0;
+
+	NUTS_PASS(retain_db_create(&rdb));
+	for (int i = 0; i < RETAIN_TOPICS; i++) {
+		snprintf(topic, sizeof(topic), "devices/%d/state", i);
+		NUTS_TRUE(retain_db_insert(rdb, topic, retain_msg(topic)) == NULL);
+		snprintf(topic, sizeof(topic), "others/%d/state", i);
+		NUTS_TRUE(retain_db_insert(rdb, topic, retain_msg(topic)) == NULL);
+	}
+
+	NUTS_PASS(retain_cursor_open(rdb, "devices/#", &cur));
+	while ((n = retain_cursor_next(cur, msgs, RETAIN_BATCH)) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			NUTS_TRUE(strncmp(nng_msg_body(msgs[i]), "devices/",
+			              8) == 0);
+			nng_msg_free(msgs[i]);
+		}
+		total += n;
+		// publish in between never blocks on the query
+		nng_msg *old =
+		    retain_db_insert(rdb, "others/0/state", retain_msg("x"));
+		nng_msg_free(old);
+	}
+	retain_cursor_close(cur);
+	NUTS_TRUE(total == RETAIN_TOPICS);
+
+	retain_db_destroy(rdb);
+}
+
+static size_t
+dbtree_retain_count(dbtree *db, char *filter)
+{
+	nng_msg **rets = dbtree_find_retain(db, filter);
+	size_t    n    = cvector_size(rets);
+
+	for (size_t i = 0; i < n; i++) {
+		nng_msg_free(rets[i]);
+	}
+	cvector_free(rets);
+	return n;
+}
+
+// Wildcard retain queries of the dbtree go through its retain_db.
+static void
+test_dbtree_retain(void)
+{
+	dbtree   *db;
+	nng_msg  *old;
+	char     *topics[] = { "a", "a/b", "a/b/c", "a/c", "ab/b", "$SYS/a" };
+
+	dbtree_create(&db);
+	for (size_t i = 0; i < sizeof(topics) / sizeof(topics[0]); i++) {
+		old = dbtree_insert_retain(db, topics[i], retain_msg(topics[i]));
+		NUTS_NULL(old);
+	}
+	NUTS_TRUE(dbtree_retain_count(db, "a/b") == 1);
+	NUTS_TRUE(dbtree_retain_count(db, "a/#") == 4);
+	NUTS_TRUE(dbtree_retain_count(db, "+/b") == 2);
+	NUTS_TRUE(dbtree_retain_count(db, "#") == 5);
+
+	// replaced msg is handed back, index keeps the new one
+	old = dbtree_insert_retain(db, "a/b", retain_msg("a/b/2"));
+	NUTS_TRUE(old != NULL);
+	nng_msg_free(old);
+	nng_msg **rets = dbtree_find_retain(db, "a/+");
+	NUTS_TRUE(cvector_size(rets) == 2);
+	for (size_t i = 0; i < cvector_size(rets); i++) {
+		NUTS_TRUE(strcmp(nng_msg_body(rets[i]), "a/b") != 0);
+		nng_msg_free(rets[i]);
+	}
+	cvector_free(rets);
+
+	old = dbtree_delete_retain(db, "a/b");
+	NUTS_TRUE(old != NULL);
+	nng_msg_free(old);
+	NUTS_TRUE(dbtree_retain_count(db, "a/#") == 3);
+
+	for (size_t i = 0; i < sizeof(topics) / sizeof(topics[0]); i++) {
+		nng_msg_free(dbtree_delete_retain(db, topics[i]));
+	}
+	NUTS_TRUE(dbtree_retain_count(db, "#") == 0);
+	dbtree_destory(db);
+}
+
+TEST_LIST = {
+	{ "retain db match", test_retain_db_match },
+	{ "retain db stream", test_retain_db_stream },
+	{ "dbtree retain", test_dbtree_retain },
+	{ NULL, NULL },
+};
@@ -9,6 +9,12 @@
 #include "nng/supplemental/nanolib/blf.h"
 #include "nng/supplemental/nanolib/ringbuffer.h"
 #include "core/nng_impl.h"
+#include <inttypes.h>
+#include <time.h>
+
+/* Names ringbuffers apart for their default segment directory */
+static nni_mtx  rb_name_lock = NNI_MTX_INITIALIZER;
+static uint32_t rb_name_seq;
 
 static inline int ringBuffer_get_msgs(ringBuffer_t *rb, unsigned int *count, nng_msg ***list)
 {
@@ -139,6 +145,17 @@ int ringBuffer_init(ringBuffer_t **rb,
 	newRB->expiredAt = expiredAt;
 	newRB->fullOp = fullOp;
 	newRB->files = NULL;
+	newRB->topic = NULL;
+	newRB->segs = NULL;
+	newRB->segsTmp = false;
+
+	/* Unique to this ringbuffer of this run, segments of others or of
+	 * a last run must not be read back as its own */
+	nni_mtx_lock(&rb_name_lock);
+	(void)snprintf(newRB->name, sizeof(newRB->name), "%d-%llu-%u",
+				   nni_plat_getpid(), (unsigned long long)time(NULL),
+				   rb_name_seq++);
+	nni_mtx_unlock(&rb_name_lock);
 
 	newRB->enqinRuleList[0] = NULL;
 	newRB->enqoutRuleList[0] = NULL;
@@ -350,6 +367,8 @@ static parquet_object *init_parquet_object(ringBuffer_t *rb, ringBufferFile_t *f
 		nng_free(dsize, sizeof(uint32_t) * rb->size);
 		return NULL;
 	}
+	newObj->topic = rb->topic;
+	newObj->msgs  = smsgs;
 
 	return newObj;
 }
@@ -475,8 +494,8 @@ static inline int init_newList_with_packet(void ***newList, int **newmsgLen,
 	return 0;
 }
 
-int ringBuffer_get_msgs_from_file_by_keys(ringBuffer_t *rb, uint64_t *keys, uint32_t count,
-										  void ***msgs, int **msgLen)
+static int ringBuffer_get_msgs_from_parquet_by_keys(ringBuffer_t *rb, uint64_t *keys, uint32_t count,
+												   void ***msgs, int **msgLen)
 {
 	if (rb == NULL || rb->files == NULL || keys == NULL || msgs == NULL || msgLen == NULL) {
 		log_error("ringbuffer is NULL or files is NULL or keys is NULL or msg is NULL or msgLen is NULL\n");
@@ -529,7 +548,7 @@ int ringBuffer_get_msgs_from_file_by_keys(ringBuffer_t *rb, uint64_t *keys, uint
 
 }
 
-int ringBuffer_get_msgs_from_file(ringBuffer_t *rb, void ***msgs, int **msgLen)
+static int ringBuffer_get_msgs_from_parquet(ringBuffer_t *rb, void ***msgs, int **msgLen)
 {
 	int ret = 0;
 
@@ -617,7 +636,234 @@ int ringBuffer_get_msgs_from_file(ringBuffer_t *rb, void ***msgs, int **msgLen)
 	return packet_count;
 }
 
+static int ringBuffer_get_msgs_from_parquet_by_range(ringBuffer_t *rb, uint64_t start, uint64_t end,
+													 void ***msgs, int **msgLen)
+{
+	uint32_t size = 0;
+
+	parquet_data_packet **packet = parquet_find_data_span_packets(NULL, start, end, &size, rb->topic);
+	if (packet == NULL || size == 0) {
+		log_error("packet is NULL\n");
+		return -1;
+	}
+
+	int ret = init_newList_with_packet(msgs, msgLen, packet, size, size);
+	free_msgs_from_file(NULL, NULL, NULL, NULL, packet, size, size);
+	if (ret != 0) {
+		log_error("init new list with packet failed\n");
+		return -1;
+	}
+
+	return size;
+}
+
+#endif
+
+static int write_msgs_to_segment(ringBuffer_t *rb)
+{
+	if (rb->segs == NULL) {
+		char dir[sizeof(RB_SEGMENT_DIR) + RBNAME_LEN + 1];
+		(void)snprintf(dir, sizeof(dir), "%s/%s", RB_SEGMENT_DIR, rb->name);
+		if (segment_store_open(&rb->segs, dir, 0, 0) != 0) {
+			log_error("open segment store %s failed, msg will be freed\n", dir);
+			ringBuffer_clean_msgs(rb, 1);
+			return -1;
+		}
+		rb->segsTmp = true;
+	}
+
+	for (unsigned int i = 0, idx = rb->head; i < rb->size; i++, idx = (idx + 1) % rb->cap) {
+		nng_msg *msg = (nng_msg *)rb->msgs[idx].data;
+		uint8_t *body = nng_msg_body(msg);
+		uint8_t *payload = nng_msg_payload_ptr(msg);
+		if (payload == NULL) {
+			payload = body;
+		}
+		uint32_t len = nng_msg_len(msg) - (payload - body);
+
+		if (segment_store_append(rb->segs, rb->msgs[idx].key, payload, len) != 0) {
+			log_error("append msg of key %" PRIu64 " to segment failed\n",
+					  rb->msgs[idx].key);
+		}
+	}
+
+	ringBuffer_clean_msgs(rb, 1);
+	return 0;
+}
+
+typedef struct {
+	char **list; /* cvector */
+	int *len;    /* cvector */
+	bool nomem;
+} ringBufferSegmentList_t;
+
+static bool ringBuffer_segment_cb(uint64_t key, const uint8_t *data, uint32_t len, void *arg)
+{
+	ringBufferSegmentList_t *sl = (ringBufferSegmentList_t *)arg;
+	(void)key;
+
+	char *msg = nng_alloc(len == 0 ? 1 : len);
+	if (msg == NULL) {
+		sl->nomem = true;
+		return false;
+	}
+	memcpy(msg, data, len);
+	cvector_push_back(sl->list, msg);
+	cvector_push_back(sl->len, (int)len);
+
+	return true;
+}
+
+static int ringBuffer_segment_list_done(ringBufferSegmentList_t *sl, void ***msgs, int **msgLen)
+{
+	int count = (int)cvector_size(sl->list);
+	char **list = NULL;
+	int *lens = NULL;
+
+	if (count > 0 && !sl->nomem) {
+		list = nng_alloc(sizeof(char *) * count);
+		lens = nng_alloc(sizeof(int) * count);
+	}
+	if (list == NULL || lens == NULL) {
+		if (count > 0) {
+			log_error("no msg found in segments or no memory\n");
+		}
+		for (int i = 0; i < count; i++) {
+			nng_free(sl->list[i], sl->len[i]);
+		}
+		if (list != NULL) {
+			nng_free(list, sizeof(char *) * count);
+		}
+		if (lens != NULL) {
+			nng_free(lens, sizeof(int) * count);
+		}
+		cvector_free(sl->list);
+		cvector_free(sl->len);
+		return -1;
+	}
+
+	memcpy(list, sl->list, sizeof(char *) * count);
+	memcpy(lens, sl->len, sizeof(int) * count);
+	cvector_free(sl->list);
+	cvector_free(sl->len);
+
+	*msgs = (void **)list;
+	*msgLen = lens;
+
+	return count;
+}
+
+static int ringBuffer_get_msgs_from_segment(ringBuffer_t *rb, uint64_t start, uint64_t end,
+											void ***msgs, int **msgLen)
+{
+	ringBufferSegmentList_t sl = { NULL, NULL, false };
+
+	(void)segment_store_foreach_span(rb->segs, start, end, ringBuffer_segment_cb, &sl);
+
+	return ringBuffer_segment_list_done(&sl, msgs, msgLen);
+}
+
+static int ringBuffer_get_msgs_from_segment_by_keys(ringBuffer_t *rb, uint64_t *keys, uint32_t count,
+													void ***msgs, int **msgLen)
+{
+	ringBufferSegmentList_t sl = { NULL, NULL, false };
+
+	for (uint32_t i = 0; i < count && !sl.nomem; i++) {
+		uint8_t *data;
+		uint32_t len;
+		if (segment_store_get(rb->segs, keys[i], &data, &len) != 0) {
+			continue;
+		}
+		cvector_push_back(sl.list, (char *)data);
+		cvector_push_back(sl.len, (int)len);
+	}
+
+	return ringBuffer_segment_list_done(&sl, msgs, msgLen);
+}
+
+int ringBuffer_get_msgs_from_file(ringBuffer_t *rb, void ***msgs, int **msgLen)
+{
+	if (rb == NULL || msgs == NULL || msgLen == NULL) {
+		log_error("ringbuffer is NULL or msgs is NULL or msgLen is NULL\n");
+		return -1;
+	}
+
+	if (rb->segs != NULL) {
+		return ringBuffer_get_msgs_from_segment(rb, 0, UINT64_MAX, msgs, msgLen);
+	}
+#ifdef SUPP_PARQUET
+	return ringBuffer_get_msgs_from_parquet(rb, msgs, msgLen);
+#else
+	log_error("ringbuffer has no file\n");
+	return -1;
+#endif
+}
+
+int ringBuffer_get_msgs_from_file_by_keys(ringBuffer_t *rb, uint64_t *keys, uint32_t count,
+										  void ***msgs, int **msgLen)
+{
+	if (rb == NULL || keys == NULL || msgs == NULL || msgLen == NULL) {
+		log_error("ringbuffer is NULL or keys is NULL or msgs is NULL or msgLen is NULL\n");
+		return -1;
+	}
+
+	if (rb->segs != NULL) {
+		return ringBuffer_get_msgs_from_segment_by_keys(rb, keys, count, msgs, msgLen);
+	}
+#ifdef SUPP_PARQUET
+	return ringBuffer_get_msgs_from_parquet_by_keys(rb, keys, count, msgs, msgLen);
+#else
+	log_error("ringbuffer has no file\n");
+	return -1;
 #endif
+}
+
+int ringBuffer_get_msgs_from_file_by_range(ringBuffer_t *rb, uint64_t start, uint64_t end,
+										   void ***msgs, int **msgLen)
+{
+	if (rb == NULL || msgs == NULL || msgLen == NULL || start > end) {
+		log_error("ringbuffer is NULL or msgs is NULL or msgLen is NULL or start > end\n");
+		return -1;
+	}
+
+	if (rb->segs != NULL) {
+		return ringBuffer_get_msgs_from_segment(rb, start, end, msgs, msgLen);
+	}
+#ifdef SUPP_PARQUET
+	return ringBuffer_get_msgs_from_parquet_by_range(rb, start, end, msgs, msgLen);
+#else
+	log_error("ringbuffer has no file\n");
+	return -1;
+#endif
+}
+
+int ringBuffer_set_segment(ringBuffer_t *rb, const char *dir,
+						   uint32_t seg_size, uint32_t seg_count)
+{
+	segment_store *segs = NULL;
+
+	if (rb == NULL || dir == NULL) {
+		log_error("ringbuffer is NULL or dir is NULL\n");
+		return -1;
+	}
+
+	if (segment_store_open(&segs, dir, seg_size, seg_count) != 0) {
+		log_error("open segment store %s failed\n", dir);
+		return -1;
+	}
+
+	nng_mtx_lock(rb->ring_lock);
+	if (rb->segsTmp) {
+		segment_store_destroy(rb->segs);
+	} else {
+		segment_store_close(rb->segs);
+	}
+	rb->segs = segs;
+	rb->segsTmp = false;
+	nng_mtx_unlock(rb->ring_lock);
+
+	return 0;
+}
 
 #if defined (SUPP_BLF)
 
@@ -949,6 +1195,14 @@ int ringBuffer_enqueue(ringBuffer_t *rb,
 				return -1;
 			}
 		}
+		if (rb->fullOp == RB_FULL_SEGMENT) {
+			ret = write_msgs_to_segment(rb);
+			if (ret != 0) {
+				log_error("Ring buffer is full and write msgs to segment failed!\n");
+				nng_mtx_unlock(rb->ring_lock);
+				return -1;
+			}
+		}
 	}
 
 	ringBufferMsg_t *msg = &rb->msgs[rb->tail];
@@ -1045,6 +1299,12 @@ int ringBuffer_release(ringBuffer_t *rb)
 		cvector_free(rb->files);
 	}
 
+	if (rb->segsTmp) {
+		segment_store_destroy(rb->segs);
+	} else {
+		segment_store_close(rb->segs);
+	}
+
 	ringBufferRuleList_release(rb->enqinRuleList, rb->enqinRuleListLen);
 	ringBufferRuleList_release(rb->deqinRuleList, rb->deqinRuleListLen);
 	ringBufferRuleList_release(rb->enqoutRuleList, rb->enqoutRuleListLen);
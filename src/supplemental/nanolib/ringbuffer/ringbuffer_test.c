@@ -529,6 +529,119 @@ void test_ringBuffer_get_and_clean_up()
 
 }
 
+static inline void free_file_msgs(void **msgs, int *msgLen, int count)
+{
+	for (int i = 0; i < count; i++) {
+		nng_free(msgs[i], msgLen[i]);
+	}
+	nng_free(msgs, sizeof(void *) * count);
+	nng_free(msgLen, sizeof(int) * count);
+}
+
+/* Removes the segments of an earlier run in dir */
+static void segment_dir_remove(const char *dir)
+{
+	segment_store *segs;
+
+	NUTS_PASS(segment_store_open(&segs, dir, 4096, 4));
+	segment_store_destroy(segs);
+	NUTS_TRUE(!nng_file_is_dir(dir));
+}
+
+void test_ringBuffer_segment(void)
+{
+	ringBuffer_t *rb;
+	nng_msg *tmp;
+	void **msgs;
+	int *msgLen;
+	char buf[32];
+	uint64_t keys[3] = { 3, 17, 1000 };
+	int count;
+
+	segment_dir_remove("/tmp/nanomq-rb-segment-test");
+	NUTS_TRUE(ringBuffer_init(&rb, 10, RB_FULL_SEGMENT, -1) == 0);
+	NUTS_TRUE(ringBuffer_set_segment(rb, "/tmp/nanomq-rb-segment-test", 4096, 4) == 0);
+
+	/* Two flushes, the last 5 msgs stay in memory */
+	for (int i = 0; i < 25; i++) {
+		NUTS_PASS(nng_msg_alloc(&tmp, 0));
+		snprintf(buf, sizeof(buf), "msg %d", i);
+		NUTS_PASS(nng_msg_append(tmp, buf, strlen(buf)));
+		NUTS_TRUE(ringBuffer_enqueue(rb, i, tmp, -1, NULL) == 0);
+	}
+	NUTS_TRUE(rb->size == 5);
+
+	count = ringBuffer_get_msgs_from_file(rb, &msgs, &msgLen);
+	NUTS_TRUE(count == 20);
+	NUTS_TRUE(msgLen[7] == 5 && memcmp(msgs[7], "msg 7", 5) == 0);
+	free_file_msgs(msgs, msgLen, count);
+
+	count = ringBuffer_get_msgs_from_file_by_keys(rb, keys, 3, &msgs, &msgLen);
+	NUTS_TRUE(count == 2);
+	NUTS_TRUE(msgLen[1] == 6 && memcmp(msgs[1], "msg 17", 6) == 0);
+	free_file_msgs(msgs, msgLen, count);
+
+	count = ringBuffer_get_msgs_from_file_by_range(rb, 5, 14, &msgs, &msgLen);
+	NUTS_TRUE(count == 10);
+	NUTS_TRUE(msgLen[0] == 5 && memcmp(msgs[0], "msg 5", 5) == 0);
+	free_file_msgs(msgs, msgLen, count);
+
+	NUTS_TRUE(ringBuffer_get_msgs_from_file_by_range(rb, 20, 30, &msgs, &msgLen) == -1);
+	NUTS_TRUE(ringBuffer_release(rb) == 0);
+	segment_dir_remove("/tmp/nanomq-rb-segment-test");
+}
+
+/* Two segment ringbuffers in the default directory keep their own msgs,
+ * which are gone with them */
+void test_ringBuffer_segment_two(void)
+{
+	ringBuffer_t *rb[2];
+	nng_msg *tmp;
+	void **msgs;
+	int *msgLen;
+	char buf[64];
+	char dir[sizeof(RB_SEGMENT_DIR) + RBNAME_LEN + 1];
+	uint64_t key = 4;
+	int count;
+
+	for (int r = 0; r < 2; r++) {
+		NUTS_TRUE(ringBuffer_init(&rb[r], 10, RB_FULL_SEGMENT, -1) == 0);
+	}
+	NUTS_TRUE(strcmp(rb[0]->name, rb[1]->name) != 0);
+
+	/* Same keys in both, one flush each, the 11th stays in memory */
+	for (int i = 0; i < 11; i++) {
+		for (int r = 0; r < 2; r++) {
+			NUTS_PASS(nng_msg_alloc(&tmp, 0));
+			snprintf(buf, sizeof(buf), "rb%d %d", r, i);
+			NUTS_PASS(nng_msg_append(tmp, buf, strlen(buf)));
+			NUTS_TRUE(ringBuffer_enqueue(rb[r], i, tmp, -1, NULL) == 0);
+		}
+	}
+
+	for (int r = 0; r < 2; r++) {
+		count = ringBuffer_get_msgs_from_file(rb[r], &msgs, &msgLen);
+		NUTS_TRUE(count == 10);
+		for (int i = 0; i < count; i++) {
+			snprintf(buf, sizeof(buf), "rb%d %d", r, i);
+			NUTS_TRUE(msgLen[i] == (int)strlen(buf) &&
+					  memcmp(msgs[i], buf, msgLen[i]) == 0);
+		}
+		free_file_msgs(msgs, msgLen, count);
+
+		count = ringBuffer_get_msgs_from_file_by_keys(rb[r], &key, 1, &msgs, &msgLen);
+		NUTS_TRUE(count == 1);
+		snprintf(buf, sizeof(buf), "rb%d 4", r);
+		NUTS_TRUE(memcmp(msgs[0], buf, strlen(buf)) == 0);
+		free_file_msgs(msgs, msgLen, count);
+
+		snprintf(dir, sizeof(dir), "%s/%s", RB_SEGMENT_DIR, rb[r]->name);
+		NUTS_TRUE(nng_file_is_dir(dir));
+		NUTS_TRUE(ringBuffer_release(rb[r]) == 0);
+		NUTS_TRUE(!nng_file_is_dir(dir));
+	}
+}
+
 NUTS_TESTS = {
 	{ "Ring buffer init test", test_ringBuffer_init },
 	{ "Ring buffer release test", test_ringBuffer_release },
@@ -539,5 +652,7 @@ NUTS_TESTS = {
 	{ "Ring buffer search msgs by key", test_ringBuffer_search_msgs_by_key },
 	{ "Ring buffer search msgs fuzz", test_ringBuffer_search_msgs_fuzz },
 	{ "Ring buffer get and clean up test", test_ringBuffer_get_and_clean_up},
+	{ "Ring buffer segment file", test_ringBuffer_segment },
+	{ "Ring buffer two segment files", test_ringBuffer_segment_two },
 	{ NULL, NULL },
 };
@@ -0,0 +1,669 @@
+//
+// Copyright 2024 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+// Segment store.
+// A segment file starts with a header and is followed by records:
+//
+//   | len u32 | crc u32 | key u64 | data [len] | pad to 8 |
+//
+// crc is crc32c of key and data. Segment files are preallocated and zero
+// filled, so the first record failing its crc ends a segment, either at
+// its free space or at a record torn by a crash. Every SEGMENT_INDEX_GAP
+// bytes a record is put in the sparse index of its segment, lookups in a
+// segment of sorted keys start from the index and stop past end key.
+
+#include <string.h>
+
+#include "core/nng_impl.h"
+#include "nng/protocol/mqtt/mqtt_parser.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/nanolib/segment.h"
+
+#ifdef NNG_PLATFORM_POSIX
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SEGMENT_MAGIC "NSEG"
+#define SEGMENT_VERSION 1
+#define SEGMENT_HDR_SIZE 32
+#define SEGMENT_REC_HDR_SIZE 16
+#define SEGMENT_INDEX_GAP 4096
+#define SEGMENT_ALIGN(n) (((n) + 7) & ~(size_t) 7)
+
+typedef struct {
+	uint64_t key;
+	uint32_t off;
+} segment_index;
+
+typedef struct {
+	uint64_t       seq;
+	int            fd;
+	uint8_t       *base;
+	uint32_t       size;
+	uint32_t       used; // end of records
+	uint32_t       records;
+	uint64_t       min_key;
+	uint64_t       max_key;
+	bool           sorted;
+	segment_index *index; // cvector
+	uint32_t       index_next;
+} segment;
+
+struct segment_store {
+	char     *dir;
+	uint32_t  seg_size;
+	uint32_t  seg_count;
+	nng_mtx  *mtx;
+	segment **segs; // cvector, oldest first, last is appended to
+	uint64_t  next_seq;
+	size_t    records;
+};
+
+static char *
+segment_path(segment_store *s, uint64_t seq)
+{
+	char  *path;
+	size_t len = strlen(s->dir) + 32;
+
+	if ((path = nng_alloc(len)) != NULL) {
+		snprintf(path, len, "%s/%020" PRIu64 ".seg", s->dir, seq);
+	}
+	return path;
+}
+
+static void
+segment_free(segment *seg)
+{
+	if (seg->base != NULL) {
+		munmap(seg->base, seg->size);
+	}
+	if (seg->fd >= 0) {
+		close(seg->fd);
+	}
+	cvector_free(seg->index);
+	NNI_FREE_STRUCT(seg);
+}
+
+static void
+segment_index_add(segment *seg, uint64_t key, uint32_t off)
+{
+	if (seg->records == 0) {
+		seg->min_key = key;
+		seg->max_key = key;
+	} else {
+		if (key < seg->max_key) {
+			seg->sorted = false;
+		}
+		seg->min_key = key < seg->min_key ? key : seg->min_key;
+		seg->max_key = key > seg->max_key ? key : seg->max_key;
+	}
+	seg->records++;
+	if (off >= seg->index_next) {
+		segment_index ent = { .key = key, .off = off };
+		cvector_push_back(seg->index, ent);
+		seg->index_next = off + SEGMENT_INDEX_GAP;
+	}
+}
+
+// Record at off, false at the end of records. Records below seg->used
+// were checked when appended or loaded, walks skip the crc.
+static bool
+segment_record(segment *seg, uint32_t off, bool check, uint64_t *key,
+    uint8_t **data, uint32_t *len, uint32_t *next)
+{
+	uint32_t rlen, crc;
+
+	if (off + SEGMENT_REC_HDR_SIZE > seg->size) {
+		return false;
+	}
+	memcpy(&rlen, seg->base + off, 4);
+	memcpy(&crc, seg->base + off + 4, 4);
+	if (rlen > seg->size - off - SEGMENT_REC_HDR_SIZE) {
+		return false;
+	}
+	if (check &&
+	    crc32c_hashn((char *) seg->base + off + 8, 8 + (size_t) rlen) !=
+	        crc) {
+		return false;
+	}
+	memcpy(key, seg->base + off + 8, 8);
+	*data = seg->base + off + SEGMENT_REC_HDR_SIZE;
+	*len  = rlen;
+	*next = off + SEGMENT_ALIGN(SEGMENT_REC_HDR_SIZE + (size_t) rlen);
+	return true;
+}
+
+// Map a segment file, a new one is preallocated and given a header.
+static int
+segment_map(segment_store *s, uint64_t seq, bool create, segment **segp)
+{
+	segment    *seg;
+	char       *path;
+	struct stat st;
+	int         rv = 0;
+
+	if ((path = segment_path(s, seq)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if ((seg = NNI_ALLOC_STRUCT(seg)) == NULL) {
+		nng_free(path, strlen(path) + 1);
+		return (NNG_ENOMEM);
+	}
+	seg->seq        = seq;
+	seg->sorted     = true;
+	seg->used       = SEGMENT_HDR_SIZE;
+	seg->index_next = SEGMENT_HDR_SIZE;
+
+	seg->fd = open(path, create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0644);
+	if (seg->fd < 0) {
+		rv = nni_plat_errno(errno);
+		goto fail;
+	}
+	if (create) {
+		if ((rv = posix_fallocate(seg->fd, 0, s->seg_size)) != 0) {
+			rv = nni_plat_errno(rv);
+			unlink(path);
+			goto fail;
+		}
+		seg->size = s->seg_size;
+	} else {
+		if (fstat(seg->fd, &st) != 0) {
+			rv = nni_plat_errno(errno);
+			goto fail;
+		}
+		if (st.st_size < SEGMENT_HDR_SIZE || st.st_size > UINT32_MAX) {
+			rv = NNG_EINVAL;
+			goto fail;
+		}
+		seg->size = (uint32_t) st.st_size;
+	}
+	seg->base = mmap(
+	    NULL, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+	if (seg->base == MAP_FAILED) {
+		seg->base = NULL;
+		rv        = nni_plat_errno(errno);
+		goto fail;
+	}
+
+	if (create) {
+		uint32_t ver = SEGMENT_VERSION;
+		memcpy(seg->base, SEGMENT_MAGIC, 4);
+		memcpy(seg->base + 4, &ver, 4);
+		memcpy(seg->base + 8, &seq, 8);
+		memcpy(seg->base + 16, &seg->size, 4);
+	} else if (memcmp(seg->base, SEGMENT_MAGIC, 4) != 0) {
+		rv = NNG_EINVAL;
+		goto fail;
+	} else {
+		uint64_t key;
+		uint8_t *data;
+		uint32_t len, next;
+		while (segment_record(
+		    seg, seg->used, true, &key, &data, &len, &next)) {
+			segment_index_add(seg, key, seg->used);
+			seg->used = next;
+		}
+	}
+
+	nng_free(path, strlen(path) + 1);
+	*segp = seg;
+	return (0);
+
+fail:
+	log_error("segment %s: %s", path, nng_strerror(rv));
+	nng_free(path, strlen(path) + 1);
+	segment_free(seg);
+	return (rv);
+}
+
+// Called with lock held.
+static void
+segment_remove_oldest(segment_store *s)
+{
+	segment *seg  = s->segs[0];
+	char    *path = segment_path(s, seg->seq);
+
+	s->records -= seg->records;
+	cvector_erase(s->segs, 0);
+	segment_free(seg);
+	if (path != NULL) {
+		if (unlink(path) != 0) {
+			log_error("Failed to remove %s errno: %d", path, errno);
+		}
+		nng_free(path, strlen(path) + 1);
+	}
+}
+
+// mkdir -p
+static int
+segment_mkdir(const char *dir)
+{
+	char *path;
+	int   rv = 0;
+
+	if ((path = nng_strdup(dir)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	for (char *p = path + 1;; p++) {
+		if (*p != '/' && *p != '\0') {
+			continue;
+		}
+		char c = *p;
+		*p     = '\0';
+		if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+			rv = nni_plat_errno(errno);
+			break;
+		}
+		if ((*p = c) == '\0') {
+			break;
+		}
+	}
+	nng_strfree(path);
+	return (rv);
+}
+
+static int
+segment_seq_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+static int
+segment_load(segment_store *s)
+{
+	DIR           *dir;
+	struct dirent *ent;
+	uint64_t      *seqs = NULL;
+	int            rv   = 0;
+
+	if ((dir = opendir(s->dir)) == NULL) {
+		return (nni_plat_errno(errno));
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		uint64_t seq;
+		char     c;
+		if (sscanf(ent->d_name, "%" SCNu64 ".se%c", &seq, &c) == 2 &&
+		    c == 'g') {
+			cvector_push_back(seqs, seq);
+		}
+	}
+	closedir(dir);
+
+	if (seqs != NULL) {
+		qsort(seqs, cvector_size(seqs), sizeof(uint64_t),
+		    segment_seq_cmp);
+	}
+	for (size_t i = 0; i < cvector_size(seqs); i++) {
+		segment *seg;
+		s->next_seq = seqs[i] + 1;
+		if ((rv = segment_map(s, seqs[i], false, &seg)) != 0) {
+			// leave an unreadable segment for inspection
+			rv = 0;
+			continue;
+		}
+		cvector_push_back(s->segs, seg);
+		s->records += seg->records;
+		if (cvector_size(s->segs) > s->seg_count) {
+			segment_remove_oldest(s);
+		}
+	}
+	cvector_free(seqs);
+
+	// Clear what follows the last good record of the active segment, a
+	// record torn by a crash could reappear behind the next appends.
+	if (!cvector_empty(s->segs)) {
+		segment *seg  = s->segs[cvector_size(s->segs) - 1];
+		uint32_t tail = seg->size - seg->used;
+		if (tail > SEGMENT_REC_HDR_SIZE) {
+			tail = SEGMENT_REC_HDR_SIZE;
+		}
+		for (uint32_t i = 0; i < tail; i++) {
+			if (seg->base[seg->used + i] != 0) {
+				memset(seg->base + seg->used, 0,
+				    seg->size - seg->used);
+				break;
+			}
+		}
+	}
+	return (rv);
+}
+
+int
+segment_store_open(
+    segment_store **sp, const char *dir, uint32_t seg_size, uint32_t seg_count)
+{
+	segment_store *s;
+	int            rv;
+
+	if (sp == NULL || dir == NULL) {
+		return (NNG_EINVAL);
+	}
+	if (seg_size == 0) {
+		seg_size = SEGMENT_SIZE_DEFAULT;
+	}
+	if (seg_size < SEGMENT_HDR_SIZE + SEGMENT_REC_HDR_SIZE) {
+		return (NNG_EINVAL);
+	}
+	if ((rv = segment_mkdir(dir)) != 0) {
+		return (rv);
+	}
+	if ((s = NNI_ALLOC_STRUCT(s)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	s->seg_size  = seg_size;
+	s->seg_count = seg_count == 0 ? SEGMENT_COUNT_DEFAULT : seg_count;
+	if ((s->dir = nng_strdup(dir)) == NULL) {
+		NNI_FREE_STRUCT(s);
+		return (NNG_ENOMEM);
+	}
+	if ((rv = nng_mtx_alloc(&s->mtx)) != 0 || (rv = segment_load(s)) != 0) {
+		segment_store_close(s);
+		return (rv);
+	}
+	*sp = s;
+	return (0);
+}
+
+void
+segment_store_close(segment_store *s)
+{
+	if (s == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < cvector_size(s->segs); i++) {
+		msync(s->segs[i]->base, s->segs[i]->size, MS_SYNC);
+		segment_free(s->segs[i]);
+	}
+	cvector_free(s->segs);
+	if (s->mtx != NULL) {
+		nng_mtx_free(s->mtx);
+	}
+	nng_strfree(s->dir);
+	NNI_FREE_STRUCT(s);
+}
+
+void
+segment_store_destroy(segment_store *s)
+{
+	if (s == NULL) {
+		return;
+	}
+	while (!cvector_empty(s->segs)) {
+		segment_remove_oldest(s);
+	}
+	// files of others are left, and the directory with them
+	(void) nng_file_delete(s->dir);
+	segment_store_close(s);
+}
+
+int
+segment_store_append(
+    segment_store *s, uint64_t key, const void *data, uint32_t len)
+{
+	size_t   need = SEGMENT_ALIGN(SEGMENT_REC_HDR_SIZE + (size_t) len);
+	segment *seg;
+	uint32_t crc;
+	int      rv;
+
+	if (need > s->seg_size - SEGMENT_HDR_SIZE) {
+		return (NNG_EMSGSIZE);
+	}
+
+	nng_mtx_lock(s->mtx);
+	seg = cvector_empty(s->segs) ? NULL : s->segs[cvector_size(s->segs) - 1];
+	if (seg == NULL || seg->used + need > seg->size) {
+		if (seg != NULL) {
+			// sealed, written back by the kernel from now on
+			msync(seg->base, seg->size, MS_ASYNC);
+		}
+		if ((rv = segment_map(s, s->next_seq, true, &seg)) != 0) {
+			nng_mtx_unlock(s->mtx);
+			return (rv);
+		}
+		s->next_seq++;
+		cvector_push_back(s->segs, seg);
+		if (cvector_size(s->segs) > s->seg_count) {
+			segment_remove_oldest(s);
+		}
+	}
+
+	uint8_t *rec = seg->base + seg->used;
+	memcpy(rec + 8, &key, 8);
+	if (len > 0) {
+		memcpy(rec + SEGMENT_REC_HDR_SIZE, data, len);
+	}
+	crc = crc32c_hashn((char *) rec + 8, 8 + (size_t) len);
+	memcpy(rec, &len, 4);
+	memcpy(rec + 4, &crc, 4);
+
+	segment_index_add(seg, key, seg->used);
+	seg->used += need;
+	s->records++;
+	nng_mtx_unlock(s->mtx);
+	return (0);
+}
+
+int
+segment_store_sync(segment_store *s)
+{
+	int rv = 0;
+
+	nng_mtx_lock(s->mtx);
+	if (!cvector_empty(s->segs)) {
+		segment *seg = s->segs[cvector_size(s->segs) - 1];
+		if (msync(seg->base, seg->used, MS_SYNC) != 0) {
+			rv = nni_plat_errno(errno);
+		}
+	}
+	nng_mtx_unlock(s->mtx);
+	return (rv);
+}
+
+// Offset to start a walk from start_key, the last indexed record below it.
+static uint32_t
+segment_seek(segment *seg, uint64_t start_key)
+{
+	size_t lo = 0;
+	size_t hi = cvector_size(seg->index);
+
+	if (!seg->sorted) {
+		return (SEGMENT_HDR_SIZE);
+	}
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (seg->index[mid].key < start_key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (lo == 0 ? SEGMENT_HDR_SIZE : seg->index[lo - 1].off);
+}
+
+size_t
+segment_store_foreach_span(segment_store *s, uint64_t start_key,
+    uint64_t end_key, segment_store_cb cb, void *arg)
+{
+	size_t n = 0;
+
+	nng_mtx_lock(s->mtx);
+	for (size_t i = 0; i < cvector_size(s->segs); i++) {
+		segment *seg = s->segs[i];
+		uint64_t key;
+		uint8_t *data;
+		uint32_t len, next;
+
+		if (seg->records == 0 || seg->max_key < start_key ||
+		    seg->min_key > end_key) {
+			continue;
+		}
+		for (uint32_t off = segment_seek(seg, start_key);
+		     off < seg->used &&
+		     segment_record(seg, off, false, &key, &data, &len, &next);
+		     off = next) {
+			if (seg->sorted && key > end_key) {
+				break;
+			}
+			if (key < start_key || key > end_key) {
+				continue;
+			}
+			n++;
+			if (!cb(key, data, len, arg)) {
+				nng_mtx_unlock(s->mtx);
+				return (n);
+			}
+		}
+	}
+	nng_mtx_unlock(s->mtx);
+	return (n);
+}
+
+typedef struct {
+	uint8_t *data;
+	uint32_t len;
+	bool     nomem;
+} segment_get_arg;
+
+// Keeps a copy of the last match, records are unmapped once the walk
+// lets go of the lock.
+static bool
+segment_get_cb(uint64_t key, const uint8_t *data, uint32_t len, void *arg)
+{
+	segment_get_arg *ga = arg;
+	uint8_t         *copy;
+
+	NNI_ARG_UNUSED(key);
+	if ((copy = nng_alloc(len == 0 ? 1 : len)) == NULL) {
+		ga->nomem = true;
+		return (false);
+	}
+	memcpy(copy, data, len);
+	if (ga->data != NULL) {
+		nng_free(ga->data, ga->len == 0 ? 1 : ga->len);
+	}
+	ga->data = copy;
+	ga->len  = len;
+	return (true);
+}
+
+int
+segment_store_get(
+    segment_store *s, uint64_t key, uint8_t **data, uint32_t *len)
+{
+	segment_get_arg ga = { 0 };
+
+	segment_store_foreach_span(s, key, key, segment_get_cb, &ga);
+	if (ga.nomem) {
+		if (ga.data != NULL) {
+			nng_free(ga.data, ga.len == 0 ? 1 : ga.len);
+		}
+		return (NNG_ENOMEM);
+	}
+	if (ga.data == NULL) {
+		return (NNG_ENOENT);
+	}
+	*data = ga.data;
+	*len  = ga.len;
+	return (0);
+}
+
+size_t
+segment_store_count(segment_store *s)
+{
+	size_t n;
+
+	nng_mtx_lock(s->mtx);
+	n = s->records;
+	nng_mtx_unlock(s->mtx);
+	return (n);
+}
+
+#else
+
+int
+segment_store_open(
+    segment_store **sp, const char *dir, uint32_t seg_size, uint32_t seg_count)
+{
+	NNI_ARG_UNUSED(sp);
+	NNI_ARG_UNUSED(dir);
+	NNI_ARG_UNUSED(seg_size);
+	NNI_ARG_UNUSED(seg_count);
+	return (NNG_ENOTSUP);
+}
+
+void
+segment_store_close(segment_store *s)
+{
+	NNI_ARG_UNUSED(s);
+}
+
+void
+segment_store_destroy(segment_store *s)
+{
+	NNI_ARG_UNUSED(s);
+}
+
+int
+segment_store_append(
+    segment_store *s, uint64_t key, const void *data, uint32_t len)
+{
+	NNI_ARG_UNUSED(s);
+	NNI_ARG_UNUSED(key);
+	NNI_ARG_UNUSED(data);
+	NNI_ARG_UNUSED(len);
+	return (NNG_ENOTSUP);
+}
+
+int
+segment_store_sync(segment_store *s)
+{
+	NNI_ARG_UNUSED(s);
+	return (NNG_ENOTSUP);
+}
+
+size_t
+segment_store_foreach_span(segment_store *s, uint64_t start_key,
+    uint64_t end_key, segment_store_cb cb, void *arg)
+{
+	NNI_ARG_UNUSED(s);
+	NNI_ARG_UNUSED(start_key);
+	NNI_ARG_UNUSED(end_key);
+	NNI_ARG_UNUSED(cb);
+	NNI_ARG_UNUSED(arg);
+	return (0);
+}
+
+int
+segment_store_get(
+    segment_store *s, uint64_t key, uint8_t **data, uint32_t *len)
+{
+	NNI_ARG_UNUSED(s);
+	NNI_ARG_UNUSED(key);
+	NNI_ARG_UNUSED(data);
+	NNI_ARG_UNUSED(len);
+	return (NNG_ENOTSUP);
+}
+
+size_t
+segment_store_count(segment_store *s)
+{
+	NNI_ARG_UNUSED(s);
+	return (0);
+}
+
+#endif
@@ -0,0 +1,230 @@
+#include "nng/supplemental/nanolib/segment.h"
+#include "nng/supplemental/util/platform.h"
+#include <nuts.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SEG_SIZE 4096
+#define SEG_COUNT 4
+#define BENCH_RECORDS 200000
+#define BENCH_LOOKUPS 100000
+
+// Segments left in dir by an earlier run are removed.
+static void
+seg_dir(char *dir, size_t len, const char *name)
+{
+	segment_store *s;
+
+	snprintf(dir, len, "/tmp/nanomq-segment-test-%s", name);
+	NUTS_PASS(segment_store_open(&s, dir, 0, 0));
+	segment_store_destroy(s);
+	NUTS_TRUE(!nng_file_is_dir(dir));
+}
+
+static void
+seg_data(char *buf, size_t len, uint64_t key)
+{
+	snprintf(buf, len, "data of key %llu", (unsigned long long) key);
+}
+
+typedef struct {
+	uint64_t next;
+	uint64_t bad;
+} seg_walk;
+
+static bool
+seg_walk_cb(uint64_t key, const uint8_t *data, uint32_t len, void *arg)
+{
+	seg_walk *w = arg;
+	char      buf[64];
+
+	seg_data(buf, sizeof(buf), key);
+	if (key != w->next || len != strlen(buf) || memcmp(data, buf, len)) {
+		w->bad++;
+	}
+	w->next++;
+	return true;
+}
+
+static void
+test_segment_append(void)
+{
+	segment_store *s;
+	char           dir[64];
+	char           buf[64];
+	uint8_t       *data;
+	uint32_t       len;
+	uint64_t       n = 0;
+	seg_walk       w = { 0 };
+
+	seg_dir(dir, sizeof(dir), "append");
+	NUTS_PASS(segment_store_open(&s, dir, SEG_SIZE, SEG_COUNT));
+	NUTS_FAIL(segment_store_append(s, 0, buf, SEG_SIZE), NNG_EMSGSIZE);
+
+	// a few segments
+	for (n = 0; n < 300; n++) {
+		seg_data(buf, sizeof(buf), n);
+		NUTS_PASS(segment_store_append(s, n, buf, strlen(buf)));
+	}
+	NUTS_TRUE(segment_store_count(s) == 300);
+	NUTS_PASS(segment_store_get(s, 123, &data, &len));
+	seg_data(buf, sizeof(buf), 123);
+	NUTS_TRUE(len == strlen(buf) && memcmp(data, buf, len) == 0);
+	nng_free(data, len);
+	NUTS_FAIL(segment_store_get(s, 300, &data, &len), NNG_ENOENT);
+
+	w.next = 100;
+	NUTS_TRUE(segment_store_foreach_span(s, 100, 199, seg_walk_cb, &w) ==
+	    100);
+	NUTS_TRUE(w.bad == 0 && w.next == 200);
+
+	// rolls over, oldest segments are removed
+	for (; n < 3000; n++) {
+		seg_data(buf, sizeof(buf), n);
+		NUTS_PASS(segment_store_append(s, n, buf, strlen(buf)));
+	}
+	NUTS_TRUE(segment_store_count(s) < 3000);
+	NUTS_FAIL(segment_store_get(s, 0, &data, &len), NNG_ENOENT);
+	NUTS_PASS(segment_store_get(s, 2999, &data, &len));
+	nng_free(data, len);
+	segment_store_close(s);
+
+	// destroyed, segments and directory are gone
+	NUTS_PASS(segment_store_open(&s, dir, SEG_SIZE, SEG_COUNT));
+	NUTS_TRUE(segment_store_count(s) > 0);
+	segment_store_destroy(s);
+	NUTS_TRUE(!nng_file_is_dir(dir));
+}
+
+// Records survive a restart up to a torn one.
+static void
+test_segment_reopen(void)
+{
+	segment_store *s;
+	char           dir[64];
+	char           path[128];
+	char           buf[64];
+	uint8_t       *data;
+	uint32_t       len;
+	size_t         count;
+	seg_walk       w = { 0 };
+	FILE          *fp;
+
+	seg_dir(dir, sizeof(dir), "reopen");
+	NUTS_PASS(segment_store_open(&s, dir, SEG_SIZE, SEG_COUNT));
+	// three segments
+	for (uint64_t n = 0; n < 300; n++) {
+		seg_data(buf, sizeof(buf), n);
+		NUTS_PASS(segment_store_append(s, n, buf, strlen(buf)));
+	}
+	count = segment_store_count(s);
+	segment_store_close(s);
+
+	NUTS_PASS(segment_store_open(&s, dir, SEG_SIZE, SEG_COUNT));
+	NUTS_TRUE(segment_store_count(s) == count);
+	NUTS_TRUE(segment_store_foreach_span(s, 0, UINT64_MAX, seg_walk_cb,
+	              &w) == count);
+	NUTS_TRUE(w.bad == 0);
+	segment_store_close(s);
+
+	// flip a data byte of the first record of the first segment
+	snprintf(path, sizeof(path), "%s/%020d.seg", dir, 0);
+	NUTS_ASSERT((fp = fopen(path, "r+b")) != NULL);
+	fseek(fp, 32 + 16, SEEK_SET);
+	fputc('X', fp);
+	fclose(fp);
+
+	NUTS_PASS(segment_store_open(&s, dir, SEG_SIZE, SEG_COUNT));
+	NUTS_TRUE(segment_store_count(s) < count);
+	NUTS_FAIL(segment_store_get(s, 0, &data, &len), NNG_ENOENT);
+	NUTS_PASS(segment_store_get(s, 299, &data, &len));
+	nng_free(data, len);
+	// appends go on after the last good record
+	NUTS_PASS(segment_store_append(s, 300, "x", 1));
+	NUTS_PASS(segment_store_get(s, 300, &data, &len));
+	NUTS_TRUE(len == 1 && data[0] == 'x');
+	nng_free(data, len);
+	segment_store_close(s);
+}
+
+// Keys out of order are still found, without the index.
+static void
+test_segment_unsorted(void)
+{
+	segment_store *s;
+	char           dir[64];
+	char           buf[64];
+	uint8_t       *data;
+	uint32_t       len;
+
+	seg_dir(dir, sizeof(dir), "unsorted");
+	NUTS_PASS(segment_store_open(&s, dir, 0, 0));
+	for (uint64_t n = 0; n < 1000; n++) {
+		uint64_t key = (n * 7919) % 1000;
+		seg_data(buf, sizeof(buf), key);
+		NUTS_PASS(segment_store_append(s, key, buf, strlen(buf)));
+	}
+	for (uint64_t key = 0; key < 1000; key++) {
+		NUTS_PASS(segment_store_get(s, key, &data, &len));
+		seg_data(buf, sizeof(buf), key);
+		NUTS_TRUE(len == strlen(buf) && memcmp(data, buf, len) == 0);
+		nng_free(data, len);
+	}
+	segment_store_close(s);
+}
+
+#ifdef NNG_TEST_BENCH
+static bool
+seg_count_cb(uint64_t key, const uint8_t *data, uint32_t len, void *arg)
+{
+	(void) key;
+	(void) data;
+	(*(uint64_t *) arg) += len;
+	return true;
+}
+
+static void
+test_segment_bench(void)
+{
+	segment_store *s;
+	char           dir[64];
+	uint8_t        payload[256];
+	uint8_t       *data;
+	uint32_t       len;
+	uint64_t       bytes = 0;
+
+	seg_dir(dir, sizeof(dir), "bench");
+	memset(payload, 'p', sizeof(payload));
+	NUTS_PASS(segment_store_open(&s, dir, 64 * 1024 * 1024, 8));
+
+	nng_time start = nng_clock();
+	for (uint64_t n = 0; n < BENCH_RECORDS; n++) {
+		NUTS_ASSERT(segment_store_append(s, n, payload, 256) == 0);
+	}
+	nng_time mid = nng_clock();
+	for (uint64_t i = 0; i < BENCH_LOOKUPS; i++) {
+		uint64_t key = (i * 7919) % BENCH_RECORDS;
+		NUTS_ASSERT(segment_store_get(s, key, &data, &len) == 0);
+		nng_free(data, len);
+	}
+	nng_time lookups = nng_clock();
+	segment_store_foreach_span(s, 0, UINT64_MAX, seg_count_cb, &bytes);
+	nng_time end = nng_clock();
+	NUTS_TRUE(bytes == (uint64_t) BENCH_RECORDS * 256);
+
+	printf("segment append %d records %lums, %d lookups %lums, scan %lums\n",
+	    BENCH_RECORDS, (unsigned long) (mid - start), BENCH_LOOKUPS,
+	    (unsigned long) (lookups - mid), (unsigned long) (end - lookups));
+	segment_store_destroy(s);
+}
+#endif
+
+TEST_LIST = {
+	{ "segment append", test_segment_append },
+	{ "segment reopen", test_segment_reopen },
+	{ "segment unsorted", test_segment_unsorted },
+#ifdef NNG_TEST_BENCH
+	{ "segment bench", test_segment_bench },
+#endif
+	{ NULL, NULL },
+};
@@ -0,0 +1,170 @@
+#include <errno.h>
+#include <stdio.h>
+
+#include "core/nng_impl.h"
+#include "nng/supplemental/nanolib/trace.h"
+
+bool trace_active = false;
+
+static void
+trace_active_store(bool on)
+{
+#if defined(_MSC_VER)
+	*(volatile bool *) &trace_active = on;
+#else
+	__atomic_store_n(&trace_active, on, __ATOMIC_RELAXED);
+#endif
+}
+
+static const char *trace_names[TRACE_STAGES] = {
+	"decode",
+	"match",
+	"queue",
+	"qos",
+	"write",
+};
+
+#ifdef NNG_ENABLE_STATS
+static const nni_stat_info trace_root_info = {
+	.si_name = "trace",
+	.si_desc = "latency of the publish pipeline",
+	.si_type = NNG_STAT_SCOPE,
+};
+
+#define TRACE_HIST(name, desc)                                    \
+	{                                                         \
+		.si_name = name, .si_desc = desc,                 \
+		.si_type = NNG_STAT_HISTOGRAM,                    \
+		.si_unit = NNG_UNIT_MICROS, .si_atomic = true,    \
+	}
+
+static const nni_stat_info trace_hist_info[TRACE_STAGES] = {
+	TRACE_HIST("decode_us", "time to read and decode a publish"),
+	TRACE_HIST("match_us", "time to find the subscribers of a topic"),
+	TRACE_HIST("queue_us", "time waiting in a subscriber's send queue"),
+	TRACE_HIST("qos_us", "time from sending a QoS message to its ack"),
+	TRACE_HIST("write_us", "time to write a publish to a socket"),
+};
+
+static nni_stat_item trace_root;
+static nni_stat_hist trace_hists[TRACE_STAGES];
+#endif
+
+// Taken to set things up and to write the file, never to record a span.
+static nni_mtx        trace_lk = NNI_MTX_INITIALIZER;
+static bool           trace_registered;
+static FILE          *trace_fp;
+static uint32_t       trace_every;
+static nni_atomic_u64 trace_left; // spans until the next one written
+
+uint64_t
+trace_clock(void)
+{
+	return (nni_clock_us());
+}
+
+const char *
+trace_stage_name(trace_stage stage)
+{
+	if (stage < 0 || stage >= TRACE_STAGES) {
+		return ("unknown");
+	}
+	return (trace_names[stage]);
+}
+
+static void
+trace_register(void)
+{
+	if (trace_registered) {
+		return;
+	}
+	nni_atomic_init64(&trace_left);
+#ifdef NNG_ENABLE_STATS
+	nni_stat_init(&trace_root, &trace_root_info);
+	for (int i = 0; i < TRACE_STAGES; i++) {
+		nni_stat_hist_init(&trace_hists[i], &trace_hist_info[i]);
+		nni_stat_add(&trace_root, &trace_hists[i].sh_item);
+	}
+	nni_stat_register(&trace_root);
+#endif
+	trace_registered = true;
+}
+
+void
+trace_enable(bool on)
+{
+	nni_mtx_lock(&trace_lk);
+	if (on) {
+		trace_register();
+	}
+	trace_active_store(on);
+	nni_mtx_unlock(&trace_lk);
+}
+
+int
+trace_open(const char *path, uint32_t every)
+{
+	FILE *fp;
+
+	if (path == NULL || every == 0) {
+		return (NNG_EINVAL);
+	}
+	if ((fp = fopen(path, "w")) == NULL) {
+		return (NNG_ESYSERR + errno);
+	}
+	nni_mtx_lock(&trace_lk);
+	if (trace_fp != NULL) {
+		fclose(trace_fp);
+	}
+	trace_register();
+	trace_fp    = fp;
+	trace_every = every;
+	nni_atomic_set64(&trace_left, every);
+	trace_active_store(true);
+	nni_mtx_unlock(&trace_lk);
+	return (0);
+}
+
+void
+trace_close(void)
+{
+	nni_mtx_lock(&trace_lk);
+	if (trace_fp != NULL) {
+		fclose(trace_fp);
+		trace_fp = NULL;
+	}
+	nni_mtx_unlock(&trace_lk);
+}
+
+void
+trace_span(trace_stage stage, uint64_t start, uint32_t id)
+{
+	uint64_t now;
+	uint64_t span;
+
+	// off, or it was off when the stage began
+	if (!trace_active_load() || start == 0 || stage < 0 ||
+	    stage >= TRACE_STAGES) {
+		return;
+	}
+	now  = nni_clock_us();
+	span = now > start ? now - start : 0;
+#ifdef NNG_ENABLE_STATS
+	nni_stat_hist_add(&trace_hists[stage], span);
+#endif
+
+	// sampled without the lock, a span may slip past a closing file
+	if (trace_fp == NULL) {
+		return;
+	}
+	if (nni_atomic_dec64_nv(&trace_left) != 0) {
+		return;
+	}
+	nni_mtx_lock(&trace_lk);
+	nni_atomic_set64(&trace_left, trace_every);
+	if (trace_fp != NULL) {
+		fprintf(trace_fp, "%llu %s %u %llu\n", (unsigned long long) now,
+		    trace_names[stage], id, (unsigned long long) span);
+	}
+	nni_mtx_unlock(&trace_lk);
+}
@@ -0,0 +1,113 @@
+#include "nng/supplemental/nanolib/trace.h"
+#include "nng/supplemental/util/platform.h"
+#include <nuts.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_FILE "/tmp/nanomq-trace-test.log"
+
+#ifdef NNG_ENABLE_STATS
+static uint64_t
+trace_stat(nng_stat *stats, const char *hist, const char *child)
+{
+	nng_stat *st;
+
+	if ((st = nng_stat_find(stats, hist)) == NULL) {
+		return (UINT64_MAX);
+	}
+	if (child != NULL && (st = nng_stat_find(st, child)) == NULL) {
+		return (UINT64_MAX);
+	}
+	return (nng_stat_value(st));
+}
+#endif
+
+static void
+test_trace_off(void)
+{
+	trace_enable(false);
+	NUTS_TRUE(trace_now() == 0);
+	// nothing to do, and no stats tree needed
+	trace_span(TRACE_QUEUE, 0, 1);
+	trace_span(TRACE_QUEUE, trace_clock(), 1);
+}
+
+// Spans go into the histogram of their stage.
+static void
+test_trace_stats(void)
+{
+#ifdef NNG_ENABLE_STATS
+	nng_stat *stats;
+	uint64_t  start;
+	uint64_t  count;
+
+	trace_enable(true);
+	start = trace_now();
+	NUTS_TRUE(start != 0);
+	nng_msleep(20);
+	trace_span(TRACE_QUEUE, start, 1);
+	trace_span(TRACE_QUEUE, 0, 1); // began while off
+	trace_span(TRACE_WRITE, trace_now(), 1);
+	trace_enable(false);
+	trace_span(TRACE_QUEUE, start, 1);
+
+	NUTS_PASS(nng_stats_get(&stats));
+	NUTS_TRUE(nng_stat_find(stats, "trace") != NULL);
+	count = 0;
+	for (nng_stat *b = nng_stat_child(nng_stat_find(stats, "queue_us"));
+	     b != NULL; b = nng_stat_next(b)) {
+		if (nng_stat_type(b) == NNG_STAT_COUNTER) {
+			count += nng_stat_value(b);
+		}
+	}
+	NUTS_TRUE(count == 1);
+	NUTS_TRUE(trace_stat(stats, "queue_us", NULL) >= 20000);
+	NUTS_TRUE(trace_stat(stats, "queue_us", "p50") >= 20000);
+	NUTS_TRUE(trace_stat(stats, "write_us", "p99") < 20000);
+	NUTS_TRUE(nng_stat_unit(nng_stat_find(stats, "decode_us")) ==
+	    NNG_UNIT_MICROS);
+	nng_stats_free(stats);
+#endif
+}
+
+// One span in every two is written.
+static void
+test_trace_file(void)
+{
+	FILE    *fp;
+	char     line[128];
+	char     stage[16];
+	unsigned id;
+	int      n = 0;
+	unsigned long long end, span;
+
+	NUTS_FAIL(trace_open(TRACE_FILE, 0), NNG_EINVAL);
+	NUTS_FAIL(trace_open(NULL, 1), NNG_EINVAL);
+	NUTS_PASS(trace_open(TRACE_FILE, 2));
+	NUTS_TRUE(trace_active_load());
+	for (uint32_t i = 0; i < 10; i++) {
+		trace_span(TRACE_MATCH, trace_now(), i);
+	}
+	trace_close();
+	trace_span(TRACE_MATCH, trace_now(), 99);
+	trace_enable(false);
+
+	NUTS_TRUE((fp = fopen(TRACE_FILE, "r")) != NULL);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		NUTS_TRUE(sscanf(line, "%llu %15s %u %llu", &end, stage, &id,
+		              &span) == 4);
+		NUTS_MATCH(stage, trace_stage_name(TRACE_MATCH));
+		NUTS_TRUE(id % 2 == 1);
+		n++;
+	}
+	fclose(fp);
+	NUTS_TRUE(n == 5);
+	remove(TRACE_FILE);
+}
+
+TEST_LIST = {
+	{ "trace off", test_trace_off },
+	{ "trace stats", test_trace_stats },
+	{ "trace file", test_trace_file },
+	{ NULL, NULL },
+};